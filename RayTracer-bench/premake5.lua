@@ -0,0 +1,61 @@
+project "RayTracer-bench"
+   kind "ConsoleApp"
+   language "C++"
+   cppdialect "C++17"
+   targetdir "bin/%{cfg.buildcfg}"
+   staticruntime "off"
+
+   -- Benchmarks the renderer itself, so it builds the RayTracer sources minus the windowed entry point
+   files
+   {
+      "src/**.h",
+      "src/**.cpp",
+
+      "../RayTracer/src/**.h",
+      "../RayTracer/src/**.cpp",
+   }
+
+   removefiles { "../RayTracer/src/WalnutApp.cpp" }
+
+   includedirs
+   {
+      "src",
+      "../RayTracer/src",
+
+      "../vendor/imgui",
+      "../vendor/glfw/include",
+
+      "../Walnut/src",
+
+      "%{IncludeDir.VulkanSDK}",
+      "%{IncludeDir.glm}",
+   }
+
+    links
+    {
+        "Walnut"
+    }
+
+   targetdir ("../bin/" .. outputdir .. "/%{prj.name}")
+   objdir ("../bin-int/" .. outputdir .. "/%{prj.name}")
+
+   filter "system:windows"
+      systemversion "latest"
+      defines { "WL_PLATFORM_WINDOWS" }
+
+   filter "configurations:Debug"
+      defines { "WL_DEBUG" }
+      runtime "Debug"
+      symbols "On"
+
+   filter "configurations:Release"
+      defines { "WL_RELEASE" }
+      runtime "Release"
+      optimize "On"
+      symbols "On"
+
+   filter "configurations:Dist"
+      defines { "WL_DIST" }
+      runtime "Release"
+      optimize "On"
+      symbols "Off"
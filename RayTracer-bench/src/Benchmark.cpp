@@ -0,0 +1,278 @@
+// RayTracer-bench: renders the standard scenes along fixed camera orbits without a window and
+// prints the results as JSON, so runs from different builds can be diffed.
+//
+//   RayTracer-bench [--size 640x360] [--frames 32] [--warmup 4] [--scenes TwoSpheres,Random10k]
+//                   [--threads 1,2,4,8] [--scaling-scene Random10k] [--out results.json]
+
+#include "Walnut/Timer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "BenchmarkScenes.h"
+#include "Camera.h"
+#include "Renderer.h"
+
+namespace Utils {
+
+	struct BenchmarkOptions
+	{
+		uint32_t Width = 640, Height = 360;
+		uint32_t FrameCount = 32;
+		uint32_t WarmupFrameCount = 4;
+
+		// Empty runs everything
+		std::vector<std::string> Scenes;
+		// Empty doubles from 1 up to every hardware thread
+		std::vector<uint32_t> ThreadCounts;
+		std::string ScalingScene = "Random10k";
+
+		std::string OutputPath;
+	};
+
+	struct BenchmarkResult
+	{
+		uint32_t ThreadCount = 0;
+		uint64_t RayCount = 0;
+		float TotalTime = 0.0f; // ms
+		std::vector<float> FrameTimes; // ms
+
+		double GetMRaysPerSecond() const { return TotalTime > 0.0f ? (double)RayCount / (TotalTime * 1000.0) : 0.0; }
+	};
+
+	static std::vector<std::string> SplitList(const char* list)
+	{
+		std::vector<std::string> result;
+		std::stringstream stream(list);
+		std::string item;
+		while (std::getline(stream, item, ','))
+		{
+			if (!item.empty())
+				result.push_back(item);
+		}
+		return result;
+	}
+
+	static bool ParseOptions(int argc, char** argv, BenchmarkOptions& options)
+	{
+		for (int i = 1; i + 1 < argc; i += 2)
+		{
+			const char* arg = argv[i];
+			const char* value = argv[i + 1];
+
+			if (strcmp(arg, "--size") == 0)
+			{
+				if (sscanf(value, "%ux%u", &options.Width, &options.Height) != 2)
+					return false;
+			}
+			else if (strcmp(arg, "--frames") == 0)
+				options.FrameCount = (uint32_t)std::max(atoi(value), 1);
+			else if (strcmp(arg, "--warmup") == 0)
+				options.WarmupFrameCount = (uint32_t)std::max(atoi(value), 0);
+			else if (strcmp(arg, "--scenes") == 0)
+				options.Scenes = SplitList(value);
+			else if (strcmp(arg, "--threads") == 0)
+			{
+				for (const std::string& count : SplitList(value))
+					options.ThreadCounts.push_back((uint32_t)std::max(atoi(count.c_str()), 1));
+			}
+			else if (strcmp(arg, "--scaling-scene") == 0)
+				options.ScalingScene = value;
+			else if (strcmp(arg, "--out") == 0)
+				options.OutputPath = value;
+			else
+				return false;
+		}
+
+		return (argc % 2) == 1;
+	}
+
+	static float Percentile(std::vector<float> values, float percentile)
+	{
+		if (values.empty())
+			return 0.0f;
+
+		std::sort(values.begin(), values.end());
+		size_t index = (size_t)(percentile * (float)(values.size() - 1) + 0.5f);
+		return values[std::min(index, values.size() - 1)];
+	}
+
+	static BenchmarkResult RunScene(const BenchmarkScene& benchmarkScene, const BenchmarkOptions& options, uint32_t threadCount)
+	{
+		Camera camera(45.0f, 0.1f, 100.0f);
+		camera.OnResize(options.Width, options.Height);
+
+		Renderer renderer;
+		renderer.GetSettings().ThreadCount = threadCount;
+		renderer.GetSettings().Accumulate = false;
+		renderer.OnResize(options.Width, options.Height);
+
+		BenchmarkResult result;
+		result.ThreadCount = threadCount;
+
+		uint32_t totalFrames = options.WarmupFrameCount + options.FrameCount;
+		for (uint32_t frame = 0; frame < totalFrames; frame++)
+		{
+			glm::vec3 position, direction;
+			BenchmarkScenes::GetCameraPose(benchmarkScene, frame, totalFrames, position, direction);
+			camera.SetPosition(position);
+			camera.SetDirection(direction);
+
+			// Only the trace is timed, the first frame also includes building the BVH
+			Walnut::Timer timer;
+			renderer.RenderFrame(benchmarkScene.SceneData, camera, nullptr);
+			float frameTime = timer.ElapsedMillis();
+
+			if (frame < options.WarmupFrameCount)
+				continue;
+
+			result.FrameTimes.push_back(frameTime);
+			result.TotalTime += frameTime;
+			result.RayCount += renderer.GetLastFrameRayCount();
+		}
+
+		return result;
+	}
+
+	static void WriteResult(std::ostream& out, const BenchmarkResult& result, const char* indent)
+	{
+		float mean = result.FrameTimes.empty() ? 0.0f : result.TotalTime / (float)result.FrameTimes.size();
+
+		out << indent << "\"threads\": " << result.ThreadCount << ",\n";
+		out << indent << "\"rays\": " << result.RayCount << ",\n";
+		out << indent << "\"mrays_per_second\": " << result.GetMRaysPerSecond() << ",\n";
+		out << indent << "\"frame_ms\": { "
+			<< "\"mean\": " << mean
+			<< ", \"min\": " << Percentile(result.FrameTimes, 0.0f)
+			<< ", \"p50\": " << Percentile(result.FrameTimes, 0.5f)
+			<< ", \"p90\": " << Percentile(result.FrameTimes, 0.9f)
+			<< ", \"p99\": " << Percentile(result.FrameTimes, 0.99f)
+			<< ", \"max\": " << Percentile(result.FrameTimes, 1.0f)
+			<< " }";
+	}
+
+	static const char* GetConfigurationName()
+	{
+#if defined(WL_DEBUG)
+		return "Debug";
+#elif defined(WL_RELEASE)
+		return "Release";
+#elif defined(WL_DIST)
+		return "Dist";
+#else
+		return "Unknown";
+#endif
+	}
+
+}
+
+int main(int argc, char** argv)
+{
+	Utils::BenchmarkOptions options;
+	if (!Utils::ParseOptions(argc, argv, options))
+	{
+		std::cerr << "Usage: RayTracer-bench [--size WxH] [--frames n] [--warmup n] [--scenes a,b] [--threads 1,2,4] [--scaling-scene name] [--out file.json]\n";
+		return 1;
+	}
+
+	uint32_t hardwareThreads = ThreadPool::GetHardwareThreadCount();
+	if (options.ThreadCounts.empty())
+	{
+		for (uint32_t count = 1; count < hardwareThreads; count *= 2)
+			options.ThreadCounts.push_back(count);
+		options.ThreadCounts.push_back(hardwareThreads);
+	}
+
+	auto isSelected = [&options](const BenchmarkScene& scene)
+	{
+		return options.Scenes.empty() || std::find(options.Scenes.begin(), options.Scenes.end(), scene.Name) != options.Scenes.end();
+	};
+
+	std::vector<BenchmarkScene> scenes = BenchmarkScenes::GetAll();
+
+	const BenchmarkScene* scalingScene = nullptr;
+	for (const BenchmarkScene& scene : scenes)
+	{
+		if (scene.Name == options.ScalingScene)
+			scalingScene = &scene;
+	}
+
+	std::stringstream out;
+	out << "{\n";
+	out << "  \"configuration\": \"" << Utils::GetConfigurationName() << "\",\n";
+	out << "  \"instruction_set\": \"" << SphereKernels::GetInstructionSetName(SphereKernels::DetectInstructionSet()) << "\",\n";
+	out << "  \"hardware_threads\": " << hardwareThreads << ",\n";
+	out << "  \"width\": " << options.Width << ",\n";
+	out << "  \"height\": " << options.Height << ",\n";
+	out << "  \"frames\": " << options.FrameCount << ",\n";
+	out << "  \"warmup_frames\": " << options.WarmupFrameCount << ",\n";
+
+	// Every selected scene with all threads
+	out << "  \"scenes\": [\n";
+	bool first = true;
+	for (const BenchmarkScene& scene : scenes)
+	{
+		if (!isSelected(scene))
+			continue;
+
+		std::cerr << "[Bench] " << scene.Name << "\n";
+		Utils::BenchmarkResult result = Utils::RunScene(scene, options, hardwareThreads);
+
+		out << (first ? "" : ",\n") << "    {\n";
+		out << "      \"name\": \"" << scene.Name << "\",\n";
+		out << "      \"spheres\": " << scene.SceneData.Spheres.size() << ",\n";
+		Utils::WriteResult(out, result, "      ");
+		out << "\n    }";
+		first = false;
+	}
+	out << "\n  ],\n";
+
+	// One scene across thread counts
+	out << "  \"scaling\": {\n";
+	out << "    \"scene\": \"" << (scalingScene ? scalingScene->Name : "") << "\",\n";
+	out << "    \"runs\": [\n";
+	if (scalingScene)
+	{
+		double singleThreadRate = 0.0;
+		for (size_t i = 0; i < options.ThreadCounts.size(); i++)
+		{
+			uint32_t threadCount = options.ThreadCounts[i];
+			std::cerr << "[Bench] " << scalingScene->Name << " with " << threadCount << " threads\n";
+			Utils::BenchmarkResult result = Utils::RunScene(*scalingScene, options, threadCount);
+
+			// Relative to the first run, which is single threaded unless --threads says otherwise
+			if (i == 0)
+				singleThreadRate = result.GetMRaysPerSecond();
+
+			out << (i == 0 ? "" : ",\n") << "      {\n";
+			Utils::WriteResult(out, result, "        ");
+			out << ",\n        \"speedup\": " << (singleThreadRate > 0.0 ? result.GetMRaysPerSecond() / singleThreadRate : 0.0);
+			out << "\n      }";
+		}
+	}
+	out << "\n    ]\n";
+	out << "  }\n";
+	out << "}\n";
+
+	if (options.OutputPath.empty())
+	{
+		std::cout << out.str();
+		return 0;
+	}
+
+	std::ofstream file(options.OutputPath);
+	if (!file)
+	{
+		std::cerr << "[Bench] Could not open " << options.OutputPath << " for writing\n";
+		return 1;
+	}
+	file << out.str();
+	return 0;
+}
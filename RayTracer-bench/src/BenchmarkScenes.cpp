@@ -0,0 +1,149 @@
+#include "BenchmarkScenes.h"
+
+#include "Walnut/Random.h"
+
+#include <cmath>
+
+namespace Utils {
+
+	static float RandomFloat(uint32_t& seed, float min, float max)
+	{
+		return Walnut::Random::Float(seed) * (max - min) + min;
+	}
+
+}
+
+namespace BenchmarkScenes {
+
+	BenchmarkScene TwoSpheres()
+	{
+		BenchmarkScene result;
+		result.Name = "TwoSpheres";
+
+		Scene& scene = result.SceneData;
+
+		Material& sphere1 = scene.Materials.emplace_back();
+		sphere1.Albedo = { 1.0f, 0.0f, 1.0f };
+		sphere1.Roughness = 0.0f;
+
+		Material& sphere2 = scene.Materials.emplace_back();
+		sphere2.Albedo = { 0.2f, 0.3f, 1.0f };
+		sphere2.Roughness = 0.1f;
+
+		Sphere& sphere = scene.Spheres.emplace_back();
+		sphere.Position = { 0.0f, 0.0f, 0.0f };
+		sphere.Radius = 1.0f;
+		sphere.MaterialIndex = 0;
+
+		Sphere& ground = scene.Spheres.emplace_back();
+		ground.Position = { 0.0f, -101.0f, 0.0f };
+		ground.Radius = 100.0f;
+		ground.MaterialIndex = 1;
+
+		result.OrbitRadius = 6.0f;
+		return result;
+	}
+
+	BenchmarkScene RandomSpheres(uint32_t sphereCount)
+	{
+		BenchmarkScene result;
+		if (sphereCount >= 1000 && sphereCount % 1000 == 0)
+			result.Name = "Random" + std::to_string(sphereCount / 1000) + "k";
+		else
+			result.Name = "Random" + std::to_string(sphereCount);
+
+		Scene& scene = result.SceneData;
+		uint32_t seed = Walnut::Random::Seed(sphereCount, 0x5eed);
+
+		constexpr uint32_t materialCount = 16;
+		for (uint32_t i = 0; i < materialCount; i++)
+		{
+			Material& material = scene.Materials.emplace_back();
+			material.Albedo = { Utils::RandomFloat(seed, 0.1f, 1.0f), Utils::RandomFloat(seed, 0.1f, 1.0f), Utils::RandomFloat(seed, 0.1f, 1.0f) };
+			material.Roughness = Utils::RandomFloat(seed, 0.0f, 1.0f);
+		}
+
+		// Keep the density roughly constant, so only the sphere count changes between sizes
+		float extent = 2.0f * std::cbrt((float)sphereCount);
+
+		for (uint32_t i = 0; i < sphereCount; i++)
+		{
+			Sphere& sphere = scene.Spheres.emplace_back();
+			sphere.Position = {
+				Utils::RandomFloat(seed, -extent, extent),
+				Utils::RandomFloat(seed, 0.0f, extent),
+				Utils::RandomFloat(seed, -extent, extent)
+			};
+			sphere.Radius = Utils::RandomFloat(seed, 0.2f, 0.6f);
+			sphere.MaterialIndex = (int)(Walnut::Random::UInt(seed) % materialCount);
+		}
+
+		Sphere& ground = scene.Spheres.emplace_back();
+		ground.Position = { 0.0f, -1000.0f, 0.0f };
+		ground.Radius = 1000.0f;
+		ground.MaterialIndex = 0;
+
+		result.OrbitCenter = { 0.0f, extent * 0.5f, 0.0f };
+		result.OrbitRadius = extent * 2.5f;
+		result.OrbitHeight = extent * 0.5f;
+		return result;
+	}
+
+	BenchmarkScene MirrorLattice()
+	{
+		BenchmarkScene result;
+		result.Name = "MirrorLattice";
+
+		Scene& scene = result.SceneData;
+
+		Material& mirror = scene.Materials.emplace_back();
+		mirror.Albedo = { 0.9f, 0.9f, 0.9f };
+		mirror.Roughness = 0.0f;
+		mirror.Metallic = 1.0f;
+
+		// 10x10x10 spheres, 2 units apart with radius 0.9, the camera orbits inside the gap in the middle
+		constexpr int gridSize = 10;
+		for (int z = 0; z < gridSize; z++)
+		{
+			for (int y = 0; y < gridSize; y++)
+			{
+				for (int x = 0; x < gridSize; x++)
+				{
+					Sphere& sphere = scene.Spheres.emplace_back();
+					sphere.Position = glm::vec3((float)x, (float)y, (float)z) * 2.0f - glm::vec3((float)(gridSize - 1));
+					sphere.Radius = 0.9f;
+					sphere.MaterialIndex = 0;
+				}
+			}
+		}
+
+		result.OrbitRadius = 0.0f;
+		return result;
+	}
+
+	std::vector<BenchmarkScene> GetAll()
+	{
+		std::vector<BenchmarkScene> scenes;
+		scenes.push_back(TwoSpheres());
+		scenes.push_back(RandomSpheres(1000));
+		scenes.push_back(RandomSpheres(10000));
+		scenes.push_back(RandomSpheres(100000));
+		scenes.push_back(MirrorLattice());
+		return scenes;
+	}
+
+	void GetCameraPose(const BenchmarkScene& scene, uint32_t frameIndex, uint32_t frameCount, glm::vec3& position, glm::vec3& direction)
+	{
+		float angle = 2.0f * 3.14159265f * (float)frameIndex / (float)glm::max(frameCount, 1u);
+
+		glm::vec3 offset = { std::sin(angle) * scene.OrbitRadius, scene.OrbitHeight, std::cos(angle) * scene.OrbitRadius };
+		position = scene.OrbitCenter + offset;
+
+		// An orbit of radius 0 spins in place instead of looking at its own center
+		if (scene.OrbitRadius > 0.0f)
+			direction = glm::normalize(scene.OrbitCenter - position);
+		else
+			direction = { -std::sin(angle), -0.2f, -std::cos(angle) };
+	}
+
+}
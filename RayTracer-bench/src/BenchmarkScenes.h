@@ -0,0 +1,36 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+#include "Scene.h"
+
+// A standard scene plus the camera orbit the benchmark flies through it.
+// Everything is generated from fixed seeds, so every build renders the same pixels.
+struct BenchmarkScene
+{
+	std::string Name;
+	Scene SceneData;
+
+	glm::vec3 OrbitCenter{ 0.0f };
+	float OrbitRadius = 6.0f;
+	float OrbitHeight = 0.0f;
+};
+
+namespace BenchmarkScenes {
+
+	// The scene the RayTracer app starts with
+	BenchmarkScene TwoSpheres();
+	// sphereCount small diffuse and glossy spheres scattered over a ground sphere
+	BenchmarkScene RandomSpheres(uint32_t sphereCount);
+	// Camera inside a lattice of perfect mirrors, nearly every path uses all bounces
+	BenchmarkScene MirrorLattice();
+
+	std::vector<BenchmarkScene> GetAll();
+
+	// Camera position and direction at frame frameIndex of frameCount
+	void GetCameraPose(const BenchmarkScene& scene, uint32_t frameIndex, uint32_t frameCount, glm::vec3& position, glm::vec3& direction);
+
+}
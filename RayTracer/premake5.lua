@@ -5,7 +5,7 @@ project "RayTracer"
    targetdir "bin/%{cfg.buildcfg}"
    staticruntime "off"
 
-   files { "src/**.h", "src/**.cpp" }
+   files { "src/**.h", "src/**.cpp", "shaders/**.comp" }
 
    includedirs
    {
@@ -26,6 +26,18 @@ project "RayTracer"
    targetdir ("../bin/" .. outputdir .. "/%{prj.name}")
    objdir ("../bin-int/" .. outputdir .. "/%{prj.name}")
 
+   -- Compute shaders are compiled to SPIR-V with the Vulkan SDK and loaded from shaders/ at runtime
+   prebuildcommands
+   {
+      '"%{VULKAN_SDK}/Bin/glslc" "%{prj.location}/shaders/PathTrace.comp" -o "%{prj.location}/shaders/PathTrace.comp.spv"',
+      '"%{VULKAN_SDK}/Bin/glslc" "%{prj.location}/shaders/Display.comp" -o "%{prj.location}/shaders/Display.comp.spv"'
+   }
+
+   postbuildcommands
+   {
+      '{COPYDIR} "%{prj.location}/shaders" "%{cfg.targetdir}/shaders"'
+   }
+
    filter "system:windows"
       systemversion "latest"
       defines { "WL_PLATFORM_WINDOWS" }
@@ -0,0 +1,454 @@
+#include "AccumulationBuffer.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "SIMD.h"
+
+namespace Utils {
+
+	using ResolveSettings = AccumulationBuffer::ResolveSettings;
+	using ToneMap = AccumulationBuffer::ToneMap;
+
+	static float MapChannel(float value, float scale, const ResolveSettings& settings)
+	{
+		value *= scale;
+
+		// NaN fails the comparison and becomes 0, as with the SIMD max. std::max would pass it on
+		// and the float to integer conversion of NaN is undefined.
+		value = value > 0.0f ? value : 0.0f;
+
+		// Infinity would end up as inf / inf = NaN, FLT_MAX maps to 1
+		if (settings.ToneMapping == ToneMap::Reinhard)
+		{
+			value = std::min(value, FLT_MAX);
+			value = value / (1.0f + value);
+		}
+		else
+		{
+			value = std::min(value, 1.0f);
+		}
+
+		if (settings.GammaCorrect)
+			value = std::sqrt(value);
+
+		return value;
+	}
+
+	// Per pixel sample counts override the scale from the settings
+	static float GetScale(const float* counts, uint32_t i, const ResolveSettings& settings)
+	{
+		return counts ? 1.0f / std::max(counts[i], 1.0f) : settings.Scale;
+	}
+
+	static uint32_t ResolvePixel(float r, float g, float b, float scale, const ResolveSettings& settings)
+	{
+		uint32_t red = (uint32_t)(MapChannel(r, scale, settings) * 255.0f);
+		uint32_t green = (uint32_t)(MapChannel(g, scale, settings) * 255.0f);
+		uint32_t blue = (uint32_t)(MapChannel(b, scale, settings) * 255.0f);
+
+		return 0xff000000 | (blue << 16) | (green << 8) | red;
+	}
+
+	static void ResolveScalar(const float* r, const float* g, const float* b, const float* counts, uint32_t* pixels, uint32_t count, const ResolveSettings& settings)
+	{
+		for (uint32_t i = 0; i < count; i++)
+			pixels[i] = ResolvePixel(r[i], g[i], b[i], GetScale(counts, i, settings), settings);
+	}
+
+	// 1.0 in the alpha half
+	static constexpr uint32_t HalfAlpha = 0x3c00;
+
+	// The operand order matches the SIMD max, which returns 0 for NaN and -0
+	static uint64_t ResolveHalfPixel(float r, float g, float b, float scale)
+	{
+		auto map = [scale](float value)
+		{
+			return (uint64_t)AccumulationBuffer::ToHalf(std::min(std::max(0.0f, value * scale), AccumulationBuffer::MaxHalf));
+		};
+		return map(r) | (map(g) << 16) | (map(b) << 32) | ((uint64_t)HalfAlpha << 48);
+	}
+
+	static void ResolveHalfScalar(const float* r, const float* g, const float* b, const float* counts, uint64_t* pixels, uint32_t count, const ResolveSettings& settings)
+	{
+		for (uint32_t i = 0; i < count; i++)
+			pixels[i] = ResolveHalfPixel(r[i], g[i], b[i], GetScale(counts, i, settings));
+	}
+
+#ifdef RT_ARCH_X86
+
+	static __m128 GetScaleSSE2(const float* counts, uint32_t i, const ResolveSettings& settings)
+	{
+		if (!counts)
+			return _mm_set1_ps(settings.Scale);
+		return _mm_div_ps(_mm_set1_ps(1.0f), _mm_max_ps(_mm_loadu_ps(counts + i), _mm_set1_ps(1.0f)));
+	}
+
+	static __m128 MapSSE2(__m128 value, __m128 scale, const ResolveSettings& settings)
+	{
+		value = _mm_mul_ps(value, scale);
+		value = _mm_max_ps(value, _mm_setzero_ps());
+
+		if (settings.ToneMapping == ToneMap::Reinhard)
+		{
+			value = _mm_min_ps(value, _mm_set1_ps(FLT_MAX));
+			value = _mm_div_ps(value, _mm_add_ps(value, _mm_set1_ps(1.0f)));
+		}
+		else
+		{
+			value = _mm_min_ps(value, _mm_set1_ps(1.0f));
+		}
+
+		if (settings.GammaCorrect)
+			value = _mm_sqrt_ps(value);
+
+		return _mm_mul_ps(value, _mm_set1_ps(255.0f));
+	}
+
+	static void ResolveSSE2(const float* r, const float* g, const float* b, const float* counts, uint32_t* pixels, uint32_t count, const ResolveSettings& settings)
+	{
+		// Streaming stores need an aligned destination
+		uint32_t i = 0;
+		for (; i < count && ((uintptr_t)(pixels + i) & 15); i++)
+			pixels[i] = ResolvePixel(r[i], g[i], b[i], GetScale(counts, i, settings), settings);
+
+		const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 scale = GetScaleSSE2(counts, i, settings);
+			__m128i red = _mm_cvttps_epi32(MapSSE2(_mm_loadu_ps(r + i), scale, settings));
+			__m128i green = _mm_cvttps_epi32(MapSSE2(_mm_loadu_ps(g + i), scale, settings));
+			__m128i blue = _mm_cvttps_epi32(MapSSE2(_mm_loadu_ps(b + i), scale, settings));
+
+			__m128i packed = _mm_or_si128(_mm_or_si128(red, _mm_slli_epi32(green, 8)), _mm_or_si128(_mm_slli_epi32(blue, 16), alpha));
+			_mm_stream_si128((__m128i*)(pixels + i), packed);
+		}
+
+		for (; i < count; i++)
+			pixels[i] = ResolvePixel(r[i], g[i], b[i], GetScale(counts, i, settings), settings);
+
+		_mm_sfence();
+	}
+
+	// Half bits in the low 16 bits of every lane, the same conversion as ToHalf
+	static __m128i MapHalfSSE2(__m128 value, __m128 scale)
+	{
+		value = _mm_max_ps(_mm_mul_ps(value, scale), _mm_setzero_ps());
+		value = _mm_min_ps(value, _mm_set1_ps(AccumulationBuffer::MaxHalf));
+
+		__m128i bits = _mm_castps_si128(_mm_mul_ps(value, _mm_set1_ps(AccumulationBuffer::HalfRebias)));
+		return _mm_srli_epi32(_mm_add_epi32(bits, _mm_set1_epi32(0x1000)), 13);
+	}
+
+	static void ResolveHalfSSE2(const float* r, const float* g, const float* b, const float* counts, uint64_t* pixels, uint32_t count, const ResolveSettings& settings)
+	{
+		uint32_t i = 0;
+		for (; i < count && ((uintptr_t)(pixels + i) & 15); i++)
+			pixels[i] = ResolveHalfPixel(r[i], g[i], b[i], GetScale(counts, i, settings));
+
+		const __m128i alpha = _mm_set1_epi32((int)(HalfAlpha << 16));
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 scale = GetScaleSSE2(counts, i, settings);
+			__m128i red = MapHalfSSE2(_mm_loadu_ps(r + i), scale);
+			__m128i green = MapHalfSSE2(_mm_loadu_ps(g + i), scale);
+			__m128i blue = MapHalfSSE2(_mm_loadu_ps(b + i), scale);
+
+			// Low and high 32 bits of every pixel, interleaved into two pixels per store
+			__m128i redGreen = _mm_or_si128(red, _mm_slli_epi32(green, 16));
+			__m128i blueAlpha = _mm_or_si128(blue, alpha);
+			_mm_stream_si128((__m128i*)(pixels + i), _mm_unpacklo_epi32(redGreen, blueAlpha));
+			_mm_stream_si128((__m128i*)(pixels + i + 2), _mm_unpackhi_epi32(redGreen, blueAlpha));
+		}
+
+		for (; i < count; i++)
+			pixels[i] = ResolveHalfPixel(r[i], g[i], b[i], GetScale(counts, i, settings));
+
+		_mm_sfence();
+	}
+
+	RT_TARGET_AVX2 static __m256 GetScaleAVX2(const float* counts, uint32_t i, const ResolveSettings& settings)
+	{
+		if (!counts)
+			return _mm256_set1_ps(settings.Scale);
+		return _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_max_ps(_mm256_loadu_ps(counts + i), _mm256_set1_ps(1.0f)));
+	}
+
+	RT_TARGET_AVX2 static __m256 MapAVX2(__m256 value, __m256 scale, const ResolveSettings& settings)
+	{
+		value = _mm256_mul_ps(value, scale);
+		value = _mm256_max_ps(value, _mm256_setzero_ps());
+
+		if (settings.ToneMapping == ToneMap::Reinhard)
+		{
+			value = _mm256_min_ps(value, _mm256_set1_ps(FLT_MAX));
+			value = _mm256_div_ps(value, _mm256_add_ps(value, _mm256_set1_ps(1.0f)));
+		}
+		else
+		{
+			value = _mm256_min_ps(value, _mm256_set1_ps(1.0f));
+		}
+
+		if (settings.GammaCorrect)
+			value = _mm256_sqrt_ps(value);
+
+		return _mm256_mul_ps(value, _mm256_set1_ps(255.0f));
+	}
+
+	RT_TARGET_AVX2 static void ResolveAVX2(const float* r, const float* g, const float* b, const float* counts, uint32_t* pixels, uint32_t count, const ResolveSettings& settings)
+	{
+		uint32_t i = 0;
+		for (; i < count && ((uintptr_t)(pixels + i) & 31); i++)
+			pixels[i] = ResolvePixel(r[i], g[i], b[i], GetScale(counts, i, settings), settings);
+
+		const __m256i alpha = _mm256_set1_epi32((int)0xff000000);
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256 scale = GetScaleAVX2(counts, i, settings);
+			__m256i red = _mm256_cvttps_epi32(MapAVX2(_mm256_loadu_ps(r + i), scale, settings));
+			__m256i green = _mm256_cvttps_epi32(MapAVX2(_mm256_loadu_ps(g + i), scale, settings));
+			__m256i blue = _mm256_cvttps_epi32(MapAVX2(_mm256_loadu_ps(b + i), scale, settings));
+
+			__m256i packed = _mm256_or_si256(_mm256_or_si256(red, _mm256_slli_epi32(green, 8)), _mm256_or_si256(_mm256_slli_epi32(blue, 16), alpha));
+			_mm256_stream_si256((__m256i*)(pixels + i), packed);
+		}
+
+		for (; i < count; i++)
+			pixels[i] = ResolvePixel(r[i], g[i], b[i], GetScale(counts, i, settings), settings);
+
+		_mm_sfence();
+	}
+
+	RT_TARGET_AVX2 static __m256i MapHalfAVX2(__m256 value, __m256 scale)
+	{
+		value = _mm256_max_ps(_mm256_mul_ps(value, scale), _mm256_setzero_ps());
+		value = _mm256_min_ps(value, _mm256_set1_ps(AccumulationBuffer::MaxHalf));
+
+		__m256i bits = _mm256_castps_si256(_mm256_mul_ps(value, _mm256_set1_ps(AccumulationBuffer::HalfRebias)));
+		return _mm256_srli_epi32(_mm256_add_epi32(bits, _mm256_set1_epi32(0x1000)), 13);
+	}
+
+	RT_TARGET_AVX2 static void ResolveHalfAVX2(const float* r, const float* g, const float* b, const float* counts, uint64_t* pixels, uint32_t count, const ResolveSettings& settings)
+	{
+		uint32_t i = 0;
+		for (; i < count && ((uintptr_t)(pixels + i) & 31); i++)
+			pixels[i] = ResolveHalfPixel(r[i], g[i], b[i], GetScale(counts, i, settings));
+
+		const __m256i alpha = _mm256_set1_epi32((int)(HalfAlpha << 16));
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256 scale = GetScaleAVX2(counts, i, settings);
+			__m256i red = MapHalfAVX2(_mm256_loadu_ps(r + i), scale);
+			__m256i green = MapHalfAVX2(_mm256_loadu_ps(g + i), scale);
+			__m256i blue = MapHalfAVX2(_mm256_loadu_ps(b + i), scale);
+
+			__m256i redGreen = _mm256_or_si256(red, _mm256_slli_epi32(green, 16));
+			__m256i blueAlpha = _mm256_or_si256(blue, alpha);
+
+			// The unpacks work within 128-bit lanes: pixels 0, 1, 4, 5 and 2, 3, 6, 7
+			__m256i low = _mm256_unpacklo_epi32(redGreen, blueAlpha);
+			__m256i high = _mm256_unpackhi_epi32(redGreen, blueAlpha);
+			_mm256_stream_si256((__m256i*)(pixels + i), _mm256_permute2x128_si256(low, high, 0x20));
+			_mm256_stream_si256((__m256i*)(pixels + i + 4), _mm256_permute2x128_si256(low, high, 0x31));
+		}
+
+		for (; i < count; i++)
+			pixels[i] = ResolveHalfPixel(r[i], g[i], b[i], GetScale(counts, i, settings));
+
+		_mm_sfence();
+	}
+
+#endif // RT_ARCH_X86
+
+#ifdef RT_ARCH_ARM64
+
+	static float32x4_t GetScaleNEON(const float* counts, uint32_t i, const ResolveSettings& settings)
+	{
+		if (!counts)
+			return vdupq_n_f32(settings.Scale);
+		return vdivq_f32(vdupq_n_f32(1.0f), vmaxq_f32(vld1q_f32(counts + i), vdupq_n_f32(1.0f)));
+	}
+
+	static float32x4_t MapNEON(float32x4_t value, float32x4_t scale, const ResolveSettings& settings)
+	{
+		value = vmulq_f32(value, scale);
+		// maxnm returns 0 for NaN like the x86 max
+		value = vmaxnmq_f32(value, vdupq_n_f32(0.0f));
+
+		if (settings.ToneMapping == ToneMap::Reinhard)
+		{
+			value = vminq_f32(value, vdupq_n_f32(FLT_MAX));
+			value = vdivq_f32(value, vaddq_f32(value, vdupq_n_f32(1.0f)));
+		}
+		else
+		{
+			value = vminq_f32(value, vdupq_n_f32(1.0f));
+		}
+
+		if (settings.GammaCorrect)
+			value = vsqrtq_f32(value);
+
+		return vmulq_n_f32(value, 255.0f);
+	}
+
+	// NEON has no non-temporal store for registers, plain stores are still full width
+	static void ResolveNEON(const float* r, const float* g, const float* b, const float* counts, uint32_t* pixels, uint32_t count, const ResolveSettings& settings)
+	{
+		const uint32x4_t alpha = vdupq_n_u32(0xff000000);
+
+		uint32_t i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			float32x4_t scale = GetScaleNEON(counts, i, settings);
+			uint32x4_t red = vcvtq_u32_f32(MapNEON(vld1q_f32(r + i), scale, settings));
+			uint32x4_t green = vcvtq_u32_f32(MapNEON(vld1q_f32(g + i), scale, settings));
+			uint32x4_t blue = vcvtq_u32_f32(MapNEON(vld1q_f32(b + i), scale, settings));
+
+			uint32x4_t packed = vorrq_u32(vorrq_u32(red, vshlq_n_u32(green, 8)), vorrq_u32(vshlq_n_u32(blue, 16), alpha));
+			vst1q_u32(pixels + i, packed);
+		}
+
+		for (; i < count; i++)
+			pixels[i] = ResolvePixel(r[i], g[i], b[i], GetScale(counts, i, settings), settings);
+	}
+
+	static uint16x4_t MapHalfNEON(float32x4_t value, float32x4_t scale)
+	{
+		// maxnm returns 0 for NaN like the x86 max
+		value = vmaxnmq_f32(vmulq_f32(value, scale), vdupq_n_f32(0.0f));
+		value = vminq_f32(value, vdupq_n_f32(AccumulationBuffer::MaxHalf));
+
+		uint32x4_t bits = vreinterpretq_u32_f32(vmulq_n_f32(value, AccumulationBuffer::HalfRebias));
+		return vmovn_u32(vshrq_n_u32(vaddq_u32(bits, vdupq_n_u32(0x1000)), 13));
+	}
+
+	static void ResolveHalfNEON(const float* r, const float* g, const float* b, const float* counts, uint64_t* pixels, uint32_t count, const ResolveSettings& settings)
+	{
+		const uint16x4_t alpha = vdup_n_u16((uint16_t)HalfAlpha);
+
+		uint32_t i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			float32x4_t scale = GetScaleNEON(counts, i, settings);
+			uint16x4x4_t rgba;
+			rgba.val[0] = MapHalfNEON(vld1q_f32(r + i), scale);
+			rgba.val[1] = MapHalfNEON(vld1q_f32(g + i), scale);
+			rgba.val[2] = MapHalfNEON(vld1q_f32(b + i), scale);
+			rgba.val[3] = alpha;
+
+			// Interleaves the four channels into four pixels
+			vst4_u16((uint16_t*)(pixels + i), rgba);
+		}
+
+		for (; i < count; i++)
+			pixels[i] = ResolveHalfPixel(r[i], g[i], b[i], GetScale(counts, i, settings));
+	}
+
+#endif // RT_ARCH_ARM64
+
+}
+
+void AccumulationBuffer::Resize(uint32_t width, uint32_t height)
+{
+	m_Width = width;
+	m_Height = height;
+
+	size_t pixelCount = (size_t)width * height;
+	m_Red.assign(pixelCount, 0.0f);
+	m_Green.assign(pixelCount, 0.0f);
+	m_Blue.assign(pixelCount, 0.0f);
+
+	if (!m_LuminanceSquared.empty())
+		m_LuminanceSquared.assign(pixelCount, 0.0f);
+	if (!m_SampleCounts.empty())
+		m_SampleCounts.assign(pixelCount, 0.0f);
+}
+
+void AccumulationBuffer::Clear()
+{
+	std::fill(m_Red.begin(), m_Red.end(), 0.0f);
+	std::fill(m_Green.begin(), m_Green.end(), 0.0f);
+	std::fill(m_Blue.begin(), m_Blue.end(), 0.0f);
+	std::fill(m_LuminanceSquared.begin(), m_LuminanceSquared.end(), 0.0f);
+	std::fill(m_SampleCounts.begin(), m_SampleCounts.end(), 0.0f);
+}
+
+void AccumulationBuffer::SetTrackVariance(bool track)
+{
+	if (track == IsTrackingVariance())
+		return;
+
+	if (track)
+		m_LuminanceSquared.assign((size_t)m_Width * m_Height, 0.0f);
+	else
+		m_LuminanceSquared.clear();
+}
+
+void AccumulationBuffer::SetTrackSampleCounts(bool track)
+{
+	if (track == IsTrackingSampleCounts())
+		return;
+
+	if (track)
+		m_SampleCounts.assign((size_t)m_Width * m_Height, 0.0f);
+	else
+		m_SampleCounts.clear();
+}
+
+float AccumulationBuffer::GetRelativeError(uint32_t index, uint32_t sampleCount) const
+{
+	if (sampleCount < 2)
+		return FLT_MAX;
+
+	float n = (float)sampleCount;
+	float mean = GetLuminance(Get(index)) / n;
+	float meanSquared = m_LuminanceSquared[index] / n;
+
+	// Unbiased sample variance, divided by n again for the variance of the mean
+	float variance = std::max(meanSquared - mean * mean, 0.0f) * n / (n - 1.0f);
+	float standardError = std::sqrt(variance / n);
+
+	// The offset keeps near black pixels from needing an absurd number of samples
+	return standardError / (mean + 1e-3f);
+}
+
+void AccumulationBuffer::Resolve(uint32_t* pixels, uint32_t first, uint32_t count, const ResolveSettings& settings, SphereKernels::InstructionSet instructionSet) const
+{
+	const float* r = m_Red.data() + first;
+	const float* g = m_Green.data() + first;
+	const float* b = m_Blue.data() + first;
+	const float* counts = m_SampleCounts.empty() ? nullptr : m_SampleCounts.data() + first;
+	pixels += first;
+
+	switch (instructionSet)
+	{
+#if defined(RT_ARCH_X86)
+		case SphereKernels::InstructionSet::SSE2: Utils::ResolveSSE2(r, g, b, counts, pixels, count, settings); return;
+		case SphereKernels::InstructionSet::AVX2: Utils::ResolveAVX2(r, g, b, counts, pixels, count, settings); return;
+#elif defined(RT_ARCH_ARM64)
+		case SphereKernels::InstructionSet::NEON: Utils::ResolveNEON(r, g, b, counts, pixels, count, settings); return;
+#endif
+		default: Utils::ResolveScalar(r, g, b, counts, pixels, count, settings); return;
+	}
+}
+
+void AccumulationBuffer::ResolveHalf(uint64_t* pixels, uint32_t first, uint32_t count, const ResolveSettings& settings, SphereKernels::InstructionSet instructionSet) const
+{
+	const float* r = m_Red.data() + first;
+	const float* g = m_Green.data() + first;
+	const float* b = m_Blue.data() + first;
+	const float* counts = m_SampleCounts.empty() ? nullptr : m_SampleCounts.data() + first;
+	pixels += first;
+
+	switch (instructionSet)
+	{
+#if defined(RT_ARCH_X86)
+		case SphereKernels::InstructionSet::SSE2: Utils::ResolveHalfSSE2(r, g, b, counts, pixels, count, settings); return;
+		case SphereKernels::InstructionSet::AVX2: Utils::ResolveHalfAVX2(r, g, b, counts, pixels, count, settings); return;
+#elif defined(RT_ARCH_ARM64)
+		case SphereKernels::InstructionSet::NEON: Utils::ResolveHalfNEON(r, g, b, counts, pixels, count, settings); return;
+#endif
+		default: Utils::ResolveHalfScalar(r, g, b, counts, pixels, count, settings); return;
+	}
+}
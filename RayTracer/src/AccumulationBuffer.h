@@ -0,0 +1,127 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstring>
+
+#include "FrameArena.h"
+#include "SphereKernels.h"
+
+// Running per pixel sums of the traced color, stored as one float plane per channel.
+// Alpha is always 1, so it is not stored at all. With variance tracking on, a fourth plane
+// sums the squared luminance of every sample for the noise estimate adaptive sampling needs.
+// With sample counts on, every pixel also keeps its own sample count, for history that was
+// carried over from another view and no longer matches the frame count.
+class AccumulationBuffer
+{
+public:
+	enum class ToneMap
+	{
+		// Plain clamp to [0, 1]
+		Clamp = 0,
+		// x / (1 + x)
+		Reinhard
+	};
+
+	struct ResolveSettings
+	{
+		// Usually 1 / sample count, ignored when the buffer tracks per pixel sample counts
+		float Scale = 1.0f;
+		ToneMap ToneMapping = ToneMap::Clamp;
+		// Gamma 2.0 (a square root), close enough to sRGB for previews
+		bool GammaCorrect = false;
+	};
+public:
+	void Resize(uint32_t width, uint32_t height);
+	void Clear();
+
+	// Turns the squared luminance plane on or off, its contents start out cleared.
+	// Off keeps the memory, reprojection toggles it on every camera move.
+	void SetTrackVariance(bool track);
+	bool IsTrackingVariance() const { return !m_LuminanceSquared.empty(); }
+	// Turns the per pixel sample count plane on or off, its contents start out cleared
+	void SetTrackSampleCounts(bool track);
+	bool IsTrackingSampleCounts() const { return !m_SampleCounts.empty(); }
+
+	void Add(uint32_t index, const glm::vec3& color)
+	{
+		m_Red[index] += color.r;
+		m_Green[index] += color.g;
+		m_Blue[index] += color.b;
+
+		if (!m_LuminanceSquared.empty())
+		{
+			float luminance = GetLuminance(color);
+			m_LuminanceSquared[index] += luminance * luminance;
+		}
+
+		if (!m_SampleCounts.empty())
+			m_SampleCounts[index] += 1.0f;
+	}
+
+	// Overwrites a pixel's sum, for buffers used as plain RGB planes
+	void Set(uint32_t index, const glm::vec3& sum)
+	{
+		m_Red[index] = sum.r;
+		m_Green[index] = sum.g;
+		m_Blue[index] = sum.b;
+	}
+
+	// Overwrites a pixel's sum and sample count, needs sample counts
+	void Set(uint32_t index, const glm::vec3& sum, float sampleCount)
+	{
+		Set(index, sum);
+		m_SampleCounts[index] = sampleCount;
+	}
+
+	glm::vec3 Get(uint32_t index) const { return { m_Red[index], m_Green[index], m_Blue[index] }; }
+	float GetSampleCount(uint32_t index) const { return m_SampleCounts[index]; }
+
+	// Standard error of the mean luminance divided by the mean luminance, for a pixel that summed sampleCount samples.
+	// Needs variance tracking.
+	float GetRelativeError(uint32_t index, uint32_t sampleCount) const;
+
+	static float GetLuminance(const glm::vec3& color) { return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f)); }
+
+	// IEEE half float, rounding to nearest with ties up. Half denormals (below 6.1e-5) can be one unit off, they round
+	// twice. Values beyond the half range clamp to its largest value, NaN becomes 0.
+	static uint16_t ToHalf(float value)
+	{
+		uint16_t sign = std::signbit(value) ? 0x8000 : 0;
+		float magnitude = std::fabs(value);
+		if (!(magnitude <= MaxHalf))
+			magnitude = magnitude > 0.0f ? MaxHalf : 0.0f;
+
+		// Moves the exponent bias from 127 to 15, half denormals come out as float denormals with the same bits
+		magnitude *= HalfRebias;
+		uint32_t bits;
+		memcpy(&bits, &magnitude, sizeof(bits));
+		return sign | (uint16_t)((bits + 0x1000) >> 13);
+	}
+
+	static constexpr float MaxHalf = 65504.0f;
+	// 2^-112
+	static constexpr float HalfRebias = 1.92592994e-34f;
+
+	// Scales, tone maps, gamma corrects and packs pixels [first, first + count) into RGBA8.
+	// The SIMD paths use non-temporal stores, pixels is meant to be upload memory the CPU never reads back.
+	void Resolve(uint32_t* pixels, uint32_t first, uint32_t count, const ResolveSettings& settings, SphereKernels::InstructionSet instructionSet) const;
+	// Scales pixels [first, first + count) into RGBA16F, 4 halves each with alpha 1, for a display that tone maps
+	// itself. Negative values clamp to 0, only settings.Scale is used. Streams like Resolve.
+	void ResolveHalf(uint64_t* pixels, uint32_t first, uint32_t count, const ResolveSettings& settings, SphereKernels::InstructionSet instructionSet) const;
+
+	const float* GetRed() const { return m_Red.data(); }
+	const float* GetGreen() const { return m_Green.data(); }
+	const float* GetBlue() const { return m_Blue.data(); }
+
+	uint32_t GetWidth() const { return m_Width; }
+	uint32_t GetHeight() const { return m_Height; }
+private:
+	FrameBuffer<float> m_Red, m_Green, m_Blue;
+	// Empty unless variance tracking is on
+	FrameBuffer<float> m_LuminanceSquared;
+	// Empty unless sample counts are on
+	FrameBuffer<float> m_SampleCounts;
+	uint32_t m_Width = 0, m_Height = 0;
+};
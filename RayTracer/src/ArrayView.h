@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+// Non-owning view of a contiguous array, std::span before C++20. Named like the std containers it stands in for,
+// so code reading geometry does not care whether it lives in a std::vector or in a mapped scene cache.
+template<typename T>
+class ArrayView
+{
+public:
+	ArrayView() = default;
+	ArrayView(T* data, size_t size)
+		: m_Data(data), m_Size(size) {}
+
+	// Only for views of const elements
+	template<typename U, typename = std::enable_if_t<std::is_same_v<const U, T>>>
+	ArrayView(const std::vector<U>& vector)
+		: m_Data(vector.data()), m_Size(vector.size()) {}
+
+	T* data() const { return m_Data; }
+	size_t size() const { return m_Size; }
+	bool empty() const { return m_Size == 0; }
+
+	T& operator[](size_t index) const { return m_Data[index]; }
+
+	T* begin() const { return m_Data; }
+	T* end() const { return m_Data + m_Size; }
+private:
+	T* m_Data = nullptr;
+	size_t m_Size = 0;
+};
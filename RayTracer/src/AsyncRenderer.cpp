@@ -0,0 +1,171 @@
+#include "AsyncRenderer.h"
+
+#include "Walnut/Application.h"
+#include "Walnut/Profiler.h"
+#include "Walnut/Timer.h"
+
+AsyncRenderer::AsyncRenderer()
+{
+	m_Thread = std::thread(&AsyncRenderer::RenderThread, this);
+}
+
+AsyncRenderer::~AsyncRenderer()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_SnapshotMutex);
+		m_Stopping = true;
+	}
+	m_SnapshotCondition.notify_one();
+
+	m_Thread.join();
+}
+
+void AsyncRenderer::Submit(const Scene& scene, const Camera& camera, uint32_t width, uint32_t height, const Renderer::Settings& settings, bool sceneChanged, bool cameraMoved)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_SnapshotMutex);
+
+		m_PendingSnapshot.Settings = settings;
+
+		bool resized = m_PendingSnapshot.Version == 0 || width != m_PendingSnapshot.Width || height != m_PendingSnapshot.Height;
+		bool reset = sceneChanged || resized || (cameraMoved && !settings.TemporalReprojection);
+		if (reset || cameraMoved)
+		{
+			m_PendingSnapshot.SceneData = scene;
+			m_PendingSnapshot.CameraData = camera;
+			m_PendingSnapshot.Width = width;
+			m_PendingSnapshot.Height = height;
+
+			// Versions the render thread never picked up still need their BVH work done
+			m_PendingSnapshot.RebuildBVH |= m_RebuildBVH;
+			m_RebuildBVH = false;
+
+			// A reset the render thread never picked up still has to happen
+			m_PendingSnapshot.Reset |= reset;
+
+			m_PendingSnapshot.Version++;
+			if (reset)
+				m_LatestResetVersion.store(m_PendingSnapshot.Version, std::memory_order_relaxed);
+		}
+
+		m_PendingSequence++;
+	}
+	m_SnapshotCondition.notify_one();
+}
+
+bool AsyncRenderer::Present()
+{
+	if (!m_Frames.Acquire())
+		return false;
+
+	const Frame& frame = m_Frames.GetReadBuffer();
+
+	if (!m_FinalImage)
+	{
+		m_FinalImage = std::make_shared<Walnut::Image>(frame.Width, frame.Height, Walnut::ImageFormat::RGBA);
+		m_FinalImage->SetReuseAllocation(true);
+	}
+	else if (m_FinalImage->GetWidth() != frame.Width || m_FinalImage->GetHeight() != frame.Height)
+		m_FinalImage->Resize(frame.Width, frame.Height);
+
+	{
+		WL_PROFILE_ZONE("Image Upload");
+		void* data = m_FinalImage->BeginStreamingWrite();
+		memcpy(data, frame.Pixels.data(), frame.Pixels.size() * sizeof(uint32_t));
+		m_FinalImage->EndStreamingWrite();
+	}
+
+	m_LastRenderTime = frame.RenderTime;
+	return true;
+}
+
+void AsyncRenderer::RenderThread()
+{
+	Walnut::Profiler::SetThreadName("Render");
+
+	Snapshot snapshot;
+	uint64_t sequence = 0;
+	uint64_t renderedVersion = 0;
+	bool converged = false;
+	uint64_t resetVersion = 0;
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_SnapshotMutex);
+
+			// Keep accumulating once there is something to render, otherwise sleep until the UI submits.
+			// A converged image only needs another look when the UI submits again.
+			m_SnapshotCondition.wait(lock, [&]()
+			{
+				return m_Stopping || m_PendingSequence != sequence || (snapshot.Width > 0 && snapshot.Height > 0 && !converged);
+			});
+
+			if (m_Stopping)
+				return;
+
+			if (m_PendingSequence != sequence)
+			{
+				if (m_PendingSnapshot.Version != snapshot.Version)
+				{
+					snapshot = m_PendingSnapshot;
+					m_PendingSnapshot.RebuildBVH = false;
+					m_PendingSnapshot.Reset = false;
+				}
+				else
+				{
+					snapshot.Settings = m_PendingSnapshot.Settings;
+				}
+
+				sequence = m_PendingSequence;
+			}
+
+			// Read under the lock, so it matches the snapshot
+			resetVersion = m_LatestResetVersion.load(std::memory_order_relaxed);
+		}
+
+		if (snapshot.Width == 0 || snapshot.Height == 0)
+			continue;
+
+		m_Renderer.GetSettings() = snapshot.Settings;
+		m_Renderer.OnResize(snapshot.Width, snapshot.Height);
+
+		if (snapshot.Version != renderedVersion)
+		{
+			if (snapshot.RebuildBVH)
+				m_Renderer.InvalidateAccelerationStructure();
+
+			// Camera only versions are reprojected by the renderer itself
+			if (snapshot.Reset)
+				m_Renderer.ResetFrameIndex();
+			renderedVersion = snapshot.Version;
+		}
+
+		// The last published frame already shows everything adaptive sampling will ever add
+		converged = m_Renderer.IsConverged();
+		if (converged)
+			continue;
+
+		Frame& frame = m_Frames.GetWriteBuffer();
+		frame.Pixels.resize(snapshot.Width * snapshot.Height);
+
+		Walnut::Timer timer;
+
+		// Only resets cancel, a reprojected camera move is better served by finishing the frame and carrying it over
+		bool completed = m_Renderer.RenderFrame(snapshot.SceneData, snapshot.CameraData, frame.Pixels.data(), [this, resetVersion]()
+		{
+			return m_Stopping.load(std::memory_order_relaxed) || m_LatestResetVersion.load(std::memory_order_relaxed) != resetVersion;
+		});
+
+		if (!completed)
+			continue;
+
+		frame.Width = snapshot.Width;
+		frame.Height = snapshot.Height;
+		frame.RenderTime = timer.ElapsedMillis();
+		m_Frames.Publish();
+
+		// The UI may be asleep waiting for input, it has to come and Present this
+		Walnut::Application::RequestFrame();
+	}
+}
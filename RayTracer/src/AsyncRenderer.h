@@ -0,0 +1,92 @@
+#pragma once
+
+#include "Walnut/Image.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "Camera.h"
+#include "FrameArena.h"
+#include "Renderer.h"
+#include "Scene.h"
+#include "TripleBuffer.h"
+
+// Runs a CPU Renderer on its own thread so a slow frame never holds up the UI.
+// The UI thread hands over versioned snapshots of the scene and camera, and a new version cancels
+// the frame in flight at tile granularity. Finished frames come back through a lock-free triple
+// buffer and Present uploads the newest one into the final image. Every finished frame requests a UI frame,
+// so the application can wait for events while the render thread accumulates.
+class AsyncRenderer
+{
+public:
+	AsyncRenderer();
+	~AsyncRenderer();
+
+	AsyncRenderer(const AsyncRenderer&) = delete;
+	AsyncRenderer& operator=(const AsyncRenderer&) = delete;
+
+	// Call once per UI frame. With sceneChanged or cameraMoved set (or a new size) the scene and camera are copied
+	// into a new version, which cancels the frame in flight and restarts accumulation. With temporal reprojection on,
+	// camera moves instead let the frame in flight finish and carry the accumulation over.
+	// Otherwise only the settings are handed over.
+	void Submit(const Scene& scene, const Camera& camera, uint32_t width, uint32_t height, const Renderer::Settings& settings, bool sceneChanged, bool cameraMoved);
+
+	// Applied to the render thread's BVH along with the next reset. Edits need no call, the copied scene
+	// carries the versions the render thread's renderer compares.
+	void InvalidateAccelerationStructure() { m_RebuildBVH = true; }
+
+	// Uploads the newest finished frame, returns false if none arrived since the last call. UI thread only.
+	bool Present();
+
+	std::shared_ptr<Walnut::Image> GetFinalImage() const { return m_FinalImage; }
+	// Trace time of the last presented frame
+	float GetLastRenderTime() const { return m_LastRenderTime; }
+private:
+	struct Snapshot
+	{
+		Scene SceneData;
+		Camera CameraData{ 45.0f, 0.1f, 100.0f };
+		Renderer::Settings Settings;
+
+		uint32_t Width = 0, Height = 0;
+		bool RebuildBVH = false;
+		// Accumulation has to start over, anything but a reprojected camera move
+		bool Reset = false;
+
+		uint64_t Version = 0;
+	};
+
+	struct Frame
+	{
+		FrameBuffer<uint32_t> Pixels;
+		uint32_t Width = 0, Height = 0;
+		float RenderTime = 0.0f;
+	};
+
+	void RenderThread();
+private:
+	// Owned by the render thread once it is running
+	Renderer m_Renderer;
+
+	std::mutex m_SnapshotMutex;
+	std::condition_variable m_SnapshotCondition;
+	Snapshot m_PendingSnapshot;
+	// Bumped by every Submit, Version only by the ones that reset
+	uint64_t m_PendingSequence = 0;
+
+	// Version of the newest snapshot with Reset set, polled by the in flight frame to see whether it is still wanted
+	std::atomic<uint64_t> m_LatestResetVersion{ 0 };
+	std::atomic<bool> m_Stopping{ false };
+
+	TripleBuffer<Frame> m_Frames;
+
+	// UI thread state
+	bool m_RebuildBVH = false;
+	std::shared_ptr<Walnut::Image> m_FinalImage;
+	float m_LastRenderTime = 0.0f;
+
+	std::thread m_Thread;
+};
@@ -0,0 +1,248 @@
+#include "BVH.h"
+
+#include <algorithm>
+
+#include "Walnut/Profiler.h"
+
+namespace Utils {
+
+	static constexpr int BVHStackSize = BVHBuilder::MaxDepth;
+
+	static AABB SphereBounds(const Sphere& sphere)
+	{
+		float radius = glm::abs(sphere.Radius);
+
+		AABB bounds;
+		bounds.Min = sphere.Position - glm::vec3(radius);
+		bounds.Max = sphere.Position + glm::vec3(radius);
+		return bounds;
+	}
+
+}
+
+BVH::BVH()
+{
+	SetInstructionSet(m_InstructionSet);
+}
+
+void BVH::SetInstructionSet(SphereKernels::InstructionSet instructionSet)
+{
+	m_InstructionSet = instructionSet;
+	m_IntersectFunction = SphereKernels::GetIntersectFunction(instructionSet);
+	m_LeafBlockSize = SphereKernels::GetLaneCount(instructionSet);
+}
+
+void BVH::Build(const std::vector<Sphere>& spheres)
+{
+	Clear();
+
+	if (spheres.empty())
+		return;
+
+	m_Bounds.resize(spheres.size());
+	for (size_t i = 0; i < spheres.size(); i++)
+		m_Bounds[i] = Utils::SphereBounds(spheres[i]);
+
+	BVHBuilder::Build(m_Bounds, m_LeafBlockSize, m_Nodes, m_PrimitiveIndices);
+	m_SphereData.Build(spheres, m_PrimitiveIndices);
+}
+
+bool BVH::Load(const std::vector<Sphere>& spheres, const PrebuiltBVH& prebuilt)
+{
+	if (prebuilt.PrimitiveIndices.size() != spheres.size() || prebuilt.LeafBlockSize != m_LeafBlockSize || prebuilt.Nodes.empty())
+		return false;
+
+	m_Nodes.assign(prebuilt.Nodes.begin(), prebuilt.Nodes.end());
+	m_PrimitiveIndices.assign(prebuilt.PrimitiveIndices.begin(), prebuilt.PrimitiveIndices.end());
+	m_Bounds.clear();
+
+	// The spheres may have been edited since the cache was written
+	Refit(spheres);
+	return true;
+}
+
+void BVH::Refit(const std::vector<Sphere>& spheres)
+{
+	if (m_Nodes.empty())
+		return;
+
+	// Children are always allocated after their parent, so walking the array
+	// backwards visits every child before the node that contains it
+	for (int i = (int)m_Nodes.size() - 1; i >= 0; i--)
+	{
+		BVHNode& node = m_Nodes[i];
+		if (node.IsLeaf())
+		{
+			UpdateNodeBounds((uint32_t)i, spheres);
+			continue;
+		}
+
+		const BVHNode& left = m_Nodes[node.LeftFirst];
+		const BVHNode& right = m_Nodes[node.LeftFirst + 1];
+		node.BoundsMin = glm::min(left.BoundsMin, right.BoundsMin);
+		node.BoundsMax = glm::max(left.BoundsMax, right.BoundsMax);
+	}
+
+	m_SphereData.Build(spheres, m_PrimitiveIndices);
+}
+
+int BVH::Intersect(const Ray& ray, float& hitDistance) const
+{
+	int closestSphere = -1;
+
+	if (m_Nodes.empty())
+		return closestSphere;
+
+	glm::vec3 inverseDirection = BVHNode::GetInverseDirection(ray.Direction);
+
+	uint32_t stack[Utils::BVHStackSize];
+	int stackPointer = 0;
+
+	const BVHNode* node = &m_Nodes[0];
+	if (node->Intersect(ray, inverseDirection, hitDistance) == FLT_MAX)
+		return closestSphere;
+
+	// Kept in registers, handed to the profiler once per ray
+	uint32_t nodesVisited = 0;
+	uint32_t intersectionTests = 0;
+
+	while (true)
+	{
+		nodesVisited++;
+
+		if (node->IsLeaf())
+		{
+			intersectionTests += node->PrimitiveCount;
+			int hit = m_IntersectFunction(ray, m_SphereData, node->LeftFirst, node->PrimitiveCount, hitDistance);
+			if (hit >= 0)
+				closestSphere = (int)m_PrimitiveIndices[node->LeftFirst + hit];
+
+			if (stackPointer == 0)
+				break;
+
+			node = &m_Nodes[stack[--stackPointer]];
+			continue;
+		}
+
+		uint32_t nearIndex = node->LeftFirst;
+		uint32_t farIndex = node->LeftFirst + 1;
+
+		float nearDistance = m_Nodes[nearIndex].Intersect(ray, inverseDirection, hitDistance);
+		float farDistance = m_Nodes[farIndex].Intersect(ray, inverseDirection, hitDistance);
+
+		// Visit the closer child first so hitDistance shrinks as early as possible
+		if (nearDistance > farDistance)
+		{
+			std::swap(nearDistance, farDistance);
+			std::swap(nearIndex, farIndex);
+		}
+
+		if (nearDistance == FLT_MAX)
+		{
+			if (stackPointer == 0)
+				break;
+
+			node = &m_Nodes[stack[--stackPointer]];
+			continue;
+		}
+
+		node = &m_Nodes[nearIndex];
+		if (farDistance != FLT_MAX)
+		{
+			RT_BVH_STACK_CHECK(stackPointer);
+			stack[stackPointer++] = farIndex;
+		}
+	}
+
+	WL_PROFILE_COUNT("BVH Nodes Visited", nodesVisited);
+	WL_PROFILE_COUNT("Intersection Tests", intersectionTests);
+
+	return closestSphere;
+}
+
+bool BVH::IsOccluded(const Ray& ray, float maxDistance) const
+{
+	if (m_Nodes.empty())
+		return false;
+
+	glm::vec3 inverseDirection = BVHNode::GetInverseDirection(ray.Direction);
+
+	uint32_t stack[Utils::BVHStackSize];
+	int stackPointer = 0;
+
+	const BVHNode* node = &m_Nodes[0];
+	if (node->Intersect(ray, inverseDirection, maxDistance) == FLT_MAX)
+		return false;
+
+	uint32_t nodesVisited = 0;
+
+	while (true)
+	{
+		nodesVisited++;
+
+		if (node->IsLeaf())
+		{
+			// The kernel shrinks its distance, any hit at all is enough here
+			float hitDistance = maxDistance;
+			if (m_IntersectFunction(ray, m_SphereData, node->LeftFirst, node->PrimitiveCount, hitDistance) >= 0)
+			{
+				WL_PROFILE_COUNT("BVH Nodes Visited", nodesVisited);
+				return true;
+			}
+
+			if (stackPointer == 0)
+				break;
+
+			node = &m_Nodes[stack[--stackPointer]];
+			continue;
+		}
+
+		// No closest hit to find, so no point in ordering the children
+		uint32_t leftIndex = node->LeftFirst;
+		uint32_t rightIndex = node->LeftFirst + 1;
+		bool left = m_Nodes[leftIndex].Intersect(ray, inverseDirection, maxDistance) != FLT_MAX;
+		bool right = m_Nodes[rightIndex].Intersect(ray, inverseDirection, maxDistance) != FLT_MAX;
+
+		if (left && right)
+		{
+			node = &m_Nodes[leftIndex];
+			RT_BVH_STACK_CHECK(stackPointer);
+			stack[stackPointer++] = rightIndex;
+		}
+		else if (left || right)
+		{
+			node = &m_Nodes[left ? leftIndex : rightIndex];
+		}
+		else
+		{
+			if (stackPointer == 0)
+				break;
+
+			node = &m_Nodes[stack[--stackPointer]];
+		}
+	}
+
+	WL_PROFILE_COUNT("BVH Nodes Visited", nodesVisited);
+
+	return false;
+}
+
+void BVH::Clear()
+{
+	m_Nodes.clear();
+	m_PrimitiveIndices.clear();
+	m_Bounds.clear();
+	m_SphereData.Clear();
+}
+
+void BVH::UpdateNodeBounds(uint32_t nodeIndex, const std::vector<Sphere>& spheres)
+{
+	BVHNode& node = m_Nodes[nodeIndex];
+
+	AABB bounds;
+	for (uint32_t i = 0; i < node.PrimitiveCount; i++)
+		bounds.Grow(Utils::SphereBounds(spheres[m_PrimitiveIndices[node.LeftFirst + i]]));
+
+	node.BoundsMin = bounds.Min;
+	node.BoundsMax = bounds.Max;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cfloat>
+
+#include "BVHBuilder.h"
+#include "Ray.h"
+#include "Scene.h"
+#include "SphereKernels.h"
+
+// Bounding volume hierarchy over Scene::Spheres, built by BVHBuilder.
+// Leaves are intersected with a SIMD kernel over a SoA copy of the spheres in leaf order.
+class BVH
+{
+public:
+	BVH();
+
+	// Picks the leaf kernel, the leaf size the SAH aims for follows its lane count.
+	// Takes effect on the next Build.
+	void SetInstructionSet(SphereKernels::InstructionSet instructionSet);
+	SphereKernels::InstructionSet GetInstructionSet() const { return m_InstructionSet; }
+
+	void Build(const std::vector<Sphere>& spheres);
+	// Takes the topology of a scene cache's hierarchy instead of building one, then refits it to the spheres.
+	// Returns false, leaving the BVH untouched, if it was built for a different sphere count or leaf size.
+	bool Load(const std::vector<Sphere>& spheres, const PrebuiltBVH& prebuilt);
+
+	// Recomputes node bounds bottom-up while keeping the tree topology.
+	// Cheap enough to run every frame while a sphere is being dragged.
+	void Refit(const std::vector<Sphere>& spheres);
+
+	// Returns the index of the closest sphere hit in front of the ray origin, or -1.
+	int Intersect(const Ray& ray, float& hitDistance) const;
+	// Shadow rays: true if any sphere is hit closer than maxDistance, stops at the first one found
+	bool IsOccluded(const Ray& ray, float maxDistance) const;
+
+	void Clear();
+
+	bool IsEmpty() const { return m_Nodes.empty(); }
+	uint32_t GetLeafBlockSize() const { return m_LeafBlockSize; }
+	size_t GetPrimitiveCount() const { return m_PrimitiveIndices.size(); }
+
+	const std::vector<BVHNode>& GetNodes() const { return m_Nodes; }
+	const std::vector<uint32_t>& GetPrimitiveIndices() const { return m_PrimitiveIndices; }
+private:
+	void UpdateNodeBounds(uint32_t nodeIndex, const std::vector<Sphere>& spheres);
+private:
+	std::vector<BVHNode> m_Nodes;
+	std::vector<uint32_t> m_PrimitiveIndices;
+	std::vector<AABB> m_Bounds;
+	SphereSoA m_SphereData;
+
+	SphereKernels::InstructionSet m_InstructionSet = SphereKernels::InstructionSet::Scalar;
+	SphereKernels::IntersectFn m_IntersectFunction = nullptr;
+	uint32_t m_LeafBlockSize = 1;
+};
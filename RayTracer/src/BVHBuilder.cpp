@@ -0,0 +1,226 @@
+#include "BVHBuilder.h"
+
+#include <algorithm>
+
+namespace Utils {
+
+	static constexpr int BVHBinCount = 12;
+	static constexpr uint32_t BVHMaxLeafSize = 4;
+	// Cost of visiting one more node, relative to intersecting one block of primitives
+	static constexpr float BVHTraversalCost = 1.0f;
+
+	// Levels median splits need to get count primitives down to leaves of at most maxLeafSize,
+	// ceil(log2(count / maxLeafSize)) since every split halves the larger side
+	static uint32_t GetMedianSplitDepth(uint32_t count, uint32_t maxLeafSize)
+	{
+		uint32_t depth = 0;
+		for (; count > maxLeafSize; depth++)
+			count = (count + 1) / 2;
+		return depth;
+	}
+
+	static float BlockCount(uint32_t primitiveCount, uint32_t blockSize)
+	{
+		return (float)((primitiveCount + blockSize - 1) / blockSize);
+	}
+
+	struct BuildState
+	{
+		const std::vector<AABB>& Bounds;
+		std::vector<glm::vec3> Centroids;
+		std::vector<BVHNode>& Nodes;
+		std::vector<uint32_t>& PrimitiveIndices;
+		uint32_t LeafBlockSize;
+		uint32_t NodesUsed = 0;
+	};
+
+	static void UpdateNodeBounds(BuildState& state, uint32_t nodeIndex)
+	{
+		BVHNode& node = state.Nodes[nodeIndex];
+
+		AABB bounds;
+		for (uint32_t i = 0; i < node.PrimitiveCount; i++)
+			bounds.Grow(state.Bounds[state.PrimitiveIndices[node.LeftFirst + i]]);
+
+		node.BoundsMin = bounds.Min;
+		node.BoundsMax = bounds.Max;
+	}
+
+	static float FindBestSplitPlane(const BuildState& state, const BVHNode& node, int& axis, float& splitPosition)
+	{
+		float bestCost = FLT_MAX;
+		axis = 0;
+		splitPosition = 0.0f;
+
+		AABB centroidBounds;
+		for (uint32_t i = 0; i < node.PrimitiveCount; i++)
+			centroidBounds.Grow(state.Centroids[state.PrimitiveIndices[node.LeftFirst + i]]);
+
+		for (int a = 0; a < 3; a++)
+		{
+			float boundsMin = centroidBounds.Min[a];
+			float boundsMax = centroidBounds.Max[a];
+			if (boundsMin == boundsMax)
+				continue;
+
+			struct Bin
+			{
+				AABB Bounds;
+				uint32_t Count = 0;
+			};
+			Bin bins[BVHBinCount];
+
+			float scale = (float)BVHBinCount / (boundsMax - boundsMin);
+			for (uint32_t i = 0; i < node.PrimitiveCount; i++)
+			{
+				uint32_t index = state.PrimitiveIndices[node.LeftFirst + i];
+				int binIndex = glm::min(BVHBinCount - 1, (int)((state.Centroids[index][a] - boundsMin) * scale));
+				bins[binIndex].Count++;
+				bins[binIndex].Bounds.Grow(state.Bounds[index]);
+			}
+
+			// Sweep from both sides to get the cost of every plane between two bins
+			float leftArea[BVHBinCount - 1], rightArea[BVHBinCount - 1];
+			uint32_t leftCount[BVHBinCount - 1], rightCount[BVHBinCount - 1];
+
+			AABB leftBox, rightBox;
+			uint32_t leftSum = 0, rightSum = 0;
+			for (int i = 0; i < BVHBinCount - 1; i++)
+			{
+				leftSum += bins[i].Count;
+				leftCount[i] = leftSum;
+				leftBox.Grow(bins[i].Bounds);
+				leftArea[i] = leftBox.Area();
+
+				rightSum += bins[BVHBinCount - 1 - i].Count;
+				rightCount[BVHBinCount - 2 - i] = rightSum;
+				rightBox.Grow(bins[BVHBinCount - 1 - i].Bounds);
+				rightArea[BVHBinCount - 2 - i] = rightBox.Area();
+			}
+
+			float binWidth = (boundsMax - boundsMin) / (float)BVHBinCount;
+			for (int i = 0; i < BVHBinCount - 1; i++)
+			{
+				if (leftCount[i] == 0 || rightCount[i] == 0)
+					continue;
+
+				float cost = BlockCount(leftCount[i], state.LeafBlockSize) * leftArea[i] + BlockCount(rightCount[i], state.LeafBlockSize) * rightArea[i];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					axis = a;
+					splitPosition = boundsMin + binWidth * (float)(i + 1);
+				}
+			}
+		}
+
+		return bestCost;
+	}
+
+	static void Subdivide(BuildState& state, uint32_t nodeIndex, uint32_t depth)
+	{
+		BVHNode& node = state.Nodes[nodeIndex];
+
+		if (node.PrimitiveCount <= 1)
+			return;
+
+		uint32_t maxLeafSize = glm::max(BVHMaxLeafSize, state.LeafBlockSize);
+
+		int axis = 0;
+		float splitPosition = 0.0f;
+		// A SAH split may peel off a sliver, leaving a child with nearly every primitive one level down.
+		// Only take it while median splits could still finish that child within MaxDepth, from here on
+		// every median split keeps that true for its children as well.
+		if (depth + 1 + GetMedianSplitDepth(node.PrimitiveCount, maxLeafSize) <= (uint32_t)BVHBuilder::MaxDepth)
+		{
+			float splitCost = FindBestSplitPlane(state, node, axis, splitPosition);
+
+			AABB nodeBounds{ node.BoundsMin, node.BoundsMax };
+			float leafCost = BlockCount(node.PrimitiveCount, state.LeafBlockSize) * nodeBounds.Area();
+			splitCost += BVHTraversalCost * nodeBounds.Area();
+
+			if (splitCost >= leafCost && node.PrimitiveCount <= maxLeafSize)
+				return;
+		}
+		else
+		{
+			glm::vec3 extent = node.BoundsMax - node.BoundsMin;
+			axis = extent.y > extent.x ? 1 : 0;
+			axis = extent.z > extent[axis] ? 2 : axis;
+			splitPosition = FLT_MAX; // Forces the median split below
+		}
+
+		// Partition primitives around the split plane
+		uint32_t* indices = state.PrimitiveIndices.data();
+		const glm::vec3* centroids = state.Centroids.data();
+		uint32_t first = node.LeftFirst;
+		uint32_t last = first + node.PrimitiveCount;
+		uint32_t* middle = std::partition(indices + first, indices + last,
+			[centroids, axis, splitPosition](uint32_t index) { return centroids[index][axis] < splitPosition; });
+
+		uint32_t leftCount = (uint32_t)(middle - indices) - first;
+
+		// All centroids on one side (or coincident), fall back to a median split
+		if (leftCount == 0 || leftCount == node.PrimitiveCount)
+		{
+			if (node.PrimitiveCount <= maxLeafSize)
+				return;
+
+			leftCount = node.PrimitiveCount / 2;
+			std::nth_element(indices + first, indices + first + leftCount, indices + last,
+				[centroids, axis](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+		}
+
+		uint32_t leftChild = state.NodesUsed++;
+		uint32_t rightChild = state.NodesUsed++;
+
+		state.Nodes[leftChild].LeftFirst = first;
+		state.Nodes[leftChild].PrimitiveCount = leftCount;
+		state.Nodes[rightChild].LeftFirst = first + leftCount;
+		state.Nodes[rightChild].PrimitiveCount = node.PrimitiveCount - leftCount;
+
+		node.LeftFirst = leftChild;
+		node.PrimitiveCount = 0;
+
+		UpdateNodeBounds(state, leftChild);
+		UpdateNodeBounds(state, rightChild);
+
+		Subdivide(state, leftChild, depth + 1);
+		Subdivide(state, rightChild, depth + 1);
+	}
+
+}
+
+void BVHBuilder::Build(const std::vector<AABB>& bounds, uint32_t leafBlockSize, std::vector<BVHNode>& nodes, std::vector<uint32_t>& primitiveIndices)
+{
+	nodes.clear();
+	primitiveIndices.clear();
+
+	if (bounds.empty())
+		return;
+
+	uint32_t count = (uint32_t)bounds.size();
+
+	Utils::BuildState state{ bounds, {}, nodes, primitiveIndices, glm::max(leafBlockSize, 1u) };
+	primitiveIndices.resize(count);
+	state.Centroids.resize(count);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		primitiveIndices[i] = i;
+		state.Centroids[i] = bounds[i].GetCenter();
+	}
+
+	// A binary tree with N leaves never has more than 2N - 1 nodes
+	nodes.resize(2 * (size_t)count - 1);
+
+	BVHNode& root = nodes[0];
+	root.LeftFirst = 0;
+	root.PrimitiveCount = count;
+	state.NodesUsed = 1;
+
+	Utils::UpdateNodeBounds(state, 0);
+	Utils::Subdivide(state, 0, 0);
+
+	nodes.resize(state.NodesUsed);
+	nodes.shrink_to_fit();
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cassert>
+#include <cfloat>
+
+#include "Ray.h"
+
+struct AABB
+{
+	glm::vec3 Min{ FLT_MAX };
+	glm::vec3 Max{ -FLT_MAX };
+
+	void Grow(const glm::vec3& point)
+	{
+		Min = glm::min(Min, point);
+		Max = glm::max(Max, point);
+	}
+
+	void Grow(const AABB& other)
+	{
+		Min = glm::min(Min, other.Min);
+		Max = glm::max(Max, other.Max);
+	}
+
+	float Area() const
+	{
+		glm::vec3 e = Max - Min;
+		return e.x * e.y + e.y * e.z + e.z * e.x;
+	}
+
+	glm::vec3 GetCenter() const { return (Min + Max) * 0.5f; }
+};
+
+struct BVHNode
+{
+	glm::vec3 BoundsMin{ FLT_MAX };
+	uint32_t LeftFirst = 0; // Index of the left child for interior nodes, first primitive for leaves
+	glm::vec3 BoundsMax{ -FLT_MAX };
+	uint32_t PrimitiveCount = 0; // 0 for interior nodes
+
+	bool IsLeaf() const { return PrimitiveCount > 0; }
+
+	// Zero components become tiny instead, so a ray running along a box face gives 0 * 1e30 rather than 0 * inf = NaN.
+	// Axis aligned boxes of flat triangles are common enough in meshes for that ray to actually happen.
+	static glm::vec3 GetInverseDirection(const glm::vec3& direction)
+	{
+		glm::vec3 inverse;
+		for (int i = 0; i < 3; i++)
+			inverse[i] = 1.0f / (direction[i] != 0.0f ? direction[i] : 1e-30f);
+		return inverse;
+	}
+
+	// Slab test, returns the entry distance or FLT_MAX on a miss
+	float Intersect(const Ray& ray, const glm::vec3& inverseDirection, float maxDistance) const
+	{
+		glm::vec3 t0 = (BoundsMin - ray.Origin) * inverseDirection;
+		glm::vec3 t1 = (BoundsMax - ray.Origin) * inverseDirection;
+
+		glm::vec3 tmin = glm::min(t0, t1);
+		glm::vec3 tmax = glm::max(t0, t1);
+
+		float tnear = glm::max(glm::max(tmin.x, tmin.y), tmin.z);
+		float tfar = glm::min(glm::min(tmax.x, tmax.y), tmax.z);
+
+		if (tfar >= tnear && tfar > 0.0f && tnear < maxDistance)
+			return tnear;
+
+		return FLT_MAX;
+	}
+};
+
+// Binned surface area heuristic build over arbitrary primitive bounds, shared by every hierarchy in the renderer.
+// The result is a single node array where the right child of an interior node always lives directly after its left child.
+class BVHBuilder
+{
+public:
+	// Leaf costs are counted in blocks of leafBlockSize primitives, for leaf kernels that test several at once.
+	// primitiveIndices comes back in leaf order.
+	static void Build(const std::vector<AABB>& bounds, uint32_t leafBlockSize, std::vector<BVHNode>& nodes, std::vector<uint32_t>& primitiveIndices);
+
+	// Deepest a tree can get, traversal stacks of this size never overflow. Build enforces it
+	// by switching to median splits once the remaining primitives would not fit otherwise.
+	static constexpr int MaxDepth = 64;
+};
+
+// Checks a traversal stack push against MaxDepth in debug builds
+#ifdef WL_DEBUG
+	#define RT_BVH_STACK_CHECK(stackPointer) assert((stackPointer) < BVHBuilder::MaxDepth)
+#else
+	#define RT_BVH_STACK_CHECK(stackPointer)
+#endif
@@ -5,6 +5,7 @@
 #include <glm/gtx/quaternion.hpp>
 
 #include "Walnut/Input/Input.h"
+#include "Walnut/Profiler.h"
 
 using namespace Walnut;
 
@@ -102,6 +103,20 @@ void Camera::OnResize(uint32_t width, uint32_t height)
 	RecalculateRayDirections();
 }
 
+void Camera::SetPosition(const glm::vec3& position)
+{
+	m_Position = position;
+	RecalculateView();
+	RecalculateRayDirections();
+}
+
+void Camera::SetDirection(const glm::vec3& direction)
+{
+	m_ForwardDirection = glm::normalize(direction);
+	RecalculateView();
+	RecalculateRayDirections();
+}
+
 float Camera::GetRotationSpeed()
 {
 	return 0.3f;
@@ -119,8 +134,38 @@ void Camera::RecalculateView()
 	m_InverseView = glm::inverse(m_View);
 }
 
+void Camera::SetCacheRayDirections(bool enabled)
+{
+	if (enabled == m_CacheRayDirections)
+		return;
+
+	m_CacheRayDirections = enabled;
+	RecalculateRayDirections();
+}
+
 void Camera::RecalculateRayDirections()
 {
+	WL_PROFILE_ZONE("Camera Ray Regen");
+
+	// Unnormalized world space direction through normalized device coordinate (cx, cy)
+	auto direction = [this](float cx, float cy)
+	{
+		glm::vec4 target = m_InverseProjection * glm::vec4(cx, cy, 1, 1);
+		return glm::vec3(m_InverseView * glm::vec4(glm::vec3(target) / target.w, 0));
+	};
+
+	glm::vec3 origin = direction(-1.0f, -1.0f);
+	m_RayGenerator.Base = origin;
+	m_RayGenerator.DeltaX = (direction(1.0f, -1.0f) - origin) / (float)glm::max(m_ViewportWidth, 1u);
+	m_RayGenerator.DeltaY = (direction(-1.0f, 1.0f) - origin) / (float)glm::max(m_ViewportHeight, 1u);
+
+	if (!m_CacheRayDirections)
+	{
+		m_RayDirections.clear();
+		m_RayDirections.shrink_to_fit();
+		return;
+	}
+
 	m_RayDirections.resize(m_ViewportWidth * m_ViewportHeight);
 
 	for (uint32_t y = 0; y < m_ViewportHeight; y++)
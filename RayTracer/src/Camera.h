@@ -1,10 +1,31 @@
 #pragma once
 
 #include <glm/glm.hpp>
-#include <vector>
+
+#include "FrameArena.h"
 
 class Camera
 {
+public:
+	// Primary ray directions without a per pixel cache. The unnormalized direction is affine in the
+	// pixel coordinate (the inverse projection's w does not depend on x or y), so three vectors describe it.
+	struct RayGenerator
+	{
+		glm::vec3 Base{ 0.0f, 0.0f, -1.0f };
+		glm::vec3 DeltaX{ 0.0f };
+		glm::vec3 DeltaY{ 0.0f };
+
+		glm::vec3 GetDirection(uint32_t x, uint32_t y) const
+		{
+			return glm::normalize(Base + DeltaX * (float)x + DeltaY * (float)y);
+		}
+
+		// Fractional pixel coordinates, for renders whose pixels do not line up with the viewport's
+		glm::vec3 GetDirection(const glm::vec2& pixel) const
+		{
+			return glm::normalize(Base + DeltaX * pixel.x + DeltaY * pixel.y);
+		}
+	};
 public:
 	Camera(float verticalFOV, float nearClip, float farClip);
 
@@ -19,7 +40,25 @@ public:
 	const glm::vec3& GetPosition() const { return m_Position; }
 	const glm::vec3& GetDirection() const { return m_ForwardDirection; }
 
-	const std::vector<glm::vec3>& GetRayDirections() const { return m_RayDirections; }
+	// For cameras placed from code or a scene file rather than mouse input
+	void SetPosition(const glm::vec3& position);
+	void SetDirection(const glm::vec3& direction);
+
+	const RayGenerator& GetRayGenerator() const { return m_RayGenerator; }
+
+	// Per pixel direction cache, off by default. Costs width * height vec3s and a full
+	// recompute on every camera move, in exchange for a load instead of a normalize per primary ray.
+	void SetCacheRayDirections(bool enabled);
+	bool IsCachingRayDirections() const { return m_CacheRayDirections; }
+	// Empty unless caching is enabled
+	const FrameBuffer<glm::vec3>& GetRayDirections() const { return m_RayDirections; }
+
+	glm::vec3 GetRayDirection(uint32_t x, uint32_t y) const
+	{
+		if (!m_RayDirections.empty())
+			return m_RayDirections[x + y * m_ViewportWidth];
+		return m_RayGenerator.GetDirection(x, y);
+	}
 
 	float GetRotationSpeed();
 private:
@@ -39,8 +78,11 @@ private:
 	glm::vec3 m_Position{0.0f, 0.0f, 0.0f};
 	glm::vec3 m_ForwardDirection{0.0f, 0.0f, 0.0f};
 
+	RayGenerator m_RayGenerator;
+
 	// Cached ray directions
-	std::vector<glm::vec3> m_RayDirections;
+	FrameBuffer<glm::vec3> m_RayDirections;
+	bool m_CacheRayDirections = false;
 
 	glm::vec2 m_LastMousePosition{ 0.0f, 0.0f };
 
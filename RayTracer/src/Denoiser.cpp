@@ -0,0 +1,182 @@
+#include "Denoiser.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Utils {
+
+	// B3 spline, the a-trous kernel of Dammertz et al.
+	static constexpr float s_Kernel[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+	// Black albedo would divide by zero, the same clamp has to be used in both directions
+	static glm::vec3 GetModulation(const glm::vec3& albedo)
+	{
+		return glm::max(albedo, glm::vec3(0.01f));
+	}
+
+	static constexpr uint32_t s_RowsPerTask = 16;
+
+}
+
+void Denoiser::Resize(uint32_t width, uint32_t height)
+{
+	if (width == m_Width && height == m_Height)
+		return;
+
+	m_Width = width;
+	m_Height = height;
+
+	for (AccumulationBuffer& buffer : m_Buffers)
+		buffer.Resize(width, height);
+	m_Albedo.Resize(width, height);
+	m_Normal.Resize(width, height);
+	m_Depth.assign((size_t)width * height, -1.0f);
+}
+
+const AccumulationBuffer& Denoiser::Denoise(ThreadPool& threadPool, const Settings& settings)
+{
+	if (m_ExternalFilter && RunExternalFilter(threadPool))
+		return m_Buffers[1];
+
+	if (settings.Iterations == 0)
+		return m_Buffers[0];
+
+	uint32_t taskCount = (m_Height + Utils::s_RowsPerTask - 1) / Utils::s_RowsPerTask;
+
+	// Filter the lighting only, the albedo comes back in the last pass
+	threadPool.Dispatch(taskCount, [this](uint32_t taskIndex, uint32_t workerIndex)
+	{
+		uint32_t first = taskIndex * Utils::s_RowsPerTask * m_Width;
+		uint32_t last = glm::min((taskIndex + 1) * Utils::s_RowsPerTask, m_Height) * m_Width;
+		for (uint32_t i = first; i < last; i++)
+			m_Buffers[0].Set(i, m_Buffers[0].Get(i) / Utils::GetModulation(m_Albedo.Get(i)));
+	});
+
+	float colorSigma = settings.ColorSigma;
+	for (uint32_t iteration = 0; iteration < settings.Iterations; iteration++)
+	{
+		bool last = iteration + 1 == settings.Iterations;
+		FilterPass(threadPool, m_Buffers[iteration % 2], m_Buffers[(iteration + 1) % 2], 1u << iteration, colorSigma, settings, last);
+		colorSigma *= 0.5f;
+	}
+
+	return m_Buffers[settings.Iterations % 2];
+}
+
+void Denoiser::FilterPass(ThreadPool& threadPool, const AccumulationBuffer& source, AccumulationBuffer& destination, uint32_t step, float colorSigma, const Settings& settings, bool remodulate)
+{
+	uint32_t taskCount = (m_Height + Utils::s_RowsPerTask - 1) / Utils::s_RowsPerTask;
+	float inverseColorVariance = 1.0f / glm::max(colorSigma * colorSigma, 1e-6f);
+
+	threadPool.Dispatch(taskCount, [&](uint32_t taskIndex, uint32_t workerIndex)
+	{
+		int width = (int)m_Width;
+		int height = (int)m_Height;
+		int maxY = glm::min((int)((taskIndex + 1) * Utils::s_RowsPerTask), height);
+
+		for (int y = (int)(taskIndex * Utils::s_RowsPerTask); y < maxY; y++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				uint32_t index = (uint32_t)(x + y * width);
+				glm::vec3 color = source.Get(index);
+				glm::vec3 normal = m_Normal.Get(index);
+				float depth = m_Depth[index];
+
+				glm::vec3 sum(0.0f);
+				float weightSum = 0.0f;
+
+				for (int dy = -2; dy <= 2; dy++)
+				{
+					int sampleY = y + dy * (int)step;
+					if (sampleY < 0 || sampleY >= height)
+						continue;
+
+					for (int dx = -2; dx <= 2; dx++)
+					{
+						int sampleX = x + dx * (int)step;
+						if (sampleX < 0 || sampleX >= width)
+							continue;
+
+						uint32_t sampleIndex = (uint32_t)(sampleX + sampleY * width);
+						glm::vec3 sampleColor = source.Get(sampleIndex);
+						float sampleDepth = m_Depth[sampleIndex];
+
+						// Sky never blends with geometry
+						if ((depth < 0.0f) != (sampleDepth < 0.0f))
+							continue;
+
+						glm::vec3 colorDifference = sampleColor - color;
+						float weight = Utils::s_Kernel[dx + 2] * Utils::s_Kernel[dy + 2];
+						weight *= std::exp(-glm::dot(colorDifference, colorDifference) * inverseColorVariance);
+
+						if (depth >= 0.0f)
+						{
+							float cosine = glm::max(glm::dot(normal, m_Normal.Get(sampleIndex)), 0.0f);
+							weight *= std::pow(cosine, settings.NormalPower);
+
+							// Expected depth change grows with the step, a plane seen at an angle changes depth linearly
+							float depthScale = settings.DepthSigma * depth * (float)step;
+							weight *= std::exp(-glm::abs(sampleDepth - depth) / glm::max(depthScale, 1e-4f));
+						}
+
+						sum += sampleColor * weight;
+						weightSum += weight;
+					}
+				}
+
+				// The center tap always has weight, the sum is never zero
+				glm::vec3 result = sum / weightSum;
+				if (remodulate)
+					result *= Utils::GetModulation(m_Albedo.Get(index));
+
+				destination.Set(index, result);
+			}
+		}
+	});
+}
+
+bool Denoiser::RunExternalFilter(ThreadPool& threadPool)
+{
+	size_t valueCount = (size_t)m_Width * m_Height * 3;
+	m_InterleavedColor.resize(valueCount);
+	m_InterleavedAlbedo.resize(valueCount);
+	m_InterleavedNormal.resize(valueCount);
+	m_InterleavedOutput.resize(valueCount);
+
+	uint32_t taskCount = (m_Height + Utils::s_RowsPerTask - 1) / Utils::s_RowsPerTask;
+	auto forEachPixel = [this, &threadPool, taskCount](auto&& function)
+	{
+		threadPool.Dispatch(taskCount, [this, &function](uint32_t taskIndex, uint32_t workerIndex)
+		{
+			uint32_t first = taskIndex * Utils::s_RowsPerTask * m_Width;
+			uint32_t last = glm::min((taskIndex + 1) * Utils::s_RowsPerTask, m_Height) * m_Width;
+			for (uint32_t i = first; i < last; i++)
+				function(i);
+		});
+	};
+
+	forEachPixel([this](uint32_t i)
+	{
+		glm::vec3 color = m_Buffers[0].Get(i);
+		glm::vec3 albedo = m_Albedo.Get(i);
+		glm::vec3 normal = m_Normal.Get(i);
+		for (int channel = 0; channel < 3; channel++)
+		{
+			m_InterleavedColor[i * 3 + channel] = color[channel];
+			m_InterleavedAlbedo[i * 3 + channel] = albedo[channel];
+			m_InterleavedNormal[i * 3 + channel] = normal[channel];
+		}
+	});
+
+	if (!m_ExternalFilter(m_InterleavedColor.data(), m_InterleavedAlbedo.data(), m_InterleavedNormal.data(), m_InterleavedOutput.data(), m_Width, m_Height))
+		return false;
+
+	forEachPixel([this](uint32_t i)
+	{
+		const float* output = m_InterleavedOutput.data() + i * 3;
+		m_Buffers[1].Set(i, { output[0], output[1], output[2] });
+	});
+
+	return true;
+}
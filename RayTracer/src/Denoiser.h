@@ -0,0 +1,64 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <functional>
+
+#include "AccumulationBuffer.h"
+#include "FrameArena.h"
+#include "ThreadPool.h"
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) for presentable low sample count images.
+// Guided by the albedo, normal and depth of every pixel's first hit. Lighting is divided by the albedo
+// before filtering and multiplied back afterwards, so material edges stay sharp and only the noise blurs.
+class Denoiser
+{
+public:
+	struct Settings
+	{
+		// Every iteration doubles the filter's step, 4 reach 30 pixels out
+		uint32_t Iterations = 4;
+		// Edge stopping, larger values blur more across edges. Color is halved every iteration.
+		float ColorSigma = 0.6f;
+		// Exponent on the cosine between normals
+		float NormalPower = 64.0f;
+		// Relative to the pixel's own depth
+		float DepthSigma = 0.05f;
+	};
+
+	// Interleaved RGB float images of width * height pixels, the layout external denoisers such as OIDN expect.
+	// Color is already divided by the sample count. Returning false falls back to the built-in filter.
+	using ExternalFilter = std::function<bool(const float* color, const float* albedo, const float* normal, float* output, uint32_t width, uint32_t height)>;
+public:
+	void Resize(uint32_t width, uint32_t height);
+
+	// Written by the renderer for every traced pixel, depth is negative for pixels that see the sky
+	void SetGuides(uint32_t index, const glm::vec3& albedo, const glm::vec3& normal, float depth)
+	{
+		m_Albedo.Set(index, albedo);
+		m_Normal.Set(index, normal);
+		m_Depth[index] = depth;
+	}
+
+	// Noisy color divided by the sample count, filled in before every Denoise
+	AccumulationBuffer& GetInput() { return m_Buffers[0]; }
+
+	// Filters the input on the pool. The result is already divided by the sample count, resolve it with a scale of 1.
+	const AccumulationBuffer& Denoise(ThreadPool& threadPool, const Settings& settings);
+
+	void SetExternalFilter(ExternalFilter filter) { m_ExternalFilter = std::move(filter); }
+private:
+	void FilterPass(ThreadPool& threadPool, const AccumulationBuffer& source, AccumulationBuffer& destination, uint32_t step, float colorSigma, const Settings& settings, bool remodulate);
+	bool RunExternalFilter(ThreadPool& threadPool);
+private:
+	// Ping pong, the input is the first one
+	AccumulationBuffer m_Buffers[2];
+	AccumulationBuffer m_Albedo, m_Normal;
+	FrameBuffer<float> m_Depth;
+
+	ExternalFilter m_ExternalFilter;
+	// Interleaved copies for the external filter
+	FrameBuffer<float> m_InterleavedColor, m_InterleavedAlbedo, m_InterleavedNormal, m_InterleavedOutput;
+
+	uint32_t m_Width = 0, m_Height = 0;
+};
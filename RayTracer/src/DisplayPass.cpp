@@ -0,0 +1,281 @@
+#include "DisplayPass.h"
+
+#include "Walnut/Application.h"
+
+#include <glm/glm.hpp>
+
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace Utils {
+
+	static const char* DisplayShaderPath = "shaders/Display.comp.spv";
+
+	// Image reallocations free their set a few frames later, this covers a window being resized in steps
+	static constexpr uint32_t MaxDescriptorSets = 16;
+
+	// Mirror of the push constants in Display.comp
+	struct DisplayConstants
+	{
+		glm::vec2 InputSize;
+		// The input fills the corner of its allocation, texture coordinates are relative to the allocation
+		glm::vec2 InputAllocatedSize;
+		uint32_t OutputWidth;
+		uint32_t OutputHeight;
+		uint32_t ToneMapping;
+		uint32_t GammaCorrect;
+	};
+
+	static_assert(sizeof(DisplayConstants) == 32, "DisplayConstants must match the push constants in Display.comp");
+
+	static std::vector<uint32_t> ReadShaderBinary(const char* filepath)
+	{
+		std::ifstream stream(filepath, std::ios::binary | std::ios::ate);
+		if (!stream)
+			return {};
+
+		size_t size = (size_t)stream.tellg();
+		std::vector<uint32_t> code(size / sizeof(uint32_t));
+
+		stream.seekg(0);
+		stream.read((char*)code.data(), code.size() * sizeof(uint32_t));
+		return code;
+	}
+
+}
+
+DisplayPass::DisplayPass()
+{
+	CreatePipeline();
+}
+
+DisplayPass::~DisplayPass()
+{
+	// The pool takes its descriptor sets with it
+	Walnut::Application::SubmitResourceFree([pipeline = m_Pipeline, pipelineLayout = m_PipelineLayout,
+		descriptorPool = m_DescriptorPool, descriptorSetLayout = m_DescriptorSetLayout]()
+	{
+		VkDevice device = Walnut::Application::GetDevice();
+
+		vkDestroyPipeline(device, pipeline, nullptr);
+		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+		vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+	});
+}
+
+void DisplayPass::CreatePipeline()
+{
+	VkDevice device = Walnut::Application::GetDevice();
+
+	VkResult err;
+
+	std::vector<uint32_t> code = Utils::ReadShaderBinary(Utils::DisplayShaderPath);
+	if (code.empty())
+	{
+		std::cerr << "[DisplayPass] Could not load " << Utils::DisplayShaderPath << ", tone mapping stays on the CPU\n";
+		return;
+	}
+
+	// Descriptor set layout
+	{
+		VkDescriptorSetLayoutBinding bindings[2] = {};
+		bindings[0].binding = 0;
+		bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		bindings[1].binding = 1;
+		bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+
+		for (auto& binding : bindings)
+		{
+			binding.descriptorCount = 1;
+			binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		}
+
+		VkDescriptorSetLayoutCreateInfo info = {};
+		info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		info.bindingCount = 2;
+		info.pBindings = bindings;
+		err = vkCreateDescriptorSetLayout(device, &info, nullptr, &m_DescriptorSetLayout);
+		check_vk_result(err);
+	}
+
+	// Descriptor pool, sets are allocated per pair of image views
+	{
+		VkDescriptorPoolSize pool_sizes[] =
+		{
+			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, Utils::MaxDescriptorSets },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, Utils::MaxDescriptorSets }
+		};
+		VkDescriptorPoolCreateInfo pool_info = {};
+		pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+		pool_info.maxSets = Utils::MaxDescriptorSets;
+		pool_info.poolSizeCount = 2;
+		pool_info.pPoolSizes = pool_sizes;
+		err = vkCreateDescriptorPool(device, &pool_info, nullptr, &m_DescriptorPool);
+		check_vk_result(err);
+	}
+
+	// Pipeline
+	{
+		VkPushConstantRange push_constants = {};
+		push_constants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		push_constants.size = sizeof(Utils::DisplayConstants);
+
+		VkPipelineLayoutCreateInfo layout_info = {};
+		layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		layout_info.setLayoutCount = 1;
+		layout_info.pSetLayouts = &m_DescriptorSetLayout;
+		layout_info.pushConstantRangeCount = 1;
+		layout_info.pPushConstantRanges = &push_constants;
+		err = vkCreatePipelineLayout(device, &layout_info, nullptr, &m_PipelineLayout);
+		check_vk_result(err);
+
+		VkShaderModuleCreateInfo module_info = {};
+		module_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+		module_info.codeSize = code.size() * sizeof(uint32_t);
+		module_info.pCode = code.data();
+		VkShaderModule shaderModule;
+		err = vkCreateShaderModule(device, &module_info, nullptr, &shaderModule);
+		check_vk_result(err);
+
+		VkComputePipelineCreateInfo pipeline_info = {};
+		pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipeline_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipeline_info.stage.module = shaderModule;
+		pipeline_info.stage.pName = "main";
+		pipeline_info.layout = m_PipelineLayout;
+		err = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &m_Pipeline);
+		check_vk_result(err);
+
+		vkDestroyShaderModule(device, shaderModule, nullptr);
+	}
+}
+
+void DisplayPass::Render(const Walnut::Image& input, Walnut::Image& target, AccumulationBuffer::ToneMap toneMapping, bool gammaCorrect)
+{
+	uint32_t width = target.GetWidth();
+	uint32_t height = target.GetHeight();
+	if (width == 0 || height == 0 || input.GetWidth() == 0 || input.GetHeight() == 0)
+		return;
+
+	Utils::DisplayConstants constants;
+	constants.InputSize = { (float)input.GetWidth(), (float)input.GetHeight() };
+	constants.InputAllocatedSize = constants.InputSize / glm::vec2(input.GetUVScaleX(), input.GetUVScaleY());
+	constants.OutputWidth = width;
+	constants.OutputHeight = height;
+	constants.ToneMapping = (uint32_t)toneMapping;
+	constants.GammaCorrect = gammaCorrect ? 1 : 0;
+
+	VkDescriptorSet descriptorSet = GetDescriptorSet(input, target);
+
+	// Recorded behind the input's upload, which was queued the same way by EndStreamingWrite
+	Walnut::Application::SubmitFrameCommand([pipeline = m_Pipeline, pipelineLayout = m_PipelineLayout, descriptorSet,
+		inputImage = input.GetVulkanImage(), targetImage = target.GetVulkanImage(), constants](VkCommandBuffer command_buffer)
+	{
+		VkImageMemoryBarrier barriers[2] = {};
+
+		// The upload's own barrier only makes the copy visible to fragment shaders
+		VkImageMemoryBarrier& read_barrier = barriers[0];
+		read_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		read_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		read_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		read_barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		read_barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		read_barrier.image = inputImage;
+
+		// Every pixel gets overwritten, so the previous contents can be discarded
+		VkImageMemoryBarrier& write_barrier = barriers[1];
+		write_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		write_barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		write_barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		write_barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		write_barrier.image = targetImage;
+
+		for (VkImageMemoryBarrier& barrier : barriers)
+		{
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			barrier.subresourceRange.levelCount = 1;
+			barrier.subresourceRange.layerCount = 1;
+		}
+		vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 0, NULL, 0, NULL, 2, barriers);
+
+		vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+		vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+		vkCmdPushConstants(command_buffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+		vkCmdDispatch(command_buffer, (constants.OutputWidth + 7) / 8, (constants.OutputHeight + 7) / 8, 1);
+
+		VkImageMemoryBarrier use_barrier = {};
+		use_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		use_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		use_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		use_barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+		use_barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		use_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		use_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		use_barrier.image = targetImage;
+		use_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		use_barrier.subresourceRange.levelCount = 1;
+		use_barrier.subresourceRange.layerCount = 1;
+		vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &use_barrier);
+	});
+}
+
+VkDescriptorSet DisplayPass::GetDescriptorSet(const Walnut::Image& input, const Walnut::Image& target)
+{
+	if (m_DescriptorSet && input.GetImageView() == m_BoundInputView && target.GetImageView() == m_BoundTargetView)
+		return m_DescriptorSet;
+
+	VkDevice device = Walnut::Application::GetDevice();
+
+	if (m_DescriptorSet)
+	{
+		Walnut::Application::SubmitResourceFree([descriptorPool = m_DescriptorPool, descriptorSet = m_DescriptorSet]()
+		{
+			vkFreeDescriptorSets(Walnut::Application::GetDevice(), descriptorPool, 1, &descriptorSet);
+		});
+	}
+
+	VkDescriptorSetAllocateInfo alloc_info = {};
+	alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	alloc_info.descriptorPool = m_DescriptorPool;
+	alloc_info.descriptorSetCount = 1;
+	alloc_info.pSetLayouts = &m_DescriptorSetLayout;
+	VkResult err = vkAllocateDescriptorSets(device, &alloc_info, &m_DescriptorSet);
+	check_vk_result(err);
+
+	VkDescriptorImageInfo input_info = {};
+	input_info.sampler = input.GetSampler();
+	input_info.imageView = input.GetImageView();
+	input_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	VkDescriptorImageInfo target_info = {};
+	target_info.imageView = target.GetImageView();
+	target_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	VkWriteDescriptorSet writes[2] = {};
+	writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writes[0].dstSet = m_DescriptorSet;
+	writes[0].dstBinding = 0;
+	writes[0].descriptorCount = 1;
+	writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	writes[0].pImageInfo = &input_info;
+
+	writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writes[1].dstSet = m_DescriptorSet;
+	writes[1].dstBinding = 1;
+	writes[1].descriptorCount = 1;
+	writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	writes[1].pImageInfo = &target_info;
+
+	vkUpdateDescriptorSets(device, 2, writes, 0, nullptr);
+
+	m_BoundInputView = input.GetImageView();
+	m_BoundTargetView = target.GetImageView();
+	return m_DescriptorSet;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Walnut/Image.h"
+
+#include "vulkan/vulkan.h"
+
+#include "AccumulationBuffer.h"
+
+// Tone maps the CPU renderer's RGBA16F image into the RGBA8 image ImGui shows, as a compute shader
+// (shaders/Display.comp) recorded into Walnut's frame command buffer after the upload of the HDR image.
+// The HDR image stays at the internal resolution, the shader filters it up to the viewport, so dynamic
+// resolution interpolates radiance rather than display values.
+class DisplayPass
+{
+public:
+	DisplayPass();
+	~DisplayPass();
+
+	DisplayPass(const DisplayPass&) = delete;
+	DisplayPass& operator=(const DisplayPass&) = delete;
+
+	// False when the compute shader could not be loaded, the renderer then resolves to RGBA8 on the CPU
+	bool IsAvailable() const { return m_Pipeline != nullptr; }
+
+	// Input must be RGBA16F and target Walnut::ImageUsage::Storage. Call after the input's EndStreamingWrite, so the copy into it comes first.
+	void Render(const Walnut::Image& input, Walnut::Image& target, AccumulationBuffer::ToneMap toneMapping, bool gammaCorrect);
+private:
+	void CreatePipeline();
+	// A new set whenever an image was reallocated, frames in flight may still use the old one
+	VkDescriptorSet GetDescriptorSet(const Walnut::Image& input, const Walnut::Image& target);
+private:
+	VkDescriptorSetLayout m_DescriptorSetLayout = nullptr;
+	VkDescriptorPool m_DescriptorPool = nullptr;
+	VkPipelineLayout m_PipelineLayout = nullptr;
+	VkPipeline m_Pipeline = nullptr;
+
+	VkDescriptorSet m_DescriptorSet = nullptr;
+	VkImageView m_BoundInputView = nullptr;
+	VkImageView m_BoundTargetView = nullptr;
+};
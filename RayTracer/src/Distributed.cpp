@@ -0,0 +1,468 @@
+#include "Distributed.h"
+
+#include "Walnut/Timer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "AccumulationBuffer.h"
+#include "Camera.h"
+#include "FrameArena.h"
+#include "ImageWriter.h"
+#include "MappedFile.h"
+#include "Renderer.h"
+#include "SceneCache.h"
+#include "SceneSerializer.h"
+#include "Socket.h"
+
+namespace Utils {
+
+	// Reads differently on a node with the other byte order, which then fails the handshake
+	static constexpr uint32_t ProtocolMagic = 0x52544452; // RTDR
+	// Bump whenever a message layout changes
+	static constexpr uint32_t ProtocolVersion = 3;
+
+	static constexpr uint32_t NoUnit = ~0u;
+	// A range this much slower than the average is handed out again
+	static constexpr float StragglerFactor = 1.5f;
+
+	// The scene size comes off the wire, anything above this is a corrupt or hostile header
+	static constexpr uint64_t MaxSceneSize = 16ull << 30;
+	// The scene goes to disk in pieces of this size, the worker never holds all of it in memory
+	static constexpr size_t SceneChunkSize = 4 << 20;
+
+	enum class MessageType : uint32_t
+	{
+		// Worker to coordinator, once after connecting
+		Hello = 1,
+		// Coordinator to worker, once: JobMessage, then the .rtscene file
+		Job,
+		// Coordinator to worker: render this range
+		Assignment,
+		// Worker to coordinator: ResultMessage, then the red, green and blue planes
+		Result,
+		// Coordinator to worker: nothing left, disconnect
+		Finish
+	};
+
+	// Precedes every message, Size counts the bytes after it
+	struct MessageHeader
+	{
+		MessageType Type;
+		uint32_t Padding = 0;
+		uint64_t Size = 0;
+	};
+
+	struct HelloMessage
+	{
+		uint32_t Magic = ProtocolMagic;
+		uint32_t Version = ProtocolVersion;
+		uint32_t ThreadCount = 0;
+		uint32_t Padding = 0;
+	};
+
+	struct JobMessage
+	{
+		// Random, names the workers' copies of the scene
+		uint64_t JobID;
+		uint32_t Width, Height;
+		uint32_t MaxDepth;
+		uint32_t LightSampling;
+		uint32_t SamplerType;
+		uint32_t Padding = 0;
+	};
+
+	struct AssignmentMessage
+	{
+		uint32_t Unit;
+		uint32_t FirstSample, SampleCount;
+		uint32_t Padding = 0;
+	};
+
+	struct ResultMessage
+	{
+		uint32_t Unit;
+		uint32_t SampleCount;
+		uint32_t Width, Height;
+	};
+
+	struct WorkUnit
+	{
+		uint32_t FirstSample, SampleCount;
+		// Workers rendering it right now, more than one once it straggled
+		uint32_t Assigned = 0;
+		float AssignedAt = 0.0f;
+		bool Done = false;
+	};
+
+	struct CoordinatorState
+	{
+		std::mutex Mutex;
+		std::condition_variable Condition;
+
+		std::vector<WorkUnit> Units;
+		uint32_t DoneUnits = 0;
+		// Seconds, for the straggler threshold
+		float DoneUnitTime = 0.0f;
+		Walnut::Timer Timer;
+
+		// Sums of every finished range, divided by MergedSamples when written
+		AccumulationBuffer Merged;
+		uint32_t MergedSamples = 0;
+	};
+
+	static bool SendMessage(Socket& socket, MessageType type, const void* payload, size_t size, const void* data = nullptr, size_t dataSize = 0)
+	{
+		MessageHeader header{ type, 0, size + dataSize };
+		return socket.Send(&header, sizeof(header)) && socket.Send(payload, size) && socket.Send(data, dataSize);
+	}
+
+	template<typename T>
+	static bool ReceiveMessage(Socket& socket, MessageType type, T& message, uint64_t& dataSize)
+	{
+		MessageHeader header;
+		if (!socket.Receive(&header, sizeof(header)) || header.Type != type || header.Size < sizeof(T))
+			return false;
+
+		dataSize = header.Size - sizeof(T);
+		return socket.Receive(&message, sizeof(T));
+	}
+
+	// Waits until there is a range for an idle worker, NoUnit once every range is done
+	static uint32_t NextUnit(CoordinatorState& state, std::unique_lock<std::mutex>& lock)
+	{
+		while (state.DoneUnits < (uint32_t)state.Units.size())
+		{
+			float now = state.Timer.Elapsed();
+
+			uint32_t straggler = NoUnit;
+			for (uint32_t i = 0; i < (uint32_t)state.Units.size(); i++)
+			{
+				WorkUnit& unit = state.Units[i];
+				if (unit.Done)
+					continue;
+
+				if (unit.Assigned == 0)
+				{
+					unit.Assigned++;
+					unit.AssignedAt = now;
+					return i;
+				}
+
+				if (straggler == NoUnit || unit.AssignedAt < state.Units[straggler].AssignedAt)
+					straggler = i;
+			}
+
+			// Nothing fresh left, the oldest range gets a second worker once it is clearly late
+			if (straggler != NoUnit && state.DoneUnits > 0)
+			{
+				float averageTime = state.DoneUnitTime / (float)state.DoneUnits;
+				WorkUnit& unit = state.Units[straggler];
+				if (now - unit.AssignedAt > averageTime * StragglerFactor)
+				{
+					unit.Assigned++;
+					// Counts from now, so the next idle worker does not pile onto the same range
+					unit.AssignedAt = now;
+					return straggler;
+				}
+			}
+
+			state.Condition.wait_for(lock, std::chrono::milliseconds(100));
+		}
+
+		return NoUnit;
+	}
+
+	static void ServeWorker(Socket& connection, uint32_t workerIndex, CoordinatorState& state, const JobMessage& job, const MappedFile& sceneFile)
+	{
+		HelloMessage hello;
+		uint64_t dataSize = 0;
+		if (!ReceiveMessage(connection, MessageType::Hello, hello, dataSize) || hello.Magic != ProtocolMagic || hello.Version != ProtocolVersion || dataSize != 0)
+		{
+			std::cerr << "[Coordinator] Worker " << workerIndex << " does not speak this protocol version or byte order\n";
+			return;
+		}
+
+		if (!SendMessage(connection, MessageType::Job, &job, sizeof(job), sceneFile.GetData(), sceneFile.GetSize()))
+		{
+			std::cerr << "[Coordinator] Lost worker " << workerIndex << " while sending the scene\n";
+			return;
+		}
+
+		std::cout << "[Coordinator] Worker " << workerIndex << " joined with " << hello.ThreadCount << " threads\n";
+
+		size_t pixelCount = (size_t)job.Width * job.Height;
+		FrameBuffer<float> planes;
+		planes.resize(pixelCount * 3);
+
+		std::unique_lock<std::mutex> lock(state.Mutex);
+		while (true)
+		{
+			uint32_t unitIndex = NextUnit(state, lock);
+			if (unitIndex == NoUnit)
+			{
+				lock.unlock();
+				SendMessage(connection, MessageType::Finish, nullptr, 0);
+				return;
+			}
+
+			AssignmentMessage assignment{ unitIndex, state.Units[unitIndex].FirstSample, state.Units[unitIndex].SampleCount };
+			float assignedAt = state.Timer.Elapsed();
+			lock.unlock();
+
+			ResultMessage result;
+			bool received = SendMessage(connection, MessageType::Assignment, &assignment, sizeof(assignment))
+				&& ReceiveMessage(connection, MessageType::Result, result, dataSize)
+				&& result.Unit == unitIndex && result.Width == job.Width && result.Height == job.Height
+				&& dataSize == planes.size() * sizeof(float)
+				&& connection.Receive(planes.data(), dataSize);
+
+			lock.lock();
+			WorkUnit& unit = state.Units[unitIndex];
+			unit.Assigned--;
+
+			if (!received)
+			{
+				// Back into the queue unless another worker already has it
+				if (!unit.Done)
+					std::cerr << "[Coordinator] Lost worker " << workerIndex << ", samples " << unit.FirstSample << " to "
+						<< unit.FirstSample + unit.SampleCount << " go back into the queue\n";
+				state.Condition.notify_all();
+				return;
+			}
+
+			// A straggler that finished after all is simply late
+			if (unit.Done)
+				continue;
+
+			const float* red = planes.data();
+			const float* green = red + pixelCount;
+			const float* blue = green + pixelCount;
+			for (uint32_t i = 0; i < (uint32_t)pixelCount; i++)
+				state.Merged.Set(i, state.Merged.Get(i) + glm::vec3(red[i], green[i], blue[i]));
+
+			unit.Done = true;
+			state.DoneUnits++;
+			state.DoneUnitTime += state.Timer.Elapsed() - assignedAt;
+			state.MergedSamples += result.SampleCount;
+			state.Condition.notify_all();
+
+			std::cout << "[Coordinator] " << state.MergedSamples << " spp, " << state.Timer.Elapsed() << "s\n";
+		}
+	}
+
+	// Image settings come from the job so every worker traces the samples the same way
+	static void SetupRenderer(const HeadlessOptions& options, const JobMessage& job, Renderer& renderer)
+	{
+		Renderer::Settings& settings = renderer.GetSettings();
+		settings.Accumulate = true;
+		settings.Backend = Renderer::RenderBackend::CPU;
+		settings.ThreadCount = options.ThreadCount;
+		settings.TileSize = options.TileSize;
+		settings.MaxDepth = job.MaxDepth;
+		settings.LightSampling = job.LightSampling != 0;
+		settings.SamplerType = (Sampler::Type)job.SamplerType;
+	}
+
+}
+
+int Distributed::RunCoordinator(const HeadlessOptions& options)
+{
+	Scene scene;
+	CameraDescription cameraDescription;
+	if (!SceneSerializer::Deserialize(options.ScenePath, scene, cameraDescription))
+		return 1;
+
+	// Workers get the scene as a cache, written first unless it already is one
+	std::string cachePath = options.ScenePath;
+	bool temporaryCache = false;
+	if (!SceneCache::IsCacheFile(cachePath))
+	{
+		temporaryCache = options.CachePath.empty();
+		std::string cacheName = "RayTracer-coordinator-" + std::to_string(options.ListenPort) + ".rtscene";
+		cachePath = temporaryCache ? (std::filesystem::temp_directory_path() / cacheName).string() : options.CachePath;
+		if (!SceneCache::Write(cachePath, scene, cameraDescription))
+			return 1;
+	}
+
+	int exitCode = 1;
+	{
+		MappedFile sceneFile;
+		Socket listener = Socket::Listen((uint16_t)options.ListenPort);
+		if (sceneFile.Open(cachePath) && listener.IsValid())
+		{
+			std::random_device random;
+			Utils::JobMessage job{ ((uint64_t)random() << 32) | random(), options.Width, options.Height, options.MaxDepth, options.LightSampling ? 1u : 0u, (uint32_t)options.SamplerType };
+
+			Utils::CoordinatorState state;
+			state.Merged.Resize(options.Width, options.Height);
+			for (uint32_t first = 0; first < options.SampleCount; first += options.BatchSize)
+				state.Units.push_back({ first, std::min(options.BatchSize, options.SampleCount - first) });
+
+			std::cout << "[Coordinator] " << state.Units.size() << " ranges of " << options.BatchSize << " spp, waiting for workers on port " << options.ListenPort << "\n";
+
+			// Stable addresses, the worker threads hold on to their socket
+			std::vector<std::unique_ptr<Socket>> connections;
+			std::vector<std::thread> threads;
+
+			while (true)
+			{
+				{
+					std::lock_guard<std::mutex> lock(state.Mutex);
+					if (state.DoneUnits == (uint32_t)state.Units.size())
+						break;
+				}
+
+				Socket connection = listener.Accept(100);
+				if (!connection.IsValid())
+					continue;
+
+				Socket& socket = *connections.emplace_back(std::make_unique<Socket>(std::move(connection)));
+				uint32_t workerIndex = (uint32_t)threads.size();
+				threads.emplace_back([&socket, workerIndex, &state, &job, &sceneFile]()
+				{
+					Utils::ServeWorker(socket, workerIndex, state, job, sceneFile);
+					socket.Shutdown();
+				});
+			}
+
+			// Late stragglers are still rendering, their results are not needed anymore
+			for (auto& connection : connections)
+				connection->Shutdown();
+			for (std::thread& thread : threads)
+				thread.join();
+
+			std::cout << "[Coordinator] " << state.MergedSamples << " spp from " << threads.size() << " workers in " << state.Timer.Elapsed() << "s, writing " << options.OutputPath << "\n";
+			if (ImageWriter::Write(options.OutputPath, state.Merged, 1.0f / (float)state.MergedSamples, options.EXR))
+				exitCode = 0;
+		}
+	}
+
+	if (temporaryCache)
+		std::remove(cachePath.c_str());
+
+	return exitCode;
+}
+
+int Distributed::RunWorker(const HeadlessOptions& options)
+{
+	Socket connection = Socket::Connect(options.CoordinatorAddress);
+	if (!connection.IsValid())
+		return 1;
+
+	Utils::HelloMessage hello;
+	hello.ThreadCount = options.ThreadCount > 0 ? options.ThreadCount : std::thread::hardware_concurrency();
+
+	Utils::JobMessage job;
+	uint64_t sceneSize = 0;
+	if (!Utils::SendMessage(connection, Utils::MessageType::Hello, &hello, sizeof(hello))
+		|| !Utils::ReceiveMessage(connection, Utils::MessageType::Job, job, sceneSize))
+	{
+		std::cerr << "[Worker] The coordinator at " << options.CoordinatorAddress << " closed the connection before sending a job\n";
+		return 1;
+	}
+
+	// Mapped while rendering, so it has to live in a file
+	// Job and worker, several workers can share a machine and its temporary directory
+	std::string sceneName = "RayTracer-" + std::to_string(job.JobID) + "-" + std::to_string(std::random_device()()) + ".rtscene";
+	std::string scenePath = (std::filesystem::temp_directory_path() / sceneName).string();
+	if (sceneSize > Utils::MaxSceneSize)
+	{
+		std::cerr << "[Worker] The coordinator announced a " << sceneSize << " byte scene, more than the " << Utils::MaxSceneSize << " accepted\n";
+		return 1;
+	}
+
+	{
+		std::ofstream stream(scenePath, std::ios::binary);
+		std::vector<char> chunk((size_t)std::min<uint64_t>(sceneSize, Utils::SceneChunkSize));
+		for (uint64_t received = 0; received < sceneSize; )
+		{
+			size_t size = (size_t)std::min<uint64_t>(sceneSize - received, chunk.size());
+			if (!connection.Receive(chunk.data(), size))
+			{
+				std::cerr << "[Worker] Lost the coordinator while receiving the scene\n";
+				stream.close();
+				std::remove(scenePath.c_str());
+				return 1;
+			}
+
+			stream.write(chunk.data(), (std::streamsize)size);
+			received += size;
+		}
+
+		if (!stream.good())
+		{
+			std::cerr << "[Worker] Could not write " << scenePath << "\n";
+			stream.close();
+			std::remove(scenePath.c_str());
+			return 1;
+		}
+	}
+
+	int exitCode = 1;
+	{
+		Scene scene;
+		CameraDescription cameraDescription;
+		if (SceneCache::Load(scenePath, scene, cameraDescription))
+		{
+			Camera camera(cameraDescription.VerticalFOV, 0.1f, 100.0f);
+			camera.OnResize(job.Width, job.Height);
+			camera.SetPosition(cameraDescription.Position);
+			camera.SetDirection(cameraDescription.Direction);
+
+			Renderer renderer;
+			Utils::SetupRenderer(options, job, renderer);
+			renderer.OnResize(job.Width, job.Height);
+
+			std::cout << "[Worker] Rendering job " << job.JobID << " at " << job.Width << "x" << job.Height << "\n";
+
+			size_t pixelCount = (size_t)job.Width * job.Height;
+			while (true)
+			{
+				Utils::AssignmentMessage assignment;
+				uint64_t dataSize = 0;
+				if (!Utils::ReceiveMessage(connection, Utils::MessageType::Assignment, assignment, dataSize))
+				{
+					// A Finish, or the coordinator hung up because it had everything it needed
+					exitCode = 0;
+					break;
+				}
+
+				renderer.GetSettings().SampleOffset = assignment.FirstSample;
+				renderer.ResetFrameIndex();
+				for (uint32_t sample = 0; sample < assignment.SampleCount; sample++)
+					renderer.RenderFrame(scene, camera, nullptr);
+
+				const AccumulationBuffer& accumulation = renderer.GetAccumulationBuffer();
+				Utils::ResultMessage result{ assignment.Unit, renderer.GetSampleCount(), job.Width, job.Height };
+				size_t planeSize = pixelCount * sizeof(float);
+				Utils::MessageHeader header{ Utils::MessageType::Result, 0, sizeof(result) + planeSize * 3 };
+
+				bool sent = connection.Send(&header, sizeof(header)) && connection.Send(&result, sizeof(result))
+					&& connection.Send(accumulation.GetRed(), planeSize)
+					&& connection.Send(accumulation.GetGreen(), planeSize)
+					&& connection.Send(accumulation.GetBlue(), planeSize);
+				if (!sent)
+				{
+					exitCode = 0;
+					break;
+				}
+
+				std::cout << "[Worker] Samples " << assignment.FirstSample << " to " << assignment.FirstSample + assignment.SampleCount << " done\n";
+			}
+		}
+	}
+
+	std::remove(scenePath.c_str());
+	return exitCode;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "Headless.h"
+
+// One headless render spread over several machines. The coordinator sends every worker the scene once, as a
+// .rtscene cache, then hands out ranges of samples of the whole image. Workers trace their range with all their
+// cores and send back the accumulated sums, which the coordinator adds up and divides by the total sample count.
+// Sample indices are global, so the result matches a single machine rendering every sample.
+//
+// Ranges still out when the queue runs dry go to idle workers again once they take clearly longer than the average,
+// the first result wins. The ranges of workers that disconnect go back into the queue. Workers may join at any time.
+//
+//   RayTracer --headless --scene scene.json --spp 4096 --size 3840x2160 --listen 7878
+//   RayTracer --headless --connect coordinator:7878        (on every render node)
+//
+// Native byte order and struct layout like the scene cache, every node must share the coordinator's architecture.
+class Distributed
+{
+public:
+	// Both return the process exit code
+	static int RunCoordinator(const HeadlessOptions& options);
+	static int RunWorker(const HeadlessOptions& options);
+};
@@ -0,0 +1,118 @@
+#include "FrameArena.h"
+
+#include "Walnut/Profiler.h"
+
+#include <atomic>
+#include <new>
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+#endif
+
+namespace Utils {
+
+	static constexpr size_t HugePageSize = 2 * 1024 * 1024;
+
+	static std::atomic<bool> s_HugePages{ false };
+	static std::atomic<size_t> s_ReservedBytes{ 0 };
+	static std::atomic<uint64_t> s_Allocations{ 0 };
+
+	static size_t RoundUp(size_t size, size_t alignment)
+	{
+		return (size + alignment - 1) / alignment * alignment;
+	}
+
+	// Null if the OS has no huge pages for us, the caller falls back to the heap
+	static void* MapHugePages(size_t size)
+	{
+#ifdef _WIN32
+		size_t largePageSize = GetLargePageMinimum();
+		if (largePageSize == 0 || size % largePageSize != 0)
+			return nullptr;
+
+		// Fails without the privilege, every time, so there is nothing worth reporting
+		return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+#else
+		void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (data == MAP_FAILED)
+			return nullptr;
+
+	#ifdef MADV_HUGEPAGE
+		// Only advice, the kernel backs what it can with huge pages and the rest with normal ones
+		madvise(data, size, MADV_HUGEPAGE);
+	#endif
+		return data;
+#endif
+	}
+
+	static void UnmapHugePages(void* data, size_t size)
+	{
+#ifdef _WIN32
+		VirtualFree(data, 0, MEM_RELEASE);
+#else
+		munmap(data, size);
+#endif
+	}
+
+}
+
+FrameArena::Allocation FrameArena::Allocate(size_t size)
+{
+	WL_PROFILE_COUNT("Frame Buffer Allocations", 1);
+
+	Allocation allocation;
+
+	// Below a huge page the rounding would waste more than the TLB saves
+	if (Utils::s_HugePages.load(std::memory_order_relaxed) && size >= Utils::HugePageSize)
+	{
+		size_t mappedSize = Utils::RoundUp(size, Utils::HugePageSize);
+		allocation.Data = Utils::MapHugePages(mappedSize);
+		if (allocation.Data)
+		{
+			allocation.Size = mappedSize;
+			allocation.Mapped = true;
+		}
+	}
+
+	if (!allocation.Data)
+	{
+		allocation.Size = Utils::RoundUp(size, Alignment);
+		allocation.Data = ::operator new(allocation.Size, std::align_val_t(Alignment));
+	}
+
+	Utils::s_ReservedBytes.fetch_add(allocation.Size, std::memory_order_relaxed);
+	Utils::s_Allocations.fetch_add(1, std::memory_order_relaxed);
+	return allocation;
+}
+
+void FrameArena::Free(const Allocation& allocation)
+{
+	if (!allocation.Data)
+		return;
+
+	if (allocation.Mapped)
+		Utils::UnmapHugePages(allocation.Data, allocation.Size);
+	else
+		::operator delete(allocation.Data, std::align_val_t(Alignment));
+
+	Utils::s_ReservedBytes.fetch_sub(allocation.Size, std::memory_order_relaxed);
+}
+
+void FrameArena::SetHugePages(bool enabled)
+{
+	Utils::s_HugePages.store(enabled, std::memory_order_relaxed);
+}
+
+bool FrameArena::IsUsingHugePages()
+{
+	return Utils::s_HugePages.load(std::memory_order_relaxed);
+}
+
+FrameArena::Stats FrameArena::GetStats()
+{
+	return { Utils::s_ReservedBytes.load(std::memory_order_relaxed), Utils::s_Allocations.load(std::memory_order_relaxed) };
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+// Memory for buffers that follow the viewport size: accumulation planes, cached ray directions, resolved pixels.
+// Aligned to a cache line, which covers every SIMD load the kernels do. With huge pages on, large allocations
+// are mapped on 2 MB pages where the OS allows it, a 4K float plane then needs a handful of TLB entries instead of thousands.
+class FrameArena
+{
+public:
+	static constexpr size_t Alignment = 64;
+
+	struct Allocation
+	{
+		void* Data = nullptr;
+		// Usable size, at least what was asked for
+		size_t Size = 0;
+		// Mapped from the OS on huge pages rather than taken from the heap
+		bool Mapped = false;
+	};
+
+	struct Stats
+	{
+		// Held by every frame buffer right now
+		size_t ReservedBytes;
+		// Since startup, resizes that reuse capacity do not add to it
+		uint64_t Allocations;
+	};
+public:
+	static Allocation Allocate(size_t size);
+	static void Free(const Allocation& allocation);
+
+	// Only affects later allocations. Transparent huge pages on Linux, large pages on Windows,
+	// which need the SeLockMemoryPrivilege. Without them allocations quietly fall back to the heap.
+	static void SetHugePages(bool enabled);
+	static bool IsUsingHugePages();
+
+	static Stats GetStats();
+};
+
+// std::vector for per pixel data that never gives memory back: shrinking keeps the capacity and growing adds
+// half again at once, so a buffer following an interactively resized viewport stops allocating after a few steps.
+// Named like the std container it stands in for.
+template<typename T>
+class FrameBuffer
+{
+	static_assert(std::is_trivially_copyable_v<T>, "Frame buffers move their elements with memcpy");
+public:
+	FrameBuffer() = default;
+	FrameBuffer(const FrameBuffer& other) { *this = other; }
+	FrameBuffer(FrameBuffer&& other) noexcept { Swap(other); }
+	~FrameBuffer() { FrameArena::Free(m_Allocation); }
+
+	// Reuses this buffer's capacity, so copying a camera every frame does not allocate either
+	FrameBuffer& operator=(const FrameBuffer& other)
+	{
+		if (this == &other)
+			return *this;
+
+		m_Size = 0;
+		Grow(other.m_Size);
+		if (other.m_Size > 0)
+			memcpy(m_Data, other.m_Data, other.m_Size * sizeof(T));
+		m_Size = other.m_Size;
+		return *this;
+	}
+
+	FrameBuffer& operator=(FrameBuffer&& other) noexcept
+	{
+		Swap(other);
+		return *this;
+	}
+
+	// New elements are value initialized, like std::vector
+	void resize(size_t count)
+	{
+		Grow(count);
+		for (size_t i = m_Size; i < count; i++)
+			m_Data[i] = T();
+		m_Size = count;
+	}
+
+	void assign(size_t count, const T& value)
+	{
+		// Nothing worth keeping, growth can skip the copy
+		m_Size = 0;
+		Grow(count);
+		for (size_t i = 0; i < count; i++)
+			m_Data[i] = value;
+		m_Size = count;
+	}
+
+	void reserve(size_t count) { Grow(count); }
+	void clear() { m_Size = 0; }
+
+	// The only way to give memory back
+	void shrink_to_fit()
+	{
+		if (m_Size == m_Capacity)
+			return;
+
+		FrameBuffer shrunk;
+		if (m_Size > 0)
+		{
+			shrunk.Reallocate(m_Size);
+			memcpy(shrunk.m_Data, m_Data, m_Size * sizeof(T));
+			shrunk.m_Size = m_Size;
+		}
+		Swap(shrunk);
+	}
+
+	T* data() { return m_Data; }
+	const T* data() const { return m_Data; }
+	size_t size() const { return m_Size; }
+	size_t capacity() const { return m_Capacity; }
+	bool empty() const { return m_Size == 0; }
+
+	T& operator[](size_t index) { return m_Data[index]; }
+	const T& operator[](size_t index) const { return m_Data[index]; }
+
+	T* begin() { return m_Data; }
+	T* end() { return m_Data + m_Size; }
+	const T* begin() const { return m_Data; }
+	const T* end() const { return m_Data + m_Size; }
+private:
+	// Keeps the first m_Size elements
+	void Grow(size_t count)
+	{
+		if (count <= m_Capacity)
+			return;
+
+		size_t capacity = m_Capacity + m_Capacity / 2;
+		Reallocate(count > capacity ? count : capacity);
+	}
+
+	void Reallocate(size_t count)
+	{
+		FrameArena::Allocation allocation = FrameArena::Allocate(count * sizeof(T));
+		if (m_Size > 0)
+			memcpy(allocation.Data, m_Data, m_Size * sizeof(T));
+
+		FrameArena::Free(m_Allocation);
+		m_Allocation = allocation;
+		m_Data = (T*)allocation.Data;
+		// Whatever the allocation rounded up to is capacity too
+		m_Capacity = allocation.Size / sizeof(T);
+	}
+
+	void Swap(FrameBuffer& other)
+	{
+		std::swap(m_Allocation, other.m_Allocation);
+		std::swap(m_Data, other.m_Data);
+		std::swap(m_Size, other.m_Size);
+		std::swap(m_Capacity, other.m_Capacity);
+	}
+private:
+	FrameArena::Allocation m_Allocation;
+	T* m_Data = nullptr;
+	size_t m_Size = 0, m_Capacity = 0;
+};
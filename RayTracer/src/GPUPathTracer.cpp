@@ -0,0 +1,486 @@
+#include "GPUPathTracer.h"
+
+#include "Walnut/Application.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace Utils {
+
+	static const char* PathTraceShaderPath = "shaders/PathTrace.comp.spv";
+
+	// Buffer and image reallocations free their set a few frames later, this covers a window being resized in steps
+	static constexpr uint32_t MaxDescriptorSets = 16;
+
+	// Mirror of the uniform block in PathTrace.comp (std140)
+	struct GPUFrameData
+	{
+		glm::mat4 InverseProjection;
+		glm::mat4 InverseView;
+		glm::vec4 CameraPosition;
+		uint32_t FrameIndex;
+		uint32_t Width;
+		uint32_t Height;
+		uint32_t NodeCount;
+		uint32_t MaxDepth;
+		uint32_t RussianRouletteDepth;
+		uint32_t Padding[2];
+	};
+
+	static_assert(sizeof(BVHNode) == 32, "BVHNode must match the std430 layout in PathTrace.comp");
+	static_assert(sizeof(GPUPathTracer::GPUSphere) == 32, "GPUSphere must match the std430 layout in PathTrace.comp");
+	static_assert(sizeof(GPUPathTracer::GPUMaterial) == 32, "GPUMaterial must match the std430 layout in PathTrace.comp");
+
+	static uint32_t GetVulkanMemoryType(VkMemoryPropertyFlags properties, uint32_t type_bits)
+	{
+		VkPhysicalDeviceMemoryProperties prop;
+		vkGetPhysicalDeviceMemoryProperties(Walnut::Application::GetPhysicalDevice(), &prop);
+		for (uint32_t i = 0; i < prop.memoryTypeCount; i++)
+		{
+			if ((prop.memoryTypes[i].propertyFlags & properties) == properties && type_bits & (1 << i))
+				return i;
+		}
+
+		return 0xffffffff;
+	}
+
+	static std::vector<uint32_t> ReadShaderBinary(const char* filepath)
+	{
+		std::ifstream stream(filepath, std::ios::binary | std::ios::ate);
+		if (!stream)
+			return {};
+
+		size_t size = (size_t)stream.tellg();
+		std::vector<uint32_t> code(size / sizeof(uint32_t));
+
+		stream.seekg(0);
+		stream.read((char*)code.data(), code.size() * sizeof(uint32_t));
+		return code;
+	}
+
+}
+
+GPUPathTracer::GPUPathTracer()
+{
+	CreatePipeline();
+}
+
+GPUPathTracer::~GPUPathTracer()
+{
+	ReleaseBuffer(m_AccumulationBuffer);
+	ReleaseBuffer(m_NodeBuffer);
+	ReleaseBuffer(m_SphereBuffer);
+	ReleaseBuffer(m_MaterialBuffer);
+	ReleaseBuffer(m_FrameBuffer);
+	for (StagingBuffer& staging : m_StagingBuffers)
+		ReleaseBuffer(staging.Data);
+
+	Walnut::Application::SubmitResourceFree([pipeline = m_Pipeline, pipelineLayout = m_PipelineLayout,
+		descriptorPool = m_DescriptorPool, descriptorSetLayout = m_DescriptorSetLayout]()
+	{
+		VkDevice device = Walnut::Application::GetDevice();
+
+		vkDestroyPipeline(device, pipeline, nullptr);
+		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+		vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+	});
+}
+
+void GPUPathTracer::CreatePipeline()
+{
+	VkDevice device = Walnut::Application::GetDevice();
+
+	VkResult err;
+
+	std::vector<uint32_t> code = Utils::ReadShaderBinary(Utils::PathTraceShaderPath);
+	if (code.empty())
+	{
+		std::cerr << "[GPUPathTracer] Could not load " << Utils::PathTraceShaderPath << ", GPU backend disabled\n";
+		return;
+	}
+
+	// Descriptor set layout
+	{
+		VkDescriptorSetLayoutBinding bindings[6] = {};
+		bindings[0].binding = 0;
+		bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		for (uint32_t i = 1; i <= 4; i++)
+		{
+			bindings[i].binding = i;
+			bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		}
+		// Offset to the frame's slot of the ring at bind time
+		bindings[5].binding = 5;
+		bindings[5].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+
+		for (auto& binding : bindings)
+		{
+			binding.descriptorCount = 1;
+			binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		}
+
+		VkDescriptorSetLayoutCreateInfo info = {};
+		info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		info.bindingCount = 6;
+		info.pBindings = bindings;
+		err = vkCreateDescriptorSetLayout(device, &info, nullptr, &m_DescriptorSetLayout);
+		check_vk_result(err);
+	}
+
+	// Descriptor pool, sets are allocated per set of buffers and target
+	{
+		VkDescriptorPoolSize pool_sizes[] =
+		{
+			{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, Utils::MaxDescriptorSets },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4 * Utils::MaxDescriptorSets },
+			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, Utils::MaxDescriptorSets }
+		};
+		VkDescriptorPoolCreateInfo pool_info = {};
+		pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+		pool_info.maxSets = Utils::MaxDescriptorSets;
+		pool_info.poolSizeCount = 3;
+		pool_info.pPoolSizes = pool_sizes;
+		err = vkCreateDescriptorPool(device, &pool_info, nullptr, &m_DescriptorPool);
+		check_vk_result(err);
+	}
+
+	// Pipeline
+	{
+		VkPipelineLayoutCreateInfo layout_info = {};
+		layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		layout_info.setLayoutCount = 1;
+		layout_info.pSetLayouts = &m_DescriptorSetLayout;
+		err = vkCreatePipelineLayout(device, &layout_info, nullptr, &m_PipelineLayout);
+		check_vk_result(err);
+
+		VkShaderModuleCreateInfo module_info = {};
+		module_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+		module_info.codeSize = code.size() * sizeof(uint32_t);
+		module_info.pCode = code.data();
+		VkShaderModule shaderModule;
+		err = vkCreateShaderModule(device, &module_info, nullptr, &shaderModule);
+		check_vk_result(err);
+
+		VkComputePipelineCreateInfo pipeline_info = {};
+		pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipeline_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipeline_info.stage.module = shaderModule;
+		pipeline_info.stage.pName = "main";
+		pipeline_info.layout = m_PipelineLayout;
+		err = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &m_Pipeline);
+		check_vk_result(err);
+
+		vkDestroyShaderModule(device, shaderModule, nullptr);
+	}
+
+	// Written every frame and read once per invocation, host visible is the right place for it
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(Walnut::Application::GetPhysicalDevice(), &properties);
+	VkDeviceSize alignment = glm::max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment, 1);
+	m_FrameDataStride = (sizeof(Utils::GPUFrameData) + alignment - 1) / alignment * alignment;
+
+	m_FrameSlotSerials.assign(Walnut::Application::GetFramesInFlight() + 1, 0);
+	CreateBuffer(m_FrameBuffer, m_FrameDataStride * m_FrameSlotSerials.size(), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+}
+
+void GPUPathTracer::UploadNodes(const BVH& bvh)
+{
+	const std::vector<BVHNode>& nodes = bvh.GetNodes();
+
+	m_NodeCount = (uint32_t)nodes.size();
+	UploadToBuffer(m_NodeBuffer, nodes.data(), nodes.size() * sizeof(BVHNode));
+}
+
+void GPUPathTracer::UploadScene(const Scene& scene, const BVH& bvh)
+{
+	const std::vector<uint32_t>& primitiveIndices = bvh.GetPrimitiveIndices();
+
+	// Spheres go up in BVH primitive order so leaves can index them directly
+	m_Spheres.resize(primitiveIndices.size());
+	for (size_t i = 0; i < primitiveIndices.size(); i++)
+	{
+		const Sphere& sphere = scene.Spheres[primitiveIndices[i]];
+
+		GPUSphere& gpuSphere = m_Spheres[i];
+		gpuSphere.Position = sphere.Position;
+		gpuSphere.Radius = sphere.Radius;
+		gpuSphere.MaterialIndex = (uint32_t)sphere.MaterialIndex;
+		gpuSphere.ObjectIndex = primitiveIndices[i];
+	}
+
+	m_Materials.resize(scene.Materials.size());
+	for (size_t i = 0; i < scene.Materials.size(); i++)
+	{
+		m_Materials[i].Albedo = scene.Materials[i].Albedo;
+		m_Materials[i].Roughness = scene.Materials[i].Roughness;
+		m_Materials[i].Metallic = scene.Materials[i].Metallic;
+		m_Materials[i].Emission = scene.Materials[i].GetEmission();
+	}
+
+	UploadToBuffer(m_SphereBuffer, m_Spheres.data(), m_Spheres.size() * sizeof(GPUSphere));
+	UploadToBuffer(m_MaterialBuffer, m_Materials.data(), m_Materials.size() * sizeof(GPUMaterial));
+}
+
+void GPUPathTracer::Render(const Camera& camera, Walnut::Image& target, uint32_t frameIndex, uint32_t maxDepth, uint32_t russianRouletteDepth)
+{
+	uint32_t width = target.GetWidth();
+	uint32_t height = target.GetHeight();
+
+	VkDeviceSize accumulationSize = (VkDeviceSize)width * height * sizeof(glm::vec4);
+	if (m_AccumulationBuffer.Size < accumulationSize)
+	{
+		ReleaseBuffer(m_AccumulationBuffer);
+		CreateBuffer(m_AccumulationBuffer, accumulationSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		m_DescriptorsDirty = true;
+
+		// The new buffer holds garbage, so start accumulating from scratch
+		frameIndex = 1;
+	}
+
+	VkDescriptorSet descriptorSet = GetDescriptorSet(target);
+
+	Utils::GPUFrameData frameData;
+	frameData.InverseProjection = camera.GetInverseProjection();
+	frameData.InverseView = camera.GetInverseView();
+	frameData.CameraPosition = glm::vec4(camera.GetPosition(), 1.0f);
+	frameData.FrameIndex = frameIndex;
+	frameData.Width = width;
+	frameData.Height = height;
+	frameData.NodeCount = m_NodeCount;
+	frameData.MaxDepth = maxDepth;
+	frameData.RussianRouletteDepth = russianRouletteDepth;
+
+	// The slot written last time around may still be read by a frame in flight, the one after it is one frame older
+	m_FrameSlotIndex = (m_FrameSlotIndex + 1) % (uint32_t)m_FrameSlotSerials.size();
+	Walnut::Application::WaitForFrame(m_FrameSlotSerials[m_FrameSlotIndex]);
+	m_FrameSlotSerials[m_FrameSlotIndex] = Walnut::Application::GetNextFrameSerial();
+
+	uint32_t frameDataOffset = (uint32_t)(m_FrameSlotIndex * m_FrameDataStride);
+	memcpy((uint8_t*)m_FrameBuffer.MappedData + frameDataOffset, &frameData, sizeof(frameData));
+
+	// Recorded behind the uploads UploadNodes and UploadScene queued the same way
+	Walnut::Application::SubmitFrameCommand([pipeline = m_Pipeline, pipelineLayout = m_PipelineLayout, descriptorSet,
+		image = target.GetVulkanImage(), frameDataOffset, width, height](VkCommandBuffer command_buffer)
+	{
+		// The previous frame's dispatch wrote the accumulation this one adds to
+		VkMemoryBarrier accumulation_barrier = {};
+		accumulation_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		accumulation_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		accumulation_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+		// Every pixel gets overwritten, so the previous contents can be discarded
+		VkImageMemoryBarrier write_barrier = {};
+		write_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		write_barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		write_barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		write_barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		write_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		write_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		write_barrier.image = image;
+		write_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		write_barrier.subresourceRange.levelCount = 1;
+		write_barrier.subresourceRange.layerCount = 1;
+		vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 1, &accumulation_barrier, 0, NULL, 1, &write_barrier);
+
+		vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+		vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 1, &frameDataOffset);
+		vkCmdDispatch(command_buffer, (width + 7) / 8, (height + 7) / 8, 1);
+
+		VkImageMemoryBarrier use_barrier = {};
+		use_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		use_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		use_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		use_barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+		use_barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		use_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		use_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		use_barrier.image = image;
+		use_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		use_barrier.subresourceRange.levelCount = 1;
+		use_barrier.subresourceRange.layerCount = 1;
+		vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &use_barrier);
+	});
+}
+
+void GPUPathTracer::CreateBuffer(Buffer& buffer, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties)
+{
+	VkDevice device = Walnut::Application::GetDevice();
+
+	VkResult err;
+
+	VkBufferCreateInfo buffer_info = {};
+	buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	buffer_info.size = size;
+	buffer_info.usage = usage;
+	buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	err = vkCreateBuffer(device, &buffer_info, nullptr, &buffer.Handle);
+	check_vk_result(err);
+
+	VkMemoryRequirements req;
+	vkGetBufferMemoryRequirements(device, buffer.Handle, &req);
+
+	VkMemoryAllocateInfo alloc_info = {};
+	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	alloc_info.allocationSize = req.size;
+	alloc_info.memoryTypeIndex = Utils::GetVulkanMemoryType(properties, req.memoryTypeBits);
+	err = vkAllocateMemory(device, &alloc_info, nullptr, &buffer.Memory);
+	check_vk_result(err);
+
+	err = vkBindBufferMemory(device, buffer.Handle, buffer.Memory, 0);
+	check_vk_result(err);
+
+	buffer.Size = size;
+
+	if (properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+	{
+		err = vkMapMemory(device, buffer.Memory, 0, VK_WHOLE_SIZE, 0, &buffer.MappedData);
+		check_vk_result(err);
+	}
+}
+
+void GPUPathTracer::ReleaseBuffer(Buffer& buffer)
+{
+	if (!buffer.Handle)
+		return;
+
+	Walnut::Application::SubmitResourceFree([handle = buffer.Handle, memory = buffer.Memory]()
+	{
+		VkDevice device = Walnut::Application::GetDevice();
+
+		vkDestroyBuffer(device, handle, nullptr);
+		vkFreeMemory(device, memory, nullptr);
+	});
+
+	buffer = Buffer();
+}
+
+void GPUPathTracer::UploadToBuffer(Buffer& buffer, const void* data, VkDeviceSize size)
+{
+	ReleaseCompletedStaging();
+
+	// Zero sized storage buffers are not allowed, keep at least a small one bound
+	VkDeviceSize requiredSize = size > 0 ? size : 64;
+
+	if (buffer.Size < requiredSize)
+	{
+		// Read by every ray, so it belongs in device local memory
+		ReleaseBuffer(buffer);
+		CreateBuffer(buffer, requiredSize * 2, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		m_DescriptorsDirty = true;
+	}
+
+	if (size == 0)
+		return;
+
+	StagingBuffer& staging = m_StagingBuffers.emplace_back();
+	CreateBuffer(staging.Data, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	memcpy(staging.Data.MappedData, data, size);
+	staging.FrameSerial = Walnut::Application::GetNextFrameSerial();
+
+	Walnut::Application::SubmitFrameCommand([source = staging.Data.Handle, destination = buffer.Handle, size](VkCommandBuffer command_buffer)
+	{
+		// The previous frame's dispatch may still be reading what the copy overwrites
+		vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 0, NULL);
+
+		VkBufferCopy region = {};
+		region.size = size;
+		vkCmdCopyBuffer(command_buffer, source, destination, 1, &region);
+
+		VkBufferMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.buffer = destination;
+		barrier.size = size;
+		vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 1, &barrier, 0, NULL);
+	});
+}
+
+void GPUPathTracer::ReleaseCompletedStaging()
+{
+	uint64_t completedSerial = Walnut::Application::GetCompletedFrameSerial();
+	auto completed = std::remove_if(m_StagingBuffers.begin(), m_StagingBuffers.end(), [completedSerial](const StagingBuffer& staging)
+	{
+		return staging.FrameSerial <= completedSerial;
+	});
+
+	VkDevice device = Walnut::Application::GetDevice();
+	for (auto it = completed; it != m_StagingBuffers.end(); ++it)
+	{
+		vkDestroyBuffer(device, it->Data.Handle, nullptr);
+		vkFreeMemory(device, it->Data.Memory, nullptr);
+	}
+	m_StagingBuffers.erase(completed, m_StagingBuffers.end());
+}
+
+VkDescriptorSet GPUPathTracer::GetDescriptorSet(const Walnut::Image& target)
+{
+	if (m_DescriptorSet && !m_DescriptorsDirty && target.GetImageView() == m_BoundImageView)
+		return m_DescriptorSet;
+
+	VkDevice device = Walnut::Application::GetDevice();
+
+	if (m_DescriptorSet)
+	{
+		Walnut::Application::SubmitResourceFree([descriptorPool = m_DescriptorPool, descriptorSet = m_DescriptorSet]()
+		{
+			vkFreeDescriptorSets(Walnut::Application::GetDevice(), descriptorPool, 1, &descriptorSet);
+		});
+	}
+
+	VkDescriptorSetAllocateInfo alloc_info = {};
+	alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	alloc_info.descriptorPool = m_DescriptorPool;
+	alloc_info.descriptorSetCount = 1;
+	alloc_info.pSetLayouts = &m_DescriptorSetLayout;
+	VkResult err = vkAllocateDescriptorSets(device, &alloc_info, &m_DescriptorSet);
+	check_vk_result(err);
+
+	VkDescriptorImageInfo image_info = {};
+	image_info.imageView = target.GetImageView();
+	image_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	const Buffer* buffers[5] = { &m_AccumulationBuffer, &m_NodeBuffer, &m_SphereBuffer, &m_MaterialBuffer, &m_FrameBuffer };
+
+	VkDescriptorBufferInfo buffer_infos[5] = {};
+	VkWriteDescriptorSet writes[6] = {};
+
+	writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writes[0].dstSet = m_DescriptorSet;
+	writes[0].dstBinding = 0;
+	writes[0].descriptorCount = 1;
+	writes[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	writes[0].pImageInfo = &image_info;
+
+	for (uint32_t i = 0; i < 5; i++)
+	{
+		buffer_infos[i].buffer = buffers[i]->Handle;
+		buffer_infos[i].offset = 0;
+		// The frame data is one slot of the ring, the dynamic offset picks which
+		buffer_infos[i].range = i == 4 ? sizeof(Utils::GPUFrameData) : VK_WHOLE_SIZE;
+
+		VkWriteDescriptorSet& write = writes[i + 1];
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = m_DescriptorSet;
+		write.dstBinding = i + 1;
+		write.descriptorCount = 1;
+		write.descriptorType = i == 4 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		write.pBufferInfo = &buffer_infos[i];
+	}
+
+	vkUpdateDescriptorSets(device, 6, writes, 0, nullptr);
+
+	m_BoundImageView = target.GetImageView();
+	m_DescriptorsDirty = false;
+	return m_DescriptorSet;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "Walnut/Image.h"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#include "vulkan/vulkan.h"
+
+#include "BVH.h"
+#include "Camera.h"
+#include "Scene.h"
+
+// Runs PerPixel/TraceRay as a Vulkan compute shader (shaders/PathTrace.comp) on Walnut's device.
+// Scene data and the accumulation buffer live in device local storage buffers, uploads go through staging
+// copies, and the result is written straight into the Walnut::Image that ImGui samples. Everything is
+// recorded into Walnut's frame command buffer, so the CPU never waits for the trace to finish.
+class GPUPathTracer
+{
+public:
+	GPUPathTracer();
+	~GPUPathTracer();
+
+	GPUPathTracer(const GPUPathTracer&) = delete;
+	GPUPathTracer& operator=(const GPUPathTracer&) = delete;
+
+	// False when the compute shader could not be loaded, the renderer then stays on the CPU
+	bool IsAvailable() const { return m_Pipeline != nullptr; }
+
+	// Only needed after the BVH was rebuilt or refit
+	void UploadNodes(const BVH& bvh);
+	// Spheres (in BVH primitive order) and materials, small enough to send every frame
+	void UploadScene(const Scene& scene, const BVH& bvh);
+
+	// Depths as in Renderer::Settings. target needs Walnut::ImageUsage::Storage.
+	void Render(const Camera& camera, Walnut::Image& target, uint32_t frameIndex, uint32_t maxDepth, uint32_t russianRouletteDepth);
+public:
+	// Mirrors of the structs in PathTrace.comp (std430)
+	struct GPUSphere
+	{
+		glm::vec3 Position;
+		float Radius;
+		uint32_t MaterialIndex;
+		uint32_t ObjectIndex;
+		uint32_t Padding[2];
+	};
+
+	struct GPUMaterial
+	{
+		glm::vec3 Albedo;
+		float Roughness;
+		// Material::GetEmission, the shader only adds it where bounces hit it
+		glm::vec3 Emission;
+		float Metallic;
+	};
+private:
+	struct Buffer
+	{
+		VkBuffer Handle = nullptr;
+		VkDeviceMemory Memory = nullptr;
+		VkDeviceSize Size = 0;
+		void* MappedData = nullptr;
+	};
+
+	// Host visible source of a copy into a device local buffer, destroyed once the frame that copies it completed
+	struct StagingBuffer
+	{
+		Buffer Data;
+		uint64_t FrameSerial = 0;
+	};
+
+	void CreatePipeline();
+
+	void CreateBuffer(Buffer& buffer, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties);
+	void ReleaseBuffer(Buffer& buffer);
+	// Grows the device local buffer when needed and queues a staged copy of data into it ahead of this frame's dispatch
+	void UploadToBuffer(Buffer& buffer, const void* data, VkDeviceSize size);
+	void ReleaseCompletedStaging();
+
+	// A new set whenever a buffer or the target was reallocated, frames in flight may still use the old one
+	VkDescriptorSet GetDescriptorSet(const Walnut::Image& target);
+private:
+	VkDescriptorSetLayout m_DescriptorSetLayout = nullptr;
+	VkDescriptorPool m_DescriptorPool = nullptr;
+	VkDescriptorSet m_DescriptorSet = nullptr;
+	VkPipelineLayout m_PipelineLayout = nullptr;
+	VkPipeline m_Pipeline = nullptr;
+
+	Buffer m_AccumulationBuffer;
+	Buffer m_NodeBuffer;
+	Buffer m_SphereBuffer;
+	Buffer m_MaterialBuffer;
+	std::vector<StagingBuffer> m_StagingBuffers;
+
+	// One slot of frame data per frame in flight and one more, bound with a dynamic offset
+	Buffer m_FrameBuffer;
+	VkDeviceSize m_FrameDataStride = 0;
+	// Serial of the frame that last read each slot
+	std::vector<uint64_t> m_FrameSlotSerials;
+	uint32_t m_FrameSlotIndex = 0;
+
+	std::vector<GPUSphere> m_Spheres;
+	std::vector<GPUMaterial> m_Materials;
+	uint32_t m_NodeCount = 0;
+
+	VkImageView m_BoundImageView = nullptr;
+	bool m_DescriptorsDirty = true;
+};
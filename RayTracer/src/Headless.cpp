@@ -0,0 +1,275 @@
+#include "Headless.h"
+
+#include "Walnut/Profiler.h"
+#include "Walnut/Timer.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "Camera.h"
+#include "Distributed.h"
+#include "FrameArena.h"
+#include "ImageWriter.h"
+#include "Renderer.h"
+#include "SceneCache.h"
+#include "SceneSerializer.h"
+
+namespace Utils {
+
+	static void PrintUsage()
+	{
+		std::cerr <<
+			"Usage: RayTracer --headless --scene <file.json|file.rtscene> [options]\n"
+			"  --out <file>       .exr (linear) or .ppm output, default frame.exr\n"
+			"  --exr-format <half|float>\n"
+			"                     bits per .exr channel, default float\n"
+			"  --exr-compression <none|rle>\n"
+			"                     lossless .exr compression, default none\n"
+			"  --size <W>x<H>     image size, default 1920x1080\n"
+			"  --spp <n>          samples per pixel, 0 for no limit, default 1024\n"
+			"  --time <s>         time budget in seconds, 0 for no limit\n"
+			"  --threads <n>      worker threads, 0 for all\n"
+			"  --tile <n>         tile size in pixels, default 16\n"
+			"  --depth <n>        maximum path segments, default 5\n"
+			"  --light-sampling <0|1>\n"
+			"                     trace a shadow ray toward a light at every bounce, default 1\n"
+			"  --sampler <name>   sobol or random sample sequences, default sobol\n"
+			"  --denoise <0|1>    write the denoised image, default 0\n"
+			"  --cache <file>     write the scene as a .rtscene cache before rendering,\n"
+			"                     with --spp 0 and no --time only the cache is written\n"
+			"  --trace <file>     write a Chrome trace of the render, one frame per sample\n"
+			"  --huge-pages <0|1> put frame buffers on huge pages where the OS allows, default 0\n"
+			"  --listen <port>    coordinate a distributed render, workers connect to this port\n"
+			"  --batch <n>        samples per pixel in every range handed to a worker, default 16\n"
+			"  --connect <h:p>    render for the coordinator at host:port, needs no --scene\n";
+	}
+
+	static bool ParseUInt(const char* text, uint32_t& value)
+	{
+		char* end = nullptr;
+		unsigned long result = std::strtoul(text, &end, 10);
+		if (end == text || *end != '\0')
+			return false;
+
+		value = (uint32_t)result;
+		return true;
+	}
+
+}
+
+bool Headless::IsRequested(int argc, char** argv)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--headless") == 0)
+			return true;
+	}
+	return false;
+}
+
+bool Headless::ParseOptions(int argc, char** argv, HeadlessOptions& options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		if (strcmp(arg, "--headless") == 0)
+			continue;
+
+		if (i + 1 >= argc)
+		{
+			std::cerr << "[Headless] Missing value for " << arg << "\n";
+			Utils::PrintUsage();
+			return false;
+		}
+
+		const char* value = argv[++i];
+		bool valid = true;
+
+		if (strcmp(arg, "--scene") == 0)
+			options.ScenePath = value;
+		else if (strcmp(arg, "--out") == 0)
+			options.OutputPath = value;
+		else if (strcmp(arg, "--cache") == 0)
+			options.CachePath = value;
+		else if (strcmp(arg, "--trace") == 0)
+			options.TracePath = value;
+		else if (strcmp(arg, "--connect") == 0)
+			options.CoordinatorAddress = value;
+		else if (strcmp(arg, "--listen") == 0)
+			valid = Utils::ParseUInt(value, options.ListenPort) && options.ListenPort > 0 && options.ListenPort <= 65535;
+		else if (strcmp(arg, "--batch") == 0)
+			valid = Utils::ParseUInt(value, options.BatchSize) && options.BatchSize > 0;
+		else if (strcmp(arg, "--spp") == 0)
+			valid = Utils::ParseUInt(value, options.SampleCount);
+		else if (strcmp(arg, "--time") == 0)
+			options.TimeBudget = (float)std::strtod(value, nullptr);
+		else if (strcmp(arg, "--threads") == 0)
+			valid = Utils::ParseUInt(value, options.ThreadCount);
+		else if (strcmp(arg, "--tile") == 0)
+			valid = Utils::ParseUInt(value, options.TileSize);
+		else if (strcmp(arg, "--depth") == 0)
+			valid = Utils::ParseUInt(value, options.MaxDepth) && options.MaxDepth > 0;
+		else if (strcmp(arg, "--light-sampling") == 0)
+		{
+			uint32_t lightSampling = 0;
+			valid = Utils::ParseUInt(value, lightSampling) && lightSampling <= 1;
+			options.LightSampling = lightSampling == 1;
+		}
+		else if (strcmp(arg, "--sampler") == 0)
+		{
+			valid = strcmp(value, "sobol") == 0 || strcmp(value, "random") == 0;
+			options.SamplerType = strcmp(value, "random") == 0 ? Sampler::Type::Random : Sampler::Type::Sobol;
+		}
+		else if (strcmp(arg, "--exr-format") == 0)
+		{
+			valid = strcmp(value, "half") == 0 || strcmp(value, "float") == 0;
+			options.EXR.PixelType = strcmp(value, "half") == 0 ? EXRPixelType::Half : EXRPixelType::Float;
+		}
+		else if (strcmp(arg, "--exr-compression") == 0)
+		{
+			valid = strcmp(value, "none") == 0 || strcmp(value, "rle") == 0;
+			options.EXR.Compression = strcmp(value, "rle") == 0 ? EXRCompression::RLE : EXRCompression::None;
+		}
+		else if (strcmp(arg, "--denoise") == 0)
+		{
+			uint32_t denoise = 0;
+			valid = Utils::ParseUInt(value, denoise) && denoise <= 1;
+			options.Denoise = denoise == 1;
+		}
+		else if (strcmp(arg, "--huge-pages") == 0)
+		{
+			uint32_t hugePages = 0;
+			valid = Utils::ParseUInt(value, hugePages) && hugePages <= 1;
+			options.HugePages = hugePages == 1;
+		}
+		else if (strcmp(arg, "--size") == 0)
+			valid = sscanf(value, "%ux%u", &options.Width, &options.Height) == 2 && options.Width > 0 && options.Height > 0;
+		else
+		{
+			std::cerr << "[Headless] Unknown option " << arg << "\n";
+			Utils::PrintUsage();
+			return false;
+		}
+
+		if (!valid)
+		{
+			std::cerr << "[Headless] Invalid value '" << value << "' for " << arg << "\n";
+			return false;
+		}
+	}
+
+	// Everything about the image comes from the coordinator
+	if (!options.CoordinatorAddress.empty())
+		return true;
+
+	if (options.ScenePath.empty())
+	{
+		std::cerr << "[Headless] --scene is required\n";
+		Utils::PrintUsage();
+		return false;
+	}
+
+	if (options.SampleCount == 0 && options.TimeBudget <= 0.0f && options.CachePath.empty())
+	{
+		std::cerr << "[Headless] Needs a sample count or a time budget to know when to stop\n";
+		return false;
+	}
+
+	if (options.ListenPort != 0 && (options.SampleCount == 0 || options.Denoise))
+	{
+		std::cerr << "[Headless] A distributed render needs --spp and cannot denoise, the guides stay on the workers\n";
+		return false;
+	}
+
+	return true;
+}
+
+int Headless::Run(const HeadlessOptions& options)
+{
+	// Before the first frame buffer is allocated
+	FrameArena::SetHugePages(options.HugePages);
+
+	if (!options.CoordinatorAddress.empty())
+		return Distributed::RunWorker(options);
+	if (options.ListenPort != 0)
+		return Distributed::RunCoordinator(options);
+
+	Scene scene;
+	CameraDescription cameraDescription;
+	if (!SceneSerializer::Deserialize(options.ScenePath, scene, cameraDescription))
+		return 1;
+
+	if (!options.CachePath.empty())
+	{
+		if (!SceneCache::Write(options.CachePath, scene, cameraDescription))
+			return 1;
+
+		std::cout << "[Headless] Wrote scene cache " << options.CachePath << "\n";
+		if (options.SampleCount == 0 && options.TimeBudget <= 0.0f)
+			return 0;
+	}
+
+	Camera camera(cameraDescription.VerticalFOV, 0.1f, 100.0f);
+	camera.OnResize(options.Width, options.Height);
+	camera.SetPosition(cameraDescription.Position);
+	camera.SetDirection(cameraDescription.Direction);
+
+	Renderer renderer;
+	Renderer::Settings& settings = renderer.GetSettings();
+	settings.Accumulate = true;
+	settings.Backend = Renderer::RenderBackend::CPU;
+	settings.ThreadCount = options.ThreadCount;
+	settings.TileSize = options.TileSize;
+	settings.MaxDepth = options.MaxDepth;
+	settings.LightSampling = options.LightSampling;
+	settings.SamplerType = options.SamplerType;
+	settings.Denoise = options.Denoise;
+
+	renderer.OnResize(options.Width, options.Height);
+
+	std::cout << "[Headless] Rendering " << options.ScenePath << " at " << options.Width << "x" << options.Height << "\n";
+
+	if (!options.TracePath.empty())
+		Walnut::Profiler::BeginCapture();
+
+	Walnut::Timer timer;
+	float lastReport = 0.0f;
+
+	while (true)
+	{
+		// No RGBA8 output, only the accumulation buffer ends up on disk
+		renderer.RenderFrame(scene, camera, nullptr);
+		Walnut::Profiler::EndFrame();
+
+		uint32_t samples = renderer.GetSampleCount();
+		float elapsed = timer.Elapsed();
+
+		if (options.SampleCount > 0 && samples >= options.SampleCount)
+			break;
+		if (options.TimeBudget > 0.0f && elapsed >= options.TimeBudget)
+			break;
+
+		if (elapsed - lastReport >= 1.0f)
+		{
+			std::cout << "[Headless] " << samples << " spp, " << elapsed << "s\n";
+			lastReport = elapsed;
+		}
+	}
+
+	uint32_t samples = renderer.GetSampleCount();
+	std::cout << "[Headless] " << samples << " spp in " << timer.Elapsed() << "s, writing " << options.OutputPath << "\n";
+
+	if (!options.TracePath.empty() && !Walnut::Profiler::EndCapture(options.TracePath))
+		return 1;
+
+	// The denoised image is already divided by the sample count
+	bool written = options.Denoise
+		? ImageWriter::Write(options.OutputPath, renderer.Denoise(), 1.0f, options.EXR)
+		: ImageWriter::Write(options.OutputPath, renderer.GetAccumulationBuffer(), 1.0f / (float)samples, options.EXR);
+	if (!written)
+		return 1;
+
+	return 0;
+}
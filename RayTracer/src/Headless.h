@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "ImageWriter.h"
+#include "Sampler.h"
+
+// Offline rendering for render nodes: drives Renderer and Camera directly, with no window,
+// ImGui or swapchain, and writes the accumulated result to disk.
+//
+//   RayTracer --headless --scene s.json --spp 1024 --size 3840x2160 --out frame.exr
+//
+// Rendering stops at --spp samples per pixel or after --time seconds, whichever comes first.
+// With --listen or --connect the render is spread over several machines, see Distributed.
+struct HeadlessOptions
+{
+	std::string ScenePath;
+	std::string OutputPath = "frame.exr";
+	// Written with SceneCache before rendering, rendering is skipped if there is no sample count or time budget
+	std::string CachePath;
+	// Chrome trace of the render, empty for none
+	std::string TracePath;
+
+	uint32_t Width = 1920, Height = 1080;
+	// 0 means no limit, at least one of SampleCount and TimeBudget has to be set unless only a cache is written
+	uint32_t SampleCount = 1024;
+	float TimeBudget = 0.0f;
+
+	// Same meaning as in Renderer::Settings
+	uint32_t ThreadCount = 0;
+	uint32_t TileSize = 16;
+	uint32_t MaxDepth = 5;
+	bool LightSampling = true;
+	Sampler::Type SamplerType = Sampler::Type::Sobol;
+	// Writes the denoised image instead of the raw accumulation
+	bool Denoise = false;
+	// Ignored for .ppm output
+	EXROptions EXR;
+	// See FrameArena::SetHugePages
+	bool HugePages = false;
+
+	// Coordinates a distributed render on this port, 0 renders locally
+	uint32_t ListenPort = 0;
+	// host:port of a coordinator to render for, the scene and image settings then come from it
+	std::string CoordinatorAddress;
+	// Samples per pixel in every range the coordinator hands out
+	uint32_t BatchSize = 16;
+};
+
+class Headless
+{
+public:
+	static bool IsRequested(int argc, char** argv);
+
+	// Returns false and prints usage if the command line is invalid
+	static bool ParseOptions(int argc, char** argv, HeadlessOptions& options);
+
+	// Returns the process exit code
+	static int Run(const HeadlessOptions& options);
+};
@@ -0,0 +1,251 @@
+#include "ImageWriter.h"
+
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace Utils {
+
+	static bool HasExtension(const std::string& filepath, const char* extension)
+	{
+		size_t length = strlen(extension);
+		if (filepath.size() < length)
+			return false;
+
+		for (size_t i = 0; i < length; i++)
+		{
+			if (std::tolower((unsigned char)filepath[filepath.size() - length + i]) != extension[i])
+				return false;
+		}
+		return true;
+	}
+
+	// EXR is little endian throughout, like every platform we build for
+	template<typename T>
+	static void Append(std::vector<char>& buffer, const T& value)
+	{
+		const char* bytes = (const char*)&value;
+		buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+	}
+
+	static void AppendString(std::vector<char>& buffer, const char* string)
+	{
+		buffer.insert(buffer.end(), string, string + strlen(string) + 1);
+	}
+
+	static void AppendAttribute(std::vector<char>& buffer, const char* name, const char* type, int32_t size)
+	{
+		AppendString(buffer, name);
+		AppendString(buffer, type);
+		Append(buffer, size);
+	}
+
+	// OpenEXR's RLE: a count byte and then either one byte repeated count + 1 times (count >= 0)
+	// or -count literal bytes
+	static void CompressRLE(const std::vector<unsigned char>& input, std::vector<char>& output)
+	{
+		constexpr size_t minRunLength = 3;
+		constexpr size_t maxRunLength = 127;
+
+		size_t size = input.size();
+		size_t runStart = 0;
+		size_t runEnd = 1;
+		while (runStart < size)
+		{
+			while (runEnd < size && input[runStart] == input[runEnd] && runEnd - runStart - 1 < maxRunLength)
+				runEnd++;
+
+			if (runEnd - runStart >= minRunLength)
+			{
+				output.push_back((char)(runEnd - runStart - 1));
+				output.push_back((char)input[runStart]);
+				runStart = runEnd;
+			}
+			else
+			{
+				// Literals up to where a run of three starts
+				while (runEnd < size && ((runEnd + 1 >= size || input[runEnd] != input[runEnd + 1])
+					|| (runEnd + 2 >= size || input[runEnd + 1] != input[runEnd + 2])) && runEnd - runStart < maxRunLength)
+					runEnd++;
+
+				output.push_back((char)-(int)(runEnd - runStart));
+				output.insert(output.end(), input.begin() + runStart, input.begin() + runEnd);
+				runStart = runEnd;
+			}
+			runEnd++;
+		}
+	}
+
+	// Moves the even bytes of the line ahead of the odd ones and stores each byte as the difference to the previous
+	// one, so the slowly changing high bytes of neighbouring values turn into runs. Reader and writer must agree exactly.
+	static void PredictRLE(const std::vector<char>& line, std::vector<unsigned char>& output)
+	{
+		size_t size = line.size();
+		output.resize(size);
+
+		size_t odd = (size + 1) / 2;
+		for (size_t i = 0; i < size; i++)
+			output[(i & 1) ? odd + i / 2 : i / 2] = (unsigned char)line[i];
+
+		unsigned char previous = output[0];
+		for (size_t i = 1; i < size; i++)
+		{
+			unsigned char current = output[i];
+			output[i] = (unsigned char)(current - previous + 128);
+			previous = current;
+		}
+	}
+
+	static bool WriteFile(const std::string& filepath, const std::vector<char>& data)
+	{
+		std::ofstream stream(filepath, std::ios::binary);
+		if (!stream)
+		{
+			std::cerr << "[ImageWriter] Could not open " << filepath << " for writing\n";
+			return false;
+		}
+
+		stream.write(data.data(), data.size());
+		return (bool)stream;
+	}
+
+}
+
+bool ImageWriter::Write(const std::string& filepath, const AccumulationBuffer& image, float scale, const EXROptions& exrOptions)
+{
+	if (Utils::HasExtension(filepath, ".exr"))
+		return WriteEXR(filepath, image, scale, exrOptions);
+	if (Utils::HasExtension(filepath, ".ppm"))
+		return WritePPM(filepath, image, scale);
+
+	std::cerr << "[ImageWriter] Unsupported format for " << filepath << ", use .exr or .ppm\n";
+	return false;
+}
+
+bool ImageWriter::WriteEXR(const std::string& filepath, const AccumulationBuffer& image, float scale, const EXROptions& options)
+{
+	uint32_t width = image.GetWidth();
+	uint32_t height = image.GetHeight();
+
+	std::vector<char> data;
+
+	Utils::Append(data, (uint32_t)20000630); // Magic number
+	Utils::Append(data, (uint32_t)2);        // Version 2, single part scanline
+
+	// Channels have to be listed alphabetically
+	const char* channelNames[] = { "B", "G", "R" };
+	Utils::AppendAttribute(data, "channels", "chlist", 3 * 18 + 1);
+	for (const char* name : channelNames)
+	{
+		Utils::AppendString(data, name);
+		Utils::Append(data, (int32_t)options.PixelType);
+		Utils::Append(data, (uint32_t)0); // pLinear + reserved
+		Utils::Append(data, (int32_t)1); // x sampling
+		Utils::Append(data, (int32_t)1); // y sampling
+	}
+	data.push_back(0);
+
+	Utils::AppendAttribute(data, "compression", "compression", 1);
+	data.push_back((char)options.Compression);
+
+	int32_t window[4] = { 0, 0, (int32_t)width - 1, (int32_t)height - 1 };
+	Utils::AppendAttribute(data, "dataWindow", "box2i", sizeof(window));
+	Utils::Append(data, window);
+	Utils::AppendAttribute(data, "displayWindow", "box2i", sizeof(window));
+	Utils::Append(data, window);
+
+	Utils::AppendAttribute(data, "lineOrder", "lineOrder", 1);
+	data.push_back(0); // INCREASING_Y
+
+	Utils::AppendAttribute(data, "pixelAspectRatio", "float", 4);
+	Utils::Append(data, 1.0f);
+
+	float screenWindowCenter[2] = { 0.0f, 0.0f };
+	Utils::AppendAttribute(data, "screenWindowCenter", "v2f", sizeof(screenWindowCenter));
+	Utils::Append(data, screenWindowCenter);
+
+	Utils::AppendAttribute(data, "screenWindowWidth", "float", 4);
+	Utils::Append(data, 1.0f);
+
+	data.push_back(0); // End of header
+
+	bool half = options.PixelType == EXRPixelType::Half;
+	bool compress = options.Compression == EXRCompression::RLE;
+	uint32_t lineSize = 3 * width * (half ? sizeof(uint16_t) : sizeof(float));
+
+	// One scanline per chunk, compressed chunks vary in size so they are collected before the offset table
+	std::vector<char> chunks;
+	std::vector<uint64_t> offsets(height);
+	uint64_t firstLine = data.size() + (uint64_t)height * sizeof(uint64_t);
+
+	std::vector<char> line;
+	std::vector<unsigned char> predicted;
+	std::vector<char> compressed;
+	line.reserve(lineSize);
+	chunks.reserve((size_t)height * (8 + lineSize));
+	for (uint32_t y = 0; y < height; y++)
+	{
+		// Planar channels, the same layout EXR stores a scanline in
+		line.clear();
+		size_t row = (size_t)(height - 1 - y) * width;
+		for (const float* channel : { image.GetBlue(), image.GetGreen(), image.GetRed() })
+		{
+			for (uint32_t x = 0; x < width; x++)
+			{
+				if (half)
+					Utils::Append(line, AccumulationBuffer::ToHalf(channel[row + x] * scale));
+				else
+					Utils::Append(line, channel[row + x] * scale);
+			}
+		}
+
+		// Readers take a chunk as stored when it is not smaller than the raw scanline
+		const std::vector<char>* chunk = &line;
+		if (compress && !line.empty())
+		{
+			compressed.clear();
+			Utils::PredictRLE(line, predicted);
+			Utils::CompressRLE(predicted, compressed);
+			if (compressed.size() < line.size())
+				chunk = &compressed;
+		}
+
+		offsets[y] = firstLine + chunks.size();
+		Utils::Append(chunks, (int32_t)y);
+		Utils::Append(chunks, (uint32_t)chunk->size());
+		chunks.insert(chunks.end(), chunk->begin(), chunk->end());
+	}
+
+	for (uint64_t offset : offsets)
+		Utils::Append(data, offset);
+	data.insert(data.end(), chunks.begin(), chunks.end());
+
+	return Utils::WriteFile(filepath, data);
+}
+
+bool ImageWriter::WritePPM(const std::string& filepath, const AccumulationBuffer& image, float scale)
+{
+	uint32_t width = image.GetWidth();
+	uint32_t height = image.GetHeight();
+
+	std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+
+	std::vector<char> data(header.begin(), header.end());
+	data.reserve(data.size() + (size_t)width * height * 3);
+
+	for (uint32_t y = 0; y < height; y++)
+	{
+		uint32_t row = (height - 1 - y) * width;
+		for (uint32_t x = 0; x < width; x++)
+		{
+			glm::vec3 color = glm::clamp(image.Get(row + x) * scale, glm::vec3(0.0f), glm::vec3(1.0f));
+			data.push_back((char)(uint8_t)(color.r * 255.0f));
+			data.push_back((char)(uint8_t)(color.g * 255.0f));
+			data.push_back((char)(uint8_t)(color.b * 255.0f));
+		}
+	}
+
+	return Utils::WriteFile(filepath, data);
+}
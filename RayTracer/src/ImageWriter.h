@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+
+#include "AccumulationBuffer.h"
+
+// Values as stored in the file
+enum class EXRPixelType
+{
+	Half = 1, Float = 2
+};
+
+enum class EXRCompression
+{
+	None = 0,
+	// Lossless, byte runs after the same predictor OpenEXR uses. Flat and dark areas shrink a lot, noisy ones barely.
+	RLE = 1
+};
+
+struct EXROptions
+{
+	// Half is exact enough for display and halves the file, values beyond 65504 clamp
+	EXRPixelType PixelType = EXRPixelType::Float;
+	EXRCompression Compression = EXRCompression::None;
+};
+
+// Writes render results to disk. Accumulation buffers keep row 0 at the bottom,
+// rows are flipped so files read top down.
+class ImageWriter
+{
+public:
+	// Picks the format from the extension: .exr (linear, see EXROptions) or .ppm (8-bit, clamped)
+	static bool Write(const std::string& filepath, const AccumulationBuffer& image, float scale = 1.0f, const EXROptions& exrOptions = {});
+
+	// Scanline OpenEXR with R, G and B channels, scale is usually 1 / sample count
+	static bool WriteEXR(const std::string& filepath, const AccumulationBuffer& image, float scale = 1.0f, const EXROptions& options = {});
+	static bool WritePPM(const std::string& filepath, const AccumulationBuffer& image, float scale = 1.0f);
+};
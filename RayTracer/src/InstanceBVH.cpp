@@ -0,0 +1,234 @@
+#include "InstanceBVH.h"
+
+#include <algorithm>
+
+#include "Walnut/Profiler.h"
+
+namespace Utils {
+
+	static constexpr int BVHStackSize = BVHBuilder::MaxDepth;
+
+	// World bounds of an object space box, from its eight transformed corners
+	static AABB TransformBounds(const glm::mat4& transform, const glm::vec3& min, const glm::vec3& max)
+	{
+		AABB bounds;
+		for (int corner = 0; corner < 8; corner++)
+		{
+			glm::vec3 point = { corner & 1 ? max.x : min.x, corner & 2 ? max.y : min.y, corner & 4 ? max.z : min.z };
+			bounds.Grow(glm::vec3(transform * glm::vec4(point, 1.0f)));
+		}
+		return bounds;
+	}
+
+}
+
+bool InstanceBVH::Update(const std::vector<Mesh>& meshes)
+{
+	bool geometryChanged = meshes.size() != m_BuiltGeometries.size();
+	bool changed = geometryChanged;
+	for (size_t i = 0; i < meshes.size() && !geometryChanged; i++)
+	{
+		if (meshes[i].Geometry.get() != m_BuiltGeometries[i])
+			geometryChanged = changed = true;
+		else if (!changed && meshes[i].GetTransform() != m_BuiltTransforms[i])
+			changed = true;
+	}
+
+	if (!changed)
+		return false;
+
+	if (geometryChanged)
+	{
+		// Geometry is immutable, only geometry without a hierarchy yet needs a build
+		std::unordered_map<const MeshGeometry*, MeshBVH> geometryBVHs;
+		for (const Mesh& mesh : meshes)
+		{
+			const MeshGeometry* key = mesh.Geometry.get();
+			if (geometryBVHs.count(key))
+				continue;
+
+			auto existing = m_GeometryBVHs.find(key);
+			if (existing != m_GeometryBVHs.end())
+				geometryBVHs.emplace(key, std::move(existing->second));
+			else
+				geometryBVHs[key].Build(mesh.Geometry);
+		}
+		m_GeometryBVHs = std::move(geometryBVHs);
+	}
+
+	size_t count = meshes.size();
+	m_Instances.resize(count);
+	m_BuiltGeometries.resize(count);
+	m_BuiltTransforms.resize(count);
+
+	std::vector<AABB> bounds(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		const Mesh& mesh = meshes[i];
+		glm::mat4 transform = mesh.GetTransform();
+
+		Instance& instance = m_Instances[i];
+		instance.Geometry = &m_GeometryBVHs[mesh.Geometry.get()];
+		instance.WorldToObject = glm::inverse(transform);
+		instance.NormalMatrix = glm::transpose(glm::inverse(glm::mat3(transform)));
+
+		// Empty geometry still needs a box the builder can sort, a point never gets hit
+		ArrayView<const BVHNode> nodes = instance.Geometry->GetNodes();
+		if (!nodes.empty())
+			bounds[i] = Utils::TransformBounds(transform, nodes[0].BoundsMin, nodes[0].BoundsMax);
+		else
+			bounds[i].Grow(glm::vec3(transform[3]));
+
+		m_BuiltGeometries[i] = mesh.Geometry.get();
+		m_BuiltTransforms[i] = transform;
+	}
+
+	BVHBuilder::Build(bounds, 1, m_Nodes, m_InstanceIndices);
+	return true;
+}
+
+bool InstanceBVH::Intersect(const Ray& ray, float& hitDistance, Hit& hit) const
+{
+	if (m_Nodes.empty())
+		return false;
+
+	glm::vec3 inverseDirection = BVHNode::GetInverseDirection(ray.Direction);
+
+	uint32_t stack[Utils::BVHStackSize];
+	int stackPointer = 0;
+
+	const BVHNode* nodes = m_Nodes.data();
+	const BVHNode* node = &nodes[0];
+	if (node->Intersect(ray, inverseDirection, hitDistance) == FLT_MAX)
+		return false;
+
+	bool found = false;
+	uint32_t nodesVisited = 0;
+
+	while (true)
+	{
+		nodesVisited++;
+
+		if (node->IsLeaf())
+		{
+			for (uint32_t i = 0; i < node->PrimitiveCount; i++)
+			{
+				uint32_t instanceIndex = m_InstanceIndices[node->LeftFirst + i];
+				const Instance& instance = m_Instances[instanceIndex];
+
+				Ray objectRay;
+				objectRay.Origin = glm::vec3(instance.WorldToObject * glm::vec4(ray.Origin, 1.0f));
+				objectRay.Direction = glm::vec3(instance.WorldToObject * glm::vec4(ray.Direction, 0.0f));
+
+				if (instance.Geometry->Intersect(objectRay, hitDistance, hit.Triangle))
+				{
+					hit.Instance = instanceIndex;
+					found = true;
+				}
+			}
+
+			if (stackPointer == 0)
+				break;
+
+			node = &nodes[stack[--stackPointer]];
+			continue;
+		}
+
+		uint32_t nearIndex = node->LeftFirst;
+		uint32_t farIndex = node->LeftFirst + 1;
+
+		float nearDistance = nodes[nearIndex].Intersect(ray, inverseDirection, hitDistance);
+		float farDistance = nodes[farIndex].Intersect(ray, inverseDirection, hitDistance);
+
+		if (nearDistance > farDistance)
+		{
+			std::swap(nearDistance, farDistance);
+			std::swap(nearIndex, farIndex);
+		}
+
+		if (nearDistance == FLT_MAX)
+		{
+			if (stackPointer == 0)
+				break;
+
+			node = &nodes[stack[--stackPointer]];
+			continue;
+		}
+
+		node = &nodes[nearIndex];
+		if (farDistance != FLT_MAX)
+		{
+			RT_BVH_STACK_CHECK(stackPointer);
+			stack[stackPointer++] = farIndex;
+		}
+	}
+
+	WL_PROFILE_COUNT("BVH Nodes Visited", nodesVisited);
+
+	return found;
+}
+
+bool InstanceBVH::IsOccluded(const Ray& ray, float maxDistance) const
+{
+	if (m_Nodes.empty())
+		return false;
+
+	glm::vec3 inverseDirection = BVHNode::GetInverseDirection(ray.Direction);
+
+	uint32_t stack[Utils::BVHStackSize];
+	int stackPointer = 0;
+
+	const BVHNode* nodes = m_Nodes.data();
+	const BVHNode* node = &nodes[0];
+	if (node->Intersect(ray, inverseDirection, maxDistance) == FLT_MAX)
+		return false;
+
+	while (true)
+	{
+		if (node->IsLeaf())
+		{
+			for (uint32_t i = 0; i < node->PrimitiveCount; i++)
+			{
+				const Instance& instance = m_Instances[m_InstanceIndices[node->LeftFirst + i]];
+
+				Ray objectRay;
+				objectRay.Origin = glm::vec3(instance.WorldToObject * glm::vec4(ray.Origin, 1.0f));
+				objectRay.Direction = glm::vec3(instance.WorldToObject * glm::vec4(ray.Direction, 0.0f));
+
+				if (instance.Geometry->IsOccluded(objectRay, maxDistance))
+					return true;
+			}
+
+			if (stackPointer == 0)
+				break;
+
+			node = &nodes[stack[--stackPointer]];
+			continue;
+		}
+
+		uint32_t leftIndex = node->LeftFirst;
+		uint32_t rightIndex = node->LeftFirst + 1;
+		bool left = nodes[leftIndex].Intersect(ray, inverseDirection, maxDistance) != FLT_MAX;
+		bool right = nodes[rightIndex].Intersect(ray, inverseDirection, maxDistance) != FLT_MAX;
+
+		if (left && right)
+		{
+			node = &nodes[leftIndex];
+			RT_BVH_STACK_CHECK(stackPointer);
+			stack[stackPointer++] = rightIndex;
+		}
+		else if (left || right)
+		{
+			node = &nodes[left ? leftIndex : rightIndex];
+		}
+		else
+		{
+			if (stackPointer == 0)
+				break;
+
+			node = &nodes[stack[--stackPointer]];
+		}
+	}
+
+	return false;
+}
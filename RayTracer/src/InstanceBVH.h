@@ -0,0 +1,63 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <unordered_map>
+#include <vector>
+
+#include "BVHBuilder.h"
+#include "MeshBVH.h"
+#include "Ray.h"
+#include "Scene.h"
+
+// Two-level hierarchy over Scene::Meshes. The bottom level is one MeshBVH per unique geometry, in object space and
+// shared by every mesh placing it. The top level is a BVH over the world bounds of the meshes, its leaves move the ray
+// into the mesh's object space and hand it to the geometry's MeshBVH. Moving a mesh only rebuilds the top level,
+// a build over one box per mesh.
+class InstanceBVH
+{
+public:
+	struct Hit
+	{
+		// Into Scene::Meshes
+		uint32_t Instance = 0;
+		MeshBVH::Hit Triangle;
+	};
+public:
+	// Builds hierarchies for new geometry, drops the ones no mesh uses anymore and rebuilds the top level if any mesh
+	// changed. Returns true if anything was rebuilt.
+	bool Update(const std::vector<Mesh>& meshes);
+
+	// Returns true and shrinks hitDistance if a triangle is closer than hitDistance
+	bool Intersect(const Ray& ray, float& hitDistance, Hit& hit) const;
+	// Shadow rays: true if any mesh is hit closer than maxDistance, stops at the first one found
+	bool IsOccluded(const Ray& ray, float maxDistance) const;
+
+	const MeshGeometry& GetGeometry(uint32_t instance) const { return *m_Instances[instance].Geometry->GetGeometry(); }
+	const glm::mat4& GetTransform(uint32_t instance) const { return m_BuiltTransforms[instance]; }
+	// Object to world for normals, the inverse transpose of the transform
+	const glm::mat3& GetNormalMatrix(uint32_t instance) const { return m_Instances[instance].NormalMatrix; }
+
+	uint32_t GetInstanceCount() const { return (uint32_t)m_Instances.size(); }
+	uint32_t GetGeometryCount() const { return (uint32_t)m_GeometryBVHs.size(); }
+private:
+	struct Instance
+	{
+		// Rays are moved into object space but not renormalized, so hit distances stay world distances
+		glm::mat4 WorldToObject{ 1.0f };
+		glm::mat3 NormalMatrix{ 1.0f };
+		const MeshBVH* Geometry = nullptr;
+	};
+private:
+	// Node based, the instances point at the values
+	std::unordered_map<const MeshGeometry*, MeshBVH> m_GeometryBVHs;
+
+	std::vector<Instance> m_Instances;
+	// What the top level was built from, to tell which meshes changed
+	std::vector<const MeshGeometry*> m_BuiltGeometries;
+	std::vector<glm::mat4> m_BuiltTransforms;
+
+	std::vector<BVHNode> m_Nodes;
+	// Instance indices in leaf order
+	std::vector<uint32_t> m_InstanceIndices;
+};
@@ -0,0 +1,182 @@
+#include "Json.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+bool JsonParser::Parse(JsonValue& value)
+{
+	if (!ParseValue(value))
+		return false;
+
+	SkipWhitespace();
+	if (m_Position != m_Text.size())
+		return Fail("trailing characters");
+
+	return true;
+}
+
+bool JsonParser::ParseValue(JsonValue& value)
+{
+	SkipWhitespace();
+	if (m_Position >= m_Text.size())
+		return Fail("unexpected end of file");
+
+	char c = m_Text[m_Position];
+	if (c == '{')
+		return ParseObject(value);
+	if (c == '[')
+		return ParseArray(value);
+	if (c == '"')
+	{
+		value.ValueType = JsonValue::Type::String;
+		return ParseString(value.String);
+	}
+	if (Consume("true"))
+	{
+		value.ValueType = JsonValue::Type::Bool;
+		value.Bool = true;
+		return true;
+	}
+	if (Consume("false"))
+	{
+		value.ValueType = JsonValue::Type::Bool;
+		value.Bool = false;
+		return true;
+	}
+	if (Consume("null"))
+	{
+		value.ValueType = JsonValue::Type::Null;
+		return true;
+	}
+
+	return ParseNumber(value);
+}
+
+bool JsonParser::ParseObject(JsonValue& value)
+{
+	value.ValueType = JsonValue::Type::Object;
+	m_Position++; // {
+
+	SkipWhitespace();
+	if (Consume("}"))
+		return true;
+
+	while (true)
+	{
+		SkipWhitespace();
+		std::string key;
+		if (!ParseString(key))
+			return false;
+
+		SkipWhitespace();
+		if (!Consume(":"))
+			return Fail("expected ':'");
+
+		JsonValue member;
+		if (!ParseValue(member))
+			return false;
+		value.Members.emplace_back(std::move(key), std::move(member));
+
+		SkipWhitespace();
+		if (Consume("}"))
+			return true;
+		if (!Consume(","))
+			return Fail("expected ',' or '}'");
+	}
+}
+
+bool JsonParser::ParseArray(JsonValue& value)
+{
+	value.ValueType = JsonValue::Type::Array;
+	m_Position++; // [
+
+	SkipWhitespace();
+	if (Consume("]"))
+		return true;
+
+	while (true)
+	{
+		JsonValue& element = value.Elements.emplace_back();
+		if (!ParseValue(element))
+			return false;
+
+		SkipWhitespace();
+		if (Consume("]"))
+			return true;
+		if (!Consume(","))
+			return Fail("expected ',' or ']'");
+	}
+}
+
+bool JsonParser::ParseString(std::string& string)
+{
+	if (!Consume("\""))
+		return Fail("expected string");
+
+	while (m_Position < m_Text.size())
+	{
+		char c = m_Text[m_Position++];
+		if (c == '"')
+			return true;
+
+		// Scene files only need the simple escapes
+		if (c == '\\' && m_Position < m_Text.size())
+		{
+			char escaped = m_Text[m_Position++];
+			switch (escaped)
+			{
+				case 'n': c = '\n'; break;
+				case 't': c = '\t'; break;
+				default:  c = escaped; break;
+			}
+		}
+
+		string += c;
+	}
+
+	return Fail("unterminated string");
+}
+
+bool JsonParser::ParseNumber(JsonValue& value)
+{
+	const char* begin = m_Text.c_str() + m_Position;
+	char* end = nullptr;
+	value.Number = std::strtod(begin, &end);
+	if (end == begin)
+		return Fail("unexpected character");
+
+	value.ValueType = JsonValue::Type::Number;
+	m_Position += end - begin;
+	return true;
+}
+
+void JsonParser::SkipWhitespace()
+{
+	while (m_Position < m_Text.size() && std::isspace((unsigned char)m_Text[m_Position]))
+		m_Position++;
+}
+
+bool JsonParser::Consume(const char* token)
+{
+	size_t length = strlen(token);
+	if (m_Text.compare(m_Position, length, token) != 0)
+		return false;
+
+	m_Position += length;
+	return true;
+}
+
+bool JsonParser::Fail(const char* message)
+{
+	// Report a line number, that is what people look for in a hand edited scene
+	size_t line = 1;
+	for (size_t i = 0; i < m_Position && i < m_Text.size(); i++)
+	{
+		if (m_Text[i] == '\n')
+			line++;
+	}
+
+	m_Error = std::string(message) + " on line " + std::to_string(line);
+	return false;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// Just enough JSON for scene files and glTF headers, there is no JSON library in the tree
+struct JsonValue
+{
+	enum class Type { Null, Bool, Number, String, Array, Object };
+
+	Type ValueType = Type::Null;
+	bool Bool = false;
+	double Number = 0.0;
+	std::string String;
+	std::vector<JsonValue> Elements;
+	std::vector<std::pair<std::string, JsonValue>> Members;
+
+	const JsonValue* Find(const char* key) const
+	{
+		for (const auto& [name, value] : Members)
+		{
+			if (name == key)
+				return &value;
+		}
+		return nullptr;
+	}
+
+	// Number member of an object, fallback if it is missing or not a number
+	double GetNumber(const char* key, double fallback) const
+	{
+		const JsonValue* member = Find(key);
+		return member && member->ValueType == Type::Number ? member->Number : fallback;
+	}
+};
+
+class JsonParser
+{
+public:
+	// The text has to outlive the parser
+	JsonParser(const std::string& text)
+		: m_Text(text) {}
+
+	bool Parse(JsonValue& value);
+
+	const std::string& GetError() const { return m_Error; }
+private:
+	bool ParseValue(JsonValue& value);
+	bool ParseObject(JsonValue& value);
+	bool ParseArray(JsonValue& value);
+	bool ParseString(std::string& string);
+	bool ParseNumber(JsonValue& value);
+
+	void SkipWhitespace();
+	bool Consume(const char* token);
+	bool Fail(const char* message);
+private:
+	const std::string& m_Text;
+	size_t m_Position = 0;
+	std::string m_Error;
+};
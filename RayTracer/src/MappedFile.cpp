@@ -0,0 +1,135 @@
+#include "MappedFile.h"
+
+#include <iostream>
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const std::string& filepath)
+{
+	Close();
+
+	HANDLE file = CreateFileA(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		std::cerr << "[MappedFile] Could not open " << filepath << "\n";
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size))
+	{
+		std::cerr << "[MappedFile] Could not get the size of " << filepath << "\n";
+		CloseHandle(file);
+		return false;
+	}
+
+	m_File = file;
+	m_Size = (size_t)size.QuadPart;
+
+	// Empty files cannot be mapped, they are still valid files
+	if (m_Size == 0)
+		return true;
+
+	m_Mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (m_Mapping)
+		m_Data = (const char*)MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0);
+
+	if (!m_Data)
+	{
+		std::cerr << "[MappedFile] Could not map " << filepath << "\n";
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_Data)
+		UnmapViewOfFile(m_Data);
+	if (m_Mapping)
+		CloseHandle(m_Mapping);
+	if (m_File)
+		CloseHandle(m_File);
+
+	m_Data = nullptr;
+	m_Mapping = nullptr;
+	m_File = nullptr;
+	m_Size = 0;
+}
+
+#else
+
+bool MappedFile::Open(const std::string& filepath)
+{
+	Close();
+
+	int file = open(filepath.c_str(), O_RDONLY);
+	if (file < 0)
+	{
+		std::cerr << "[MappedFile] Could not open " << filepath << "\n";
+		return false;
+	}
+
+	struct stat status;
+	if (fstat(file, &status) != 0)
+	{
+		std::cerr << "[MappedFile] Could not get the size of " << filepath << "\n";
+		close(file);
+		return false;
+	}
+
+	m_Size = (size_t)status.st_size;
+
+	// Empty files cannot be mapped, they are still valid files
+	if (m_Size == 0)
+	{
+		close(file);
+		return true;
+	}
+
+	void* data = mmap(nullptr, m_Size, PROT_READ, MAP_PRIVATE, file, 0);
+	// The mapping keeps its own reference to the file
+	close(file);
+
+	if (data == MAP_FAILED)
+	{
+		std::cerr << "[MappedFile] Could not map " << filepath << "\n";
+		m_Size = 0;
+		return false;
+	}
+
+	// Loaders parse every part of the file at once, start reading all of it in
+	madvise(data, m_Size, MADV_WILLNEED);
+
+	m_Data = (const char*)data;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_Data)
+		munmap((void*)m_Data, m_Size);
+
+	m_Data = nullptr;
+	m_Size = 0;
+}
+
+#endif
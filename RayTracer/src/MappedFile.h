@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only memory mapping of a whole file. Pages are read in by the OS the first time they
+// are touched, so large files are parsed straight out of the page cache without a copy.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Returns false and prints the reason to stderr on failure
+	bool Open(const std::string& filepath);
+	void Close();
+
+	const char* GetData() const { return m_Data; }
+	size_t GetSize() const { return m_Size; }
+private:
+	const char* m_Data = nullptr;
+	size_t m_Size = 0;
+
+#ifdef _WIN32
+	void* m_File = nullptr;
+	void* m_Mapping = nullptr;
+#endif
+};
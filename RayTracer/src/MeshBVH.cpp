@@ -0,0 +1,241 @@
+#include "MeshBVH.h"
+
+#include <algorithm>
+
+#include "Walnut/Profiler.h"
+
+namespace Utils {
+
+	static constexpr int BVHStackSize = BVHBuilder::MaxDepth;
+
+	// Möller and Trumbore 1997, returns the distance or FLT_MAX on a miss
+	static float IntersectTriangle(const Ray& ray, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, glm::vec2& barycentrics)
+	{
+		glm::vec3 edge1 = v1 - v0;
+		glm::vec3 edge2 = v2 - v0;
+
+		glm::vec3 p = glm::cross(ray.Direction, edge2);
+		float determinant = glm::dot(edge1, p);
+
+		// Parallel to the triangle
+		if (glm::abs(determinant) < 1e-12f)
+			return FLT_MAX;
+
+		float inverseDeterminant = 1.0f / determinant;
+
+		glm::vec3 t = ray.Origin - v0;
+		float u = glm::dot(t, p) * inverseDeterminant;
+		if (u < 0.0f || u > 1.0f)
+			return FLT_MAX;
+
+		glm::vec3 q = glm::cross(t, edge1);
+		float v = glm::dot(ray.Direction, q) * inverseDeterminant;
+		if (v < 0.0f || u + v > 1.0f)
+			return FLT_MAX;
+
+		float distance = glm::dot(edge2, q) * inverseDeterminant;
+		if (distance <= 0.0f)
+			return FLT_MAX;
+
+		barycentrics = { u, v };
+		return distance;
+	}
+
+}
+
+void MeshBVH::Build(std::shared_ptr<const MeshGeometry> geometry)
+{
+	m_Geometry = std::move(geometry);
+	m_BuiltNodes.clear();
+	m_BuiltTriangles.clear();
+
+	if (m_Geometry && !m_Geometry->BVHNodes.empty())
+	{
+		m_Nodes = m_Geometry->BVHNodes;
+		m_Triangles = m_Geometry->BVHTriangles;
+		return;
+	}
+
+	uint32_t triangleCount = m_Geometry ? m_Geometry->GetTriangleCount() : 0;
+
+	std::vector<AABB> bounds(triangleCount);
+	for (uint32_t i = 0; i < triangleCount; i++)
+	{
+		const uint32_t* indices = m_Geometry->Indices.data() + i * 3;
+		for (int corner = 0; corner < 3; corner++)
+			bounds[i].Grow(m_Geometry->Positions[indices[corner]]);
+	}
+
+	// Triangles are tested one at a time, no block size to round to
+	BVHBuilder::Build(bounds, 1, m_BuiltNodes, m_BuiltTriangles);
+	m_Nodes = m_BuiltNodes;
+	m_Triangles = m_BuiltTriangles;
+}
+
+bool MeshBVH::Intersect(const Ray& ray, float& hitDistance, Hit& hit) const
+{
+	if (m_Nodes.empty())
+		return false;
+
+	const glm::vec3* positions = m_Geometry->Positions.data();
+	const uint32_t* indices = m_Geometry->Indices.data();
+
+	glm::vec3 inverseDirection = BVHNode::GetInverseDirection(ray.Direction);
+
+	uint32_t stack[Utils::BVHStackSize];
+	int stackPointer = 0;
+
+	const BVHNode* nodes = m_Nodes.data();
+	const uint32_t* triangles = m_Triangles.data();
+
+	const BVHNode* node = &nodes[0];
+	if (node->Intersect(ray, inverseDirection, hitDistance) == FLT_MAX)
+		return false;
+
+	bool found = false;
+	// Kept in registers, handed to the profiler once per ray
+	uint32_t nodesVisited = 0;
+	uint32_t intersectionTests = 0;
+
+	while (true)
+	{
+		nodesVisited++;
+
+		if (node->IsLeaf())
+		{
+			intersectionTests += node->PrimitiveCount;
+			for (uint32_t i = 0; i < node->PrimitiveCount; i++)
+			{
+				uint32_t triangle = triangles[node->LeftFirst + i];
+				const uint32_t* corners = indices + triangle * 3;
+
+				glm::vec2 barycentrics;
+				float distance = Utils::IntersectTriangle(ray, positions[corners[0]], positions[corners[1]], positions[corners[2]], barycentrics);
+				if (distance < hitDistance)
+				{
+					hitDistance = distance;
+					hit.Triangle = triangle;
+					hit.Barycentrics = barycentrics;
+					found = true;
+				}
+			}
+
+			if (stackPointer == 0)
+				break;
+
+			node = &nodes[stack[--stackPointer]];
+			continue;
+		}
+
+		uint32_t nearIndex = node->LeftFirst;
+		uint32_t farIndex = node->LeftFirst + 1;
+
+		float nearDistance = nodes[nearIndex].Intersect(ray, inverseDirection, hitDistance);
+		float farDistance = nodes[farIndex].Intersect(ray, inverseDirection, hitDistance);
+
+		// Visit the closer child first so hitDistance shrinks as early as possible
+		if (nearDistance > farDistance)
+		{
+			std::swap(nearDistance, farDistance);
+			std::swap(nearIndex, farIndex);
+		}
+
+		if (nearDistance == FLT_MAX)
+		{
+			if (stackPointer == 0)
+				break;
+
+			node = &nodes[stack[--stackPointer]];
+			continue;
+		}
+
+		node = &nodes[nearIndex];
+		if (farDistance != FLT_MAX)
+		{
+			RT_BVH_STACK_CHECK(stackPointer);
+			stack[stackPointer++] = farIndex;
+		}
+	}
+
+	WL_PROFILE_COUNT("BVH Nodes Visited", nodesVisited);
+	WL_PROFILE_COUNT("Intersection Tests", intersectionTests);
+
+	return found;
+}
+
+bool MeshBVH::IsOccluded(const Ray& ray, float maxDistance) const
+{
+	if (m_Nodes.empty())
+		return false;
+
+	const glm::vec3* positions = m_Geometry->Positions.data();
+	const uint32_t* indices = m_Geometry->Indices.data();
+
+	glm::vec3 inverseDirection = BVHNode::GetInverseDirection(ray.Direction);
+
+	uint32_t stack[Utils::BVHStackSize];
+	int stackPointer = 0;
+
+	const BVHNode* nodes = m_Nodes.data();
+	const uint32_t* triangles = m_Triangles.data();
+
+	const BVHNode* node = &nodes[0];
+	if (node->Intersect(ray, inverseDirection, maxDistance) == FLT_MAX)
+		return false;
+
+	uint32_t nodesVisited = 0;
+
+	while (true)
+	{
+		nodesVisited++;
+
+		if (node->IsLeaf())
+		{
+			for (uint32_t i = 0; i < node->PrimitiveCount; i++)
+			{
+				const uint32_t* corners = indices + triangles[node->LeftFirst + i] * 3;
+
+				glm::vec2 barycentrics;
+				if (Utils::IntersectTriangle(ray, positions[corners[0]], positions[corners[1]], positions[corners[2]], barycentrics) < maxDistance)
+				{
+					WL_PROFILE_COUNT("BVH Nodes Visited", nodesVisited);
+					return true;
+				}
+			}
+
+			if (stackPointer == 0)
+				break;
+
+			node = &nodes[stack[--stackPointer]];
+			continue;
+		}
+
+		// No closest hit to find, so no point in ordering the children
+		uint32_t leftIndex = node->LeftFirst;
+		uint32_t rightIndex = node->LeftFirst + 1;
+		bool left = nodes[leftIndex].Intersect(ray, inverseDirection, maxDistance) != FLT_MAX;
+		bool right = nodes[rightIndex].Intersect(ray, inverseDirection, maxDistance) != FLT_MAX;
+
+		if (left && right)
+		{
+			node = &nodes[leftIndex];
+			RT_BVH_STACK_CHECK(stackPointer);
+			stack[stackPointer++] = rightIndex;
+		}
+		else if (left || right)
+		{
+			node = &nodes[left ? leftIndex : rightIndex];
+		}
+		else
+		{
+			if (stackPointer == 0)
+				break;
+
+			node = &nodes[stack[--stackPointer]];
+		}
+	}
+
+	WL_PROFILE_COUNT("BVH Nodes Visited", nodesVisited);
+
+	return false;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <memory>
+#include <vector>
+
+#include "ArrayView.h"
+#include "BVHBuilder.h"
+#include "Ray.h"
+#include "Scene.h"
+
+// Bounding volume hierarchy over the triangles of one MeshGeometry, built by BVHBuilder
+// or taken as is from the geometry when it came from a scene cache.
+// Keeps the geometry alive, leaves read the vertices through its index buffer.
+class MeshBVH
+{
+public:
+	struct Hit
+	{
+		uint32_t Triangle = 0;
+		// Weights of the triangle's second and third vertex
+		glm::vec2 Barycentrics{ 0.0f };
+	};
+public:
+	MeshBVH() = default;
+	// The views may point into this object's own arrays, moving keeps them valid and copying would not
+	MeshBVH(const MeshBVH&) = delete;
+	MeshBVH& operator=(const MeshBVH&) = delete;
+	MeshBVH(MeshBVH&&) = default;
+	MeshBVH& operator=(MeshBVH&&) = default;
+
+	void Build(std::shared_ptr<const MeshGeometry> geometry);
+
+	// Möller-Trumbore against every triangle the ray reaches, returns true and shrinks hitDistance
+	// if one is closer than hitDistance. Triangles are double sided.
+	bool Intersect(const Ray& ray, float& hitDistance, Hit& hit) const;
+	// Shadow rays: true if any triangle is hit closer than maxDistance, stops at the first one found
+	bool IsOccluded(const Ray& ray, float maxDistance) const;
+
+	const MeshGeometry* GetGeometry() const { return m_Geometry.get(); }
+	ArrayView<const BVHNode> GetNodes() const { return m_Nodes; }
+	ArrayView<const uint32_t> GetTriangles() const { return m_Triangles; }
+private:
+	std::shared_ptr<const MeshGeometry> m_Geometry;
+	// Into the geometry's prebuilt hierarchy or the built one below
+	ArrayView<const BVHNode> m_Nodes;
+	// Triangle indices in leaf order
+	ArrayView<const uint32_t> m_Triangles;
+
+	std::vector<BVHNode> m_BuiltNodes;
+	std::vector<uint32_t> m_BuiltTriangles;
+};
@@ -0,0 +1,829 @@
+#include "MeshLoader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "Json.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+namespace Utils {
+
+	// Chunks smaller than this are not worth a task of their own
+	static constexpr size_t OBJMinChunkSize = 1 << 20;
+	// More chunks than workers, lines are not spread evenly over the file
+	static constexpr uint32_t OBJChunksPerWorker = 4;
+
+	// glTF copies are split into tasks of this many elements
+	static constexpr uint32_t GLTFElementsPerTask = 1 << 16;
+
+	static bool IsSpace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	static void SkipSpaces(const char*& p, const char* end)
+	{
+		while (p < end && IsSpace(*p))
+			p++;
+	}
+
+	static const char* FindLineEnd(const char* p, const char* end)
+	{
+		const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+		return lineEnd ? lineEnd : end;
+	}
+
+	// Stops at the first character that cannot continue the number, no terminator needed
+	static bool ParseInt(const char*& p, const char* end, int64_t& value)
+	{
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negative = *p++ == '-';
+
+		const char* digits = p;
+		value = 0;
+		while (p < end && *p >= '0' && *p <= '9')
+			value = value * 10 + (*p++ - '0');
+
+		if (negative)
+			value = -value;
+		return p != digits;
+	}
+
+	static bool ParseFloat(const char*& p, const char* end, float& value)
+	{
+		static constexpr double s_PowersOfTen[] = {
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+		};
+
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negative = *p++ == '-';
+
+		// Digits past the 19th do not fit the mantissa and only shift the exponent
+		uint64_t mantissa = 0;
+		int exponent = 0;
+		int digitCount = 0;
+		bool anyDigits = false;
+
+		for (; p < end && *p >= '0' && *p <= '9'; p++, anyDigits = true)
+		{
+			if (digitCount < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				digitCount += mantissa != 0;
+			}
+			else
+			{
+				exponent++;
+			}
+		}
+
+		if (p < end && *p == '.')
+		{
+			for (p++; p < end && *p >= '0' && *p <= '9'; p++, anyDigits = true)
+			{
+				if (digitCount < 19)
+				{
+					mantissa = mantissa * 10 + (*p - '0');
+					digitCount += mantissa != 0;
+					exponent--;
+				}
+			}
+		}
+
+		if (!anyDigits)
+			return false;
+
+		if (p < end && (*p == 'e' || *p == 'E'))
+		{
+			const char* exponentStart = p++;
+			int64_t explicitExponent = 0;
+			if (ParseInt(p, end, explicitExponent))
+				exponent += (int)std::clamp<int64_t>(explicitExponent, -1000, 1000);
+			else
+				p = exponentStart;
+		}
+
+		double result = (double)mantissa;
+		while (exponent > 22 && result != 0.0)
+		{
+			result *= 1e22;
+			exponent -= 22;
+		}
+		while (exponent < -22 && result != 0.0)
+		{
+			result /= 1e22;
+			exponent += 22;
+		}
+
+		if (result != 0.0)
+			result = exponent >= 0 ? result * s_PowersOfTen[exponent] : result / s_PowersOfTen[-exponent];
+
+		value = (float)(negative ? -result : result);
+		return true;
+	}
+
+	static bool ParseVec3(const char*& p, const char* end, glm::vec3& value)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			SkipSpaces(p, end);
+			if (!ParseFloat(p, end, value[i]))
+				return false;
+		}
+		return true;
+	}
+
+	enum class OBJRecord { None, Position, Normal, Face };
+
+	// Leaves p after the keyword
+	static OBJRecord GetRecordType(const char*& p, const char* lineEnd)
+	{
+		SkipSpaces(p, lineEnd);
+		if (lineEnd - p < 2)
+			return OBJRecord::None;
+
+		if (p[0] == 'v' && IsSpace(p[1]))
+		{
+			p += 2;
+			return OBJRecord::Position;
+		}
+		if (p[0] == 'f' && IsSpace(p[1]))
+		{
+			p += 2;
+			return OBJRecord::Face;
+		}
+		if (lineEnd - p >= 3 && p[0] == 'v' && p[1] == 'n' && IsSpace(p[2]))
+		{
+			p += 3;
+			return OBJRecord::Normal;
+		}
+
+		return OBJRecord::None;
+	}
+
+	struct OBJChunk
+	{
+		const char* Begin = nullptr;
+		const char* End = nullptr;
+
+		// Counted by the first pass
+		uint32_t LineCount = 0;
+		uint32_t PositionCount = 0, NormalCount = 0, TriangleCount = 0;
+
+		// Prefix sums over the chunks before this one
+		uint32_t FirstLine = 0;
+		uint32_t FirstPosition = 0, FirstNormal = 0, FirstTriangle = 0;
+
+		const char* Error = nullptr;
+		const char* ErrorPosition = nullptr;
+	};
+
+	static void CountOBJChunk(OBJChunk& chunk)
+	{
+		const char* p = chunk.Begin;
+		while (p < chunk.End)
+		{
+			const char* lineEnd = FindLineEnd(p, chunk.End);
+			chunk.LineCount++;
+
+			switch (GetRecordType(p, lineEnd))
+			{
+				case OBJRecord::Position: chunk.PositionCount++; break;
+				case OBJRecord::Normal:   chunk.NormalCount++; break;
+				case OBJRecord::Face:
+				{
+					uint32_t cornerCount = 0;
+					while (true)
+					{
+						SkipSpaces(p, lineEnd);
+						if (p == lineEnd)
+							break;
+
+						cornerCount++;
+						while (p < lineEnd && !IsSpace(*p))
+							p++;
+					}
+
+					// Fewer corners are reported by the second pass
+					if (cornerCount >= 3)
+						chunk.TriangleCount += cornerCount - 2;
+					break;
+				}
+				default: break;
+			}
+
+			p = lineEnd < chunk.End ? lineEnd + 1 : chunk.End;
+		}
+	}
+
+	// OBJ indices start at 1, negative ones count back from the last vertex defined so far
+	static bool ResolveIndex(int64_t index, uint32_t definedSoFar, uint32_t total, uint32_t& result)
+	{
+		int64_t resolved = index > 0 ? index - 1 : (int64_t)definedSoFar + index;
+		if (index == 0 || resolved < 0 || resolved >= (int64_t)total)
+			return false;
+
+		result = (uint32_t)resolved;
+		return true;
+	}
+
+	static void ParseOBJChunk(OBJChunk& chunk, uint32_t totalPositions, uint32_t totalNormals, MeshData& geometry)
+	{
+		glm::vec3* positions = geometry.Positions.data() + chunk.FirstPosition;
+		glm::vec3* normals = geometry.Normals.data() + chunk.FirstNormal;
+		uint32_t* indices = geometry.Indices.data() + (size_t)chunk.FirstTriangle * 3;
+		uint32_t* normalIndices = totalNormals > 0 ? geometry.NormalIndices.data() + (size_t)chunk.FirstTriangle * 3 : nullptr;
+
+		uint32_t positionCount = 0, normalCount = 0;
+
+		auto fail = [&chunk](const char* message, const char* position)
+		{
+			chunk.Error = message;
+			chunk.ErrorPosition = position;
+		};
+
+		const char* p = chunk.Begin;
+		while (p < chunk.End)
+		{
+			const char* lineStart = p;
+			const char* lineEnd = FindLineEnd(p, chunk.End);
+
+			switch (GetRecordType(p, lineEnd))
+			{
+				case OBJRecord::Position:
+				{
+					if (!ParseVec3(p, lineEnd, positions[positionCount++]))
+						return fail("expected three coordinates", lineStart);
+					break;
+				}
+				case OBJRecord::Normal:
+				{
+					if (!ParseVec3(p, lineEnd, normals[normalCount++]))
+						return fail("expected three coordinates", lineStart);
+					break;
+				}
+				case OBJRecord::Face:
+				{
+					uint32_t positionsSoFar = chunk.FirstPosition + positionCount;
+					uint32_t normalsSoFar = chunk.FirstNormal + normalCount;
+
+					uint32_t firstPosition = 0, firstNormal = 0, previousPosition = 0, previousNormal = 0;
+					uint32_t cornerCount = 0;
+					while (true)
+					{
+						SkipSpaces(p, lineEnd);
+						if (p == lineEnd)
+							break;
+
+						// p, p/t, p//n or p/t/n, texture coordinates are skipped
+						int64_t index = 0;
+						uint32_t position = 0, normal = MeshGeometry::InvalidIndex;
+						if (!ParseInt(p, lineEnd, index) || !ResolveIndex(index, positionsSoFar, totalPositions, position))
+							return fail("invalid vertex index", lineStart);
+
+						if (p < lineEnd && *p == '/')
+						{
+							p++;
+							ParseInt(p, lineEnd, index);
+							if (p < lineEnd && *p == '/')
+							{
+								p++;
+								if (!ParseInt(p, lineEnd, index) || !ResolveIndex(index, normalsSoFar, totalNormals, normal))
+									return fail("invalid normal index", lineStart);
+							}
+						}
+
+						if (p < lineEnd && !IsSpace(*p))
+							return fail("unexpected character in face", lineStart);
+
+						if (cornerCount == 0)
+						{
+							firstPosition = position;
+							firstNormal = normal;
+						}
+						else if (cornerCount >= 2)
+						{
+							// Fan around the first corner
+							indices[0] = firstPosition;
+							indices[1] = previousPosition;
+							indices[2] = position;
+							indices += 3;
+
+							if (normalIndices)
+							{
+								normalIndices[0] = firstNormal;
+								normalIndices[1] = previousNormal;
+								normalIndices[2] = normal;
+								normalIndices += 3;
+							}
+						}
+
+						previousPosition = position;
+						previousNormal = normal;
+						cornerCount++;
+					}
+
+					if (cornerCount < 3)
+						return fail("face with fewer than three corners", lineStart);
+					break;
+				}
+				default: break;
+			}
+
+			p = lineEnd < chunk.End ? lineEnd + 1 : chunk.End;
+		}
+	}
+
+	struct GLTFAccessor
+	{
+		const char* Data = nullptr;
+		uint32_t Count = 0;
+		uint32_t Stride = 0;
+		uint32_t ComponentType = 0;
+	};
+
+	static constexpr uint32_t GLTFUnsignedByte = 5121;
+	static constexpr uint32_t GLTFUnsignedShort = 5123;
+	static constexpr uint32_t GLTFUnsignedInt = 5125;
+	static constexpr uint32_t GLTFFloat = 5126;
+	static constexpr uint32_t GLTFTriangles = 4;
+
+	static uint32_t GetComponentSize(uint32_t componentType)
+	{
+		switch (componentType)
+		{
+			case GLTFUnsignedByte:  return 1;
+			case GLTFUnsignedShort: return 2;
+			case GLTFUnsignedInt:   return 4;
+			case GLTFFloat:         return 4;
+			default:                return 0;
+		}
+	}
+
+	static const JsonValue* GetElement(const JsonValue& root, const char* array, double index)
+	{
+		const JsonValue* elements = root.Find(array);
+		if (!elements || index < 0.0 || index >= (double)elements->Elements.size())
+			return nullptr;
+		return &elements->Elements[(size_t)index];
+	}
+
+	// Resolves an accessor down to a pointer into one of the buffers, with every range checked
+	static bool GetAccessor(const JsonValue& root, double accessorIndex, const char* expectedType, const std::vector<std::pair<const char*, size_t>>& buffers,
+		GLTFAccessor& accessor, std::string& error)
+	{
+		const JsonValue* accessorNode = GetElement(root, "accessors", accessorIndex);
+		if (!accessorNode)
+		{
+			error = "missing accessor";
+			return false;
+		}
+
+		const JsonValue* type = accessorNode->Find("type");
+		if (!type || type->String != expectedType)
+		{
+			error = std::string("accessor is not ") + expectedType;
+			return false;
+		}
+
+		if (accessorNode->Find("sparse"))
+		{
+			error = "sparse accessors are not supported";
+			return false;
+		}
+
+		const JsonValue* viewNode = GetElement(root, "bufferViews", accessorNode->GetNumber("bufferView", -1.0));
+		if (!viewNode)
+		{
+			error = "accessor without a buffer view";
+			return false;
+		}
+
+		double bufferIndex = viewNode->GetNumber("buffer", -1.0);
+		if (bufferIndex < 0.0 || bufferIndex >= (double)buffers.size())
+		{
+			error = "buffer view with an invalid buffer";
+			return false;
+		}
+
+		accessor.ComponentType = (uint32_t)accessorNode->GetNumber("componentType", 0.0);
+		accessor.Count = (uint32_t)accessorNode->GetNumber("count", 0.0);
+
+		uint32_t componentCount = strcmp(expectedType, "VEC3") == 0 ? 3 : 1;
+		uint32_t elementSize = GetComponentSize(accessor.ComponentType) * componentCount;
+		if (elementSize == 0)
+		{
+			error = "unsupported component type";
+			return false;
+		}
+
+		accessor.Stride = (uint32_t)viewNode->GetNumber("byteStride", (double)elementSize);
+
+		const auto& [bufferData, bufferSize] = buffers[(size_t)bufferIndex];
+		double viewOffset = viewNode->GetNumber("byteOffset", 0.0);
+		double viewLength = viewNode->GetNumber("byteLength", 0.0);
+		double accessorOffset = accessorNode->GetNumber("byteOffset", 0.0);
+		double accessedLength = accessor.Count > 0 ? accessorOffset + (double)accessor.Stride * (accessor.Count - 1) + elementSize : 0.0;
+
+		if (viewOffset < 0.0 || viewOffset + viewLength > (double)bufferSize || accessorOffset < 0.0 || accessedLength > viewLength || accessor.Stride < elementSize)
+		{
+			error = "accessor out of buffer bounds";
+			return false;
+		}
+
+		accessor.Data = bufferData + (size_t)viewOffset + (size_t)accessorOffset;
+		return true;
+	}
+
+	static uint32_t ReadIndex(const GLTFAccessor& accessor, uint32_t i)
+	{
+		const char* element = accessor.Data + (size_t)i * accessor.Stride;
+		switch (accessor.ComponentType)
+		{
+			case GLTFUnsignedByte:  return (uint8_t)*element;
+			case GLTFUnsignedShort: { uint16_t value; memcpy(&value, element, sizeof(value)); return value; }
+			default:                { uint32_t value; memcpy(&value, element, sizeof(value)); return value; }
+		}
+	}
+
+	static glm::vec3 ReadVec3(const GLTFAccessor& accessor, uint32_t i)
+	{
+		glm::vec3 value;
+		memcpy(&value, accessor.Data + (size_t)i * accessor.Stride, sizeof(value));
+		return value;
+	}
+
+	struct GLTFPrimitive
+	{
+		GLTFAccessor Positions, Normals, Indices;
+		bool HasNormals = false, HasIndices = false;
+
+		uint32_t FirstVertex = 0, FirstIndex = 0;
+		uint32_t GetIndexCount() const { return HasIndices ? Indices.Count : Positions.Count; }
+	};
+
+	static bool LoadGLTF(const std::string& json, const std::vector<std::pair<const char*, size_t>>& buffers, ThreadPool& threadPool, MeshData& geometry, std::string& error)
+	{
+		JsonValue root;
+		JsonParser parser(json);
+		if (!parser.Parse(root) || root.ValueType != JsonValue::Type::Object)
+		{
+			error = parser.GetError().empty() ? "expected an object" : parser.GetError();
+			return false;
+		}
+
+		std::vector<GLTFPrimitive> primitives;
+		uint32_t vertexCount = 0, indexCount = 0;
+		bool anyNormals = false;
+
+		if (const JsonValue* meshes = root.Find("meshes"))
+		{
+			for (const JsonValue& mesh : meshes->Elements)
+			{
+				const JsonValue* primitiveNodes = mesh.Find("primitives");
+				if (!primitiveNodes)
+					continue;
+
+				for (const JsonValue& primitiveNode : primitiveNodes->Elements)
+				{
+					// Points and lines have nothing to intersect
+					if ((uint32_t)primitiveNode.GetNumber("mode", (double)GLTFTriangles) != GLTFTriangles)
+						continue;
+
+					const JsonValue* attributes = primitiveNode.Find("attributes");
+					if (!attributes || !attributes->Find("POSITION"))
+						continue;
+
+					GLTFPrimitive primitive;
+					if (!GetAccessor(root, attributes->GetNumber("POSITION", -1.0), "VEC3", buffers, primitive.Positions, error))
+						return false;
+
+					if (attributes->Find("NORMAL"))
+					{
+						if (!GetAccessor(root, attributes->GetNumber("NORMAL", -1.0), "VEC3", buffers, primitive.Normals, error))
+							return false;
+
+						primitive.HasNormals = primitive.Normals.Count == primitive.Positions.Count;
+						anyNormals |= primitive.HasNormals;
+					}
+
+					if (primitive.Positions.ComponentType != GLTFFloat || (primitive.HasNormals && primitive.Normals.ComponentType != GLTFFloat))
+					{
+						error = "quantized positions and normals are not supported";
+						return false;
+					}
+
+					if (primitiveNode.Find("indices"))
+					{
+						if (!GetAccessor(root, primitiveNode.GetNumber("indices", -1.0), "SCALAR", buffers, primitive.Indices, error))
+							return false;
+
+						if (primitive.Indices.ComponentType == GLTFFloat)
+						{
+							error = "float indices";
+							return false;
+						}
+						primitive.HasIndices = true;
+					}
+
+					if (primitive.GetIndexCount() % 3 != 0)
+					{
+						error = "triangle primitive with an index count that is not a multiple of 3";
+						return false;
+					}
+
+					primitive.FirstVertex = vertexCount;
+					primitive.FirstIndex = indexCount;
+					vertexCount += primitive.Positions.Count;
+					indexCount += primitive.GetIndexCount();
+					primitives.push_back(primitive);
+				}
+			}
+		}
+
+		geometry.Positions.resize(vertexCount);
+		geometry.Normals.resize(anyNormals ? vertexCount : 0);
+		geometry.Indices.resize(indexCount);
+		geometry.NormalIndices.clear();
+
+		// A task is a block of vertices or a block of indices of one primitive
+		struct Task
+		{
+			uint32_t Primitive;
+			bool Vertices;
+			uint32_t First, Count;
+		};
+
+		std::vector<Task> tasks;
+		for (uint32_t i = 0; i < (uint32_t)primitives.size(); i++)
+		{
+			for (uint32_t first = 0; first < primitives[i].Positions.Count; first += GLTFElementsPerTask)
+				tasks.push_back({ i, true, first, std::min(GLTFElementsPerTask, primitives[i].Positions.Count - first) });
+			for (uint32_t first = 0; first < primitives[i].GetIndexCount(); first += GLTFElementsPerTask)
+				tasks.push_back({ i, false, first, std::min(GLTFElementsPerTask, primitives[i].GetIndexCount() - first) });
+		}
+
+		std::atomic<bool> invalidIndex = false;
+		threadPool.Dispatch((uint32_t)tasks.size(), [&](uint32_t taskIndex, uint32_t workerIndex)
+		{
+			const Task& task = tasks[taskIndex];
+			const GLTFPrimitive& primitive = primitives[task.Primitive];
+
+			if (task.Vertices)
+			{
+				for (uint32_t i = task.First; i < task.First + task.Count; i++)
+				{
+					geometry.Positions[primitive.FirstVertex + i] = ReadVec3(primitive.Positions, i);
+					// Zero normals make the renderer fall back to the geometric one
+					if (anyNormals)
+						geometry.Normals[primitive.FirstVertex + i] = primitive.HasNormals ? ReadVec3(primitive.Normals, i) : glm::vec3(0.0f);
+				}
+				return;
+			}
+
+			for (uint32_t i = task.First; i < task.First + task.Count; i++)
+			{
+				uint32_t index = primitive.HasIndices ? ReadIndex(primitive.Indices, i) : i;
+				if (index >= primitive.Positions.Count)
+				{
+					invalidIndex = true;
+					index = 0;
+				}
+				geometry.Indices[primitive.FirstIndex + i] = primitive.FirstVertex + index;
+			}
+		});
+
+		if (invalidIndex)
+		{
+			error = "index out of range";
+			return false;
+		}
+
+		return true;
+	}
+
+	static bool LoadGLB(const MappedFile& file, ThreadPool& threadPool, MeshData& geometry, std::string& error)
+	{
+		static constexpr uint32_t s_Magic = 0x46546c67; // "glTF"
+		static constexpr uint32_t s_JsonChunk = 0x4e4f534a;
+		static constexpr uint32_t s_BinaryChunk = 0x004e4942;
+
+		const char* data = file.GetData();
+		size_t size = file.GetSize();
+
+		uint32_t header[3];
+		if (size < sizeof(header) + 8)
+		{
+			error = "file too small";
+			return false;
+		}
+
+		memcpy(header, data, sizeof(header));
+		if (header[0] != s_Magic || header[1] != 2)
+		{
+			error = "not a glTF 2.0 binary";
+			return false;
+		}
+
+		std::string json;
+		std::vector<std::pair<const char*, size_t>> buffers;
+
+		// Chunks are 4 byte aligned: a length, a type and the data
+		size_t offset = sizeof(header);
+		while (offset + 8 <= size)
+		{
+			uint32_t chunkHeader[2];
+			memcpy(chunkHeader, data + offset, sizeof(chunkHeader));
+			offset += sizeof(chunkHeader);
+
+			if (chunkHeader[0] > size - offset)
+			{
+				error = "truncated chunk";
+				return false;
+			}
+
+			if (chunkHeader[1] == s_JsonChunk && json.empty())
+				json.assign(data + offset, chunkHeader[0]);
+			else if (chunkHeader[1] == s_BinaryChunk && buffers.empty())
+				buffers.emplace_back(data + offset, chunkHeader[0]);
+
+			offset += (chunkHeader[0] + 3) & ~3u;
+		}
+
+		if (json.empty())
+		{
+			error = "no JSON chunk";
+			return false;
+		}
+
+		return LoadGLTF(json, buffers, threadPool, geometry, error);
+	}
+
+	static std::string GetDirectory(const std::string& filepath)
+	{
+		size_t separator = filepath.find_last_of("/\\");
+		return separator == std::string::npos ? std::string() : filepath.substr(0, separator + 1);
+	}
+
+	static bool HasExtension(const std::string& filepath, const char* extension)
+	{
+		size_t length = strlen(extension);
+		if (filepath.size() < length)
+			return false;
+
+		for (size_t i = 0; i < length; i++)
+		{
+			if (tolower((unsigned char)filepath[filepath.size() - length + i]) != extension[i])
+				return false;
+		}
+		return true;
+	}
+
+}
+
+std::shared_ptr<MeshGeometry> MeshLoader::Load(const std::string& filepath)
+{
+	MappedFile file;
+	if (!file.Open(filepath))
+		return nullptr;
+
+	ThreadPool threadPool;
+	auto geometry = std::make_shared<MeshData>();
+	std::string error;
+	bool loaded = false;
+
+	if (Utils::HasExtension(filepath, ".obj"))
+	{
+		loaded = LoadOBJ(file.GetData(), file.GetSize(), threadPool, *geometry, error);
+	}
+	else if (Utils::HasExtension(filepath, ".glb"))
+	{
+		loaded = Utils::LoadGLB(file, threadPool, *geometry, error);
+	}
+	else if (Utils::HasExtension(filepath, ".gltf"))
+	{
+		std::string json(file.GetData() ? file.GetData() : "", file.GetSize());
+
+		// Buffers have to be known before the accessors can be resolved, so the header is parsed twice
+		JsonValue root;
+		JsonParser parser(json);
+		if (!parser.Parse(root))
+		{
+			std::cerr << "[MeshLoader] " << filepath << ": " << parser.GetError() << "\n";
+			return nullptr;
+		}
+
+		std::vector<std::unique_ptr<MappedFile>> bufferFiles;
+		std::vector<std::pair<const char*, size_t>> buffers;
+		if (const JsonValue* bufferNodes = root.Find("buffers"))
+		{
+			for (const JsonValue& bufferNode : bufferNodes->Elements)
+			{
+				const JsonValue* uri = bufferNode.Find("uri");
+				if (!uri || uri->String.empty() || uri->String.compare(0, 5, "data:") == 0)
+				{
+					std::cerr << "[MeshLoader] " << filepath << ": only buffers in separate files are supported\n";
+					return nullptr;
+				}
+
+				auto& bufferFile = bufferFiles.emplace_back(std::make_unique<MappedFile>());
+				if (!bufferFile->Open(Utils::GetDirectory(filepath) + uri->String))
+					return nullptr;
+				buffers.emplace_back(bufferFile->GetData(), bufferFile->GetSize());
+			}
+		}
+
+		loaded = Utils::LoadGLTF(json, buffers, threadPool, *geometry, error);
+	}
+	else
+	{
+		error = "unknown extension, expected .obj, .glb or .gltf";
+	}
+
+	if (!loaded)
+	{
+		std::cerr << "[MeshLoader] " << filepath << ": " << error << "\n";
+		return nullptr;
+	}
+
+	return MeshGeometry::Create(std::move(geometry));
+}
+
+bool MeshLoader::LoadOBJ(const char* data, size_t size, ThreadPool& threadPool, MeshData& geometry, std::string& error)
+{
+	uint32_t workerCount = threadPool.GetWorkerCount();
+	uint32_t chunkCount = (uint32_t)std::clamp<size_t>(size / Utils::OBJMinChunkSize, 1, workerCount * Utils::OBJChunksPerWorker);
+
+	// Split at line boundaries, every chunk starts right after a newline
+	std::vector<Utils::OBJChunk> chunks(chunkCount);
+	const char* end = data + size;
+	for (uint32_t i = 0; i < chunkCount; i++)
+	{
+		const char* begin = data + size * i / chunkCount;
+		if (i > 0)
+		{
+			begin = std::max(begin, chunks[i - 1].Begin);
+			const char* newline = (const char*)memchr(begin, '\n', end - begin);
+			begin = newline ? newline + 1 : end;
+		}
+		chunks[i].Begin = begin;
+	}
+	for (uint32_t i = 0; i < chunkCount; i++)
+		chunks[i].End = i + 1 < chunkCount ? chunks[i + 1].Begin : end;
+
+	threadPool.Dispatch(chunkCount, [&chunks](uint32_t taskIndex, uint32_t workerIndex)
+	{
+		Utils::CountOBJChunk(chunks[taskIndex]);
+	});
+
+	// Every chunk writes to its own range of the output arrays
+	uint64_t lineCount = 0, positionCount = 0, normalCount = 0, triangleCount = 0;
+	for (Utils::OBJChunk& chunk : chunks)
+	{
+		chunk.FirstLine = (uint32_t)lineCount;
+		chunk.FirstPosition = (uint32_t)positionCount;
+		chunk.FirstNormal = (uint32_t)normalCount;
+		chunk.FirstTriangle = (uint32_t)triangleCount;
+
+		lineCount += chunk.LineCount;
+		positionCount += chunk.PositionCount;
+		normalCount += chunk.NormalCount;
+		triangleCount += chunk.TriangleCount;
+	}
+
+	if (positionCount >= MeshGeometry::InvalidIndex || triangleCount * 3 >= MeshGeometry::InvalidIndex)
+	{
+		error = "too many vertices or triangles";
+		return false;
+	}
+
+	geometry.Positions.resize((size_t)positionCount);
+	geometry.Normals.resize((size_t)normalCount);
+	geometry.Indices.resize((size_t)triangleCount * 3);
+	geometry.NormalIndices.resize(normalCount > 0 ? (size_t)triangleCount * 3 : 0);
+
+	threadPool.Dispatch(chunkCount, [&](uint32_t taskIndex, uint32_t workerIndex)
+	{
+		Utils::ParseOBJChunk(chunks[taskIndex], (uint32_t)positionCount, (uint32_t)normalCount, geometry);
+	});
+
+	for (const Utils::OBJChunk& chunk : chunks)
+	{
+		if (!chunk.Error)
+			continue;
+
+		uint32_t line = chunk.FirstLine + 1 + (uint32_t)std::count(chunk.Begin, chunk.ErrorPosition, '\n');
+		error = std::string(chunk.Error) + " on line " + std::to_string(line);
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "Scene.h"
+
+class ThreadPool;
+
+// Loads triangle meshes from memory-mapped files, parsing different parts of the file on every hardware thread.
+// Output arrays are sized up front, nothing is allocated per vertex, per face or per line.
+//
+//   .obj   v, vn and f records. Polygons are fan triangulated, negative (relative) indices are supported,
+//          everything else (texture coordinates, groups, materials) is skipped.
+//   .glb   Binary glTF 2.0, and .gltf with its buffers in separate files. Every triangle primitive of every
+//          mesh is merged into one geometry in mesh space, the node hierarchy and its transforms are ignored.
+//          Positions and normals have to be float VEC3, indices any unsigned integer type.
+class MeshLoader
+{
+public:
+	// Picks the format from the extension. Returns nullptr and prints the reason to stderr on failure.
+	static std::shared_ptr<MeshGeometry> Load(const std::string& filepath);
+
+	// Parses OBJ text already in memory, error gets the reason and line on failure
+	static bool LoadOBJ(const char* data, size_t size, ThreadPool& threadPool, MeshData& geometry, std::string& error);
+};
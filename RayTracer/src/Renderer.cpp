@@ -1,175 +1,1737 @@
 #include "Renderer.h"
-#include "Walnut/Random.h"
+#include "Walnut/Profiler.h"
+#include "Walnut/Timer.h"
 
-#include <execution>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <type_traits>
 
 namespace Utils {
 
-	static uint32_t ConvertToRGBA(const glm::vec4& color)
+	// Paths per task in every wavefront stage
+	static constexpr uint32_t WavefrontChunkSize = 1024;
+	// Rays per task of TraceRays and TraceOcclusion
+	static constexpr uint32_t QueryChunkSize = 1024;
+	// Marks a path that ended during shading
+	static constexpr uint32_t InvalidPath = 0xffffffff;
+
+	static constexpr float Pi = 3.14159265358979f;
+
+	// Sampler dimensions every decision reads. Values drawn together share a group of four, so they stay
+	// stratified against each other with the Sobol sampler.
+	static constexpr uint32_t CameraDimension = 0; // Subpixel position
+	static constexpr uint32_t FirstBounceDimension = Sampler::GroupSize;
+	static constexpr uint32_t BounceDimensions = 2 * Sampler::GroupSize;
+	// Within a bounce
+	static constexpr uint32_t LightDimension = 0; // Light pick, then a point on it
+	static constexpr uint32_t RouletteDimension = 3;
+	static constexpr uint32_t MaterialDimension = Sampler::GroupSize; // Lobe, then a direction
+
+	// Orthonormal basis around n, Duff et al. 2017
+	static void BuildBasis(const glm::vec3& n, glm::vec3& tangent, glm::vec3& bitangent)
+	{
+		float sign = std::copysign(1.0f, n.z);
+		float a = -1.0f / (sign + n.z);
+		float b = n.x * n.y * a;
+		tangent = { 1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x };
+		bitangent = { b, sign + n.y * n.y * a, -n.y };
+	}
+
+	static glm::vec3 FresnelSchlick(const glm::vec3& f0, float cosTheta)
+	{
+		float m = 1.0f - cosTheta;
+		float m2 = m * m;
+		return f0 + (1.0f - f0) * (m2 * m2 * m);
+	}
+
+	// Separable Smith masking for GGX, alpha2 is the squared GGX width
+	static float SmithG1(float alpha2, float cosTheta)
+	{
+		return 2.0f * cosTheta / (cosTheta + std::sqrt(alpha2 + (1.0f - alpha2) * cosTheta * cosTheta));
+	}
+
+	// GGX distribution of microfacet normals, alpha2 is the squared GGX width
+	static float GGX(float alpha2, float cosHalf)
+	{
+		float d = cosHalf * cosHalf * (alpha2 - 1.0f) + 1.0f;
+		return alpha2 / (Pi * d * d);
+	}
+
+	// What sampling and evaluating a material seen from one direction share
+	struct MaterialLobes
+	{
+		glm::vec3 F0;
+		// Reflectance of the Lambertian base, what Fresnel and the metallic part leave of the albedo
+		glm::vec3 Diffuse;
+		float CosView;
+		float Alpha2;
+		float SpecularProbability;
+	};
+
+	// Metallic-roughness material: a Lambertian base under a GGX specular lobe whose color goes from 4%
+	// grey for dielectrics to the albedo for metals
+	static MaterialLobes PrepareLobes(const Material& material, const glm::vec3& normal, const glm::vec3& view)
+	{
+		float metallic = glm::clamp(material.Metallic, 0.0f, 1.0f);
+		float roughness = glm::clamp(material.Roughness, 0.0f, 1.0f);
+
+		MaterialLobes lobes;
+		lobes.CosView = glm::max(glm::dot(normal, view), 1e-4f);
+		lobes.F0 = glm::mix(glm::vec3(0.04f), material.Albedo, metallic);
+
+		glm::vec3 fresnelView = FresnelSchlick(lobes.F0, lobes.CosView);
+		lobes.Diffuse = material.Albedo * (1.0f - metallic) * (1.0f - fresnelView);
+
+		// alpha = roughness^2
+		float alpha = roughness * roughness;
+		lobes.Alpha2 = glm::max(alpha * alpha, 1e-8f);
+
+		// Metals have no diffuse lobe, dielectrics reflect about as much as Fresnel says
+		lobes.SpecularProbability = glm::mix((fresnelView.x + fresnelView.y + fresnelView.z) / 3.0f, 1.0f, metallic);
+		return lobes;
+	}
+
+	// Density of SampleMaterial returning direction, over solid angle with both lobes combined
+	static float MaterialPdf(const MaterialLobes& lobes, const glm::vec3& normal, const glm::vec3& view, const glm::vec3& direction)
+	{
+		float cosLight = glm::dot(normal, direction);
+		if (cosLight <= 0.0f)
+			return 0.0f;
+
+		glm::vec3 half = glm::normalize(view + direction);
+		float viewDotHalf = glm::dot(view, half);
+		float cosHalf = glm::max(glm::dot(normal, half), 0.0f);
+
+		float pdf = (1.0f - lobes.SpecularProbability) * cosLight / Pi;
+		if (viewDotHalf > 0.0f)
+			pdf += lobes.SpecularProbability * GGX(lobes.Alpha2, cosHalf) * cosHalf / (4.0f * viewDotHalf);
+		return pdf;
+	}
+
+	// One lobe is picked at random and its importance sampled, weight is the BRDF times cosine over the pdf
+	// of the direction. pdf receives MaterialPdf for the direction. Returns false if the sample is absorbed.
+	static bool SampleMaterial(const Material& material, const glm::vec3& normal, const glm::vec3& view, Sampler& sampler,
+		glm::vec3& direction, glm::vec3& weight, float& pdf)
+	{
+		MaterialLobes lobes = PrepareLobes(material, normal, view);
+
+		glm::vec3 tangent, bitangent;
+		BuildBasis(normal, tangent, bitangent);
+
+		float lobe = sampler.Next();
+		glm::vec2 u = sampler.Next2D();
+		float u1 = u.x;
+		float u2 = u.y;
+		float phi = 2.0f * Pi * u2;
+
+		if (lobe >= lobes.SpecularProbability)
+		{
+			// Cosine weighted, the cosine and 1/pi cancel against the pdf
+			float radius = std::sqrt(u1);
+			direction = tangent * (radius * std::cos(phi)) + bitangent * (radius * std::sin(phi)) + normal * std::sqrt(1.0f - u1);
+			weight = lobes.Diffuse / (1.0f - lobes.SpecularProbability);
+			pdf = MaterialPdf(lobes, normal, view, direction);
+			return true;
+		}
+
+		// Microfacet normal from the GGX distribution
+		float cosHalf = std::sqrt((1.0f - u1) / (1.0f + (lobes.Alpha2 - 1.0f) * u1));
+		float sinHalf = std::sqrt(glm::max(1.0f - cosHalf * cosHalf, 0.0f));
+		glm::vec3 half = tangent * (sinHalf * std::cos(phi)) + bitangent * (sinHalf * std::sin(phi)) + normal * cosHalf;
+
+		float viewDotHalf = glm::dot(view, half);
+		direction = 2.0f * viewDotHalf * half - view;
+
+		float cosLight = glm::dot(normal, direction);
+		if (cosLight <= 0.0f || viewDotHalf <= 0.0f)
+			return false;
+
+		// D cancels against the pdf of half, leaving F * G * (v.h) / (n.v * n.h)
+		glm::vec3 fresnel = FresnelSchlick(lobes.F0, viewDotHalf);
+		float geometry = SmithG1(lobes.Alpha2, lobes.CosView) * SmithG1(lobes.Alpha2, cosLight);
+		weight = fresnel * (geometry * viewDotHalf / (lobes.CosView * cosHalf * lobes.SpecularProbability));
+		pdf = MaterialPdf(lobes, normal, view, direction);
+		return true;
+	}
+
+	// BRDF times cosine toward direction for light sampling, pdf receives what SampleMaterial's would be
+	static glm::vec3 EvaluateMaterial(const Material& material, const glm::vec3& normal, const glm::vec3& view, const glm::vec3& direction, float& pdf)
+	{
+		pdf = 0.0f;
+
+		float cosLight = glm::dot(normal, direction);
+		if (cosLight <= 0.0f)
+			return glm::vec3(0.0f);
+
+		MaterialLobes lobes = PrepareLobes(material, normal, view);
+		glm::vec3 result = lobes.Diffuse * (cosLight / Pi);
+
+		glm::vec3 half = glm::normalize(view + direction);
+		float viewDotHalf = glm::dot(view, half);
+		if (viewDotHalf > 0.0f)
+		{
+			// F * D * G / (4 * n.v * n.l), times n.l
+			float cosHalf = glm::max(glm::dot(normal, half), 0.0f);
+			float geometry = SmithG1(lobes.Alpha2, lobes.CosView) * SmithG1(lobes.Alpha2, cosLight);
+			result += FresnelSchlick(lobes.F0, viewDotHalf) * (GGX(lobes.Alpha2, cosHalf) * geometry / (4.0f * lobes.CosView));
+		}
+
+		pdf = MaterialPdf(lobes, normal, view, direction);
+		return result;
+	}
+
+	// The preview integrator's material: the albedo as a Lambertian surface, cosine sampled. Same outputs as SampleMaterial.
+	static void SampleDiffuse(const Material& material, const glm::vec3& normal, Sampler& sampler, glm::vec3& direction, glm::vec3& weight, float& pdf)
+	{
+		glm::vec3 tangent, bitangent;
+		BuildBasis(normal, tangent, bitangent);
+
+		glm::vec2 u = sampler.Next2D();
+		float radius = std::sqrt(u.x);
+		float phi = 2.0f * Pi * u.y;
+		float cosLight = std::sqrt(1.0f - u.x);
+		direction = tangent * (radius * std::cos(phi)) + bitangent * (radius * std::sin(phi)) + normal * cosLight;
+		weight = material.Albedo;
+		pdf = cosLight / Pi;
+	}
+
+	static glm::vec3 EvaluateDiffuse(const Material& material, const glm::vec3& normal, const glm::vec3& direction, float& pdf)
+	{
+		float cosLight = glm::max(glm::dot(normal, direction), 0.0f);
+		pdf = cosLight / Pi;
+		return material.Albedo * pdf;
+	}
+
+	// Veach's power heuristic with beta = 2, the weight of the strategy whose density is pdf
+	static float PowerHeuristic(float pdf, float otherPdf)
+	{
+		float a = pdf * pdf;
+		float b = otherPdf * otherPdf;
+		return a + b > 0.0f ? a / (a + b) : 0.0f;
+	}
+
+	// Solid angle a sphere covers seen from a point outside it, as 1 - cos of the cone's half angle.
+	// Written with the sine so small, distant lights keep their precision. Zero from inside the sphere.
+	static float SphereConeSize(const glm::vec3& point, const Sphere& sphere, float& cosMax)
+	{
+		glm::vec3 toCenter = sphere.Position - point;
+		float distanceSquared = glm::dot(toCenter, toCenter);
+		float radiusSquared = sphere.Radius * sphere.Radius;
+		if (distanceSquared <= radiusSquared)
+			return 0.0f;
+
+		float sinMaxSquared = radiusSquared / distanceSquared;
+		cosMax = std::sqrt(1.0f - sinMaxSquared);
+		return sinMaxSquared / (1.0f + cosMax);
+	}
+
+	// Copies the objects' versions, returns true if any of them or the count changed
+	template<typename T>
+	static bool UpdateVersions(const std::vector<T>& objects, std::vector<uint32_t>& versions)
 	{
-		uint8_t r = (uint8_t)(color.r * 255.0f);
-		uint8_t g = (uint8_t)(color.g * 255.0f);
-		uint8_t b = (uint8_t)(color.b * 255.0f);
-		uint8_t a = (uint8_t)(color.a * 255.0f);
+		bool changed = objects.size() != versions.size();
+		versions.resize(objects.size());
+		for (size_t i = 0; i < objects.size(); i++)
+		{
+			changed |= objects[i].Version != versions[i];
+			versions[i] = objects[i].Version;
+		}
+		return changed;
+	}
+
+	static bool IsMaterialUsed(const Scene& scene, int materialIndex)
+	{
+		for (const Sphere& sphere : scene.Spheres)
+		{
+			if (sphere.MaterialIndex == materialIndex)
+				return true;
+		}
+		for (const Mesh& mesh : scene.Meshes)
+		{
+			if (mesh.MaterialIndex == materialIndex)
+				return true;
+		}
+		return false;
+	}
+
+	// t in [0, 256], two channels per multiply
+	static uint32_t LerpRGBA8(uint32_t a, uint32_t b, uint32_t t)
+	{
+		uint32_t redBlue = (((a & 0x00ff00ff) * (256 - t) + (b & 0x00ff00ff) * t) >> 8) & 0x00ff00ff;
+		uint32_t greenAlpha = (((a >> 8) & 0x00ff00ff) * (256 - t) + ((b >> 8) & 0x00ff00ff) * t) & 0xff00ff00;
+		return redBlue | greenAlpha;
+	}
+
+}
+
+void Renderer::OnResize(uint32_t width, uint32_t height)
+{
+	if (m_Width == width && m_Height == height)
+		return;
+
+	m_Width = width;
+	m_Height = height;
+
+	UpdateRenderResolution();
+
+	// Whatever was accumulated belongs to the old size
+	ResetFrameIndex();
+}
+
+void Renderer::UpdateRenderResolution()
+{
+	uint32_t renderWidth = m_Width > 0 ? glm::max((uint32_t)((float)m_Width * m_RenderScale + 0.5f), 1u) : 0;
+	uint32_t renderHeight = m_Height > 0 ? glm::max((uint32_t)((float)m_Height * m_RenderScale + 0.5f), 1u) : 0;
+	if (renderWidth == m_RenderWidth && renderHeight == m_RenderHeight)
+		return;
+
+	m_RenderWidth = renderWidth;
+	m_RenderHeight = renderHeight;
+	m_Accumulation.Resize(renderWidth, renderHeight);
+
+	// Dynamic resolution switches back and forth on every camera move, so full resolution keeps the memory
+	if (renderWidth != m_Width || renderHeight != m_Height)
+		m_ScaledPixels.resize((size_t)renderWidth * renderHeight);
+	else
+		m_ScaledPixels.clear();
+
+	ResetFrameIndex();
+}
+
+void Renderer::UpdateRenderScale(bool moving)
+{
+	float scale = m_RenderScale;
+	if (!m_Settings.DynamicResolution)
+	{
+		scale = 1.0f;
+	}
+	else if (moving)
+	{
+		// Trace time is roughly proportional to the pixel count, which goes with the square of the scale.
+		// Only half the correction is applied per frame so a single slow frame does not make it oscillate.
+		if (m_LastCPUFrameTime > 0.0f)
+		{
+			float ideal = scale * std::sqrt(m_Settings.TargetFrameTime / m_LastCPUFrameTime);
+			scale = glm::mix(scale, ideal, 0.5f);
+		}
+	}
+	else
+	{
+		// Back to full resolution over a few frames, each one sharper than the last
+		scale *= 2.0f;
+	}
+
+	scale = glm::clamp(scale, glm::clamp(m_Settings.MinRenderScale, 0.05f, 1.0f), 1.0f);
+	// Steps of 1/32 keep timing noise from resizing the buffers every frame
+	scale = glm::min(std::ceil(scale * 32.0f) / 32.0f, 1.0f);
+
+	if (scale == m_RenderScale)
+		return;
+
+	m_RenderScale = scale;
+	UpdateRenderResolution();
+}
+
+void Renderer::Render(const Scene& scene, const Camera& camera)
+{
+	// The image is only created here, so a renderer driven through RenderFrame never touches Vulkan.
+	// The GPU backend and the display pass write it from compute shaders.
+	if (!m_FinalImage)
+	{
+		m_FinalImage = std::make_shared<Walnut::Image>(m_Width, m_Height, Walnut::ImageFormat::RGBA, nullptr, Walnut::ImageUsage::Storage);
+		m_FinalImage->SetReuseAllocation(true);
+	}
+	else if (m_FinalImage->GetWidth() != m_Width || m_FinalImage->GetHeight() != m_Height)
+		m_FinalImage->Resize(m_Width, m_Height);
+
+	m_ActiveScene = &scene;
+	m_ActiveCamera = &camera;
+
+	bool sceneChanged = false;
+	UpdateScene(scene, sceneChanged);
+
+	if (m_Settings.Backend == RenderBackend::GPU && RenderGPU(scene, camera, sceneChanged))
+	{
+		if (m_Settings.Accumulate)
+			m_FrameIndex++;
+		else
+			m_FrameIndex = 1;
+		return;
+	}
+
+	if (m_ActiveBackend != RenderBackend::CPU)
+	{
+		m_ActiveBackend = RenderBackend::CPU;
+		ResetFrameIndex();
+	}
+
+	if (m_Settings.HDRDisplay && !m_DisplayPass)
+		m_DisplayPass = std::make_unique<DisplayPass>();
+	bool hdr = m_Settings.HDRDisplay && m_DisplayPass->IsAvailable();
+
+	// The image already holds the converged result, leave the CPU idle until something changes
+	if (!IsConverged() || m_ResolvedHDR != hdr)
+	{
+		if (hdr)
+		{
+			// Allocated for the viewport and reusing that allocation, so whatever internal resolution RenderCPU picks fits the staging slot.
+			// The upload then takes the size the image has by EndStreamingWrite.
+			if (!m_HDRImage)
+			{
+				m_HDRImage = std::make_shared<Walnut::Image>(m_Width, m_Height, Walnut::ImageFormat::RGBA16F);
+				m_HDRImage->SetReuseAllocation(true);
+			}
+			else
+				m_HDRImage->Resize(m_Width, m_Height);
+
+			uint64_t* imageData = (uint64_t*)m_HDRImage->BeginStreamingWrite();
+			RenderCPU(nullptr, imageData, nullptr);
+			m_HDRImage->Resize(m_RenderWidth, m_RenderHeight);
+			m_HDRImage->EndStreamingWrite();
+		}
+		else
+		{
+			// Pixels go straight into the image's mapped staging memory, which may be write combined: write only
+			uint32_t* imageData = (uint32_t*)m_FinalImage->BeginStreamingWrite();
+			RenderCPU(imageData, nullptr, nullptr);
+			m_FinalImage->EndStreamingWrite();
+		}
+	}
+
+	// Every frame, converged or not, so tone mapping changes show without tracing anything
+	if (hdr)
+		m_DisplayPass->Render(*m_HDRImage, *m_FinalImage, m_Settings.ToneMapping, m_Settings.GammaCorrect);
+}
+
+bool Renderer::RenderFrame(const Scene& scene, const Camera& camera, uint32_t* pixels, const CancelCallback& isCancelled)
+{
+	m_ActiveScene = &scene;
+	m_ActiveCamera = &camera;
+
+	bool sceneChanged = false;
+	UpdateScene(scene, sceneChanged);
+	m_ActiveBackend = RenderBackend::CPU;
+
+	return RenderCPU(pixels, nullptr, isCancelled);
+}
+
+template<typename Function>
+void Renderer::DispatchQueries(const Scene& scene, uint32_t count, Function&& function)
+{
+	// Only the acceleration structures, the edits stay unseen for the next frame to reset and upload
+	UpdateAccelerationStructure(scene);
+
+	// Hits look up materials in the queried scene, the next frame sets its own
+	const Scene* activeScene = m_ActiveScene;
+	m_ActiveScene = &scene;
+
+	m_ThreadPool.Resize(m_Settings.ThreadCount);
+
+	uint32_t taskCount = (count + Utils::QueryChunkSize - 1) / Utils::QueryChunkSize;
+	m_ThreadPool.Dispatch(taskCount, [count, &function](uint32_t taskIndex, uint32_t workerIndex)
+	{
+		uint32_t first = taskIndex * Utils::QueryChunkSize;
+		function(first, glm::min(first + Utils::QueryChunkSize, count));
+	});
+
+	m_ActiveScene = activeScene;
+}
+
+void Renderer::TraceRays(const Scene& scene, const Ray* rays, HitPayload* hits, uint32_t count)
+{
+	WL_PROFILE_ZONE("Trace Rays");
+
+	DispatchQueries(scene, count, [this, rays, hits](uint32_t first, uint32_t last)
+	{
+		for (uint32_t i = first; i < last; i++)
+			hits[i] = TraceRay(rays[i]);
+	});
+}
+
+void Renderer::TraceOcclusion(const Scene& scene, const Ray* rays, const float* maxDistances, uint8_t* occluded, uint32_t count)
+{
+	WL_PROFILE_ZONE("Trace Occlusion");
+
+	DispatchQueries(scene, count, [this, rays, maxDistances, occluded](uint32_t first, uint32_t last)
+	{
+		for (uint32_t i = first; i < last; i++)
+			occluded[i] = IsOccluded(rays[i], maxDistances[i]) ? 1 : 0;
+	});
+}
+
+uint32_t Renderer::SelectIntegrator(bool cameraMoved) const
+{
+	IntegratorMode mode = m_Settings.Integrator;
+	if (mode == IntegratorMode::PathTracer && m_Settings.PreviewWhileMoving && cameraMoved)
+		mode = IntegratorMode::Preview;
+
+	if (mode == IntegratorMode::AmbientOcclusion)
+		return IntegratorFeatures::AmbientOcclusion;
+
+	uint32_t features = 0;
+	if (m_Settings.LightSampling && !m_Lights.empty())
+		features |= IntegratorFeatures::NextEventEstimation;
+	if (m_EmissiveSurfaces)
+		features |= IntegratorFeatures::EmissiveSurfaces;
+	if (mode == IntegratorMode::Preview)
+		features |= IntegratorFeatures::Preview;
+	return features;
+}
+
+template<typename Function>
+void Renderer::DispatchIntegrator(uint32_t features, Function&& function)
+{
+	constexpr uint32_t nee = IntegratorFeatures::NextEventEstimation;
+	constexpr uint32_t emissive = IntegratorFeatures::EmissiveSurfaces;
+	constexpr uint32_t preview = IntegratorFeatures::Preview;
+
+	switch (features)
+	{
+		case 0:                         function(std::integral_constant<uint32_t, 0>()); break;
+		case nee:                       function(std::integral_constant<uint32_t, nee>()); break;
+		case emissive:                  function(std::integral_constant<uint32_t, emissive>()); break;
+		case nee | emissive:            function(std::integral_constant<uint32_t, nee | emissive>()); break;
+		case preview:                   function(std::integral_constant<uint32_t, preview>()); break;
+		case preview | nee:             function(std::integral_constant<uint32_t, preview | nee>()); break;
+		case preview | emissive:        function(std::integral_constant<uint32_t, preview | emissive>()); break;
+		case preview | nee | emissive:  function(std::integral_constant<uint32_t, preview | nee | emissive>()); break;
+		case IntegratorFeatures::AmbientOcclusion:
+			function(std::integral_constant<uint32_t, IntegratorFeatures::AmbientOcclusion>());
+			break;
+	}
+}
+
+bool Renderer::RenderCPU(uint32_t* pixels, uint64_t* halfPixels, const CancelCallback& isCancelled)
+{
+	WL_PROFILE_ZONE("Render CPU");
+	Walnut::Timer timer;
+
+	// Compared against the last frame rather than left to the callers, so every caller gets the same motion handling
+	const Camera::RayGenerator& rayGenerator = m_ActiveCamera->GetRayGenerator();
+	bool cameraMoved = m_ActiveCamera->GetPosition() != m_LastCameraPosition || rayGenerator.Base != m_LastRayGenerator.Base
+		|| rayGenerator.DeltaX != m_LastRayGenerator.DeltaX || rayGenerator.DeltaY != m_LastRayGenerator.DeltaY;
+
+	glm::vec3 previousCameraPosition = m_LastCameraPosition;
+	Camera::RayGenerator previousRayGenerator = m_LastRayGenerator;
+	m_LastCameraPosition = m_ActiveCamera->GetPosition();
+	m_LastRayGenerator = rayGenerator;
+
+	UpdateRenderScale(cameraMoved);
+
+	uint32_t width = m_RenderWidth;
+	uint32_t height = m_RenderHeight;
+
+	uint32_t tileSize = glm::max(m_Settings.TileSize, 1u);
+	uint32_t tileCountX = (width + tileSize - 1) / tileSize;
+	uint32_t tileCountY = (height + tileSize - 1) / tileSize;
+	uint32_t tileCount = tileCountX * tileCountY;
+
+	// Per tile sample counts only mean something for the tile grid and sampling mode they were taken with
+	bool adaptive = m_Settings.Accumulate && m_Settings.AdaptiveSampling;
+	bool reproject = m_Settings.Accumulate && m_Settings.TemporalReprojection && !adaptive;
+	// Turning the denoiser on restarts, converged adaptive tiles would never write their guides otherwise
+	bool captureGuides = m_Settings.Denoise;
+	if (captureGuides && !m_CaptureGuides)
+		ResetFrameIndex();
+	m_CaptureGuides = captureGuides;
+
+	// Also drops the preview samples of a camera move once the camera stops
+	uint32_t features = SelectIntegrator(cameraMoved);
+	if (features != m_IntegratorFeatures)
+		ResetFrameIndex();
+	m_IntegratorFeatures = features;
+
+	if (adaptive != m_AdaptiveSampling || reproject != m_TemporalReprojection || tileSize != m_TileSize || tileCount != m_TileStates.size())
+	{
+		m_AdaptiveSampling = adaptive;
+		m_TemporalReprojection = reproject;
+		m_TileSize = tileSize;
+		m_TileStates.resize(tileCount);
+		ResetFrameIndex();
+	}
+
+	if (m_FrameIndex == 1)
+	{
+		m_Accumulation.SetTrackVariance(adaptive);
+		m_Accumulation.SetTrackSampleCounts(reproject);
+		m_Accumulation.Clear();
+		m_PrimaryHits.resize(reproject ? (size_t)width * height : 0);
+
+		if (captureGuides)
+			m_Denoiser.Resize(width, height);
+
+		std::fill(m_TileStates.begin(), m_TileStates.end(), TileState());
+		m_ActiveTileCount = tileCount;
+		m_Converged = false;
+	}
+
+	// The previous view's accumulation becomes the history this frame reads from, the new one is written in full
+	bool reprojecting = reproject && cameraMoved && m_FrameIndex > 1;
+	if (reprojecting)
+	{
+		std::swap(m_Accumulation, m_History);
+		std::swap(m_PrimaryHits, m_PreviousPrimaryHits);
+
+		if (m_Accumulation.GetWidth() != width || m_Accumulation.GetHeight() != height)
+			m_Accumulation.Resize(width, height);
+		m_Accumulation.SetTrackVariance(false);
+		m_Accumulation.SetTrackSampleCounts(true);
+		m_PrimaryHits.resize((size_t)width * height);
+
+		m_HistoryCameraPosition = previousCameraPosition;
+		m_HistoryInverseRayBasis = glm::inverse(glm::mat3(previousRayGenerator.DeltaX, previousRayGenerator.DeltaY, previousRayGenerator.Base));
+	}
+
+	// Converged tiles hand their samples to the rest, so a frame costs about the same until few tiles are left
+	uint32_t samplesPerTile = 1;
+	m_ActiveTiles.clear();
+	if (adaptive)
+	{
+		for (uint32_t i = 0; i < tileCount; i++)
+		{
+			if (!m_TileStates[i].Converged)
+				m_ActiveTiles.push_back(i);
+		}
+
+		constexpr uint32_t maxSamplesPerTile = 8;
+		if (!m_ActiveTiles.empty())
+			samplesPerTile = glm::clamp(tileCount / (uint32_t)m_ActiveTiles.size(), 1u, maxSamplesPerTile);
+	}
+
+	std::atomic<bool> cancelled{ false };
+	std::atomic<uint64_t> rayCount{ 0 };
+	std::atomic<uint32_t> convergedCount{ 0 };
+
+	// Adaptive sampling decides per tile, which a frame wide wave cannot. Ambient occlusion has no bounces to sort.
+	bool wavefront = m_Settings.Wavefront && !adaptive && !(features & IntegratorFeatures::AmbientOcclusion);
+	// The wavefront traces the frame itself, no tiles to dispatch then
+	uint32_t dispatchCount = wavefront ? 0 : adaptive ? (uint32_t)m_ActiveTiles.size() : tileCount;
+
+	m_ThreadPool.Resize(m_Settings.ThreadCount);
+	uint64_t wavefrontRayCount = 0;
+	if (wavefront)
+		cancelled = !TraceWavefront(features, reproject, reprojecting, captureGuides, isCancelled, wavefrontRayCount);
+
+	// One instantiation of the tile loop per integrator variant, picked here for the whole frame
+	DispatchIntegrator(features, [&](auto integrator)
+	{
+		m_ThreadPool.Dispatch(dispatchCount,
+			[this, integrator, &isCancelled, &cancelled, &rayCount, &convergedCount, adaptive, reproject, reprojecting, captureGuides, samplesPerTile, width, height, tileSize, tileCountX](uint32_t taskIndex, uint32_t workerIndex)
+			{
+				constexpr uint32_t Features = decltype(integrator)::value;
+
+				// Skip the remaining tiles rather than finishing a frame nobody wants anymore
+				if (cancelled.load(std::memory_order_relaxed))
+					return;
+				if (isCancelled && isCancelled())
+				{
+					cancelled.store(true, std::memory_order_relaxed);
+					return;
+				}
+
+				WL_PROFILE_ZONE("Trace Tile");
+
+				uint32_t tileIndex = adaptive ? m_ActiveTiles[taskIndex] : taskIndex;
+				uint32_t minX = (tileIndex % tileCountX) * tileSize;
+				uint32_t minY = (tileIndex / tileCountX) * tileSize;
+				uint32_t maxX = glm::min(minX + tileSize, width);
+				uint32_t maxY = glm::min(minY + tileSize, height);
+
+				uint32_t tileRayCount = 0;
+
+				if (!adaptive)
+				{
+					TraceTile<Features>(minX, minY, maxX, maxY, reproject, reprojecting, captureGuides, tileRayCount);
+					rayCount.fetch_add(tileRayCount, std::memory_order_relaxed);
+					WL_PROFILE_COUNT("Rays Cast", tileRayCount);
+					return;
+				}
+
+				// Tasks own distinct tiles, so the tile state needs no synchronisation
+				TileState& tile = m_TileStates[tileIndex];
+				uint32_t sampleCount = glm::min(samplesPerTile, m_Settings.AdaptiveMaxSamples - glm::min(tile.SampleCount, m_Settings.AdaptiveMaxSamples));
+				sampleCount = glm::max(sampleCount, 1u);
+
+				for (uint32_t sample = 0; sample < sampleCount; sample++)
+				{
+					// Sample indices continue where the tile left off, matching the frame index of uniform sampling
+					uint32_t sampleIndex = m_Settings.SampleOffset + tile.SampleCount + sample + 1;
+					bool writeGuides = captureGuides && sample + 1 == sampleCount;
+					for (uint32_t y = minY; y < maxY; y++)
+					{
+						for (uint32_t x = minX; x < maxX; x++)
+						{
+							PrimaryHit hit;
+							glm::vec4 color = PerPixel<Features>(x, y, sampleIndex, tileRayCount, writeGuides ? &hit : nullptr);
+							m_Accumulation.Add(x + y * width, glm::vec3(color));
+
+							if (writeGuides)
+								m_Denoiser.SetGuides(x + y * width, hit.Albedo, hit.Normal, hit.Distance);
+						}
+					}
+				}
+				tile.SampleCount += sampleCount;
+
+				if (tile.SampleCount >= m_Settings.AdaptiveMaxSamples
+					|| (tile.SampleCount >= m_Settings.AdaptiveMinSamples && IsTileConverged(minX, minY, maxX, maxY, tile.SampleCount)))
+				{
+					tile.Converged = true;
+					convergedCount.fetch_add(1, std::memory_order_relaxed);
+				}
+
+				rayCount.fetch_add(tileRayCount, std::memory_order_relaxed);
+				WL_PROFILE_COUNT("Rays Cast", tileRayCount);
+			});
+	});
+
+	rayCount += wavefrontRayCount;
+
+	if (cancelled)
+	{
+		// The history was only read, putting it back leaves everything as it was before this frame
+		if (reprojecting)
+		{
+			std::swap(m_Accumulation, m_History);
+			std::swap(m_PrimaryHits, m_PreviousPrimaryHits);
+			m_LastCameraPosition = previousCameraPosition;
+			m_LastRayGenerator = previousRayGenerator;
+		}
+		else
+		{
+			// Some tiles accumulated this frame and some did not
+			ResetFrameIndex();
+		}
+		return false;
+	}
+
+	m_LastFrameRayCount = rayCount;
+
+	if (adaptive)
+	{
+		m_ActiveTileCount = (uint32_t)m_ActiveTiles.size() - convergedCount;
+		m_Converged = m_ActiveTileCount == 0;
+	}
+	else
+	{
+		m_ActiveTileCount = tileCount;
+	}
+
+	if (pixels || halfPixels)
+	{
+		// Below full resolution the resolve goes to a scratch image first, half pixels stay at the internal resolution
+		bool upscale = !halfPixels && !m_ScaledPixels.empty();
+		uint32_t* target = upscale ? m_ScaledPixels.data() : pixels;
+		if (captureGuides)
+			Resolve(DenoiseAccumulation(m_FrameIndex), 1.0f, target, halfPixels);
+		else if (adaptive)
+			ResolveTiles(target, halfPixels);
+		else
+			Resolve(m_Accumulation, 1.0f / (float)m_FrameIndex, target, halfPixels);
+		m_ResolvedDenoise = captureGuides;
+
+		if (upscale)
+			Upscale(pixels);
+	}
+
+	m_LastCPUFrameTime = timer.ElapsedMillis();
+
+	if (m_Settings.Accumulate)
+		m_FrameIndex++;
+	else
+		m_FrameIndex = 1;
+
+	return true;
+}
+
+template<uint32_t Features>
+void Renderer::TraceTile(uint32_t minX, uint32_t minY, uint32_t maxX, uint32_t maxY, bool reproject, bool reprojecting, bool captureGuides, uint32_t& rayCount)
+{
+	for (uint32_t y = minY; y < maxY; y++)
+	{
+		for (uint32_t x = minX; x < maxX; x++)
+		{
+			uint32_t index = x + y * m_RenderWidth;
+
+			if (!reproject && !captureGuides)
+			{
+				glm::vec4 color = PerPixel<Features>(x, y, m_Settings.SampleOffset + m_FrameIndex, rayCount);
+				m_Accumulation.Add(index, glm::vec3(color));
+				continue;
+			}
+
+			PrimaryHit hit;
+			glm::vec3 color = glm::vec3(PerPixel<Features>(x, y, m_Settings.SampleOffset + m_FrameIndex, rayCount, &hit));
+			AccumulateSample(index, color, hit, reproject, reprojecting, captureGuides);
+		}
+	}
+}
+
+void Renderer::AccumulateSample(uint32_t index, const glm::vec3& color, const PrimaryHit& hit, bool reproject, bool reprojecting, bool captureGuides)
+{
+	if (captureGuides)
+		m_Denoiser.SetGuides(index, hit.Albedo, hit.Normal, hit.Distance);
+
+	if (!reproject)
+	{
+		m_Accumulation.Add(index, color);
+		return;
+	}
+
+	if (reprojecting)
+	{
+		glm::vec3 history(0.0f);
+		float historyLength = 0.0f;
+		FetchHistory(hit, history, historyLength);
+		m_Accumulation.Set(index, history + color, historyLength + 1.0f);
+	}
+	else
+	{
+		m_Accumulation.Add(index, color);
+	}
+
+	m_PrimaryHits[index] = hit;
+}
+
+bool Renderer::TraceWavefront(uint32_t features, bool reproject, bool reprojecting, bool captureGuides, const CancelCallback& isCancelled, uint64_t& rayCount)
+{
+	WL_PROFILE_ZONE("Trace Wavefront");
+
+	uint32_t pixelCount = m_RenderWidth * m_RenderHeight;
+	uint32_t waveSize = glm::clamp(m_Settings.WavefrontSize, 1u, glm::max(pixelCount, 1u));
+	uint32_t bucketCount = (uint32_t)m_ActiveScene->Materials.size() + 1; // The last bucket holds the misses
+	bool capturePrimaryHits = reproject || captureGuides;
+
+	WavefrontBuffers& buffers = m_Wavefront;
+	buffers.Resize(waveSize, capturePrimaryHits);
+
+	auto forEachPath = [this](uint32_t count, auto&& function)
+	{
+		uint32_t taskCount = (count + Utils::WavefrontChunkSize - 1) / Utils::WavefrontChunkSize;
+		m_ThreadPool.Dispatch(taskCount, [count, &function](uint32_t taskIndex, uint32_t workerIndex)
+		{
+			uint32_t first = taskIndex * Utils::WavefrontChunkSize;
+			uint32_t last = glm::min(first + Utils::WavefrontChunkSize, count);
+			function(taskIndex, first, last);
+		});
+	};
+
+	for (uint32_t waveFirst = 0; waveFirst < pixelCount; waveFirst += waveSize)
+	{
+		if (isCancelled && isCancelled())
+			return false;
+
+		uint32_t waveCount = glm::min(waveSize, pixelCount - waveFirst);
+
+		// Primary rays, one path per pixel of the wave, in scanline order
+		forEachPath(waveCount, [this, &buffers, waveFirst](uint32_t taskIndex, uint32_t first, uint32_t last)
+		{
+			for (uint32_t i = first; i < last; i++)
+			{
+				uint32_t pixel = waveFirst + i;
+				buffers.Rays[i] = GeneratePrimaryRay(pixel % m_RenderWidth, pixel / m_RenderWidth, m_Settings.SampleOffset + m_FrameIndex);
+				buffers.Pixels[i] = pixel;
+				buffers.Throughputs[i] = glm::vec3(1.0f);
+				buffers.Pdfs[i] = 0.0f;
+				buffers.Radiance[i] = glm::vec3(0.0f);
+			}
+		});
+
+		uint32_t activeCount = waveCount;
+		for (uint32_t bounce = 0; activeCount > 0; bounce++)
+		{
+			if (bounce > 0 && isCancelled && isCancelled())
+				return false;
+
+			// Intersection, the sort key is the material that shades the hit
+			forEachPath(activeCount, [this, &buffers, bounce, bucketCount, capturePrimaryHits](uint32_t taskIndex, uint32_t first, uint32_t last)
+			{
+				for (uint32_t i = first; i < last; i++)
+				{
+					HitPayload& payload = buffers.Hits[i];
+					payload = TraceRay(buffers.Rays[i]);
+					buffers.Keys[i] = payload.HitDistance < 0.0f ? bucketCount - 1 : (uint32_t)payload.MaterialIndex;
+
+					// Primary rays are still in wave order, path i is pixel i of the wave
+					if (bounce == 0 && capturePrimaryHits)
+						CapturePrimaryHit(buffers.Rays[i], payload, buffers.PrimaryHits[i]);
+				}
+				WL_PROFILE_COUNT("Rays Cast", last - first);
+			});
+			rayCount += activeCount;
+
+			// Counting sort by material: every chunk counts its keys, a prefix sum over (bucket, chunk) gives every
+			// chunk its own write position inside every bucket, then each chunk scatters its paths in order
+			uint32_t chunkCount = (activeCount + Utils::WavefrontChunkSize - 1) / Utils::WavefrontChunkSize;
+			buffers.BucketOffsets.assign((size_t)chunkCount * bucketCount, 0);
+
+			forEachPath(activeCount, [&buffers, bucketCount](uint32_t taskIndex, uint32_t first, uint32_t last)
+			{
+				uint32_t* counts = buffers.BucketOffsets.data() + (size_t)taskIndex * bucketCount;
+				for (uint32_t i = first; i < last; i++)
+					counts[buffers.Keys[i]]++;
+			});
+
+			uint32_t offset = 0;
+			for (uint32_t bucket = 0; bucket < bucketCount; bucket++)
+			{
+				for (uint32_t chunk = 0; chunk < chunkCount; chunk++)
+				{
+					uint32_t& value = buffers.BucketOffsets[(size_t)chunk * bucketCount + bucket];
+					uint32_t count = value;
+					value = offset;
+					offset += count;
+				}
+			}
+
+			forEachPath(activeCount, [&buffers, bucketCount](uint32_t taskIndex, uint32_t first, uint32_t last)
+			{
+				uint32_t* offsets = buffers.BucketOffsets.data() + (size_t)taskIndex * bucketCount;
+				for (uint32_t i = first; i < last; i++)
+					buffers.Order[offsets[buffers.Keys[i]]++] = i;
+			});
+
+			// Shading in material order, every path writes its next ray to the slot of its sorted position
+			DispatchIntegrator(features, [&](auto integrator)
+			{
+				forEachPath(activeCount, [this, integrator, &buffers, waveFirst, bounce](uint32_t taskIndex, uint32_t first, uint32_t last)
+				{
+					constexpr uint32_t Features = decltype(integrator)::value;
+
+					uint32_t alive = 0;
+					for (uint32_t j = first; j < last; j++)
+					{
+						uint32_t i = buffers.Order[j];
+						uint32_t pixel = buffers.Pixels[i];
+
+						Ray ray = buffers.Rays[i];
+						glm::vec3 throughput = buffers.Throughputs[i];
+						float pdf = buffers.Pdfs[i];
+						bool continues = Shade<Features>(buffers.Hits[i], pixel, m_Settings.SampleOffset + m_FrameIndex, bounce, ray, buffers.Radiance[pixel - waveFirst], throughput, pdf);
+
+						buffers.NextRays[j] = ray;
+						buffers.NextPixels[j] = continues ? pixel : Utils::InvalidPath;
+						buffers.NextThroughputs[j] = throughput;
+						buffers.NextPdfs[j] = pdf;
+						alive += continues;
+					}
+					buffers.ChunkAlive[taskIndex] = alive;
+				});
+			});
+
+			// Compaction, the paths that go on move to the front of the ray buffer in sorted order
+			uint32_t aliveCount = 0;
+			for (uint32_t chunk = 0; chunk < chunkCount; chunk++)
+			{
+				uint32_t alive = buffers.ChunkAlive[chunk];
+				buffers.ChunkAlive[chunk] = aliveCount;
+				aliveCount += alive;
+			}
 
-		uint32_t result = (a << 24) | (b << 16) | (g << 8) | r;
+			forEachPath(activeCount, [&buffers](uint32_t taskIndex, uint32_t first, uint32_t last)
+			{
+				uint32_t destination = buffers.ChunkAlive[taskIndex];
+				for (uint32_t j = first; j < last; j++)
+				{
+					if (buffers.NextPixels[j] == Utils::InvalidPath)
+						continue;
 
-		return result;
+					buffers.Rays[destination] = buffers.NextRays[j];
+					buffers.Pixels[destination] = buffers.NextPixels[j];
+					buffers.Throughputs[destination] = buffers.NextThroughputs[j];
+					buffers.Pdfs[destination] = buffers.NextPdfs[j];
+					destination++;
+				}
+			});
+
+			activeCount = aliveCount;
+		}
+
+		// Every pixel of the wave has its sample, hand it to the accumulation like TraceTile does
+		forEachPath(waveCount, [this, &buffers, waveFirst, reproject, reprojecting, captureGuides, capturePrimaryHits](uint32_t taskIndex, uint32_t first, uint32_t last)
+		{
+			for (uint32_t i = first; i < last; i++)
+			{
+				if (capturePrimaryHits)
+					AccumulateSample(waveFirst + i, buffers.Radiance[i], buffers.PrimaryHits[i], reproject, reprojecting, captureGuides);
+				else
+					m_Accumulation.Add(waveFirst + i, buffers.Radiance[i]);
+			}
+		});
 	}
 
+	return true;
 }
 
-void Renderer::OnResize(uint32_t width, uint32_t height)
+void Renderer::WavefrontBuffers::Resize(uint32_t pathCount, bool primaryHits)
 {
-	if (m_FinalImage)
+	if (Rays.size() != pathCount)
 	{
-		if (m_FinalImage->GetWidth() == width && m_FinalImage->GetHeight() == height) {
-			return;
-		}
+		Rays.resize(pathCount);
+		NextRays.resize(pathCount);
+		Pixels.resize(pathCount);
+		NextPixels.resize(pathCount);
+		Throughputs.resize(pathCount);
+		NextThroughputs.resize(pathCount);
+		Pdfs.resize(pathCount);
+		NextPdfs.resize(pathCount);
+		Hits.resize(pathCount);
+		Keys.resize(pathCount);
+		Order.resize(pathCount);
+		Radiance.resize(pathCount);
+		ChunkAlive.resize((pathCount + Utils::WavefrontChunkSize - 1) / Utils::WavefrontChunkSize);
+	}
+
+	PrimaryHits.resize(primaryHits ? pathCount : 0);
+}
+
+bool Renderer::FetchHistory(const PrimaryHit& hit, glm::vec3& sum, float& sampleCount) const
+{
+	// Solves Base * t + DeltaX * (x * t) + DeltaY * (y * t) = point for the previous camera's pixel (x, y).
+	// Misses only have a direction, the sky does not depend on where the camera is.
+	bool miss = hit.Distance < 0.0f;
+	glm::vec3 toPoint = miss ? hit.Position : hit.Position - m_HistoryCameraPosition;
+	glm::vec3 solution = m_HistoryInverseRayBasis * toPoint;
+	if (solution.z <= 0.0f)
+		return false;
+
+	// Viewport pixel to internal pixel, the identity at full resolution
+	glm::vec2 scale = { (float)m_RenderWidth / (float)m_Width, (float)m_RenderHeight / (float)m_Height };
+	glm::vec2 viewportPixel = glm::vec2(solution.x, solution.y) / solution.z;
+
+	// Antialiased pixels cover [x, x + 1), the others are centered on their ray
+	glm::vec2 pixel = m_Settings.Antialiasing ? viewportPixel * scale : (viewportPixel + 0.5f) * scale;
+	int x = (int)std::floor(pixel.x);
+	int y = (int)std::floor(pixel.y);
+	if (x < 0 || y < 0 || x >= (int)m_RenderWidth || y >= (int)m_RenderHeight)
+		return false;
 
-		m_FinalImage->Resize(width, height);
+	uint32_t index = (uint32_t)x + (uint32_t)y * m_RenderWidth;
+	const PrimaryHit& previous = m_PreviousPrimaryHits[index];
+	if ((previous.Distance < 0.0f) != miss)
+		return false;
+
+	// Disocclusion: whatever that pixel saw last frame is not this surface
+	if (!miss)
+	{
+		float planeDistance = glm::abs(glm::dot(hit.Position - previous.Position, previous.Normal));
+		if (planeDistance > 0.01f * glm::length(toPoint) || glm::dot(hit.Normal, previous.Normal) < 0.9f)
+			return false;
 	}
-	else {
-		m_FinalImage = std::make_shared<Walnut::Image>(width, height, Walnut::ImageFormat::RGBA);
+
+	sum = m_History.Get(index);
+	sampleCount = m_History.GetSampleCount(index);
+
+	float maxHistoryLength = (float)glm::max(m_Settings.MaxHistoryLength, 1u);
+	if (sampleCount > maxHistoryLength)
+	{
+		sum *= maxHistoryLength / sampleCount;
+		sampleCount = maxHistoryLength;
 	}
 
-	delete[] m_ImageData;
-	m_ImageData = new uint32_t[width * height];
+	return true;
+}
 
-	delete[] m_AccumulationData;
-	m_AccumulationData = new glm::vec4[width * height];
+bool Renderer::IsTileConverged(uint32_t minX, uint32_t minY, uint32_t maxX, uint32_t maxY, uint32_t sampleCount) const
+{
+	for (uint32_t y = minY; y < maxY; y++)
+	{
+		for (uint32_t x = minX; x < maxX; x++)
+		{
+			if (m_Accumulation.GetRelativeError(x + y * m_RenderWidth, sampleCount) > m_Settings.NoiseThreshold)
+				return false;
+		}
+	}
 
-	m_ImageHorizontalIter.resize(width);
-	m_ImageVerticalIter.resize(height);
+	return true;
+}
 
-	for (uint32_t i = 0; i < width; i++)
-		m_ImageHorizontalIter[i] = i;
-	for (uint32_t i = 0; i < height; i++)
-		m_ImageVerticalIter[i] = i;
+bool Renderer::IsConverged() const
+{
+	bool toneMapped = m_ResolvedHDR || (m_Settings.ToneMapping == m_ResolvedToneMapping && m_Settings.GammaCorrect == m_ResolvedGammaCorrect);
+	return m_Converged && m_Settings.Accumulate && m_Settings.AdaptiveSampling && toneMapped
+		&& m_Settings.Denoise == m_ResolvedDenoise;
 }
 
-void Renderer::Render(const Scene& scene, const Camera& camera)
+const AccumulationBuffer& Renderer::Denoise()
 {
-	m_ActiveScene = &scene;
-	m_ActiveCamera = &camera;
-	
-	if (m_FrameIndex == 1)
-		memset(m_AccumulationData, 0, m_FinalImage->GetWidth() * m_FinalImage->GetHeight() * sizeof(glm::vec4));
+	return DenoiseAccumulation(glm::max(GetSampleCount(), 1u));
+}
+
+const AccumulationBuffer& Renderer::DenoiseAccumulation(uint32_t sampleCount)
+{
+	WL_PROFILE_ZONE("Denoise");
+
+	m_Denoiser.Resize(m_RenderWidth, m_RenderHeight);
+
+	// Every pixel divided by its own sample count, however this frame counted samples
+	AccumulationBuffer& input = m_Denoiser.GetInput();
+	bool perPixelCounts = m_Accumulation.IsTrackingSampleCounts();
+	bool perTileCounts = m_AdaptiveSampling;
+
+	uint32_t tileSize = m_TileSize;
+	uint32_t tileCountX = (m_RenderWidth + tileSize - 1) / tileSize;
+	m_ThreadPool.Dispatch((uint32_t)m_TileStates.size(), [&](uint32_t tileIndex, uint32_t workerIndex)
+	{
+		uint32_t minX = (tileIndex % tileCountX) * tileSize;
+		uint32_t minY = (tileIndex / tileCountX) * tileSize;
+		uint32_t maxX = glm::min(minX + tileSize, m_RenderWidth);
+		uint32_t maxY = glm::min(minY + tileSize, m_RenderHeight);
 
-#define MT 1
-#if MT
-	std::for_each(std::execution::par, m_ImageVerticalIter.begin(), m_ImageVerticalIter.end(), 
-		[this](uint32_t y) 
+		float scale = 1.0f / (float)glm::max(perTileCounts ? m_TileStates[tileIndex].SampleCount : sampleCount, 1u);
+		for (uint32_t y = minY; y < maxY; y++)
 		{
-			std::for_each(m_ImageHorizontalIter.begin(), m_ImageHorizontalIter.end(),
-				[this, y](uint32_t x)
-				{
-					glm::vec4 color = PerPixel(x, y);
-					m_AccumulationData[x + y * m_FinalImage->GetWidth()] += color;
+			for (uint32_t x = minX; x < maxX; x++)
+			{
+				uint32_t index = x + y * m_RenderWidth;
+				float pixelScale = perPixelCounts ? 1.0f / glm::max(m_Accumulation.GetSampleCount(index), 1.0f) : scale;
+				input.Set(index, m_Accumulation.Get(index) * pixelScale);
+			}
+		}
+	});
+
+	return m_Denoiser.Denoise(m_ThreadPool, m_Settings.DenoiserSettings);
+}
 
-					glm::vec4 accumulatedColor = m_AccumulationData[x + y * m_FinalImage->GetWidth()];
-					accumulatedColor /= (float)m_FrameIndex;
+void Renderer::Resolve(const AccumulationBuffer& buffer, float scale, uint32_t* pixels, uint64_t* halfPixels)
+{
+	WL_PROFILE_ZONE("Resolve");
 
-					accumulatedColor = glm::clamp(accumulatedColor, glm::vec4(0.0f), glm::vec4(1.0f));
-					m_ImageData[x + y * m_FinalImage->GetWidth()] = Utils::ConvertToRGBA(accumulatedColor);
-				});
-		});
-#else
-	for (uint32_t y = 0; y < m_FinalImage->GetHeight(); y++) 
+	AccumulationBuffer::ResolveSettings settings;
+	settings.Scale = scale;
+	settings.ToneMapping = m_Settings.ToneMapping;
+	settings.GammaCorrect = m_Settings.GammaCorrect;
+
+	m_ResolvedToneMapping = settings.ToneMapping;
+	m_ResolvedGammaCorrect = settings.GammaCorrect;
+	m_ResolvedHDR = halfPixels != nullptr;
+
+	// Pure streaming work, split into large contiguous chunks rather than tiles.
+	// A multiple of 8 pixels keeps every chunk after the first aligned for the wide stores.
+	constexpr uint32_t chunkSize = 64 * 1024;
+	uint32_t pixelCount = m_RenderWidth * m_RenderHeight;
+	uint32_t chunkCount = (pixelCount + chunkSize - 1) / chunkSize;
+
+	SphereKernels::InstructionSet instructionSet = m_BVH.GetInstructionSet();
+	m_ThreadPool.Dispatch(chunkCount, [&buffer, pixels, halfPixels, pixelCount, &settings, instructionSet](uint32_t chunkIndex, uint32_t workerIndex)
+	{
+		uint32_t first = chunkIndex * chunkSize;
+		uint32_t count = glm::min(chunkSize, pixelCount - first);
+		if (halfPixels)
+			buffer.ResolveHalf(halfPixels, first, count, settings, instructionSet);
+		else
+			buffer.Resolve(pixels, first, count, settings, instructionSet);
+	});
+}
+
+void Renderer::ResolveTiles(uint32_t* pixels, uint64_t* halfPixels)
+{
+	WL_PROFILE_ZONE("Resolve");
+
+	m_ResolvedToneMapping = m_Settings.ToneMapping;
+	m_ResolvedGammaCorrect = m_Settings.GammaCorrect;
+	m_ResolvedHDR = halfPixels != nullptr;
+
+	uint32_t tileSize = m_TileSize;
+	uint32_t tileCountX = (m_RenderWidth + tileSize - 1) / tileSize;
+
+	// Converged tiles are resolved too, the destination is a different staging slot every frame
+	SphereKernels::InstructionSet instructionSet = m_BVH.GetInstructionSet();
+	m_ThreadPool.Dispatch((uint32_t)m_TileStates.size(), [this, pixels, halfPixels, tileSize, tileCountX, instructionSet](uint32_t tileIndex, uint32_t workerIndex)
+	{
+		AccumulationBuffer::ResolveSettings settings;
+		settings.Scale = 1.0f / (float)glm::max(m_TileStates[tileIndex].SampleCount, 1u);
+		settings.ToneMapping = m_Settings.ToneMapping;
+		settings.GammaCorrect = m_Settings.GammaCorrect;
+
+		uint32_t minX = (tileIndex % tileCountX) * tileSize;
+		uint32_t minY = (tileIndex / tileCountX) * tileSize;
+		uint32_t maxX = glm::min(minX + tileSize, m_RenderWidth);
+		uint32_t maxY = glm::min(minY + tileSize, m_RenderHeight);
+
+		for (uint32_t y = minY; y < maxY; y++)
+		{
+			if (halfPixels)
+				m_Accumulation.ResolveHalf(halfPixels, minX + y * m_RenderWidth, maxX - minX, settings, instructionSet);
+			else
+				m_Accumulation.Resolve(pixels, minX + y * m_RenderWidth, maxX - minX, settings, instructionSet);
+		}
+	});
+}
+
+void Renderer::Upscale(uint32_t* pixels)
+{
+	WL_PROFILE_ZONE("Upscale");
+
+	uint32_t sourceWidth = m_RenderWidth;
+	uint32_t sourceHeight = m_RenderHeight;
+	const uint32_t* source = m_ScaledPixels.data();
+
+	// Pixel centers line up, edges clamp
+	auto getSourceCoordinate = [](uint32_t coordinate, uint32_t size, uint32_t sourceSize, uint32_t& first, uint32_t& second, uint32_t& weight)
 	{
-		for (uint32_t x = 0; x < m_FinalImage->GetWidth(); x++) 
+		float position = glm::max(((float)coordinate + 0.5f) * (float)sourceSize / (float)size - 0.5f, 0.0f);
+		first = glm::min((uint32_t)position, sourceSize - 1);
+		second = glm::min(first + 1, sourceSize - 1);
+		weight = (uint32_t)((position - (float)first) * 256.0f);
+	};
+
+	struct Column { uint32_t First, Second, Weight; };
+	std::vector<Column> columns(m_Width);
+	for (uint32_t x = 0; x < m_Width; x++)
+		getSourceCoordinate(x, m_Width, sourceWidth, columns[x].First, columns[x].Second, columns[x].Weight);
+
+	constexpr uint32_t rowsPerTask = 16;
+	uint32_t taskCount = (m_Height + rowsPerTask - 1) / rowsPerTask;
+	m_ThreadPool.Dispatch(taskCount, [&](uint32_t taskIndex, uint32_t workerIndex)
+	{
+		uint32_t maxY = glm::min((taskIndex + 1) * rowsPerTask, m_Height);
+		for (uint32_t y = taskIndex * rowsPerTask; y < maxY; y++)
 		{
-			glm::vec4 color = PerPixel(x, y);
-			m_AccumulationData[x + y * m_FinalImage->GetWidth()] += color;
+			uint32_t firstRow, secondRow, rowWeight;
+			getSourceCoordinate(y, m_Height, sourceHeight, firstRow, secondRow, rowWeight);
 
-			glm::vec4 accumulatedColor = m_AccumulationData[x + y * m_FinalImage->GetWidth()];
-			accumulatedColor /= (float)m_FrameIndex;
+			const uint32_t* top = source + firstRow * sourceWidth;
+			const uint32_t* bottom = source + secondRow * sourceWidth;
+			uint32_t* row = pixels + y * m_Width;
 
-			accumulatedColor = glm::clamp(accumulatedColor, glm::vec4(0.0f), glm::vec4(1.0f));
-			m_ImageData[x + y * m_FinalImage->GetWidth()] = Utils::ConvertToRGBA(accumulatedColor);
+			for (uint32_t x = 0; x < m_Width; x++)
+			{
+				const Column& column = columns[x];
+				uint32_t upper = Utils::LerpRGBA8(top[column.First], top[column.Second], column.Weight);
+				uint32_t lower = Utils::LerpRGBA8(bottom[column.First], bottom[column.Second], column.Weight);
+				row[x] = Utils::LerpRGBA8(upper, lower, rowWeight);
+			}
 		}
+	});
+}
+
+const char* Renderer::GetGPUUnsupportedReason(const Scene& scene)
+{
+	// The shader traces the sphere BVH only
+	if (!scene.Meshes.empty())
+		return "meshes are CPU only";
+	// Nothing would ever be lit, the shader has no light sampling and a path can't hit a point light
+	if (!scene.PointLights.empty())
+		return "point lights are CPU only";
+
+	return nullptr;
+}
+
+bool Renderer::RenderGPU(const Scene& scene, const Camera& camera, bool sceneChanged)
+{
+	if (GetGPUUnsupportedReason(scene))
+		return false;
+
+	if (!m_GPUPathTracer)
+	{
+		m_GPUPathTracer = std::make_unique<GPUPathTracer>();
+		m_GPUNodesStale = true;
 	}
-#endif
 
-	m_FinalImage->SetData(m_ImageData);
+	if (!m_GPUPathTracer->IsAvailable())
+		return false;
 
-	if (m_Settings.Accumulate)
-		m_FrameIndex++;
-	else
-		m_FrameIndex = 1;
+	if (m_ActiveBackend != RenderBackend::GPU)
+	{
+		m_ActiveBackend = RenderBackend::GPU;
+		m_GPUNodesStale = true;
+		ResetFrameIndex();
+	}
+
+	if (m_GPUNodesStale)
+		m_GPUPathTracer->UploadNodes(m_BVH);
+
+	// Spheres go up in BVH order, so a new hierarchy needs them again as well
+	if (m_GPUNodesStale || sceneChanged)
+		m_GPUPathTracer->UploadScene(scene, m_BVH);
+	m_GPUNodesStale = false;
+
+	m_GPUPathTracer->Render(camera, *m_FinalImage, m_FrameIndex, m_Settings.MaxDepth, m_Settings.RussianRouletteDepth);
+	return true;
+}
+
+void Renderer::UpdateScene(const Scene& scene, bool& sceneChanged)
+{
+	WL_PROFILE_ZONE("Scene Update");
+
+	SceneVersions& versions = m_SceneVersions;
+	bool replaced = versions.Source != &scene;
+	versions.Source = &scene;
+
+	bool spheresChanged = Utils::UpdateVersions(scene.Spheres, versions.Spheres) || replaced;
+	bool meshesChanged = Utils::UpdateVersions(scene.Meshes, versions.Meshes) || replaced;
+	bool pointLightsChanged = Utils::UpdateVersions(scene.PointLights, versions.PointLights) || replaced;
+
+	// Only materials some sphere or mesh uses can change the image, and only their emission changes the lights
+	bool materialCountChanged = replaced || versions.Materials.size() != scene.Materials.size();
+	bool materialsVisible = materialCountChanged;
+	bool emissionChanged = materialCountChanged;
+	versions.Materials.resize(scene.Materials.size());
+	versions.Emissions.resize(scene.Materials.size());
+	for (size_t i = 0; i < scene.Materials.size(); i++)
+	{
+		const Material& material = scene.Materials[i];
+		if (!materialCountChanged && material.Version == versions.Materials[i])
+			continue;
+
+		versions.Materials[i] = material.Version;
+		materialsVisible = materialsVisible || Utils::IsMaterialUsed(scene, (int)i);
+
+		glm::vec3 emission = material.GetEmission();
+		emissionChanged |= emission != versions.Emissions[i];
+		versions.Emissions[i] = emission;
+	}
+
+	UpdateAccelerationStructure(scene);
+
+	if (spheresChanged || meshesChanged || pointLightsChanged || emissionChanged)
+		UpdateLights(scene);
+
+	// Point lights are only ever found by light sampling
+	sceneChanged = spheresChanged || meshesChanged || materialsVisible || (pointLightsChanged && m_Settings.LightSampling);
+	if (sceneChanged)
+		ResetFrameIndex();
+}
+
+bool Renderer::UpdateAccelerationStructure(const Scene& scene)
+{
+	WL_PROFILE_ZONE("Acceleration Structure");
+
+	SceneVersions& versions = m_AccelerationVersions;
+	bool replaced = versions.Source != &scene;
+	versions.Source = &scene;
+	if (replaced)
+		m_RebuildBVH = true;
+
+	// Count changes rebuild instead
+	if (Utils::UpdateVersions(scene.Spheres, versions.Spheres))
+		m_RefitBVH = true;
+	bool meshesChanged = Utils::UpdateVersions(scene.Meshes, versions.Meshes) || replaced;
+
+	SphereKernels::InstructionSet instructionSet = m_Settings.SIMD ? SphereKernels::DetectInstructionSet() : SphereKernels::InstructionSet::Scalar;
+	if (instructionSet != m_BVH.GetInstructionSet())
+	{
+		m_BVH.SetInstructionSet(instructionSet);
+		m_RebuildBVH = true;
+	}
+
+	// Only looked at after an edit. New geometry builds its own hierarchy, anything else only rebuilds the top level.
+	meshesChanged = meshesChanged && m_MeshInstances.Update(scene.Meshes);
+
+	if (m_RebuildBVH || m_BVH.GetPrimitiveCount() != scene.Spheres.size())
+	{
+		if (!scene.SphereBVH || !m_BVH.Load(scene.Spheres, *scene.SphereBVH))
+			m_BVH.Build(scene.Spheres);
+		m_RebuildBVH = false;
+		m_RefitBVH = false;
+		m_GPUNodesStale = true;
+		return true;
+	}
+	
+	if (m_RefitBVH)
+	{
+		m_BVH.Refit(scene.Spheres);
+		m_RefitBVH = false;
+		m_GPUNodesStale = true;
+		return true;
+	}
+
+	return meshesChanged;
 }
 
-glm::vec4 Renderer::PerPixel(uint32_t x, uint32_t y)
+Ray Renderer::GeneratePrimaryRay(uint32_t x, uint32_t y, uint32_t sampleIndex) const
 {
 	Ray ray;
 	ray.Origin = m_ActiveCamera->GetPosition();
-	ray.Direction = m_ActiveCamera->GetRayDirections()[x + y * m_FinalImage->GetWidth()];
-	
-	glm::vec3 color(0.0f);
-	float multiplier = 1.0f;
+	if (m_Settings.Antialiasing)
+	{
+		// A random point of the pixel, which covers viewport coordinates [x, x + 1) at full resolution
+		Sampler sampler(m_Settings.SamplerType, x + y * m_RenderWidth, sampleIndex, Utils::CameraDimension);
+		glm::vec2 scale = { (float)m_Width / (float)m_RenderWidth, (float)m_Height / (float)m_RenderHeight };
+		ray.Direction = m_ActiveCamera->GetRayGenerator().GetDirection((glm::vec2((float)x, (float)y) + sampler.Next2D()) * scale);
+	}
+	else if (m_RenderWidth == m_Width && m_RenderHeight == m_Height)
+	{
+		ray.Direction = m_ActiveCamera->GetRayDirection(x, y);
+	}
+	else
+	{
+		// Through the center of the viewport pixels this internal pixel covers
+		glm::vec2 scale = { (float)m_Width / (float)m_RenderWidth, (float)m_Height / (float)m_RenderHeight };
+		ray.Direction = m_ActiveCamera->GetRayGenerator().GetDirection((glm::vec2((float)x, (float)y) + 0.5f) * scale - 0.5f);
+	}
+	return ray;
+}
+
+void Renderer::CapturePrimaryHit(const Ray& ray, const HitPayload& payload, PrimaryHit& primaryHit) const
+{
+	primaryHit.Distance = payload.HitDistance;
+	primaryHit.Position = payload.HitDistance < 0.0f ? ray.Direction : payload.WorldPosition;
+	primaryHit.Normal = payload.HitDistance < 0.0f ? glm::vec3(0.0f) : payload.WorldNormal;
+	// The sky's albedo is its color, so the denoiser sees it as flat
+	primaryHit.Albedo = payload.HitDistance < 0.0f ? glm::vec3(0.6f, 0.7f, 0.9f)
+		: m_ActiveScene->Materials[payload.MaterialIndex].Albedo;
+}
 
-	int bounces = 5;
-	for (int i = 0; i < bounces; i++)
+template<uint32_t Features>
+bool Renderer::Shade(const HitPayload& payload, uint32_t pixelIndex, uint32_t sampleIndex, uint32_t bounce, Ray& ray, glm::vec3& color, glm::vec3& throughput, float& bsdfPdf) const
+{
+	constexpr bool lightSampling = (Features & IntegratorFeatures::NextEventEstimation) != 0;
+	constexpr bool preview = (Features & IntegratorFeatures::Preview) != 0;
+
+	// The sky is never sampled as a light, only bounces find it
+	if (payload.HitDistance < 0.0f)
 	{
-		Renderer::HitPayload payload = TraceRay(ray);
+		glm::vec3 skyColor = glm::vec3(0.6f, 0.7f, 0.9f);
+		color += skyColor * throughput;
+
+		return false;
+	}
+
+	const Material& material = m_ActiveScene->Materials[payload.MaterialIndex];
+
+	if constexpr ((Features & IntegratorFeatures::EmissiveSurfaces) != 0)
+	{
+		glm::vec3 emission = material.GetEmission();
+		if (emission != glm::vec3(0.0f))
+		{
+			// Light sampling at the previous bounce could have picked this point too, the two share it by MIS.
+			// Camera rays and paths without light sampling take all of it.
+			float weight = 1.0f;
+			if (lightSampling && bsdfPdf > 0.0f)
+				weight = Utils::PowerHeuristic(bsdfPdf, GetLightPdf(payload, ray));
+
+			color += emission * throughput * weight;
+		}
+	}
+
+	// The preview stops after the bounce that gathers direct light
+	uint32_t maxDepth = preview ? glm::min(m_Settings.MaxDepth, 2u) : m_Settings.MaxDepth;
+	if (bounce + 1 >= maxDepth)
+		return false;
+
+	// Keyed by pixel, sample and dimension so the image does not depend on which thread traced the tile
+	uint32_t dimension = Utils::FirstBounceDimension + bounce * Utils::BounceDimensions;
+
+	// Seen from inside a sphere the normal points away from the ray
+	glm::vec3 view = -ray.Direction;
+	glm::vec3 normal = glm::dot(payload.WorldNormal, view) < 0.0f ? -payload.WorldNormal : payload.WorldNormal;
+	glm::vec3 position = payload.WorldPosition + normal * 0.0001f;
+
+	// The light's path is one segment longer than this one, which the depth test above already allowed for
+	if constexpr (lightSampling)
+	{
+		Sampler lightSampler(m_Settings.SamplerType, pixelIndex, sampleIndex, dimension + Utils::LightDimension);
+		color += throughput * SampleLights<Features>(material, position, normal, view, lightSampler);
+	}
+
+	Sampler materialSampler(m_Settings.SamplerType, pixelIndex, sampleIndex, dimension + Utils::MaterialDimension);
+	glm::vec3 direction, weight;
+	if constexpr (preview)
+		Utils::SampleDiffuse(material, normal, materialSampler, direction, weight, bsdfPdf);
+	else if (!Utils::SampleMaterial(material, normal, view, materialSampler, direction, weight, bsdfPdf))
+		return false;
+
+	throughput *= weight;
+
+	// Russian roulette: past the first few bounces a path survives with a probability that follows its
+	// throughput, the survivors are scaled up by the inverse so the estimate stays unbiased
+	if (!preview && bounce + 1 >= m_Settings.RussianRouletteDepth)
+	{
+		float survival = glm::min(glm::max(throughput.x, glm::max(throughput.y, throughput.z)), 0.95f);
+		Sampler rouletteSampler(m_Settings.SamplerType, pixelIndex, sampleIndex, dimension + Utils::RouletteDimension);
+		if (rouletteSampler.Next() >= survival)
+			return false;
+
+		throughput /= survival;
+	}
+
+	ray.Origin = position;
+	ray.Direction = direction;
+
+	return true;
+}
+
+glm::vec3 Renderer::ShadeAmbientOcclusion(const HitPayload& payload, const Ray& ray, uint32_t pixelIndex, uint32_t sampleIndex) const
+{
+	if (payload.HitDistance < 0.0f)
+		return glm::vec3(0.6f, 0.7f, 0.9f);
+
+	glm::vec3 view = -ray.Direction;
+	glm::vec3 normal = glm::dot(payload.WorldNormal, view) < 0.0f ? -payload.WorldNormal : payload.WorldNormal;
+
+	// Cosine weighted, so the average visibility is the occlusion a diffuse surface would see
+	const Material& material = m_ActiveScene->Materials[payload.MaterialIndex];
+	Sampler sampler(m_Settings.SamplerType, pixelIndex, sampleIndex, Utils::FirstBounceDimension + Utils::MaterialDimension);
+	Ray occlusionRay;
+	glm::vec3 albedo;
+	float pdf;
+	occlusionRay.Origin = payload.WorldPosition + normal * 0.0001f;
+	Utils::SampleDiffuse(material, normal, sampler, occlusionRay.Direction, albedo, pdf);
+
+	WL_PROFILE_COUNT("Shadow Rays", 1);
+	return IsOccluded(occlusionRay, m_Settings.AmbientOcclusionDistance) ? glm::vec3(0.0f) : albedo;
+}
+
+template<uint32_t Features>
+glm::vec3 Renderer::SampleLights(const Material& material, const glm::vec3& position, const glm::vec3& normal, const glm::vec3& view, Sampler& sampler) const
+{
+	float pick = sampler.Next();
+	glm::vec2 u = sampler.Next2D();
+	float u1 = u.x;
+	float u2 = u.y;
+
+	size_t lightIndex = std::upper_bound(m_LightDistribution.begin(), m_LightDistribution.end(), pick) - m_LightDistribution.begin();
+	const Light& light = m_Lights[glm::min(lightIndex, m_Lights.size() - 1)];
 
-		if (payload.HitDistance < 0.0f)
+	glm::vec3 direction;
+	float distance;
+	// Over solid angle, light pick included. Stays 0 for point lights, which no bounce can hit.
+	float lightPdf = 0.0f;
+	glm::vec3 radiance;
+
+	switch (light.LightType)
+	{
+		case Light::Type::Point:
 		{
-			glm::vec3 skyColor = glm::vec3(0.6f, 0.7f, 0.9f);
-			color += skyColor * multiplier;
+			direction = m_ActiveScene->PointLights[light.Index].Position - position;
+			distance = glm::length(direction);
+			if (distance <= 0.0f)
+				return glm::vec3(0.0f);
 
+			direction /= distance;
+			radiance = light.Emission / (distance * distance * light.Probability);
 			break;
 		}
+		case Light::Type::Sphere:
+		{
+			// Uniform over the cone the sphere covers, every direction in it hits the sphere
+			const Sphere& sphere = m_ActiveScene->Spheres[light.Index];
+			float cosMax;
+			float coneSize = Utils::SphereConeSize(position, sphere, cosMax);
+			if (coneSize <= 0.0f)
+				return glm::vec3(0.0f);
+
+			glm::vec3 axis = glm::normalize(sphere.Position - position);
+			glm::vec3 tangent, bitangent;
+			Utils::BuildBasis(axis, tangent, bitangent);
 
-		glm::vec3 light = glm::normalize(glm::vec3(-1, -1, -1));
-		float d = glm::max(glm::dot(payload.WorldNormal, -light), 0.0f);
+			float cosTheta = 1.0f - u1 * coneSize;
+			float sinTheta = std::sqrt(glm::max(1.0f - cosTheta * cosTheta, 0.0f));
+			float phi = 2.0f * Utils::Pi * u2;
+			direction = tangent * (sinTheta * std::cos(phi)) + bitangent * (sinTheta * std::sin(phi)) + axis * cosTheta;
 
-		const Sphere& sphere = m_ActiveScene->Spheres[payload.ObjectIndex];
-		const Material& material = m_ActiveScene->Materials[sphere.MaterialIndex];
+			glm::vec3 origin = position - sphere.Position;
+			float b = glm::dot(origin, direction);
+			float c = glm::dot(origin, origin) - sphere.Radius * sphere.Radius;
+			distance = -b - std::sqrt(glm::max(b * b - c, 0.0f));
+
+			lightPdf = light.Probability / (2.0f * Utils::Pi * coneSize);
+			radiance = light.Emission / lightPdf;
+			break;
+		}
+		case Light::Type::Triangle:
+		{
+			// Uniform over the area, converted to solid angle
+			float root = std::sqrt(u1);
+			glm::vec3 point = light.Vertices[0] * (1.0f - root) + light.Vertices[1] * (u2 * root) + light.Vertices[2] * ((1.0f - u2) * root);
 
-		glm::vec3 sphereColor = material.Albedo;
-		sphereColor *= d;
-		color += sphereColor * multiplier;
+			direction = point - position;
+			float distanceSquared = glm::dot(direction, direction);
+			distance = std::sqrt(distanceSquared);
+			if (distance <= 0.0f)
+				return glm::vec3(0.0f);
 
-		multiplier *= 0.5f;
+			direction /= distance;
+			float cosLight = glm::abs(glm::dot(light.Normal, direction));
+			if (cosLight <= 1e-6f)
+				return glm::vec3(0.0f);
 
-		ray.Origin = payload.WorldPosition + payload.WorldNormal * 0.0001f;
-		ray.Direction = glm::reflect(ray.Direction, payload.WorldNormal + material.Roughness * Walnut::Random::Vec3(-0.5f, 0.5f));
+			lightPdf = light.Probability * distanceSquared / (light.Area * cosLight);
+			radiance = light.Emission / lightPdf;
+			break;
+		}
 	}
-	
-	return glm::vec4(color, 1.0f);
+
+	float bsdfPdf;
+	glm::vec3 reflectance = (Features & IntegratorFeatures::Preview) != 0 ? Utils::EvaluateDiffuse(material, normal, direction, bsdfPdf)
+		: Utils::EvaluateMaterial(material, normal, view, direction, bsdfPdf);
+	if (reflectance == glm::vec3(0.0f))
+		return glm::vec3(0.0f);
+
+	// Stops short of the light's surface so the light does not shadow itself
+	Ray shadowRay;
+	shadowRay.Origin = position;
+	shadowRay.Direction = direction;
+	WL_PROFILE_COUNT("Shadow Rays", 1);
+	if (IsOccluded(shadowRay, distance * 0.999f))
+		return glm::vec3(0.0f);
+
+	float weight = lightPdf > 0.0f ? Utils::PowerHeuristic(lightPdf, bsdfPdf) : 1.0f;
+	return reflectance * radiance * weight;
 }
 
-Renderer::HitPayload Renderer::TraceRay(const Ray& ray)
+float Renderer::GetLightPdf(const HitPayload& payload, const Ray& ray) const
 {
-	int closestSphere = -1;
-	float hitDistance = FLT_MAX;
+	if (payload.TriangleIndex < 0)
+	{
+		uint32_t lightIndex = m_SphereLights[payload.ObjectIndex];
+		if (lightIndex == InvalidLight)
+			return 0.0f;
+
+		float cosMax;
+		float coneSize = Utils::SphereConeSize(ray.Origin, m_ActiveScene->Spheres[payload.ObjectIndex], cosMax);
+		return coneSize > 0.0f ? m_Lights[lightIndex].Probability / (2.0f * Utils::Pi * coneSize) : 0.0f;
+	}
+
+	uint32_t firstLight = m_MeshLights[payload.ObjectIndex];
+	if (firstLight == InvalidLight)
+		return 0.0f;
+
+	const Light& light = m_Lights[firstLight + (uint32_t)payload.TriangleIndex];
+	float cosLight = glm::abs(glm::dot(light.Normal, ray.Direction));
+	if (cosLight <= 1e-6f)
+		return 0.0f;
+
+	return light.Probability * payload.HitDistance * payload.HitDistance / (light.Area * cosLight);
+}
 
-	for (size_t i = 0; i < m_ActiveScene->Spheres.size(); i++)
+void Renderer::UpdateLights(const Scene& scene)
+{
+	m_Lights.clear();
+	m_SphereLights.assign(scene.Spheres.size(), InvalidLight);
+	m_MeshLights.assign(scene.Meshes.size(), InvalidLight);
+	m_EmissiveSurfaces = false;
+
+	// Probabilities hold the power until they are normalized below
+	for (size_t i = 0; i < scene.PointLights.size(); i++)
+	{
+		const PointLight& pointLight = scene.PointLights[i];
+
+		Light& light = m_Lights.emplace_back();
+		light.LightType = Light::Type::Point;
+		light.Index = (uint32_t)i;
+		light.Emission = pointLight.Color * pointLight.Intensity;
+		light.Probability = AccumulationBuffer::GetLuminance(light.Emission) * 4.0f * Utils::Pi;
+	}
+
+	for (size_t i = 0; i < scene.Spheres.size(); i++)
 	{
-		const Sphere& sphere = m_ActiveScene->Spheres[i];
-		glm::vec3 origin = ray.Origin - sphere.Position;
+		const Sphere& sphere = scene.Spheres[i];
+		glm::vec3 emission = scene.Materials[sphere.MaterialIndex].GetEmission();
+		if (emission == glm::vec3(0.0f))
+			continue;
 
-		float a = glm::dot(ray.Direction, ray.Direction);
-		float b = 2.0f * glm::dot(origin, ray.Direction);
-		float c = glm::dot(origin, origin) - sphere.Radius * sphere.Radius;
+		m_EmissiveSurfaces = true;
+		m_SphereLights[i] = (uint32_t)m_Lights.size();
 
-		// Quadratic formula
-		float discriminant = b * b - 4.0f * a * c;
+		Light& light = m_Lights.emplace_back();
+		light.LightType = Light::Type::Sphere;
+		light.Index = (uint32_t)i;
+		light.Emission = emission;
+		light.Probability = AccumulationBuffer::GetLuminance(emission) * 4.0f * Utils::Pi * Utils::Pi * sphere.Radius * sphere.Radius;
+	}
 
-		if (discriminant < 0.0f) {
+	for (size_t i = 0; i < scene.Meshes.size(); i++)
+	{
+		const Mesh& mesh = scene.Meshes[i];
+		glm::vec3 emission = scene.Materials[mesh.MaterialIndex].GetEmission();
+		if (!mesh.Geometry || emission == glm::vec3(0.0f))
 			continue;
-		}
 
-		// Closest intersection point
-		float closestT = (-b - glm::sqrt(discriminant)) / (2.0f * a);
+		m_EmissiveSurfaces = true;
+		m_MeshLights[i] = (uint32_t)m_Lights.size();
+
+		const MeshGeometry& geometry = *mesh.Geometry;
+		const glm::mat4& transform = m_MeshInstances.GetTransform((uint32_t)i);
+		for (uint32_t triangle = 0; triangle < geometry.GetTriangleCount(); triangle++)
+		{
+			Light& light = m_Lights.emplace_back();
+			light.LightType = Light::Type::Triangle;
+			light.Index = triangle;
+			light.Emission = emission;
+			for (int corner = 0; corner < 3; corner++)
+				light.Vertices[corner] = glm::vec3(transform * glm::vec4(geometry.Positions[geometry.Indices[triangle * 3 + corner]], 1.0f));
 
-		if (closestT > 0.0f && closestT < hitDistance) {
-			hitDistance = closestT;
-			closestSphere = (int) i;
+			glm::vec3 cross = glm::cross(light.Vertices[1] - light.Vertices[0], light.Vertices[2] - light.Vertices[0]);
+			float length = glm::length(cross);
+			light.Area = 0.5f * length;
+			light.Normal = length > 0.0f ? cross / length : glm::vec3(0.0f);
+			// Degenerate triangles get no power and are never picked
+			light.Probability = AccumulationBuffer::GetLuminance(emission) * Utils::Pi * light.Area;
 		}
 	}
 
+	float totalPower = 0.0f;
+	for (const Light& light : m_Lights)
+		totalPower += glm::max(light.Probability, 0.0f);
+
+	if (totalPower <= 0.0f)
+	{
+		m_Lights.clear();
+		m_SphereLights.assign(scene.Spheres.size(), InvalidLight);
+		m_MeshLights.assign(scene.Meshes.size(), InvalidLight);
+		m_LightDistribution.clear();
+		return;
+	}
+
+	m_LightDistribution.resize(m_Lights.size());
+	float sum = 0.0f;
+	for (size_t i = 0; i < m_Lights.size(); i++)
+	{
+		m_Lights[i].Probability = glm::max(m_Lights[i].Probability, 0.0f) / totalPower;
+		sum += m_Lights[i].Probability;
+		m_LightDistribution[i] = sum;
+	}
+}
+
+template<uint32_t Features>
+glm::vec4 Renderer::PerPixel(uint32_t x, uint32_t y, uint32_t sampleIndex, uint32_t& rayCount, PrimaryHit* primaryHit)
+{
+	Ray ray = GeneratePrimaryRay(x, y, sampleIndex);
+
+	if constexpr ((Features & IntegratorFeatures::AmbientOcclusion) != 0)
+	{
+		Renderer::HitPayload payload = TraceRay(ray);
+		rayCount++;
+
+		if (primaryHit)
+			CapturePrimaryHit(ray, payload, *primaryHit);
+
+		return glm::vec4(ShadeAmbientOcclusion(payload, ray, x + y * m_RenderWidth, sampleIndex), 1.0f);
+	}
+
+	glm::vec3 color(0.0f);
+	glm::vec3 throughput(1.0f);
+	float bsdfPdf = 0.0f;
+
+	// Shade ends every path by Settings::MaxDepth
+	for (uint32_t i = 0; ; i++)
+	{
+		Renderer::HitPayload payload = TraceRay(ray);
+		rayCount++;
+
+		if (i == 0 && primaryHit)
+			CapturePrimaryHit(ray, payload, *primaryHit);
+
+		if (!Shade<Features>(payload, x + y * m_RenderWidth, sampleIndex, i, ray, color, throughput, bsdfPdf))
+			break;
+	}
+	
+	return glm::vec4(color, 1.0f);
+}
+
+Renderer::HitPayload Renderer::TraceRay(const Ray& ray)
+{
+	float hitDistance = FLT_MAX;
+	int closestSphere = m_BVH.Intersect(ray, hitDistance);
+
+	// Starts from the sphere's distance, so meshes only report what is in front of it
+	InstanceBVH::Hit meshHit;
+	if (m_MeshInstances.Intersect(ray, hitDistance, meshHit))
+		return ClosestMeshHit(ray, hitDistance, meshHit);
+
 	if (closestSphere < 0) {
 		return Miss(ray);
 	}
@@ -177,14 +1739,21 @@ Renderer::HitPayload Renderer::TraceRay(const Ray& ray)
 	return ClosestHit(ray, hitDistance, closestSphere);
 }
 
+bool Renderer::IsOccluded(const Ray& ray, float maxDistance) const
+{
+	return m_BVH.IsOccluded(ray, maxDistance) || m_MeshInstances.IsOccluded(ray, maxDistance);
+}
+
 
 Renderer::HitPayload Renderer::ClosestHit(const Ray& ray, float hitDistance, int objectIndex)
 {
 	Renderer::HitPayload payload;
 	payload.HitDistance = hitDistance;
 	payload.ObjectIndex = objectIndex;
+	payload.TriangleIndex = -1;
 	
 	const Sphere& closestSphere = m_ActiveScene->Spheres[objectIndex];
+	payload.MaterialIndex = closestSphere.MaterialIndex;
 
 	glm::vec3 origin = ray.Origin - closestSphere.Position;
 
@@ -196,10 +1765,56 @@ Renderer::HitPayload Renderer::ClosestHit(const Ray& ray, float hitDistance, int
 	return payload;
 }
 
+Renderer::HitPayload Renderer::ClosestMeshHit(const Ray& ray, float hitDistance, const InstanceBVH::Hit& hit)
+{
+	Renderer::HitPayload payload;
+	payload.HitDistance = hitDistance;
+	payload.ObjectIndex = (int)hit.Instance;
+	payload.TriangleIndex = (int)hit.Triangle.Triangle;
+	payload.MaterialIndex = m_ActiveScene->Meshes[hit.Instance].MaterialIndex;
+	payload.WorldPosition = ray.Origin + ray.Direction * hitDistance;
+
+	// The geometry is in object space, its normals go through the instance's normal matrix
+	const MeshGeometry& geometry = m_MeshInstances.GetGeometry(hit.Instance);
+	const glm::mat3& normalMatrix = m_MeshInstances.GetNormalMatrix(hit.Instance);
+	const uint32_t* corners = geometry.Indices.data() + (size_t)hit.Triangle.Triangle * 3;
+	const glm::vec2& barycentrics = hit.Triangle.Barycentrics;
+
+	const glm::vec3& v0 = geometry.Positions[corners[0]];
+	glm::vec3 geometricNormal = glm::normalize(normalMatrix * glm::cross(geometry.Positions[corners[1]] - v0, geometry.Positions[corners[2]] - v0));
+	payload.WorldNormal = geometricNormal;
+
+	if (!geometry.Normals.empty())
+	{
+		const uint32_t* normalCorners = geometry.NormalIndices.empty() ? corners : geometry.NormalIndices.data() + (size_t)hit.Triangle.Triangle * 3;
+		if (normalCorners[0] != MeshGeometry::InvalidIndex && normalCorners[1] != MeshGeometry::InvalidIndex && normalCorners[2] != MeshGeometry::InvalidIndex)
+		{
+			glm::vec3 normal = geometry.Normals[normalCorners[0]] * (1.0f - barycentrics.x - barycentrics.y)
+				+ geometry.Normals[normalCorners[1]] * barycentrics.x
+				+ geometry.Normals[normalCorners[2]] * barycentrics.y;
+
+			// Missing normals are stored as zero
+			if (glm::dot(normal, normal) > 1e-12f)
+				payload.WorldNormal = glm::normalize(normalMatrix * normal);
+		}
+	}
+
+	// Triangles are double sided, shade the side the ray came from
+	if (glm::dot(geometricNormal, ray.Direction) > 0.0f)
+		geometricNormal = -geometricNormal;
+	if (glm::dot(payload.WorldNormal, geometricNormal) < 0.0f)
+		payload.WorldNormal = -payload.WorldNormal;
+
+	return payload;
+}
+
 Renderer::HitPayload Renderer::Miss(const Ray& ray)
 {
 	Renderer::HitPayload payload;
 	payload.HitDistance = -1.0f;
+	payload.ObjectIndex = -1;
+	payload.MaterialIndex = -1;
+	payload.TriangleIndex = -1;
 	
 	return payload;
 }
\ No newline at end of file
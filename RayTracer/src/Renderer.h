@@ -2,56 +2,434 @@
 
 #include "Walnut/Image.h"
 
+#include <functional>
 #include <memory>
+#include <vector>
 #include <glm/glm.hpp>
 
+#include "AccumulationBuffer.h"
+#include "Denoiser.h"
 #include "Camera.h"
+#include "FrameArena.h"
 #include "Ray.h"
+#include "Sampler.h"
 #include "Scene.h"
+#include "BVH.h"
+#include "InstanceBVH.h"
+#include "ThreadPool.h"
+#include "GPUPathTracer.h"
+#include "DisplayPass.h"
 
 
 class Renderer
 {
 public:
+	enum class RenderBackend
+	{
+		CPU = 0,
+		// Vulkan compute shader, falls back to the CPU if the shader is unavailable
+		GPU
+	};
+
+	enum class IntegratorMode
+	{
+		PathTracer = 0,
+		// At most one bounce with every material shaded as Lambertian by its albedo, direct light and little else
+		Preview,
+		// Albedo at the first hit, dark where the hemisphere above it is blocked within AmbientOcclusionDistance
+		AmbientOcclusion
+	};
+
 	struct Settings {
 		bool Accumulate = true;
+
+		RenderBackend Backend = RenderBackend::CPU;
+
+		// Edge length in pixels of the square tiles handed to the thread pool
+		uint32_t TileSize = 16;
+		// 0 uses every hardware thread
+		uint32_t ThreadCount = 0;
+
+		// Intersect BVH leaves and resolve the image with the widest SIMD kernels the CPU supports
+		bool SIMD = true;
+
+		// Segments per path, the camera ray included. From RussianRouletteDepth on, paths whose throughput
+		// dropped end early at random, so deep specular chains only cost where they still carry light.
+		uint32_t MaxDepth = 5;
+		uint32_t RussianRouletteDepth = 3;
+
+		// CPU only. Next-event estimation: every bounce also traces a shadow ray toward one light picked by power,
+		// point lights and emissive spheres and meshes, and multiple importance sampling weighs it against bounces
+		// that hit the same light by chance. Off, only bounces find emissive surfaces and point lights stay dark.
+		bool LightSampling = true;
+
+		// CPU only. Where every random decision of a path comes from, see Sampler
+		Sampler::Type SamplerType = Sampler::Type::Sobol;
+		// Primary rays go through a random point of their pixel rather than its corner, which antialiases
+		// edges as samples accumulate. Off, the camera's cached ray directions are used if it has them.
+		bool Antialiasing = true;
+
+		// CPU only. What every sample computes, the integrator is compiled for each mode and scene, see IntegratorFeatures
+		IntegratorMode Integrator = IntegratorMode::PathTracer;
+		// Path tracer only. Frames the camera moved in use the preview integrator, accumulation restarts once it stops.
+		bool PreviewWhileMoving = false;
+		float AmbientOcclusionDistance = 1.0f;
+
+		AccumulationBuffer::ToneMap ToneMapping = AccumulationBuffer::ToneMap::Clamp;
+		bool GammaCorrect = false;
+		// CPU and Render only. Uploads the image as half floats and tone maps it on the GPU, see DisplayPass.
+		// Tone mapping changes no longer need a resolve, and below full resolution the radiance is upscaled.
+		bool HDRDisplay = true;
+
+		// CPU and Accumulate only. Tiles stop sampling once their noise drops below NoiseThreshold and their
+		// share of the frame goes to the tiles that are still noisy. Once every tile stopped, so does rendering.
+		bool AdaptiveSampling = false;
+		// Worst pixel's standard error of the mean luminance, relative to that mean
+		float NoiseThreshold = 0.02f;
+		uint32_t AdaptiveMinSamples = 16;
+		// Tiles stop here even if still noisy, a single firefly would otherwise keep one sampling forever
+		uint32_t AdaptiveMaxSamples = 4096;
+
+		// CPU only. While the camera moves the internal resolution drops to hold TargetFrameTime and the
+		// result is upscaled to the viewport. Once it stops, the resolution doubles every frame back to full.
+		bool DynamicResolution = false;
+		float TargetFrameTime = 16.0f; // ms
+		// Fraction of the viewport's width and height
+		float MinRenderScale = 0.25f;
+
+		// CPU and Accumulate only, ignored with adaptive sampling. Camera moves reproject the accumulated samples
+		// into the new view instead of discarding them, pixels whose surface was hidden before start over.
+		bool TemporalReprojection = false;
+		// Reprojected pixels keep at most this many samples, view dependent shading would smear otherwise
+		uint32_t MaxHistoryLength = 32;
+
+		// CPU only, ignored with adaptive sampling. Traces the frame in waves of WavefrontSize paths, one bounce
+		// of every path at a time: intersect all, sort the hits by material, shade all, compact the survivors.
+		// Same image as the per pixel loop, the sampling is seeded the same way.
+		bool Wavefront = false;
+		uint32_t WavefrontSize = 1 << 18;
+
+		// CPU only. Added to every sample index, so renderers given disjoint ranges trace independent samples
+		// whose sums add up to the image one renderer would have accumulated, see Distributed
+		uint32_t SampleOffset = 0;
+
+		// CPU only. Filters what is displayed, the accumulation itself stays noisy. Meant for the first few samples of a view.
+		bool Denoise = false;
+		Denoiser::Settings DenoiserSettings;
+	};
+public:
+	// Polled once per tile, returning true abandons the frame
+	using CancelCallback = std::function<bool()>;
+
+	// Closest hit of a ray, what TraceRays returns and every bounce shades. Positions and normals in world space,
+	// normals facing the side the ray came from on meshes. A miss only has HitDistance -1 and the indices -1.
+	struct HitPayload
+	{
+		// In multiples of the ray direction's length
+		float HitDistance;
+		glm::vec3 WorldPosition;
+		glm::vec3 WorldNormal;
+
+		// Into Scene::Spheres or Scene::Meshes
+		int ObjectIndex;
+		int MaterialIndex;
+		// Into the mesh's triangles, -1 for spheres
+		int TriangleIndex;
 	};
 public:
 	Renderer() = default;
 
 	void OnResize(uint32_t width, uint32_t height);
+	// Renders with the selected backend into the final image, UI thread only
 	void Render(const Scene& scene, const Camera& camera);
+	// CPU only, writes width * height RGBA8 pixels (skipped if pixels is null) and never touches Vulkan,
+	// so it can run on any thread. Returns false when cancelled, accumulation then restarts with the next frame.
+	bool RenderFrame(const Scene& scene, const Camera& camera, uint32_t* pixels, const CancelCallback& isCancelled = nullptr);
+
+	// Ray queries for picking, visibility checks and offline tools, without the image path. The acceleration structures
+	// are first brought up to date with scene like a frame would (edits reset accumulation the same way), then the rays
+	// are traced on the thread pool with the SIMD kernels. Same threading rules as RenderFrame.
+	void TraceRays(const Scene& scene, const Ray* rays, HitPayload* hits, uint32_t count);
+	// occluded[i] receives 1 if any sphere or mesh is closer than maxDistances[i] along rays[i], else 0.
+	// Cheaper than TraceRays, traversal stops at the first hit.
+	void TraceOcclusion(const Scene& scene, const Ray* rays, const float* maxDistances, uint8_t* occluded, uint32_t count);
 
 	std::shared_ptr<Walnut::Image> GetFinalImage() const { return m_FinalImage; }
 
-	void ResetFrameIndex() { m_FrameIndex = 1; }
+	void ResetFrameIndex() { m_FrameIndex = 1; m_Converged = false; }
+	// Samples summed into the accumulation buffer, divide by this to get the image.
+	// With adaptive sampling every tile has its own count and this is only the frame count.
+	uint32_t GetSampleCount() const { return m_FrameIndex - 1; }
+	// Adaptive sampling stopped every tile and the last resolved image is still current,
+	// another frame would change nothing. Cleared by ResetFrameIndex.
+	bool IsConverged() const;
+	// Tiles adaptive sampling is still sampling, out of GetTileCount
+	uint32_t GetActiveTileCount() const { return m_ActiveTileCount; }
+	uint32_t GetTileCount() const { return (uint32_t)m_TileStates.size(); }
+
+	// Internal resolution relative to the viewport, below 1 only with dynamic resolution.
+	// The accumulation buffer has the internal resolution.
+	float GetRenderScale() const { return m_RenderScale; }
+	uint32_t GetRenderWidth() const { return m_RenderWidth; }
+	uint32_t GetRenderHeight() const { return m_RenderHeight; }
+
+	// Denoises the accumulation as it is now, the result is already divided by the sample count.
+	// Needs Settings::Denoise during rendering so the guides were written.
+	const AccumulationBuffer& Denoise();
+	// Replaces the built-in filter, e.g. with OIDN, until it returns false
+	void SetExternalDenoiser(Denoiser::ExternalFilter filter) { m_Denoiser.SetExternalFilter(std::move(filter)); }
+	const AccumulationBuffer& GetAccumulationBuffer() const { return m_Accumulation; }
+	// Rays traced by the last completed CPU frame, primary and bounces
+	uint64_t GetLastFrameRayCount() const { return m_LastFrameRayCount; }
+
+	// The next Render rebuilds the BVH from scratch. Edits are noticed through the versions in Scene, see there.
+	void InvalidateAccelerationStructure() { m_RebuildBVH = true; }
+	// The next Render treats every object as changed, for a Scene whose contents were replaced wholesale
+	void InvalidateScene() { m_SceneVersions.Source = nullptr; m_AccelerationVersions.Source = nullptr; }
+
 	Settings& GetSettings() { return m_Settings; }
+
+	SphereKernels::InstructionSet GetInstructionSet() const { return m_BVH.GetInstructionSet(); }
+	RenderBackend GetActiveBackend() const { return m_ActiveBackend; }
+	// Why the GPU backend can't render the scene, nullptr when it can. Render falls back to the CPU then.
+	static const char* GetGPUUnsupportedReason(const Scene& scene);
 private:
-	struct HitPayload
+	// What light sampling picks from, rebuilt every frame from the scene
+	struct Light
 	{
-		float HitDistance;
-		glm::vec3 WorldPosition;
-		glm::vec3 WorldNormal;
+		enum class Type : uint32_t
+		{
+			Point = 0, Sphere, Triangle
+		};
 
-		int ObjectIndex;
+		Type LightType = Type::Point;
+		// Into Scene::PointLights or Scene::Spheres
+		uint32_t Index = 0;
+		// Of being picked, proportional to the light's power
+		float Probability = 0.0f;
+		// Intensity for point lights, radiance for the others
+		glm::vec3 Emission{ 0.0f };
+
+		// Triangles only, world space
+		glm::vec3 Vertices[3];
+		glm::vec3 Normal{ 0.0f };
+		float Area = 0.0f;
+	};
+
+	// What a pixel's first ray hit, misses keep the ray direction in Position
+	struct PrimaryHit
+	{
+		glm::vec3 Position{ 0.0f };
+		float Distance = -1.0f;
+		glm::vec3 Normal{ 0.0f };
+		glm::vec3 Albedo{ 1.0f };
 	};
 
-	glm::vec4 PerPixel(uint32_t x, uint32_t y);
+	// The object versions of the last frame, Version of every object in the scene's order
+	struct SceneVersions
+	{
+		// Null until the first frame, a different scene means everything changed
+		const Scene* Source = nullptr;
+		std::vector<uint32_t> Spheres, Meshes, Materials, PointLights;
+		// A material edit only rebuilds the lights if the emission changed
+		std::vector<glm::vec3> Emissions;
+	};
+
+	struct TileState
+	{
+		uint32_t SampleCount = 0;
+		bool Converged = false;
+	};
+
+	// Paths of one wave, Next* receive the shading stage's output before compaction moves it back
+	struct WavefrontBuffers
+	{
+		std::vector<Ray> Rays, NextRays;
+		// Pixel index of every path
+		std::vector<uint32_t> Pixels, NextPixels;
+		std::vector<glm::vec3> Throughputs, NextThroughputs;
+		// Density of the material sample that led to each ray, for MIS
+		std::vector<float> Pdfs, NextPdfs;
+		std::vector<HitPayload> Hits;
+		// Sort keys and the resulting order
+		std::vector<uint32_t> Keys, Order;
+		// Per chunk, counts then write offsets
+		std::vector<uint32_t> BucketOffsets, ChunkAlive;
+		// Indexed by pixel within the wave
+		std::vector<glm::vec3> Radiance;
+		std::vector<PrimaryHit> PrimaryHits;
+
+		void Resize(uint32_t pathCount, bool primaryHits);
+	};
+
+	// Compile time switches of PerPixel, Shade and SampleLights. SelectIntegrator picks them once per frame from the
+	// settings and the scene, so the bounce loop holds no branches on things that cannot change within a frame.
+	struct IntegratorFeatures
+	{
+		enum : uint32_t
+		{
+			// Light sampling is on and the scene has lights
+			NextEventEstimation = 1 << 0,
+			// Some sphere or mesh emits, only then do hits look up emission
+			EmissiveSurfaces = 1 << 1,
+			// IntegratorMode::Preview
+			Preview = 1 << 2,
+			// IntegratorMode::AmbientOcclusion, never combined with the others
+			AmbientOcclusion = 1 << 3
+		};
+	};
+
+	uint32_t SelectIntegrator(bool cameraMoved) const;
+	// Calls function with the features as a std::integral_constant, for every combination SelectIntegrator returns
+	template<typename Function>
+	static void DispatchIntegrator(uint32_t features, Function&& function);
+
+	// sampleIndex picks the pixel's point of every sample sequence, it must differ between samples of the same pixel
+	template<uint32_t Features>
+	glm::vec4 PerPixel(uint32_t x, uint32_t y, uint32_t sampleIndex, uint32_t& rayCount, PrimaryHit* primaryHit = nullptr);
+	Ray GeneratePrimaryRay(uint32_t x, uint32_t y, uint32_t sampleIndex) const;
+	void CapturePrimaryHit(const Ray& ray, const HitPayload& payload, PrimaryHit& primaryHit) const;
+	// One bounce: adds what the hit and a sampled light contribute to color, samples the material and turns ray into
+	// the next bounce. bsdfPdf is the density of the sample that led to ray, 0 for camera rays, and receives the new one.
+	// Returns false when the path ends, on a miss, at MaxDepth, on absorption or by Russian roulette.
+	template<uint32_t Features>
+	bool Shade(const HitPayload& payload, uint32_t pixelIndex, uint32_t sampleIndex, uint32_t bounce, Ray& ray, glm::vec3& color, glm::vec3& throughput, float& bsdfPdf) const;
+	// Next-event estimation from a shading point, returns the MIS weighted radiance of one light sample
+	template<uint32_t Features>
+	glm::vec3 SampleLights(const Material& material, const glm::vec3& position, const glm::vec3& normal, const glm::vec3& view, Sampler& sampler) const;
+	// The whole sample of the ambient occlusion integrator from its first hit, one occlusion ray like a shadow ray
+	glm::vec3 ShadeAmbientOcclusion(const HitPayload& payload, const Ray& ray, uint32_t pixelIndex, uint32_t sampleIndex) const;
+	// Density over solid angle of SampleLights picking the emissive hit payload from the origin of ray
+	float GetLightPdf(const HitPayload& payload, const Ray& ray) const;
+	// Collects the point lights and emissive surfaces of the scene, after the acceleration structures are updated
+	void UpdateLights(const Scene& scene);
+	// Compares the scene's versions with the last frame's, updates the acceleration structures and lights that depend
+	// on changed objects and resets accumulation if the image can change
+	void UpdateScene(const Scene& scene, bool& sceneChanged);
+	// Runs function(first, last) over [0, count) in chunks on the thread pool, for the ray queries.
+	// Leaves the frame index and the edits the next frame acts on alone.
+	template<typename Function>
+	void DispatchQueries(const Scene& scene, uint32_t count, Function&& function);
 
 	HitPayload TraceRay(const Ray& ray);
+	// Any sphere or mesh closer than maxDistance
+	bool IsOccluded(const Ray& ray, float maxDistance) const;
 	HitPayload ClosestHit(const Ray& ray, float hitDistance, int objectIndex);
+	HitPayload ClosestMeshHit(const Ray& ray, float hitDistance, const InstanceBVH::Hit& hit);
 	HitPayload Miss(const Ray& ray);
+	// Builds or refits them for the spheres and meshes whose versions changed since they were last updated,
+	// by a frame or a ray query. Returns true if a BVH changed.
+	bool UpdateAccelerationStructure(const Scene& scene);
+	bool RenderGPU(const Scene& scene, const Camera& camera, bool sceneChanged);
+	// Returns false if isCancelled fired before every tile was traced. Resolves into halfPixels at the internal
+	// resolution if given, else into pixels at the viewport's.
+	bool RenderCPU(uint32_t* pixels, uint64_t* halfPixels, const CancelCallback& isCancelled);
+	// One sample per pixel, reprojecting reads the history instead of adding to the accumulation
+	template<uint32_t Features>
+	void TraceTile(uint32_t minX, uint32_t minY, uint32_t maxX, uint32_t maxY, bool reproject, bool reprojecting, bool captureGuides, uint32_t& rayCount);
+	// The whole frame in wavefront mode, one sample per pixel like TraceTile. Returns false if isCancelled fired.
+	bool TraceWavefront(uint32_t features, bool reproject, bool reprojecting, bool captureGuides, const CancelCallback& isCancelled, uint64_t& rayCount);
+	// Guides, history and accumulation for one traced sample
+	void AccumulateSample(uint32_t index, const glm::vec3& color, const PrimaryHit& hit, bool reproject, bool reprojecting, bool captureGuides);
+	// Looks up the previous view's pixel for this hit, false if it is off screen or saw a different surface
+	bool FetchHistory(const PrimaryHit& hit, glm::vec3& sum, float& sampleCount) const;
+	// Accumulation or denoised buffer to RGBA8, or to RGBA16F without tone mapping if halfPixels is given.
+	// Run after every tile was traced.
+	void Resolve(const AccumulationBuffer& buffer, float scale, uint32_t* pixels, uint64_t* halfPixels);
+	// The accumulation with each tile divided by its own sample count
+	void ResolveTiles(uint32_t* pixels, uint64_t* halfPixels);
+	// sampleCount is only used where the accumulation has no per tile or per pixel counts
+	const AccumulationBuffer& DenoiseAccumulation(uint32_t sampleCount);
+	// Bilinear from m_ScaledPixels at the internal resolution to pixels at the viewport's
+	void Upscale(uint32_t* pixels);
+	// Picks this frame's render scale from camera motion and the last frame time
+	void UpdateRenderScale(bool moving);
+	// Applies m_RenderScale to the viewport size, resets accumulation if the internal resolution changed
+	void UpdateRenderResolution();
+	// Whether the tile's worst pixel is below the noise threshold
+	bool IsTileConverged(uint32_t minX, uint32_t minY, uint32_t maxX, uint32_t maxY, uint32_t sampleCount) const;
 private:
 	std::shared_ptr<Walnut::Image> m_FinalImage;
 	Settings m_Settings;
 
-	std::vector<uint32_t> m_ImageHorizontalIter, m_ImageVerticalIter;
+	SceneVersions m_SceneVersions;
+	// Spheres and meshes only, for what the acceleration structures were last updated with. Apart from
+	// m_SceneVersions, so ray queries can bring the BVH up to date without consuming a frame's edits.
+	SceneVersions m_AccelerationVersions;
+
+	BVH m_BVH;
+	bool m_RebuildBVH = true;
+	bool m_RefitBVH = false;
+	// Over Scene::Meshes, one bottom level per unique geometry
+	InstanceBVH m_MeshInstances;
+
+	std::vector<Light> m_Lights;
+	// Running sum of the light probabilities, searched to pick a light
+	std::vector<float> m_LightDistribution;
+	// Light of every sphere and of the first triangle of every mesh, InvalidLight unless emissive.
+	// A mesh's triangles are consecutive lights.
+	std::vector<uint32_t> m_SphereLights, m_MeshLights;
+	static constexpr uint32_t InvalidLight = 0xffffffff;
+	// Whether any sphere or mesh emits, whatever power that comes to
+	bool m_EmissiveSurfaces = false;
+
+	std::unique_ptr<GPUPathTracer> m_GPUPathTracer;
+	// The BVH changed since the GPU's copy was uploaded, whether a frame or a ray query changed it
+	bool m_GPUNodesStale = true;
+
+	std::unique_ptr<DisplayPass> m_DisplayPass;
+	// RGBA16F at the internal resolution, what the display pass tone maps into the final image
+	std::shared_ptr<Walnut::Image> m_HDRImage;
+	RenderBackend m_ActiveBackend = RenderBackend::CPU;
+
+	ThreadPool m_ThreadPool;
 
 	const Scene* m_ActiveScene = nullptr;
 	const Camera* m_ActiveCamera = nullptr;
 
-	uint32_t* m_ImageData = nullptr;
-	glm::vec4* m_AccumulationData = nullptr;
+	AccumulationBuffer m_Accumulation;
+	// Viewport, the size of the final image and of RenderFrame's pixels
+	uint32_t m_Width = 0, m_Height = 0;
+	// What is actually traced, everything tile related uses these
+	uint32_t m_RenderWidth = 0, m_RenderHeight = 0;
+
+	// Dynamic resolution
+	float m_RenderScale = 1.0f;
+	float m_LastCPUFrameTime = 0.0f; // ms
+	glm::vec3 m_LastCameraPosition{ 0.0f };
+	Camera::RayGenerator m_LastRayGenerator;
+	// Resolved internal resolution image waiting to be upscaled
+	FrameBuffer<uint32_t> m_ScaledPixels;
 
 	uint32_t m_FrameIndex = 1;
+	uint64_t m_LastFrameRayCount = 0;
+	// What the last frame was traced with, samples of another variant do not belong in the same accumulation
+	uint32_t m_IntegratorFeatures = 0;
+
+	// Adaptive sampling, indexed like the tiles handed to the thread pool
+	std::vector<TileState> m_TileStates;
+	std::vector<uint32_t> m_ActiveTiles;
+	uint32_t m_TileSize = 0;
+	uint32_t m_ActiveTileCount = 0;
+	bool m_AdaptiveSampling = false;
+	bool m_Converged = false;
+
+	// Temporal reprojection, the history is the accumulation of the previous view while a move is reprojected
+	AccumulationBuffer m_History;
+	FrameBuffer<PrimaryHit> m_PrimaryHits, m_PreviousPrimaryHits;
+	glm::vec3 m_HistoryCameraPosition{ 0.0f };
+	glm::mat3 m_HistoryInverseRayBasis{ 1.0f };
+	bool m_TemporalReprojection = false;
+
+	Denoiser m_Denoiser;
+	bool m_CaptureGuides = false;
+
+	WavefrontBuffers m_Wavefront;
+
+	// What the last Resolve used, a converged image has to be resolved again when these change.
+	// Tone mapping only matters without HDR, the display pass applies it every frame.
+	AccumulationBuffer::ToneMap m_ResolvedToneMapping = AccumulationBuffer::ToneMap::Clamp;
+	bool m_ResolvedGammaCorrect = false;
+	bool m_ResolvedDenoise = false;
+	bool m_ResolvedHDR = false;
 };
\ No newline at end of file
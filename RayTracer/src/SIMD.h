@@ -0,0 +1,21 @@
+#pragma once
+
+// Architecture detection and intrinsic headers shared by the SIMD kernels
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+	#define RT_ARCH_X86 1
+	#include <immintrin.h>
+	#ifdef _MSC_VER
+		#include <intrin.h>
+	#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+	#define RT_ARCH_ARM64 1
+	#include <arm_neon.h>
+#endif
+
+// MSVC lets us use any intrinsic in any function, GCC and Clang need to be told per function
+#if defined(RT_ARCH_X86) && !defined(_MSC_VER)
+	#define RT_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+	#define RT_TARGET_AVX2
+#endif
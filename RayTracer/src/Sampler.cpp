@@ -0,0 +1,120 @@
+#include "Sampler.h"
+
+#include "Walnut/Random.h"
+
+namespace Utils {
+
+	// Generator matrices of the first four Sobol dimensions as 32 column vectors, bit 31 being the first
+	// binary digit. The first dimension is the van der Corput sequence, the others come from the primitive
+	// polynomials and initial direction numbers of Joe and Kuo 2008.
+	struct SobolMatrices
+	{
+		uint32_t Directions[Sampler::GroupSize][32];
+	};
+
+	static constexpr SobolMatrices BuildSobolMatrices()
+	{
+		constexpr uint32_t degrees[Sampler::GroupSize - 1] = { 1, 2, 3 };
+		constexpr uint32_t coefficients[Sampler::GroupSize - 1] = { 0, 1, 1 };
+		constexpr uint32_t initial[Sampler::GroupSize - 1][3] = { { 1, 0, 0 }, { 1, 3, 0 }, { 1, 3, 1 } };
+
+		SobolMatrices matrices = {};
+		for (uint32_t bit = 0; bit < 32; bit++)
+			matrices.Directions[0][bit] = 1u << (31 - bit);
+
+		for (uint32_t dimension = 1; dimension < Sampler::GroupSize; dimension++)
+		{
+			uint32_t degree = degrees[dimension - 1];
+			uint32_t coefficient = coefficients[dimension - 1];
+			uint32_t* directions = matrices.Directions[dimension];
+
+			for (uint32_t bit = 0; bit < degree; bit++)
+				directions[bit] = initial[dimension - 1][bit] << (31 - bit);
+
+			// Bratley and Fox's recurrence over the polynomial's coefficients
+			for (uint32_t bit = degree; bit < 32; bit++)
+			{
+				uint32_t direction = directions[bit - degree] ^ (directions[bit - degree] >> degree);
+				for (uint32_t k = 1; k < degree; k++)
+				{
+					if ((coefficient >> (degree - 1 - k)) & 1)
+						direction ^= directions[bit - k];
+				}
+				directions[bit] = direction;
+			}
+		}
+		return matrices;
+	}
+
+	static constexpr SobolMatrices s_Sobol = BuildSobolMatrices();
+
+	static uint32_t Sobol(uint32_t index, uint32_t dimension)
+	{
+		uint32_t result = 0;
+		for (uint32_t bit = 0; index != 0; index >>= 1, bit++)
+		{
+			if (index & 1)
+				result ^= s_Sobol.Directions[dimension][bit];
+		}
+		return result;
+	}
+
+	static uint32_t ReverseBits(uint32_t x)
+	{
+		x = (x << 16) | (x >> 16);
+		x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+		x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+		x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+		x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+		return x;
+	}
+
+	// Owen scrambling as a hash, every bit is flipped depending only on the bits above it.
+	// Laine and Karras' permutation works from the low bits, so it runs on the reversed value.
+	static uint32_t NestedUniformScramble(uint32_t x, uint32_t seed)
+	{
+		x = ReverseBits(x);
+		x += seed;
+		x ^= x * 0x6c50b47cu;
+		x ^= x * 0xb82f1e52u;
+		x ^= x * 0xc7afe638u;
+		x ^= x * 0x8d22f6e6u;
+		return ReverseBits(x);
+	}
+
+	// [0, 1), the top 24 bits map exactly onto the float mantissa
+	static float ToFloat(uint32_t x)
+	{
+		return (float)(x >> 8) * (1.0f / 16777216.0f);
+	}
+
+}
+
+Sampler::Sampler(Type type, uint32_t pixelIndex, uint32_t sampleIndex, uint32_t firstDimension)
+	: m_Type(type), m_PixelSeed(Walnut::Random::PCGHash(pixelIndex)), m_SampleIndex(sampleIndex - 1), m_Dimension(firstDimension)
+{
+	if (m_Type == Type::Random)
+		m_State = Walnut::Random::Seed(pixelIndex, sampleIndex, firstDimension);
+}
+
+float Sampler::Next()
+{
+	uint32_t dimension = m_Dimension++;
+
+	if (m_Type == Type::Random)
+		return Walnut::Random::Float(m_State);
+
+	// Every group gets its own shuffle of the sample order, or all groups would walk their points in
+	// lockstep and the dimensions of different groups would be correlated
+	uint32_t group = dimension / GroupSize;
+	uint32_t groupSeed = Walnut::Random::Seed(m_PixelSeed, group);
+	if (group != m_Group)
+	{
+		m_Group = group;
+		m_State = Utils::NestedUniformScramble(m_SampleIndex, groupSeed);
+	}
+
+	uint32_t component = dimension % GroupSize;
+	uint32_t value = Utils::Sobol(m_State, component);
+	return Utils::ToFloat(Utils::NestedUniformScramble(value, Walnut::Random::Seed(groupSeed, component)));
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+// The numbers behind the random decisions of one path. Dimension d of sample i is coordinate d of point i
+// of the pixel's sequence, so the renderer reads every decision from a fixed dimension, whichever
+// decisions the path made before it.
+//
+// Sobol is Burley's hash based Owen scrambling of a 4D Sobol sequence (JCGT 2020). Every group of four
+// dimensions is a 4D Sobol sequence of its own, shuffled and scrambled with seeds per pixel and group.
+// The samples of a pixel stay stratified within every group, so the error falls off faster than with
+// independent numbers, while neighbouring pixels stay uncorrelated. Random draws an independent PCG hash
+// for every number.
+class Sampler
+{
+public:
+	enum class Type
+	{
+		Random = 0, Sobol
+	};
+
+	// Dimensions that make up one Sobol sequence, pairs that should stay stratified belong in the same group
+	static constexpr uint32_t GroupSize = 4;
+public:
+	// sampleIndex counts from 1 like the renderer's frame index, values start at firstDimension
+	Sampler(Type type, uint32_t pixelIndex, uint32_t sampleIndex, uint32_t firstDimension);
+
+	// The next dimension, in [0, 1)
+	float Next();
+	glm::vec2 Next2D()
+	{
+		float x = Next();
+		return { x, Next() };
+	}
+private:
+	Type m_Type;
+	uint32_t m_PixelSeed;
+	uint32_t m_SampleIndex;
+	uint32_t m_Dimension;
+
+	// Random: the hash chain. Sobol: the point of the current group the sample index was shuffled to.
+	uint32_t m_State = 0;
+	uint32_t m_Group = ~0u;
+};
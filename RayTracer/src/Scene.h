@@ -1,14 +1,29 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
 
+#include <memory>
 #include <vector>
 
+#include "ArrayView.h"
+#include "BVHBuilder.h"
+
 struct Material
 {
 	glm::vec3 Albedo{ 1.0f };
 	float Roughness = 1.0;
 	float Metallic = 0.0;
+
+	// Emitted radiance is EmissionColor * EmissionPower, on both sides. Spheres and meshes using an
+	// emissive material are area lights the renderer samples directly.
+	glm::vec3 EmissionColor{ 0.0f };
+	float EmissionPower = 0.0f;
+
+	glm::vec3 GetEmission() const { return EmissionColor * EmissionPower; }
+
+	// See Scene
+	uint32_t Version = 0;
 };
 
 struct Sphere
@@ -17,10 +32,115 @@ struct Sphere
 	float Radius = 0.5f;
 
 	int MaterialIndex;
+
+	// See Scene
+	uint32_t Version = 0;
+};
+
+// Infinitely small light, found only by light sampling since no ray can hit it
+struct PointLight
+{
+	glm::vec3 Position{ 0.0f };
+	glm::vec3 Color{ 1.0f };
+	// Radiant intensity, the light falls off with the squared distance
+	float Intensity = 1.0f;
+
+	// See Scene
+	uint32_t Version = 0;
+};
+
+// Owning arrays behind a MeshGeometry that was loaded or generated rather than mapped
+struct MeshData
+{
+	std::vector<glm::vec3> Positions;
+	std::vector<glm::vec3> Normals;
+	std::vector<uint32_t> Indices;
+	std::vector<uint32_t> NormalIndices;
+};
+
+// Indexed triangles, three indices per triangle. Loaded once and shared between every Mesh
+// and every copy of the scene, so it is never modified after loading.
+// The arrays are views, into a MeshData or straight into a mapped scene cache, kept alive by Storage.
+struct MeshGeometry
+{
+	ArrayView<const glm::vec3> Positions;
+	// Optional, triangles without normals are shaded flat
+	ArrayView<const glm::vec3> Normals;
+	ArrayView<const uint32_t> Indices;
+	// Parallel to Indices when Normals come with indices of their own (OBJ), empty when they share Indices.
+	// InvalidIndex marks a corner without a normal.
+	ArrayView<const uint32_t> NormalIndices;
+
+	// Hierarchy over the triangles from a scene cache, MeshBVH uses it instead of building one.
+	// Empty for geometry that was not loaded from a cache.
+	ArrayView<const BVHNode> BVHNodes;
+	ArrayView<const uint32_t> BVHTriangles;
+
+	std::shared_ptr<const void> Storage;
+
+	static constexpr uint32_t InvalidIndex = 0xffffffff;
+
+	uint32_t GetTriangleCount() const { return (uint32_t)(Indices.size() / 3); }
+
+	static std::shared_ptr<MeshGeometry> Create(std::shared_ptr<const MeshData> data)
+	{
+		auto geometry = std::make_shared<MeshGeometry>();
+		geometry->Positions = data->Positions;
+		geometry->Normals = data->Normals;
+		geometry->Indices = data->Indices;
+		geometry->NormalIndices = data->NormalIndices;
+		geometry->Storage = std::move(data);
+		return geometry;
+	}
 };
 
+// One placement of a geometry. Copies of an asset share its MeshGeometry and, in the renderer, its hierarchy,
+// only the transform is their own.
+struct Mesh
+{
+	std::shared_ptr<const MeshGeometry> Geometry;
+
+	// Object to world: scaled, then rotated about X, Y and Z in that order (degrees), then moved to Position
+	glm::vec3 Position{ 0.0f };
+	glm::vec3 Rotation{ 0.0f };
+	glm::vec3 Scale{ 1.0f };
+
+	int MaterialIndex = 0;
+
+	// See Scene
+	uint32_t Version = 0;
+
+	glm::mat4 GetTransform() const
+	{
+		glm::mat4 transform = glm::translate(glm::mat4(1.0f), Position);
+		transform = glm::rotate(transform, glm::radians(Rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
+		transform = glm::rotate(transform, glm::radians(Rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
+		transform = glm::rotate(transform, glm::radians(Rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
+		return glm::scale(transform, Scale);
+	}
+};
+
+// Hierarchy over Scene::Spheres from a scene cache. Used instead of a build while the sphere count
+// and the leaf size of the renderer's kernels still match, and refit so edits stay correct.
+struct PrebuiltBVH
+{
+	ArrayView<const BVHNode> Nodes;
+	ArrayView<const uint32_t> PrimitiveIndices;
+	uint32_t LeafBlockSize = 1;
+
+	std::shared_ptr<const void> Storage;
+};
+
+// Whoever edits a sphere, mesh, material or point light in place bumps its Version. The renderer keeps the versions
+// of the last frame and only redoes what depends on the objects that changed: a moved sphere refits the BVH, a moved
+// mesh rebuilds the top level, a material edit touches no geometry, and accumulation restarts only if the image can
+// change. Adding or removing objects needs no bump, and neither does rendering a different Scene object.
 struct Scene
 {
 	std::vector<Sphere> Spheres;
+	std::vector<Mesh> Meshes;
 	std::vector<Material> Materials;
+	std::vector<PointLight> PointLights;
+
+	std::shared_ptr<const PrebuiltBVH> SphereBVH;
 };
\ No newline at end of file
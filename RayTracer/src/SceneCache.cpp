@@ -0,0 +1,377 @@
+#include "SceneCache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "BVH.h"
+#include "MappedFile.h"
+#include "MeshBVH.h"
+#include "SphereKernels.h"
+
+namespace Utils {
+
+	static constexpr char s_Magic[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0' };
+
+	// Every section starts on a cache line, which also covers the alignment of every record type
+	static constexpr uint64_t s_SectionAlignment = 64;
+
+	static_assert(std::is_trivially_copyable_v<Sphere> && std::is_trivially_copyable_v<Material> && std::is_trivially_copyable_v<PointLight>
+		&& std::is_trivially_copyable_v<BVHNode>,
+		"Cached records are written and mapped as raw memory");
+	static_assert(sizeof(glm::vec3) == 12, "Mesh arrays are mapped as tightly packed vec3s");
+
+	struct Section
+	{
+		uint64_t Offset = 0;
+		uint64_t Count = 0;
+	};
+
+	struct CacheHeader
+	{
+		char Magic[8];
+		uint32_t Version;
+
+		// A cache from a build with different structs is rejected instead of misread
+		uint32_t SphereSize, MaterialSize, NodeSize;
+
+		float CameraPosition[3];
+		float CameraDirection[3];
+		float VerticalFOV;
+
+		uint32_t SphereBVHLeafBlockSize;
+
+		Section Spheres, Materials, PointLights, Meshes, Geometries;
+		Section SphereBVHNodes, SphereBVHIndices;
+	};
+
+	// Meshes that share geometry share one of these
+	struct GeometryRecord
+	{
+		Section Positions, Normals, Indices, NormalIndices;
+		Section BVHNodes, BVHTriangles;
+	};
+
+	struct MeshRecord
+	{
+		uint32_t Geometry;
+		int32_t MaterialIndex;
+		float Position[3], Rotation[3], Scale[3];
+	};
+
+	class CacheWriter
+	{
+	public:
+		CacheWriter(const std::string& filepath)
+			: m_Stream(filepath, std::ios::binary) {}
+
+		bool IsOpen() const { return (bool)m_Stream; }
+		bool IsGood() const { return m_Stream.good(); }
+
+		template<typename T>
+		Section Append(const T* data, size_t count)
+		{
+			Pad();
+
+			Section section{ m_Offset, count };
+			m_Stream.write((const char*)data, count * sizeof(T));
+			m_Offset += count * sizeof(T);
+			return section;
+		}
+
+		template<typename T>
+		Section Append(ArrayView<const T> view) { return Append(view.data(), view.size()); }
+
+		void Rewrite(const void* data, size_t size)
+		{
+			m_Stream.seekp(0);
+			m_Stream.write((const char*)data, size);
+		}
+	private:
+		void Pad()
+		{
+			static const char s_Zeros[s_SectionAlignment] = {};
+			uint64_t padding = (s_SectionAlignment - m_Offset % s_SectionAlignment) % s_SectionAlignment;
+			m_Stream.write(s_Zeros, padding);
+			m_Offset += padding;
+		}
+	private:
+		std::ofstream m_Stream;
+		uint64_t m_Offset = 0;
+	};
+
+	// Checks the section fits the file and returns a view of it
+	template<typename T>
+	static bool GetSection(const MappedFile& file, const Section& section, ArrayView<const T>& view)
+	{
+		if (section.Count == 0)
+		{
+			view = {};
+			return true;
+		}
+
+		if (section.Offset % s_SectionAlignment != 0 || section.Offset > file.GetSize()
+			|| section.Count > (file.GetSize() - section.Offset) / sizeof(T))
+			return false;
+
+		view = { (const T*)(file.GetData() + section.Offset), (size_t)section.Count };
+		return true;
+	}
+
+	// Every index below count. Corners without a normal are allowed InvalidIndex.
+	static bool AreIndicesInRange(ArrayView<const uint32_t> indices, size_t count, bool allowInvalid = false)
+	{
+		for (uint32_t index : indices)
+		{
+			if (index >= count && !(allowInvalid && index == MeshGeometry::InvalidIndex))
+				return false;
+		}
+		return true;
+	}
+
+	// Leaves must stay within the primitive array and children come after their parent, which Refit relies on
+	// and which rules out cycles. The depth is capped at what the traversal stacks hold.
+	static bool IsValidBVH(ArrayView<const BVHNode> nodes, size_t primitiveCount)
+	{
+		std::vector<uint32_t> depths(nodes.size(), 0);
+		for (size_t i = 0; i < nodes.size(); i++)
+		{
+			const BVHNode& node = nodes[i];
+			if (node.IsLeaf())
+			{
+				if (node.LeftFirst > primitiveCount || node.PrimitiveCount > primitiveCount - node.LeftFirst)
+					return false;
+				continue;
+			}
+
+			if (node.LeftFirst <= i || (size_t)node.LeftFirst + 1 >= nodes.size())
+				return false;
+
+			uint32_t depth = depths[i] + 1;
+			if (depth > (uint32_t)BVHBuilder::MaxDepth)
+				return false;
+			depths[node.LeftFirst] = std::max(depths[node.LeftFirst], depth);
+			depths[node.LeftFirst + 1] = std::max(depths[node.LeftFirst + 1], depth);
+		}
+		return true;
+	}
+
+	static bool IsValidGeometry(const MeshGeometry& geometry)
+	{
+		if (geometry.Indices.size() % 3 != 0 || !AreIndicesInRange(geometry.Indices, geometry.Positions.size()))
+			return false;
+
+		if (geometry.NormalIndices.empty())
+		{
+			// Normals then share the position indices
+			if (!geometry.Normals.empty() && !AreIndicesInRange(geometry.Indices, geometry.Normals.size()))
+				return false;
+		}
+		else if (geometry.NormalIndices.size() != geometry.Indices.size() || !AreIndicesInRange(geometry.NormalIndices, geometry.Normals.size(), true))
+			return false;
+
+		return AreIndicesInRange(geometry.BVHTriangles, geometry.GetTriangleCount()) && IsValidBVH(geometry.BVHNodes, geometry.BVHTriangles.size());
+	}
+
+}
+
+bool SceneCache::IsCacheFile(const std::string& filepath)
+{
+	static constexpr const char* s_Extension = ".rtscene";
+	size_t length = strlen(s_Extension);
+	return filepath.size() >= length && filepath.compare(filepath.size() - length, length, s_Extension) == 0;
+}
+
+bool SceneCache::Write(const std::string& filepath, const Scene& scene, const CameraDescription& camera)
+{
+	Utils::CacheWriter writer(filepath);
+	if (!writer.IsOpen())
+	{
+		std::cerr << "[SceneCache] Could not open " << filepath << " for writing\n";
+		return false;
+	}
+
+	Utils::CacheHeader header{};
+	memcpy(header.Magic, Utils::s_Magic, sizeof(header.Magic));
+	header.Version = Version;
+	header.SphereSize = sizeof(Sphere);
+	header.MaterialSize = sizeof(Material);
+	header.NodeSize = sizeof(BVHNode);
+	for (int i = 0; i < 3; i++)
+	{
+		header.CameraPosition[i] = camera.Position[i];
+		header.CameraDirection[i] = camera.Direction[i];
+	}
+	header.VerticalFOV = camera.VerticalFOV;
+
+	// Placeholder, rewritten once every section's offset is known
+	writer.Append(&header, 1);
+
+	header.Spheres = writer.Append(scene.Spheres.data(), scene.Spheres.size());
+	header.Materials = writer.Append(scene.Materials.data(), scene.Materials.size());
+	header.PointLights = writer.Append(scene.PointLights.data(), scene.PointLights.size());
+
+	// Built for the kernels of this machine, a reader with other kernels builds its own
+	BVH sphereBVH;
+	sphereBVH.SetInstructionSet(SphereKernels::DetectInstructionSet());
+	if (!scene.SphereBVH || !sphereBVH.Load(scene.Spheres, *scene.SphereBVH))
+		sphereBVH.Build(scene.Spheres);
+
+	header.SphereBVHLeafBlockSize = sphereBVH.GetLeafBlockSize();
+	header.SphereBVHNodes = writer.Append(sphereBVH.GetNodes().data(), sphereBVH.GetNodes().size());
+	header.SphereBVHIndices = writer.Append(sphereBVH.GetPrimitiveIndices().data(), sphereBVH.GetPrimitiveIndices().size());
+
+	std::unordered_map<const MeshGeometry*, uint32_t> geometryIndices;
+	std::vector<Utils::GeometryRecord> geometries;
+	std::vector<Utils::MeshRecord> meshes;
+
+	for (const Mesh& mesh : scene.Meshes)
+	{
+		if (!mesh.Geometry)
+			continue;
+
+		auto [it, inserted] = geometryIndices.try_emplace(mesh.Geometry.get(), (uint32_t)geometries.size());
+		Utils::MeshRecord& meshRecord = meshes.emplace_back();
+		meshRecord.Geometry = it->second;
+		meshRecord.MaterialIndex = mesh.MaterialIndex;
+		for (int i = 0; i < 3; i++)
+		{
+			meshRecord.Position[i] = mesh.Position[i];
+			meshRecord.Rotation[i] = mesh.Rotation[i];
+			meshRecord.Scale[i] = mesh.Scale[i];
+		}
+
+		if (!inserted)
+			continue;
+
+		const MeshGeometry& geometry = *mesh.Geometry;
+		MeshBVH bvh;
+		bvh.Build(mesh.Geometry);
+
+		Utils::GeometryRecord& record = geometries.emplace_back();
+		record.Positions = writer.Append(geometry.Positions);
+		record.Normals = writer.Append(geometry.Normals);
+		record.Indices = writer.Append(geometry.Indices);
+		record.NormalIndices = writer.Append(geometry.NormalIndices);
+		record.BVHNodes = writer.Append(bvh.GetNodes());
+		record.BVHTriangles = writer.Append(bvh.GetTriangles());
+	}
+
+	header.Geometries = writer.Append(geometries.data(), geometries.size());
+	header.Meshes = writer.Append(meshes.data(), meshes.size());
+	writer.Rewrite(&header, sizeof(header));
+
+	if (!writer.IsGood())
+	{
+		std::cerr << "[SceneCache] Could not write " << filepath << "\n";
+		return false;
+	}
+
+	return true;
+}
+
+bool SceneCache::Load(const std::string& filepath, Scene& scene, CameraDescription& camera)
+{
+	auto file = std::make_shared<MappedFile>();
+	if (!file->Open(filepath))
+		return false;
+
+	auto fail = [&filepath](const char* reason)
+	{
+		std::cerr << "[SceneCache] " << filepath << ": " << reason << "\n";
+		return false;
+	};
+
+	if (file->GetSize() < sizeof(Utils::CacheHeader))
+		return fail("too small for a scene cache");
+
+	// The mapping is page aligned, so is the header at its start
+	const Utils::CacheHeader& header = *(const Utils::CacheHeader*)file->GetData();
+	if (memcmp(header.Magic, Utils::s_Magic, sizeof(header.Magic)) != 0)
+		return fail("not a scene cache");
+	if (header.Version != Version)
+		return fail("written by a different version, recreate it");
+	if (header.SphereSize != sizeof(Sphere) || header.MaterialSize != sizeof(Material) || header.NodeSize != sizeof(BVHNode))
+		return fail("written by a build with a different record layout, recreate it");
+
+	ArrayView<const Sphere> spheres;
+	ArrayView<const Material> materials;
+	ArrayView<const PointLight> pointLights;
+	ArrayView<const Utils::MeshRecord> meshes;
+	ArrayView<const Utils::GeometryRecord> geometryRecords;
+	auto sphereBVH = std::make_shared<PrebuiltBVH>();
+
+	if (!Utils::GetSection(*file, header.Spheres, spheres) || !Utils::GetSection(*file, header.Materials, materials)
+		|| !Utils::GetSection(*file, header.PointLights, pointLights)
+		|| !Utils::GetSection(*file, header.Meshes, meshes) || !Utils::GetSection(*file, header.Geometries, geometryRecords)
+		|| !Utils::GetSection(*file, header.SphereBVHNodes, sphereBVH->Nodes) || !Utils::GetSection(*file, header.SphereBVHIndices, sphereBVH->PrimitiveIndices))
+		return fail("section out of bounds");
+
+	for (const Sphere& sphere : spheres)
+	{
+		if (sphere.MaterialIndex < 0 || (size_t)sphere.MaterialIndex >= materials.size())
+			return fail("sphere with an invalid material");
+	}
+
+	if (!Utils::AreIndicesInRange(sphereBVH->PrimitiveIndices, spheres.size()) || !Utils::IsValidBVH(sphereBVH->Nodes, sphereBVH->PrimitiveIndices.size()))
+		return fail("invalid sphere hierarchy");
+
+	std::vector<std::shared_ptr<const MeshGeometry>> geometries;
+	for (const Utils::GeometryRecord& record : geometryRecords)
+	{
+		auto geometry = std::make_shared<MeshGeometry>();
+		if (!Utils::GetSection(*file, record.Positions, geometry->Positions) || !Utils::GetSection(*file, record.Normals, geometry->Normals)
+			|| !Utils::GetSection(*file, record.Indices, geometry->Indices) || !Utils::GetSection(*file, record.NormalIndices, geometry->NormalIndices)
+			|| !Utils::GetSection(*file, record.BVHNodes, geometry->BVHNodes) || !Utils::GetSection(*file, record.BVHTriangles, geometry->BVHTriangles))
+			return fail("mesh section out of bounds");
+
+		if (!Utils::IsValidGeometry(*geometry))
+			return fail("mesh with invalid indices");
+
+		geometry->Storage = file;
+		geometries.push_back(std::move(geometry));
+	}
+
+	// Built aside, so a cache that fails validation leaves the scene as it was
+	std::vector<Mesh> loadedMeshes;
+	loadedMeshes.reserve(meshes.size());
+	for (const Utils::MeshRecord& record : meshes)
+	{
+		if (record.Geometry >= geometries.size())
+			return fail("mesh with an invalid geometry");
+		if (record.MaterialIndex < 0 || (size_t)record.MaterialIndex >= materials.size())
+			return fail("mesh with an invalid material");
+
+		Mesh& mesh = loadedMeshes.emplace_back();
+		mesh.Geometry = geometries[record.Geometry];
+		mesh.MaterialIndex = record.MaterialIndex;
+		for (int i = 0; i < 3; i++)
+		{
+			mesh.Position[i] = record.Position[i];
+			mesh.Rotation[i] = record.Rotation[i];
+			mesh.Scale[i] = record.Scale[i];
+		}
+	}
+
+	for (int i = 0; i < 3; i++)
+	{
+		camera.Position[i] = header.CameraPosition[i];
+		camera.Direction[i] = header.CameraDirection[i];
+	}
+	camera.VerticalFOV = header.VerticalFOV;
+
+	scene.Spheres.assign(spheres.begin(), spheres.end());
+	scene.Materials.assign(materials.begin(), materials.end());
+	scene.PointLights.assign(pointLights.begin(), pointLights.end());
+	scene.Meshes = std::move(loadedMeshes);
+
+	sphereBVH->LeafBlockSize = header.SphereBVHLeafBlockSize;
+	sphereBVH->Storage = file;
+	scene.SphereBVH = std::move(sphereBVH);
+
+	return true;
+}
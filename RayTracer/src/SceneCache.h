@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+
+#include "Scene.h"
+#include "SceneSerializer.h"
+
+// Flat binary snapshot of a scene with every hierarchy already built, loaded by mapping the file.
+// Mesh arrays and their BVHs are used in place, straight out of the mapping. Spheres and materials are
+// copied into the Scene because the UI edits them, the sphere BVH is copied and refit rather than built.
+//
+// Written for the machine that reads it: native byte order and struct layout, guarded by the version and
+// the record sizes in the header. The contents are trusted, only the section bounds are checked on load.
+//
+//   RayTracer --headless --scene scene.json --cache scene.rtscene --spp 0
+class SceneCache
+{
+public:
+	// Bump whenever a record layout or the meaning of a section changes
+	static constexpr uint32_t Version = 4;
+
+	static bool IsCacheFile(const std::string& filepath);
+
+	// Returns false and prints the reason to stderr on failure
+	static bool Write(const std::string& filepath, const Scene& scene, const CameraDescription& camera);
+	static bool Load(const std::string& filepath, Scene& scene, CameraDescription& camera);
+};
@@ -0,0 +1,173 @@
+#include "SceneSerializer.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Json.h"
+#include "MeshLoader.h"
+#include "SceneCache.h"
+
+namespace Utils {
+
+	static void ReadFloat(const JsonValue& object, const char* key, float& value)
+	{
+		const JsonValue* member = object.Find(key);
+		if (member && member->ValueType == JsonValue::Type::Number)
+			value = (float)member->Number;
+	}
+
+	static void ReadInt(const JsonValue& object, const char* key, int& value)
+	{
+		const JsonValue* member = object.Find(key);
+		if (member && member->ValueType == JsonValue::Type::Number)
+			value = (int)member->Number;
+	}
+
+	static void ReadVec3(const JsonValue& object, const char* key, glm::vec3& value)
+	{
+		const JsonValue* member = object.Find(key);
+		if (!member || member->ValueType != JsonValue::Type::Array || member->Elements.size() != 3)
+			return;
+
+		for (int i = 0; i < 3; i++)
+		{
+			if (member->Elements[i].ValueType == JsonValue::Type::Number)
+				value[i] = (float)member->Elements[i].Number;
+		}
+	}
+
+}
+
+bool SceneSerializer::Deserialize(const std::string& filepath, Scene& scene, CameraDescription& camera)
+{
+	if (SceneCache::IsCacheFile(filepath))
+		return SceneCache::Load(filepath, scene, camera);
+
+	std::ifstream stream(filepath);
+	if (!stream)
+	{
+		std::cerr << "[SceneSerializer] Could not open " << filepath << "\n";
+		return false;
+	}
+
+	std::stringstream buffer;
+	buffer << stream.rdbuf();
+	std::string text = buffer.str();
+
+	JsonValue root;
+	JsonParser parser(text);
+	if (!parser.Parse(root) || root.ValueType != JsonValue::Type::Object)
+	{
+		std::cerr << "[SceneSerializer] " << filepath << ": " << (parser.GetError().empty() ? "expected an object" : parser.GetError()) << "\n";
+		return false;
+	}
+
+	if (const JsonValue* cameraNode = root.Find("camera"))
+	{
+		Utils::ReadVec3(*cameraNode, "position", camera.Position);
+		Utils::ReadVec3(*cameraNode, "direction", camera.Direction);
+		Utils::ReadFloat(*cameraNode, "fov", camera.VerticalFOV);
+	}
+
+	// Only scene caches come with a prebuilt hierarchy
+	scene.SphereBVH.reset();
+
+	scene.Materials.clear();
+	if (const JsonValue* materials = root.Find("materials"))
+	{
+		for (const JsonValue& node : materials->Elements)
+		{
+			Material& material = scene.Materials.emplace_back();
+			Utils::ReadVec3(node, "albedo", material.Albedo);
+			Utils::ReadFloat(node, "roughness", material.Roughness);
+			Utils::ReadFloat(node, "metallic", material.Metallic);
+			Utils::ReadVec3(node, "emission", material.EmissionColor);
+			Utils::ReadFloat(node, "emissionPower", material.EmissionPower);
+		}
+	}
+
+	// Spheres index into this, so an empty list still needs one material
+	if (scene.Materials.empty())
+		scene.Materials.emplace_back();
+
+	scene.PointLights.clear();
+	if (const JsonValue* lights = root.Find("lights"))
+	{
+		for (const JsonValue& node : lights->Elements)
+		{
+			PointLight& light = scene.PointLights.emplace_back();
+			Utils::ReadVec3(node, "position", light.Position);
+			Utils::ReadVec3(node, "color", light.Color);
+			Utils::ReadFloat(node, "intensity", light.Intensity);
+		}
+	}
+
+	scene.Spheres.clear();
+	if (const JsonValue* spheres = root.Find("spheres"))
+	{
+		for (const JsonValue& node : spheres->Elements)
+		{
+			Sphere& sphere = scene.Spheres.emplace_back();
+			sphere.MaterialIndex = 0;
+			Utils::ReadVec3(node, "position", sphere.Position);
+			Utils::ReadFloat(node, "radius", sphere.Radius);
+			Utils::ReadInt(node, "material", sphere.MaterialIndex);
+
+			if (sphere.MaterialIndex < 0 || sphere.MaterialIndex >= (int)scene.Materials.size())
+			{
+				std::cerr << "[SceneSerializer] " << filepath << ": sphere " << scene.Spheres.size() - 1
+					<< " uses material " << sphere.MaterialIndex << ", which does not exist\n";
+				return false;
+			}
+		}
+	}
+
+	// Mesh paths are relative to the scene file
+	size_t separator = filepath.find_last_of("/\\");
+	std::string directory = separator == std::string::npos ? std::string() : filepath.substr(0, separator + 1);
+
+	// Meshes naming the same file are instances of one geometry
+	std::unordered_map<std::string, std::shared_ptr<const MeshGeometry>> geometries;
+
+	scene.Meshes.clear();
+	if (const JsonValue* meshes = root.Find("meshes"))
+	{
+		for (const JsonValue& node : meshes->Elements)
+		{
+			const JsonValue* path = node.Find("path");
+			if (!path || path->ValueType != JsonValue::Type::String)
+			{
+				std::cerr << "[SceneSerializer] " << filepath << ": mesh " << scene.Meshes.size() << " has no path\n";
+				return false;
+			}
+
+			Mesh& mesh = scene.Meshes.emplace_back();
+			Utils::ReadVec3(node, "position", mesh.Position);
+			Utils::ReadVec3(node, "rotation", mesh.Rotation);
+			Utils::ReadVec3(node, "scale", mesh.Scale);
+			Utils::ReadInt(node, "material", mesh.MaterialIndex);
+			if (mesh.MaterialIndex < 0 || mesh.MaterialIndex >= (int)scene.Materials.size())
+			{
+				std::cerr << "[SceneSerializer] " << filepath << ": mesh " << scene.Meshes.size() - 1
+					<< " uses material " << mesh.MaterialIndex << ", which does not exist\n";
+				return false;
+			}
+
+			bool absolute = !path->String.empty() && (path->String[0] == '/' || path->String[0] == '\\' || path->String.find(':') != std::string::npos);
+			std::string meshPath = absolute ? path->String : directory + path->String;
+
+			std::shared_ptr<const MeshGeometry>& geometry = geometries[meshPath];
+			if (!geometry)
+				geometry = MeshLoader::Load(meshPath);
+			if (!geometry)
+				return false;
+			mesh.Geometry = geometry;
+		}
+	}
+
+	return true;
+}
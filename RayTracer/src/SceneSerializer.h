@@ -0,0 +1,35 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <string>
+
+#include "Scene.h"
+
+// Where the camera sits in a scene file, applied with Camera::SetPosition/SetDirection
+struct CameraDescription
+{
+	glm::vec3 Position{ 0.0f, 0.0f, 6.0f };
+	glm::vec3 Direction{ 0.0f, 0.0f, -1.0f };
+	float VerticalFOV = 45.0f;
+};
+
+// Reads scenes written as JSON:
+//
+//   {
+//     "camera":    { "position": [0, 0, 6], "direction": [0, 0, -1], "fov": 45 },
+//     "materials": [ { "albedo": [1, 0, 1], "roughness": 0.0, "metallic": 0.0, "emission": [1, 1, 1], "emissionPower": 0.0 } ],
+//     "lights":    [ { "position": [0, 5, 0], "color": [1, 1, 1], "intensity": 10.0 } ],
+//     "spheres":   [ { "position": [0, 0, 0], "radius": 1.0, "material": 0 } ],
+//     "meshes":    [ { "path": "bunny.obj", "material": 0, "position": [0, 0, 0], "rotation": [0, 90, 0], "scale": [1, 1, 1] } ]
+//   }
+//
+// Every key is optional and falls back to the defaults in Scene.h. Mesh paths are relative to the
+// scene file and loaded with MeshLoader, once per file however many meshes place it.
+// Files ending in .rtscene are scene caches and go to SceneCache.
+class SceneSerializer
+{
+public:
+	// Returns false and prints the reason to stderr if the file is missing or malformed
+	static bool Deserialize(const std::string& filepath, Scene& scene, CameraDescription& camera);
+};
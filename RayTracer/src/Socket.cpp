@@ -0,0 +1,232 @@
+#include "Socket.h"
+
+#include <cstring>
+#include <iostream>
+#include <mutex>
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <winsock2.h>
+	#include <ws2tcpip.h>
+	#pragma comment(lib, "ws2_32.lib")
+#else
+	#include <netdb.h>
+	#include <netinet/in.h>
+	#include <netinet/tcp.h>
+	#include <poll.h>
+	#include <sys/socket.h>
+	#include <unistd.h>
+#endif
+
+namespace Utils {
+
+#ifdef _WIN32
+	using NativeSocket = SOCKET;
+
+	static bool InitializeSockets()
+	{
+		static std::once_flag s_Once;
+		static bool s_Initialized = false;
+		std::call_once(s_Once, []()
+		{
+			WSADATA data;
+			s_Initialized = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+			if (!s_Initialized)
+				std::cerr << "[Socket] Could not initialize Winsock\n";
+		});
+		return s_Initialized;
+	}
+
+	static void CloseNative(NativeSocket handle) { closesocket(handle); }
+	static int PollNative(WSAPOLLFD* descriptor, uint32_t timeoutMs) { return WSAPoll(descriptor, 1, (INT)timeoutMs); }
+	using PollDescriptor = WSAPOLLFD;
+
+	static constexpr int ShutdownBoth = SD_BOTH;
+	static constexpr int SendFlags = 0;
+#else
+	using NativeSocket = int;
+
+	static bool InitializeSockets() { return true; }
+	static void CloseNative(NativeSocket handle) { close(handle); }
+	static int PollNative(pollfd* descriptor, uint32_t timeoutMs) { return poll(descriptor, 1, (int)timeoutMs); }
+	using PollDescriptor = pollfd;
+
+	static constexpr int ShutdownBoth = SHUT_RDWR;
+	// A peer that vanished must fail the send, not raise SIGPIPE
+	static constexpr int SendFlags = MSG_NOSIGNAL;
+#endif
+
+	static NativeSocket ToNative(uintptr_t handle) { return (NativeSocket)handle; }
+	static uintptr_t FromNative(NativeSocket handle) { return (uintptr_t)(intptr_t)handle; }
+
+	// Frames go out whole, Nagle would hold back the tail of every one
+	static void DisableNagle(NativeSocket handle)
+	{
+		int enable = 1;
+		setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, (const char*)&enable, sizeof(enable));
+	}
+
+}
+
+Socket::~Socket()
+{
+	Close();
+}
+
+Socket::Socket(Socket&& other) noexcept
+	: m_Handle(other.m_Handle)
+{
+	other.m_Handle = InvalidHandle;
+}
+
+Socket& Socket::operator=(Socket&& other) noexcept
+{
+	if (this != &other)
+	{
+		Close();
+		m_Handle = other.m_Handle;
+		other.m_Handle = InvalidHandle;
+	}
+	return *this;
+}
+
+Socket Socket::Listen(uint16_t port)
+{
+	if (!Utils::InitializeSockets())
+		return Socket();
+
+	Utils::NativeSocket handle = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	Socket listener(Utils::FromNative(handle));
+	if (!listener.IsValid())
+	{
+		std::cerr << "[Socket] Could not create a socket\n";
+		return Socket();
+	}
+
+	// A coordinator restarted right after a run must not wait for the old port to time out
+	int reuse = 1;
+	setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port);
+	if (bind(handle, (const sockaddr*)&address, sizeof(address)) != 0 || listen(handle, SOMAXCONN) != 0)
+	{
+		std::cerr << "[Socket] Could not listen on port " << port << "\n";
+		return Socket();
+	}
+
+	return listener;
+}
+
+Socket Socket::Connect(const std::string& address)
+{
+	if (!Utils::InitializeSockets())
+		return Socket();
+
+	size_t colon = address.rfind(':');
+	if (colon == std::string::npos)
+	{
+		std::cerr << "[Socket] Expected host:port, got " << address << "\n";
+		return Socket();
+	}
+
+	std::string host = address.substr(0, colon);
+	std::string port = address.substr(colon + 1);
+
+	addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+
+	addrinfo* results = nullptr;
+	if (getaddrinfo(host.c_str(), port.c_str(), &hints, &results) != 0)
+	{
+		std::cerr << "[Socket] Could not resolve " << address << "\n";
+		return Socket();
+	}
+
+	Socket connection;
+	for (addrinfo* result = results; result && !connection.IsValid(); result = result->ai_next)
+	{
+		Utils::NativeSocket handle = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+		Socket candidate(Utils::FromNative(handle));
+		if (candidate.IsValid() && connect(handle, result->ai_addr, (int)result->ai_addrlen) == 0)
+			connection = std::move(candidate);
+	}
+	freeaddrinfo(results);
+
+	if (!connection.IsValid())
+	{
+		std::cerr << "[Socket] Could not connect to " << address << "\n";
+		return Socket();
+	}
+
+	Utils::DisableNagle(Utils::ToNative(connection.m_Handle));
+	return connection;
+}
+
+Socket Socket::Accept(uint32_t timeoutMs)
+{
+	Utils::PollDescriptor descriptor = {};
+	descriptor.fd = Utils::ToNative(m_Handle);
+	descriptor.events = POLLIN;
+	if (Utils::PollNative(&descriptor, timeoutMs) <= 0)
+		return Socket();
+
+	Utils::NativeSocket handle = accept(Utils::ToNative(m_Handle), nullptr, nullptr);
+	Socket connection(Utils::FromNative(handle));
+	if (connection.IsValid())
+		Utils::DisableNagle(handle);
+	return connection;
+}
+
+bool Socket::Send(const void* data, size_t size)
+{
+	const char* bytes = (const char*)data;
+	while (size > 0)
+	{
+		// Chunked, a single call takes an int on Windows
+		int chunk = (int)(size < (1u << 30) ? size : (1u << 30));
+		int sent = send(Utils::ToNative(m_Handle), bytes, chunk, Utils::SendFlags);
+		if (sent <= 0)
+			return false;
+
+		bytes += sent;
+		size -= (size_t)sent;
+	}
+	return true;
+}
+
+bool Socket::Receive(void* data, size_t size)
+{
+	char* bytes = (char*)data;
+	while (size > 0)
+	{
+		int chunk = (int)(size < (1u << 30) ? size : (1u << 30));
+		int received = recv(Utils::ToNative(m_Handle), bytes, chunk, 0);
+		if (received <= 0)
+			return false;
+
+		bytes += received;
+		size -= (size_t)received;
+	}
+	return true;
+}
+
+void Socket::Shutdown()
+{
+	if (IsValid())
+		shutdown(Utils::ToNative(m_Handle), Utils::ShutdownBoth);
+}
+
+void Socket::Close()
+{
+	if (!IsValid())
+		return;
+
+	Utils::CloseNative(Utils::ToNative(m_Handle));
+	m_Handle = InvalidHandle;
+}
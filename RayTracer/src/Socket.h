@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Blocking TCP connection or listening socket, BSD sockets or Winsock. Move only, closes itself.
+class Socket
+{
+public:
+	Socket() = default;
+	~Socket();
+
+	Socket(Socket&& other) noexcept;
+	Socket& operator=(Socket&& other) noexcept;
+
+	Socket(const Socket&) = delete;
+	Socket& operator=(const Socket&) = delete;
+
+	// Listens on every interface. Return an invalid socket and print the reason to stderr on failure.
+	static Socket Listen(uint16_t port);
+	// host:port, host a name or an address
+	static Socket Connect(const std::string& address);
+
+	// Waits at most timeoutMs for a connection
+	Socket Accept(uint32_t timeoutMs);
+
+	// False once the connection failed or the other side closed it
+	bool Send(const void* data, size_t size);
+	bool Receive(void* data, size_t size);
+
+	// Unblocks another thread waiting in Send or Receive, both then fail
+	void Shutdown();
+	void Close();
+
+	bool IsValid() const { return m_Handle != InvalidHandle; }
+private:
+	// SOCKET on Windows is pointer sized
+	static constexpr uintptr_t InvalidHandle = ~(uintptr_t)0;
+
+	explicit Socket(uintptr_t handle)
+		: m_Handle(handle) {}
+private:
+	uintptr_t m_Handle = InvalidHandle;
+};
@@ -0,0 +1,342 @@
+#include "SphereKernels.h"
+
+#include <cfloat>
+
+#include "SIMD.h"
+
+void SphereSoA::Build(const std::vector<Sphere>& spheres, const std::vector<uint32_t>& order)
+{
+	m_Count = (uint32_t)order.size();
+
+	size_t paddedCount = m_Count + MaxLaneCount;
+	PositionX.assign(paddedCount, 0.0f);
+	PositionY.assign(paddedCount, 0.0f);
+	PositionZ.assign(paddedCount, 0.0f);
+	RadiusSquared.assign(paddedCount, 0.0f);
+
+	for (uint32_t i = 0; i < m_Count; i++)
+	{
+		const Sphere& sphere = spheres[order[i]];
+		PositionX[i] = sphere.Position.x;
+		PositionY[i] = sphere.Position.y;
+		PositionZ[i] = sphere.Position.z;
+		RadiusSquared[i] = sphere.Radius * sphere.Radius;
+	}
+}
+
+void SphereSoA::Clear()
+{
+	PositionX.clear();
+	PositionY.clear();
+	PositionZ.clear();
+	RadiusSquared.clear();
+	m_Count = 0;
+}
+
+namespace SphereKernels {
+
+	namespace Utils {
+
+		static int FirstSetBit(uint32_t mask)
+		{
+#ifdef _MSC_VER
+			unsigned long index;
+			_BitScanForward(&index, mask);
+			return (int)index;
+#else
+			return __builtin_ctz(mask);
+#endif
+		}
+
+	}
+
+	// Half-b form of the quadratic from the original TraceRay:
+	// t = (-b - sqrt(b^2 - ac)) / a with b = dot(oc, d), c = dot(oc, oc) - r^2
+	static int IntersectScalar(const Ray& ray, const SphereSoA& spheres, uint32_t first, uint32_t count, float& hitDistance)
+	{
+		int closest = -1;
+		float a = glm::dot(ray.Direction, ray.Direction);
+
+		for (uint32_t i = 0; i < count; i++)
+		{
+			uint32_t index = first + i;
+			glm::vec3 origin = ray.Origin - glm::vec3(spheres.PositionX[index], spheres.PositionY[index], spheres.PositionZ[index]);
+
+			float b = glm::dot(origin, ray.Direction);
+			float c = glm::dot(origin, origin) - spheres.RadiusSquared[index];
+
+			float discriminant = b * b - a * c;
+			if (discriminant < 0.0f)
+				continue;
+
+			float t = (-b - glm::sqrt(discriminant)) / a;
+			if (t > 0.0f && t < hitDistance)
+			{
+				hitDistance = t;
+				closest = (int)i;
+			}
+		}
+
+		return closest;
+	}
+
+#ifdef RT_ARCH_X86
+
+	static int IntersectSSE2(const Ray& ray, const SphereSoA& spheres, uint32_t first, uint32_t count, float& hitDistance)
+	{
+		int closest = -1;
+
+		const __m128 ox = _mm_set1_ps(ray.Origin.x);
+		const __m128 oy = _mm_set1_ps(ray.Origin.y);
+		const __m128 oz = _mm_set1_ps(ray.Origin.z);
+		const __m128 dx = _mm_set1_ps(ray.Direction.x);
+		const __m128 dy = _mm_set1_ps(ray.Direction.y);
+		const __m128 dz = _mm_set1_ps(ray.Direction.z);
+
+		float aScalar = glm::dot(ray.Direction, ray.Direction);
+		const __m128 a = _mm_set1_ps(aScalar);
+		const __m128 inverseA = _mm_set1_ps(1.0f / aScalar);
+
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 noHit = _mm_set1_ps(FLT_MAX);
+		const __m128i laneIndex = _mm_setr_epi32(0, 1, 2, 3);
+
+		for (uint32_t i = 0; i < count; i += 4)
+		{
+			uint32_t index = first + i;
+
+			__m128 ocx = _mm_sub_ps(ox, _mm_loadu_ps(&spheres.PositionX[index]));
+			__m128 ocy = _mm_sub_ps(oy, _mm_loadu_ps(&spheres.PositionY[index]));
+			__m128 ocz = _mm_sub_ps(oz, _mm_loadu_ps(&spheres.PositionZ[index]));
+
+			__m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, dx), _mm_mul_ps(ocy, dy)), _mm_mul_ps(ocz, dz));
+			__m128 c = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz));
+			c = _mm_sub_ps(c, _mm_loadu_ps(&spheres.RadiusSquared[index]));
+
+			__m128 discriminant = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(a, c));
+			__m128 t = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(zero, b), _mm_sqrt_ps(_mm_max_ps(discriminant, zero))), inverseA);
+
+			__m128 valid = _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_set1_epi32((int)(count - i)), laneIndex));
+			valid = _mm_and_ps(valid, _mm_cmpge_ps(discriminant, zero));
+			valid = _mm_and_ps(valid, _mm_cmpgt_ps(t, zero));
+			valid = _mm_and_ps(valid, _mm_cmplt_ps(t, _mm_set1_ps(hitDistance)));
+
+			if (_mm_movemask_ps(valid) == 0)
+				continue;
+
+			t = _mm_or_ps(_mm_and_ps(valid, t), _mm_andnot_ps(valid, noHit));
+
+			__m128 minimum = _mm_min_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(2, 3, 0, 1)));
+			minimum = _mm_min_ps(minimum, _mm_shuffle_ps(minimum, minimum, _MM_SHUFFLE(1, 0, 3, 2)));
+
+			hitDistance = _mm_cvtss_f32(minimum);
+			closest = (int)i + Utils::FirstSetBit((uint32_t)_mm_movemask_ps(_mm_cmpeq_ps(t, minimum)));
+		}
+
+		return closest;
+	}
+
+	RT_TARGET_AVX2 static int IntersectAVX2(const Ray& ray, const SphereSoA& spheres, uint32_t first, uint32_t count, float& hitDistance)
+	{
+		int closest = -1;
+
+		const __m256 ox = _mm256_set1_ps(ray.Origin.x);
+		const __m256 oy = _mm256_set1_ps(ray.Origin.y);
+		const __m256 oz = _mm256_set1_ps(ray.Origin.z);
+		const __m256 dx = _mm256_set1_ps(ray.Direction.x);
+		const __m256 dy = _mm256_set1_ps(ray.Direction.y);
+		const __m256 dz = _mm256_set1_ps(ray.Direction.z);
+
+		float aScalar = ray.Direction.x * ray.Direction.x + ray.Direction.y * ray.Direction.y + ray.Direction.z * ray.Direction.z;
+		const __m256 a = _mm256_set1_ps(aScalar);
+		const __m256 inverseA = _mm256_set1_ps(1.0f / aScalar);
+
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 noHit = _mm256_set1_ps(FLT_MAX);
+		const __m256i laneIndex = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+		for (uint32_t i = 0; i < count; i += 8)
+		{
+			uint32_t index = first + i;
+
+			__m256 ocx = _mm256_sub_ps(ox, _mm256_loadu_ps(&spheres.PositionX[index]));
+			__m256 ocy = _mm256_sub_ps(oy, _mm256_loadu_ps(&spheres.PositionY[index]));
+			__m256 ocz = _mm256_sub_ps(oz, _mm256_loadu_ps(&spheres.PositionZ[index]));
+
+			__m256 b = _mm256_fmadd_ps(ocz, dz, _mm256_fmadd_ps(ocy, dy, _mm256_mul_ps(ocx, dx)));
+			__m256 c = _mm256_fmadd_ps(ocz, ocz, _mm256_fmadd_ps(ocy, ocy, _mm256_mul_ps(ocx, ocx)));
+			c = _mm256_sub_ps(c, _mm256_loadu_ps(&spheres.RadiusSquared[index]));
+
+			__m256 discriminant = _mm256_fmsub_ps(b, b, _mm256_mul_ps(a, c));
+			__m256 t = _mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(zero, b), _mm256_sqrt_ps(_mm256_max_ps(discriminant, zero))), inverseA);
+
+			__m256 valid = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32((int)(count - i)), laneIndex));
+			valid = _mm256_and_ps(valid, _mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ));
+			valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, zero, _CMP_GT_OQ));
+			valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_set1_ps(hitDistance), _CMP_LT_OQ));
+
+			if (_mm256_movemask_ps(valid) == 0)
+				continue;
+
+			t = _mm256_blendv_ps(noHit, t, valid);
+
+			__m256 minimum = _mm256_min_ps(t, _mm256_permute_ps(t, _MM_SHUFFLE(2, 3, 0, 1)));
+			minimum = _mm256_min_ps(minimum, _mm256_permute_ps(minimum, _MM_SHUFFLE(1, 0, 3, 2)));
+			minimum = _mm256_min_ps(minimum, _mm256_permute2f128_ps(minimum, minimum, 0x01));
+
+			hitDistance = _mm256_cvtss_f32(minimum);
+			closest = (int)i + Utils::FirstSetBit((uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(t, minimum, _CMP_EQ_OQ)));
+		}
+
+		return closest;
+	}
+
+	static bool CPUSupportsAVX2()
+	{
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+			return false;
+
+		__cpuid(info, 1);
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool fma = (info[2] & (1 << 12)) != 0;
+		if (!osxsave || !fma)
+			return false;
+
+		// The OS has to save the upper halves of the YMM registers on context switches
+		unsigned long long xcr0 = _xgetbv(0);
+		if ((xcr0 & 0x6) != 0x6)
+			return false;
+
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+	}
+
+#endif // RT_ARCH_X86
+
+#ifdef RT_ARCH_ARM64
+
+	static int IntersectNEON(const Ray& ray, const SphereSoA& spheres, uint32_t first, uint32_t count, float& hitDistance)
+	{
+		int closest = -1;
+
+		const float32x4_t ox = vdupq_n_f32(ray.Origin.x);
+		const float32x4_t oy = vdupq_n_f32(ray.Origin.y);
+		const float32x4_t oz = vdupq_n_f32(ray.Origin.z);
+		const float32x4_t dx = vdupq_n_f32(ray.Direction.x);
+		const float32x4_t dy = vdupq_n_f32(ray.Direction.y);
+		const float32x4_t dz = vdupq_n_f32(ray.Direction.z);
+
+		float aScalar = glm::dot(ray.Direction, ray.Direction);
+		const float32x4_t a = vdupq_n_f32(aScalar);
+		const float32x4_t inverseA = vdupq_n_f32(1.0f / aScalar);
+
+		const float32x4_t zero = vdupq_n_f32(0.0f);
+		const float32x4_t noHit = vdupq_n_f32(FLT_MAX);
+		const uint32_t laneIndexData[4] = { 0, 1, 2, 3 };
+		const uint32x4_t laneIndex = vld1q_u32(laneIndexData);
+
+		for (uint32_t i = 0; i < count; i += 4)
+		{
+			uint32_t index = first + i;
+
+			float32x4_t ocx = vsubq_f32(ox, vld1q_f32(&spheres.PositionX[index]));
+			float32x4_t ocy = vsubq_f32(oy, vld1q_f32(&spheres.PositionY[index]));
+			float32x4_t ocz = vsubq_f32(oz, vld1q_f32(&spheres.PositionZ[index]));
+
+			float32x4_t b = vfmaq_f32(vfmaq_f32(vmulq_f32(ocx, dx), ocy, dy), ocz, dz);
+			float32x4_t c = vfmaq_f32(vfmaq_f32(vmulq_f32(ocx, ocx), ocy, ocy), ocz, ocz);
+			c = vsubq_f32(c, vld1q_f32(&spheres.RadiusSquared[index]));
+
+			float32x4_t discriminant = vfmsq_f32(vmulq_f32(b, b), a, c);
+			float32x4_t t = vmulq_f32(vsubq_f32(vnegq_f32(b), vsqrtq_f32(vmaxq_f32(discriminant, zero))), inverseA);
+
+			uint32x4_t valid = vcltq_u32(laneIndex, vdupq_n_u32(count - i));
+			valid = vandq_u32(valid, vcgeq_f32(discriminant, zero));
+			valid = vandq_u32(valid, vcgtq_f32(t, zero));
+			valid = vandq_u32(valid, vcltq_f32(t, vdupq_n_f32(hitDistance)));
+
+			if (vmaxvq_u32(valid) == 0)
+				continue;
+
+			t = vbslq_f32(valid, t, noHit);
+
+			float minimum = vminvq_f32(t);
+			uint32x4_t isMinimum = vceqq_f32(t, vdupq_n_f32(minimum));
+
+			uint32_t lanes[4];
+			vst1q_u32(lanes, isMinimum);
+			for (int lane = 0; lane < 4; lane++)
+			{
+				if (lanes[lane])
+				{
+					hitDistance = minimum;
+					closest = (int)i + lane;
+					break;
+				}
+			}
+		}
+
+		return closest;
+	}
+
+#endif // RT_ARCH_ARM64
+
+	InstructionSet DetectInstructionSet()
+	{
+#if defined(RT_ARCH_X86)
+		if (CPUSupportsAVX2())
+			return InstructionSet::AVX2;
+		return InstructionSet::SSE2;
+#elif defined(RT_ARCH_ARM64)
+		return InstructionSet::NEON;
+#else
+		return InstructionSet::Scalar;
+#endif
+	}
+
+	IntersectFn GetIntersectFunction(InstructionSet instructionSet)
+	{
+		switch (instructionSet)
+		{
+#if defined(RT_ARCH_X86)
+			case InstructionSet::SSE2: return IntersectSSE2;
+			case InstructionSet::AVX2: return IntersectAVX2;
+#elif defined(RT_ARCH_ARM64)
+			case InstructionSet::NEON: return IntersectNEON;
+#endif
+			default: return IntersectScalar;
+		}
+	}
+
+	uint32_t GetLaneCount(InstructionSet instructionSet)
+	{
+		switch (instructionSet)
+		{
+			case InstructionSet::Scalar: return 1;
+			case InstructionSet::SSE2: return 4;
+			case InstructionSet::AVX2: return 8;
+			case InstructionSet::NEON: return 4;
+		}
+		return 1;
+	}
+
+	const char* GetInstructionSetName(InstructionSet instructionSet)
+	{
+		switch (instructionSet)
+		{
+			case InstructionSet::Scalar: return "Scalar";
+			case InstructionSet::SSE2:   return "SSE2";
+			case InstructionSet::AVX2:   return "AVX2";
+			case InstructionSet::NEON:   return "NEON";
+		}
+		return "Unknown";
+	}
+
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+
+#include "Ray.h"
+#include "Scene.h"
+
+// Sphere data in structure-of-arrays layout, stored in BVH primitive order.
+// Every array carries MaxLaneCount floats of padding at the end, so a kernel can always
+// load a full register starting at any valid index.
+struct SphereSoA
+{
+	static constexpr uint32_t MaxLaneCount = 8;
+
+	std::vector<float> PositionX, PositionY, PositionZ;
+	std::vector<float> RadiusSquared;
+
+	void Build(const std::vector<Sphere>& spheres, const std::vector<uint32_t>& order);
+	void Clear();
+
+	uint32_t GetCount() const { return m_Count; }
+private:
+	uint32_t m_Count = 0;
+};
+
+namespace SphereKernels {
+
+	enum class InstructionSet
+	{
+		Scalar = 0,
+		SSE2,
+		AVX2,
+		NEON
+	};
+
+	// Intersects the ray with spheres [first, first + count) and returns the index (relative to first)
+	// of the closest hit in front of the origin that is nearer than hitDistance, or -1.
+	// hitDistance is updated on a hit.
+	using IntersectFn = int(*)(const Ray& ray, const SphereSoA& spheres, uint32_t first, uint32_t count, float& hitDistance);
+
+	// Best instruction set supported by both the build and the CPU we are running on
+	InstructionSet DetectInstructionSet();
+
+	IntersectFn GetIntersectFunction(InstructionSet instructionSet);
+	uint32_t GetLaneCount(InstructionSet instructionSet);
+	const char* GetInstructionSetName(InstructionSet instructionSet);
+
+}
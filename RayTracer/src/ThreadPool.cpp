@@ -0,0 +1,167 @@
+#include "ThreadPool.h"
+
+#include "Walnut/Profiler.h"
+
+ThreadPool::ThreadPool(uint32_t threadCount)
+{
+	Start(threadCount);
+}
+
+ThreadPool::~ThreadPool()
+{
+	Stop();
+}
+
+void ThreadPool::Resize(uint32_t threadCount)
+{
+	if (threadCount == m_RequestedThreadCount)
+		return;
+
+	Stop();
+	Start(threadCount);
+}
+
+uint32_t ThreadPool::GetHardwareThreadCount()
+{
+	uint32_t count = std::thread::hardware_concurrency();
+	return count > 0 ? count : 1;
+}
+
+void ThreadPool::Dispatch(uint32_t taskCount, const Task& task)
+{
+	if (taskCount == 0)
+		return;
+
+	uint32_t workerCount = GetWorkerCount();
+
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		// Contiguous blocks keep neighbouring tiles on the same core until stealing kicks in
+		for (uint32_t i = 0; i < workerCount; i++)
+		{
+			uint32_t begin = (uint32_t)((uint64_t)taskCount * i / workerCount);
+			uint32_t end = (uint32_t)((uint64_t)taskCount * (i + 1) / workerCount);
+
+			std::lock_guard<std::mutex> queueLock(m_Queues[i]->Mutex);
+			for (uint32_t t = begin; t < end; t++)
+				m_Queues[i]->Tasks.push_back(t);
+		}
+
+		m_Task = &task;
+		m_RemainingTasks = taskCount;
+		m_Generation++;
+	}
+	m_WakeCondition.notify_all();
+
+	RunTasks(0);
+
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	m_DoneCondition.wait(lock, [this]() { return m_RemainingTasks == 0 && m_BusyWorkers == 0; });
+	m_Task = nullptr;
+}
+
+void ThreadPool::Start(uint32_t threadCount)
+{
+	m_RequestedThreadCount = threadCount;
+
+	uint32_t workerCount = threadCount > 0 ? threadCount : GetHardwareThreadCount();
+
+	m_Stopping = false;
+	m_Queues.clear();
+	for (uint32_t i = 0; i < workerCount; i++)
+		m_Queues.emplace_back(std::make_unique<WorkQueue>());
+
+	// Worker 0 is whichever thread calls Dispatch
+	for (uint32_t i = 1; i < workerCount; i++)
+		m_Threads.emplace_back(&ThreadPool::WorkerThread, this, i);
+}
+
+void ThreadPool::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stopping = true;
+	}
+	m_WakeCondition.notify_all();
+
+	for (auto& thread : m_Threads)
+		thread.join();
+
+	m_Threads.clear();
+	m_Queues.clear();
+}
+
+void ThreadPool::WorkerThread(uint32_t workerIndex)
+{
+	Walnut::Profiler::SetThreadName("Worker " + std::to_string(workerIndex));
+
+	uint64_t generation = 0;
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_WakeCondition.wait(lock, [this, generation]() { return m_Stopping || m_Generation != generation; });
+
+			if (m_Stopping)
+				return;
+
+			generation = m_Generation;
+
+			// Woke up after the dispatch already completed
+			if (!m_Task)
+				continue;
+
+			m_BusyWorkers++;
+		}
+
+		RunTasks(workerIndex);
+
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_BusyWorkers--;
+		}
+		m_DoneCondition.notify_one();
+	}
+}
+
+void ThreadPool::RunTasks(uint32_t workerIndex)
+{
+	uint32_t taskIndex;
+	while (PopTask(workerIndex, taskIndex))
+	{
+		(*m_Task)(taskIndex, workerIndex);
+		m_RemainingTasks--;
+	}
+}
+
+bool ThreadPool::PopTask(uint32_t workerIndex, uint32_t& taskIndex)
+{
+	{
+		WorkQueue& queue = *m_Queues[workerIndex];
+		std::lock_guard<std::mutex> lock(queue.Mutex);
+		if (!queue.Tasks.empty())
+		{
+			taskIndex = queue.Tasks.front();
+			queue.Tasks.pop_front();
+			return true;
+		}
+	}
+
+	// Steal from the far end of another worker's block
+	uint32_t workerCount = GetWorkerCount();
+	for (uint32_t i = 1; i < workerCount; i++)
+	{
+		WorkQueue& victim = *m_Queues[(workerIndex + i) % workerCount];
+		std::lock_guard<std::mutex> lock(victim.Mutex);
+		if (!victim.Tasks.empty())
+		{
+			taskIndex = victim.Tasks.back();
+			victim.Tasks.pop_back();
+			return true;
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker pool used by the renderer to process image tiles.
+// Every Dispatch hands each worker a contiguous block of task indices in its own deque,
+// workers drain their own deque from the front and steal from the back of others once they run dry.
+class ThreadPool
+{
+public:
+	using Task = std::function<void(uint32_t taskIndex, uint32_t workerIndex)>;
+public:
+	// A thread count of 0 uses std::thread::hardware_concurrency()
+	explicit ThreadPool(uint32_t threadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	void Resize(uint32_t threadCount);
+
+	// Runs task for every index in [0, taskCount) and blocks until all of them finished.
+	// The calling thread participates as worker 0.
+	void Dispatch(uint32_t taskCount, const Task& task);
+
+	// Includes the calling thread
+	uint32_t GetWorkerCount() const { return (uint32_t)m_Queues.size(); }
+	uint32_t GetRequestedThreadCount() const { return m_RequestedThreadCount; }
+
+	static uint32_t GetHardwareThreadCount();
+private:
+	struct WorkQueue
+	{
+		std::mutex Mutex;
+		std::deque<uint32_t> Tasks;
+	};
+
+	void Start(uint32_t threadCount);
+	void Stop();
+
+	void WorkerThread(uint32_t workerIndex);
+	void RunTasks(uint32_t workerIndex);
+	bool PopTask(uint32_t workerIndex, uint32_t& taskIndex);
+private:
+	std::vector<std::unique_ptr<WorkQueue>> m_Queues;
+	std::vector<std::thread> m_Threads;
+
+	std::mutex m_Mutex;
+	std::condition_variable m_WakeCondition;
+	std::condition_variable m_DoneCondition;
+
+	const Task* m_Task = nullptr;
+	uint64_t m_Generation = 0;
+	uint32_t m_BusyWorkers = 0;
+	std::atomic<uint32_t> m_RemainingTasks{ 0 };
+	bool m_Stopping = false;
+
+	uint32_t m_RequestedThreadCount = 0;
+};
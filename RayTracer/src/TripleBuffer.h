@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free handoff of the newest value from one producer thread to one consumer thread.
+// The producer always owns a slot to write into, the consumer a slot to read from, and the
+// third slot holds whatever was published last. Neither side ever waits for the other.
+template<typename T>
+class TripleBuffer
+{
+public:
+	// Producer side
+	T& GetWriteBuffer() { return m_Buffers[m_WriteIndex]; }
+
+	void Publish()
+	{
+		uint32_t previous = m_SharedIndex.exchange(m_WriteIndex | FreshBit, std::memory_order_acq_rel);
+		m_WriteIndex = previous & IndexMask;
+	}
+
+	// Consumer side, returns false if nothing was published since the last call
+	bool Acquire()
+	{
+		if (!(m_SharedIndex.load(std::memory_order_relaxed) & FreshBit))
+			return false;
+
+		uint32_t previous = m_SharedIndex.exchange(m_ReadIndex, std::memory_order_acq_rel);
+		m_ReadIndex = previous & IndexMask;
+		return true;
+	}
+
+	T& GetReadBuffer() { return m_Buffers[m_ReadIndex]; }
+private:
+	static constexpr uint32_t IndexMask = 0x3;
+	static constexpr uint32_t FreshBit = 0x4;
+
+	T m_Buffers[3];
+
+	// Each index is only touched by its own side, keep them off the shared cache line
+	alignas(64) uint32_t m_WriteIndex = 0;
+	alignas(64) uint32_t m_ReadIndex = 1;
+	alignas(64) std::atomic<uint32_t> m_SharedIndex{ 2 };
+};
@@ -2,20 +2,25 @@
 #include "Walnut/EntryPoint.h"
 
 #include "Walnut/Image.h"
+#include "Walnut/Profiler.h"
 #include "Walnut/Timer.h"
 
 #include "Renderer.h"
+#include "AsyncRenderer.h"
 #include "Camera.h"
+#include "FrameArena.h"
+#include "Headless.h"
+#include "MeshLoader.h"
+#include "SceneSerializer.h"
 
 #include <windows.h>
 
 #include <glm/gtc/type_ptr.hpp>
 #include <thread>
 #include <algorithm>
-#include <gl/GL.h>
+#include <cstring>
 #include <Psapi.h>
 #pragma comment(lib, "psapi.lib")
-#pragma comment(lib, "opengl32.lib")
 
 #include <GLFW/glfw3.h>
 
@@ -24,9 +29,18 @@ using namespace Walnut;
 class ExampleLayer : public Walnut::Layer
 {
 public:
-	ExampleLayer()
+	// Loads the scene from a file (.json or a .rtscene cache) if a path is given, the built-in scene otherwise
+	ExampleLayer(const std::string& scenePath = {})
 		: m_Camera(45.0f, 0.1f, 100.0f)
 	{
+		CameraDescription camera;
+		if (!scenePath.empty() && SceneSerializer::Deserialize(scenePath, m_Scene, camera)) {
+			m_Camera = Camera(camera.VerticalFOV, 0.1f, 100.0f);
+			m_Camera.SetPosition(camera.Position);
+			m_Camera.SetDirection(camera.Direction);
+			return;
+		}
+		m_Scene = Scene();
 
 		Material& sphere1 = m_Scene.Materials.emplace_back();
 		sphere1.Albedo = { 1.0f, 0.0f, 1.0f };
@@ -58,7 +72,12 @@ public:
 	virtual void OnUpdate(float ts) override
 	{
 		if (m_Camera.OnUpdate(ts)) {
-			m_Renderer.ResetFrameIndex();
+			// Reprojection carries the accumulation over to the new view instead
+			if (!m_Renderer.GetSettings().TemporalReprojection)
+				m_Renderer.ResetFrameIndex();
+			m_CameraMoved = true;
+			// Key presses are events, but held keys need frames to keep moving
+			Application::RequestFrame();
 		}
 	}
 
@@ -74,38 +93,285 @@ public:
 
 		ImGui::Checkbox("Accumulate", &m_Renderer.GetSettings().Accumulate);
 
+		Renderer::Settings& settings = m_Renderer.GetSettings();
+
+		int maxDepth = (int)settings.MaxDepth;
+		if (ImGui::DragInt("Max Depth", &maxDepth, 0.2f, 1, 64)) {
+			settings.MaxDepth = (uint32_t)maxDepth;
+			m_Renderer.ResetFrameIndex();
+		}
+		int russianRouletteDepth = (int)settings.RussianRouletteDepth;
+		if (ImGui::DragInt("Russian Roulette Depth", &russianRouletteDepth, 0.2f, 1, 64)) {
+			settings.RussianRouletteDepth = (uint32_t)russianRouletteDepth;
+			m_Renderer.ResetFrameIndex();
+		}
+		if (ImGui::Checkbox("Light Sampling", &settings.LightSampling))
+			m_Renderer.ResetFrameIndex();
+		if (settings.LightSampling && m_Renderer.GetActiveBackend() == Renderer::RenderBackend::GPU)
+			ImGui::TextDisabled("CPU only, the GPU backend finds emitters by hitting them");
+
+		const char* integratorNames[] = { "Path Tracer", "Preview", "Ambient Occlusion" };
+		int integrator = (int)settings.Integrator;
+		if (ImGui::Combo("Integrator", &integrator, integratorNames, IM_ARRAYSIZE(integratorNames))) {
+			settings.Integrator = (Renderer::IntegratorMode)integrator;
+			m_Renderer.ResetFrameIndex();
+		}
+		if (settings.Integrator == Renderer::IntegratorMode::PathTracer)
+			ImGui::Checkbox("Preview While Moving", &settings.PreviewWhileMoving);
+		if (settings.Integrator == Renderer::IntegratorMode::AmbientOcclusion) {
+			if (ImGui::DragFloat("Occlusion Distance", &settings.AmbientOcclusionDistance, 0.01f, 0.01f, 100.0f))
+				m_Renderer.ResetFrameIndex();
+		}
+
+		const char* samplerNames[] = { "Random", "Sobol" };
+		int samplerType = (int)settings.SamplerType;
+		if (ImGui::Combo("Sampler", &samplerType, samplerNames, IM_ARRAYSIZE(samplerNames))) {
+			settings.SamplerType = (Sampler::Type)samplerType;
+			m_Renderer.ResetFrameIndex();
+		}
+		if (ImGui::Checkbox("Antialiasing", &settings.Antialiasing))
+			m_Renderer.ResetFrameIndex();
+
+		ImGui::Checkbox("Adaptive Sampling", &settings.AdaptiveSampling);
+		if (settings.AdaptiveSampling) {
+			ImGui::DragFloat("Noise Threshold", &settings.NoiseThreshold, 0.001f, 0.001f, 0.5f, "%.3f");
+
+			int minSamples = (int)settings.AdaptiveMinSamples;
+			if (ImGui::DragInt("Min Samples", &minSamples, 1.0f, 2, 1024))
+				settings.AdaptiveMinSamples = (uint32_t)minSamples;
+			int maxSamples = (int)settings.AdaptiveMaxSamples;
+			if (ImGui::DragInt("Max Samples", &maxSamples, 16.0f, minSamples, 65536))
+				settings.AdaptiveMaxSamples = (uint32_t)maxSamples;
+
+			if (!m_AsyncRenderer) {
+				if (m_Renderer.IsConverged())
+					ImGui::Text("Converged after %u frames", m_Renderer.GetSampleCount());
+				else
+					ImGui::Text("Sampling %u / %u tiles", m_Renderer.GetActiveTileCount(), m_Renderer.GetTileCount());
+			}
+		}
+
+		bool asyncRendering = m_AsyncRenderer != nullptr;
+		if (ImGui::Checkbox("Async rendering", &asyncRendering)) {
+			if (asyncRendering) {
+				m_AsyncRenderer = std::make_unique<AsyncRenderer>();
+			}
+			else {
+				m_AsyncRenderer.reset();
+				m_Renderer.ResetFrameIndex();
+			}
+		}
+
+		const char* backendNames[] = { "CPU", "GPU (Vulkan compute)" };
+		int backend = (int)m_Renderer.GetSettings().Backend;
+		if (ImGui::Combo("Backend", &backend, backendNames, IM_ARRAYSIZE(backendNames))) {
+			m_Renderer.GetSettings().Backend = (Renderer::RenderBackend)backend;
+		}
+		if (m_AsyncRenderer) {
+			if (m_Renderer.GetSettings().Backend != Renderer::RenderBackend::CPU)
+				ImGui::TextDisabled("Async rendering always runs on the CPU");
+		}
+		else if (m_Renderer.GetSettings().Backend != m_Renderer.GetActiveBackend()) {
+			if (const char* reason = Renderer::GetGPUUnsupportedReason(m_Scene))
+				ImGui::TextDisabled("GPU backend skipped, %s: rendering on the CPU", reason);
+			else
+				ImGui::TextDisabled("GPU backend unavailable, rendering on the CPU");
+		}
+
+		ImGui::Checkbox("Dynamic Resolution", &settings.DynamicResolution);
+		if (settings.DynamicResolution) {
+			ImGui::DragFloat("Target Frame Time (ms)", &settings.TargetFrameTime, 0.5f, 1.0f, 100.0f, "%.1f");
+			ImGui::SliderFloat("Min Render Scale", &settings.MinRenderScale, 0.1f, 1.0f, "%.2f");
+			if (!m_AsyncRenderer)
+				ImGui::Text("Render scale: %.2f (%ux%u)", m_Renderer.GetRenderScale(), m_Renderer.GetRenderWidth(), m_Renderer.GetRenderHeight());
+		}
+
+		ImGui::Checkbox("Temporal Reprojection", &settings.TemporalReprojection);
+		if (settings.TemporalReprojection) {
+			if (settings.AdaptiveSampling)
+				ImGui::TextDisabled("Not combined with adaptive sampling");
+			int maxHistoryLength = (int)settings.MaxHistoryLength;
+			if (ImGui::DragInt("Max History", &maxHistoryLength, 1.0f, 1, 1024))
+				settings.MaxHistoryLength = (uint32_t)maxHistoryLength;
+		}
+
+		ImGui::Checkbox("Denoise", &settings.Denoise);
+		if (settings.Denoise) {
+			Denoiser::Settings& denoiser = settings.DenoiserSettings;
+			int iterations = (int)denoiser.Iterations;
+			if (ImGui::SliderInt("Denoise Iterations", &iterations, 0, 6))
+				denoiser.Iterations = (uint32_t)iterations;
+			ImGui::DragFloat("Color Sigma", &denoiser.ColorSigma, 0.01f, 0.01f, 10.0f);
+			ImGui::DragFloat("Normal Power", &denoiser.NormalPower, 1.0f, 1.0f, 256.0f);
+			ImGui::DragFloat("Depth Sigma", &denoiser.DepthSigma, 0.005f, 0.001f, 1.0f);
+		}
+
+		int tileSize = (int)m_Renderer.GetSettings().TileSize;
+		if (ImGui::DragInt("Tile Size", &tileSize, 1.0f, 4, 128)) {
+			m_Renderer.GetSettings().TileSize = (uint32_t)tileSize;
+		}
+
+		bool cacheRayDirections = m_Camera.IsCachingRayDirections();
+		if (ImGui::Checkbox("Cache Ray Directions", &cacheRayDirections)) {
+			m_Camera.SetCacheRayDirections(cacheRayDirections);
+		}
+
+		const char* toneMapNames[] = { "Clamp", "Reinhard" };
+		int toneMapping = (int)m_Renderer.GetSettings().ToneMapping;
+		if (ImGui::Combo("Tone Mapping", &toneMapping, toneMapNames, IM_ARRAYSIZE(toneMapNames))) {
+			m_Renderer.GetSettings().ToneMapping = (AccumulationBuffer::ToneMap)toneMapping;
+		}
+		ImGui::Checkbox("Gamma Correct", &m_Renderer.GetSettings().GammaCorrect);
+		ImGui::Checkbox("HDR Display", &m_Renderer.GetSettings().HDRDisplay);
+
+		ImGui::Checkbox("SIMD", &m_Renderer.GetSettings().SIMD);
+		ImGui::SameLine();
+		ImGui::TextDisabled("(%s)", SphereKernels::GetInstructionSetName(m_Renderer.GetInstructionSet()));
+
+		ImGui::Checkbox("Wavefront", &m_Renderer.GetSettings().Wavefront);
+
+		int threadCount = (int)m_Renderer.GetSettings().ThreadCount;
+		if (ImGui::SliderInt("Threads (0 = all)", &threadCount, 0, (int)std::thread::hardware_concurrency())) {
+			m_Renderer.GetSettings().ThreadCount = (uint32_t)threadCount;
+		}
+
 		if (ImGui::Button("Reset")) {
 			m_Renderer.ResetFrameIndex();
+			m_SceneChanged = true;
 		}
 
+		ImGui::Separator();
+
+		Application& app = Application::Get();
+
+		const char* presentModeNames[] = { "FIFO (VSync)", "Mailbox", "Immediate" };
+		int presentMode = (int)app.GetPresentMode();
+		if (ImGui::Combo("Present Mode", &presentMode, presentModeNames, IM_ARRAYSIZE(presentModeNames)))
+			app.SetPresentMode((PresentMode)presentMode);
+
+		float targetFrameRate = app.GetTargetFrameRate();
+		if (ImGui::DragFloat("Frame Rate Cap (0 = off)", &targetFrameRate, 1.0f, 0.0f, 1000.0f, "%.0f"))
+			app.SetTargetFrameRate(std::max(targetFrameRate, 0.0f));
+
+		bool waitForEvents = app.IsWaitingForEvents();
+		if (ImGui::Checkbox("Sleep When Idle", &waitForEvents))
+			app.SetWaitForEvents(waitForEvents);
+
 		ImGui::End();
 
 		ImGui::Begin("Scene");
+		if (m_Picked.HitDistance < 0.0f) {
+			ImGui::TextDisabled("Click the viewport to pick an object");
+		}
+		else if (m_Picked.TriangleIndex >= 0) {
+			ImGui::Text("Picked mesh %d, triangle %d, material %d at %.3f", m_Picked.ObjectIndex, m_Picked.TriangleIndex, m_Picked.MaterialIndex, m_Picked.HitDistance);
+		}
+		else {
+			ImGui::Text("Picked sphere %d, material %d at %.3f", m_Picked.ObjectIndex, m_Picked.MaterialIndex, m_Picked.HitDistance);
+		}
+		ImGui::Separator();
+
 		for (size_t i = 0; i < m_Scene.Spheres.size(); i++) {
 			ImGui::PushID(i);
 
+			// The renderer refits the BVH for edited spheres
 			Sphere& sphere = m_Scene.Spheres[i];
-			ImGui::DragFloat3("Position", glm::value_ptr(sphere.Position), 0.1f);
-			ImGui::DragFloat("Radius", &sphere.Radius, 0.1f);
-			ImGui::DragInt("Material", &sphere.MaterialIndex, 1.0f, 0, (int)m_Scene.Materials.size() - 1);
+			bool changed = ImGui::DragFloat3("Position", glm::value_ptr(sphere.Position), 0.1f);
+			changed |= ImGui::DragFloat("Radius", &sphere.Radius, 0.1f);
+			changed |= ImGui::DragInt("Material", &sphere.MaterialIndex, 1.0f, 0, (int)m_Scene.Materials.size() - 1);
+			if (changed) {
+				sphere.Version++;
+				m_SceneChanged = true;
+			}
+
+			ImGui::Separator();
+
+			ImGui::PopID();
+		}
+
+		ImGui::PushID("Meshes");
+		for (size_t i = 0; i < m_Scene.Meshes.size(); i++) {
+			ImGui::PushID(i);
+
+			Mesh& mesh = m_Scene.Meshes[i];
+			ImGui::Text("Mesh %d: %u triangles", (int)i, mesh.Geometry ? mesh.Geometry->GetTriangleCount() : 0u);
+			// Edited meshes only rebuild the top level hierarchy
+			bool changed = ImGui::DragFloat3("Position", glm::value_ptr(mesh.Position), 0.1f);
+			changed |= ImGui::DragFloat3("Rotation", glm::value_ptr(mesh.Rotation), 1.0f);
+			changed |= ImGui::DragFloat3("Scale", glm::value_ptr(mesh.Scale), 0.05f);
+			changed |= ImGui::DragInt("Material", &mesh.MaterialIndex, 1.0f, 0, (int)m_Scene.Materials.size() - 1);
+			if (changed) {
+				mesh.Version++;
+				m_SceneChanged = true;
+			}
 
 			ImGui::Separator();
 
 			ImGui::PopID();
 		}
 
+		ImGui::InputText("Mesh File", m_MeshPath, sizeof(m_MeshPath));
+		if (ImGui::Button("Load Mesh")) {
+			// Failures are reported on stderr, the scene stays as it was
+			if (std::shared_ptr<MeshGeometry> geometry = MeshLoader::Load(m_MeshPath)) {
+				Mesh& mesh = m_Scene.Meshes.emplace_back();
+				mesh.Geometry = std::move(geometry);
+				m_SceneChanged = true;
+			}
+		}
+		ImGui::SameLine();
+		if (ImGui::Button("Add Instance") && !m_Scene.Meshes.empty()) {
+			// Shares the geometry and its hierarchy, offset so it can be told apart
+			Mesh instance = m_Scene.Meshes.back();
+			instance.Position.x += 1.0f;
+			m_Scene.Meshes.push_back(std::move(instance));
+			m_SceneChanged = true;
+		}
+		ImGui::Separator();
+		ImGui::PopID();
+
 		for (size_t i = 0; i < m_Scene.Materials.size(); i++) {
 			ImGui::PushID(i);
 
+			// No geometry work, and no restart unless something uses the material
 			Material& material = m_Scene.Materials[i];
-			ImGui::ColorEdit3("Albedo", glm::value_ptr(material.Albedo));
-			ImGui::DragFloat("Roughness", &material.Roughness, 0.05f, 0.0f, 1.0f);
-			ImGui::DragFloat("Metallic", &material.Metallic, 0.05f, 0.0f, 1.0f);
+			bool changed = ImGui::ColorEdit3("Albedo", glm::value_ptr(material.Albedo));
+			changed |= ImGui::DragFloat("Roughness", &material.Roughness, 0.05f, 0.0f, 1.0f);
+			changed |= ImGui::DragFloat("Metallic", &material.Metallic, 0.05f, 0.0f, 1.0f);
+			changed |= ImGui::ColorEdit3("Emission Color", glm::value_ptr(material.EmissionColor));
+			changed |= ImGui::DragFloat("Emission Power", &material.EmissionPower, 0.05f, 0.0f, FLT_MAX);
+			if (changed) {
+				material.Version++;
+				m_SceneChanged = true;
+			}
+
+			ImGui::Separator();
+
+			ImGui::PopID();
+		}
+
+		ImGui::PushID("Point Lights");
+		for (size_t i = 0; i < m_Scene.PointLights.size(); i++) {
+			ImGui::PushID(i);
+
+			PointLight& light = m_Scene.PointLights[i];
+			bool changed = ImGui::DragFloat3("Position", glm::value_ptr(light.Position), 0.1f);
+			changed |= ImGui::ColorEdit3("Color", glm::value_ptr(light.Color));
+			changed |= ImGui::DragFloat("Intensity", &light.Intensity, 0.1f, 0.0f, FLT_MAX);
+			if (changed) {
+				light.Version++;
+				m_SceneChanged = true;
+			}
 
 			ImGui::Separator();
 
 			ImGui::PopID();
 		}
+		if (ImGui::Button("Add Point Light")) {
+			m_Scene.PointLights.emplace_back().Position = glm::vec3(0.0f, 3.0f, 0.0f);
+			m_SceneChanged = true;
+		}
+		ImGui::PopID();
 
 		ImGui::End();
 
@@ -115,9 +381,17 @@ public:
 		m_ViewportWidth = ImGui::GetContentRegionAvail().x;
 		m_ViewportHeight = ImGui::GetContentRegionAvail().y;
 
-		auto image = m_Renderer.GetFinalImage();
+		auto image = m_AsyncRenderer ? m_AsyncRenderer->GetFinalImage() : m_Renderer.GetFinalImage();
 		if (image) {
-			ImGui::Image(image->GetDescriptorSet(), { (float)image->GetWidth(), (float)image->GetHeight() }, ImVec2(0, 1), ImVec2(1, 0));
+			// Flipped vertically, and only the part of the allocation the image fills
+			ImGui::Image(image->GetDescriptorSet(), { (float)image->GetWidth(), (float)image->GetHeight() }, ImVec2(0, image->GetUVScaleY()), ImVec2(image->GetUVScaleX(), 0));
+
+			// Left click picks whatever is under the cursor, the image is shown flipped so rows count from the bottom
+			if (ImGui::IsItemClicked(ImGuiMouseButton_Left)) {
+				ImVec2 min = ImGui::GetItemRectMin();
+				ImVec2 mouse = ImGui::GetMousePos();
+				Pick({ mouse.x - min.x, (float)image->GetHeight() - (mouse.y - min.y) });
+			}
 		}
 
 		ImGui::End();
@@ -171,11 +445,11 @@ public:
 		// 2. GPU Monitoring
 		ImGui::Separator();
 		ImGui::Text("GPU Stats:");
-		const GLubyte* renderer = glGetString(GL_RENDERER);
-		const GLubyte* version = glGetString(GL_VERSION);
-		ImGui::Text("Renderer: %s", renderer);
-		ImGui::Text("Driver: %s", version);
-		
+		VkPhysicalDeviceProperties deviceProperties;
+		vkGetPhysicalDeviceProperties(Application::GetPhysicalDevice(), &deviceProperties);
+		ImGui::Text("Device: %s", deviceProperties.deviceName);
+		ImGui::Text("Vulkan: %u.%u.%u", VK_VERSION_MAJOR(deviceProperties.apiVersion), VK_VERSION_MINOR(deviceProperties.apiVersion), VK_VERSION_PATCH(deviceProperties.apiVersion));
+		ImGui::Text("Driver: 0x%08x", deviceProperties.driverVersion);
 
 		// 3. Detailed System Stats
 		ImGui::Separator();
@@ -240,6 +514,13 @@ public:
 				}
 		#endif
 
+		// Per pixel buffers only allocate while the viewport outgrows them
+		FrameArena::Stats arenaStats = FrameArena::GetStats();
+		ImGui::Text("Frame Buffers: %.2f MB, %llu allocations", arenaStats.ReservedBytes / (1024.0f * 1024.0f), (unsigned long long)arenaStats.Allocations);
+		bool hugePages = FrameArena::IsUsingHugePages();
+		if (ImGui::Checkbox("Huge Pages (new buffers)", &hugePages))
+			FrameArena::SetHugePages(hugePages);
+
 		// 4. Performance Histograms
 		ImGui::Separator();
 		ImGui::Text("Performance Histograms:");
@@ -247,34 +528,44 @@ public:
 		// Frame time distribution
 		ImGui::PlotHistogram("Frame Time Dist", frameTimes, 100, 0, nullptr, 0.0f, maxFrameTime, ImVec2(0, 80));
 
-		// Memory allocation tracking
-		static std::vector<float> allocSizes;  // Use float for ImGui compatibility
-		static int totalAllocations = 0;
-		static float maxAllocationSize = 0.0f;
-
-		// Simulate allocation tracking
-		if (rand() % 10 == 0) {
-			float size = static_cast<float>(rand() % 1024 + 1);
-			allocSizes.push_back(size);
-			totalAllocations++;
-			if (size > maxAllocationSize) maxAllocationSize = size;
-			if (allocSizes.size() > 100) allocSizes.erase(allocSizes.begin());
+		// 5. Profiler zones and counters of the last frame, Dist builds compile them out
+		ImGui::Separator();
+		ImGui::Text("Zones (last frame, summed over threads):");
+		if (ImGui::BeginTable("Zones", 3, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingStretchProp)) {
+			ImGui::TableSetupColumn("Zone");
+			ImGui::TableSetupColumn("ms");
+			ImGui::TableSetupColumn("Calls");
+			ImGui::TableHeadersRow();
+			for (const Profiler::ZoneStats& zone : Profiler::GetFrameZones()) {
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn();
+				ImGui::TextUnformatted(zone.Name);
+				ImGui::TableNextColumn();
+				ImGui::Text("%.3f", zone.Milliseconds);
+				ImGui::TableNextColumn();
+				ImGui::Text("%u", zone.Calls);
+			}
+			ImGui::EndTable();
 		}
 
-		if (!allocSizes.empty()) {
-			ImGui::PlotHistogram("Allocation Sizes", allocSizes.data(), static_cast<int>(allocSizes.size()),
-				0, nullptr, 0.0f, maxAllocationSize, ImVec2(0, 80));
-			ImGui::Text("Allocations: %d (Max: %.0f bytes)", totalAllocations, maxAllocationSize);
-		}
+		ImGui::Text("Counters (last frame):");
+		for (const Profiler::CounterStats& counter : Profiler::GetFrameCounters())
+			ImGui::Text("%s: %llu", counter.Name, (unsigned long long)counter.Value);
 
-		// 5. Advanced Controls
+		// 6. Advanced Controls
 		ImGui::Separator();
 		if (ImGui::Button("Reset Stats")) {
 			frameTimeMin = FLT_MAX;
 			frameTimeMax = 0;
-			allocSizes.clear();
-			totalAllocations = 0;
-			maxAllocationSize = 0;
+		}
+		ImGui::SameLine();
+		if (!Profiler::IsCapturing()) {
+			if (ImGui::Button("Start Trace Capture"))
+				Profiler::BeginCapture();
+		}
+		else if (ImGui::Button("Stop Trace Capture")) {
+			// Opens in chrome://tracing or ui.perfetto.dev, Tracy imports it with import-chrome
+			Profiler::EndCapture("trace.json");
 		}
 
 		ImGui::End();
@@ -286,8 +577,35 @@ public:
 		//ImGui::ShowDemoWindow();
 	}
 
+	// Viewport coordinates from the bottom left, in pixels
+	void Pick(const glm::vec2& position)
+	{
+		// Also with the async renderer, which owns copies of everything, the UI thread's renderer answers.
+		// Queries never reset its accumulation.
+		Ray ray;
+		ray.Origin = m_Camera.GetPosition();
+		ray.Direction = m_Camera.GetRayGenerator().GetDirection(position);
+		m_Renderer.TraceRays(m_Scene, &ray, &m_Picked, 1);
+	}
+
 	void Render()
 	{
+		if (m_AsyncRenderer) {
+			// Never waits on the trace, the viewport shows whichever frame finished last
+			m_Camera.OnResize(m_ViewportWidth, m_ViewportHeight);
+			m_AsyncRenderer->Submit(m_Scene, m_Camera, m_ViewportWidth, m_ViewportHeight, m_Renderer.GetSettings(), m_SceneChanged, m_CameraMoved);
+			m_SceneChanged = false;
+			m_CameraMoved = false;
+
+			if (m_AsyncRenderer->Present())
+				m_LastRenderTime = m_AsyncRenderer->GetLastRenderTime();
+			return;
+		}
+
+		// The renderer finds the edits through the scene's versions and restarts accumulation itself
+		m_SceneChanged = false;
+		m_CameraMoved = false;
+
 		Timer timer;
 
 		m_Renderer.OnResize(m_ViewportWidth, m_ViewportHeight);
@@ -295,24 +613,57 @@ public:
 		m_Renderer.Render(m_Scene, m_Camera);
 
 		m_LastRenderTime = timer.ElapsedMillis();
+
+		// Without accumulation every frame would look the same, and a converged one already shows everything
+		if (m_Renderer.GetSettings().Accumulate && !m_Renderer.IsConverged())
+			Application::RequestFrame();
 	}
 
 private:
 	Renderer m_Renderer;
+	std::unique_ptr<AsyncRenderer> m_AsyncRenderer;
 	Camera m_Camera;
 	Scene m_Scene;
 	uint32_t m_ViewportWidth = 0, m_ViewportHeight = 0;
 
+	// Scene edits and camera moves since the last Submit to the async renderer
+	bool m_SceneChanged = true;
+	bool m_CameraMoved = false;
+
+	// .obj, .glb or .gltf, loaded from the scene panel
+	char m_MeshPath[256] = {};
+
 	float m_LastRenderTime = 0.0f;
+
+	// The last viewport click's hit, see Pick
+	Renderer::HitPayload m_Picked{ -1.0f, glm::vec3(0.0f), glm::vec3(0.0f), -1, -1, -1 };
 };
 
 Walnut::Application* Walnut::CreateApplication(int argc, char** argv)
 {
+	// Render nodes never open a window, Vulkan or ImGui
+	if (Headless::IsRequested(argc, argv))
+	{
+		HeadlessOptions options;
+		g_ApplicationExitCode = Headless::ParseOptions(argc, argv, options) ? Headless::Run(options) : 1;
+		g_ApplicationRunning = false;
+		return nullptr;
+	}
+
 	Walnut::ApplicationSpecification spec;
 	spec.Name = "RayTracer";
+	// Layers request the frames accumulation still needs, the rest waits for input
+	spec.WaitForEvents = true;
 
 	Walnut::Application* app = new Walnut::Application(spec);
-	app->PushLayer<ExampleLayer>();
+	// RayTracer --scene <file> opens a scene instead of the built-in one
+	std::string scenePath;
+	for (int i = 1; i + 1 < argc; i++) {
+		if (strcmp(argv[i], "--scene") == 0)
+			scenePath = argv[i + 1];
+	}
+
+	app->PushLayer(std::make_shared<ExampleLayer>(scenePath));
 	app->SetMenubarCallback([app]()
 		{
 			if (ImGui::BeginMenu("File"))
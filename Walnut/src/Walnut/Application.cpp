@@ -14,12 +14,21 @@
 #include <vulkan/vulkan.h>
 #include <glm/glm.hpp>
 
+#include "Profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <thread>
 
 // Emedded font
 #include "ImGui/Roboto-Regular.embed"
 
-extern bool g_ApplicationRunning;
+// Defined here rather than in EntryPoint.h, so programs with their own main still link against Application
+bool g_ApplicationRunning = true;
+// Returned from main when CreateApplication hands back nullptr
+int g_ApplicationExitCode = 0;
 
 // [Win32] Our example includes a copy of glfw3.lib pre-compiled with VS2010 to maximize ease of testing and compatibility with old VS compilers.
 // To link with VS2010-era libraries, VS2015+ requires linking with legacy_stdio_definitions.lib, which we do using this pragma.
@@ -28,7 +37,6 @@ extern bool g_ApplicationRunning;
 #pragma comment(lib, "legacy_stdio_definitions")
 #endif
 
-//#define IMGUI_UNLIMITED_FRAME_RATE
 #ifdef _DEBUG
 #define IMGUI_VULKAN_DEBUG_REPORT
 #endif
@@ -47,10 +55,25 @@ static ImGui_ImplVulkanH_Window g_MainWindowData;
 static int                      g_MinImageCount = 2;
 static bool                     g_SwapChainRebuild = false;
 
+// Set by Application::RequestFrame, possibly from another thread
+static std::atomic<bool> s_FrameRequested{ false };
+
+// ImGui reacts to some input a frame late (hover highlights, popups opening), so waking up renders this many more
+static const uint32_t s_FramesAfterWakeUp = 2;
+
 // Per-frame-in-flight
 static std::vector<std::vector<VkCommandBuffer>> s_AllocatedCommandBuffers;
 static std::vector<std::vector<std::function<void()>>> s_ResourceFreeQueue;
 
+// Recorded into the next frame's command buffer, before the ImGui render pass
+static std::vector<std::function<void(VkCommandBuffer)>> s_FrameCommandQueue;
+
+// Every submitted frame gets an increasing serial, so resources can tell when the GPU is done with them.
+// s_FrameSerials is indexed by swapchain image, like g_MainWindowData.Frames
+static std::vector<uint64_t> s_FrameSerials;
+static uint64_t s_SubmittedFrameSerial = 0;
+static uint64_t s_CompletedFrameSerial = 0;
+
 // Unlike g_MainWindowData.FrameIndex, this is not the the swapchain image index
 // and is always guaranteed to increase (eg. 0, 1, 2, 0, 1, 2)
 static uint32_t s_CurrentFrameIndex = 0;
@@ -153,18 +176,27 @@ static void SetupVulkan(const char** extensions, uint32_t extensions_count)
 		free(gpus);
 	}
 
-	// Select graphics queue family
+	// Select graphics queue family, preferring one that can also run compute work
 	{
 		uint32_t count;
 		vkGetPhysicalDeviceQueueFamilyProperties(g_PhysicalDevice, &count, NULL);
 		VkQueueFamilyProperties* queues = (VkQueueFamilyProperties*)malloc(sizeof(VkQueueFamilyProperties) * count);
 		vkGetPhysicalDeviceQueueFamilyProperties(g_PhysicalDevice, &count, queues);
 		for (uint32_t i = 0; i < count; i++)
-			if (queues[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+			if ((queues[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) && (queues[i].queueFlags & VK_QUEUE_COMPUTE_BIT))
 			{
 				g_QueueFamily = i;
 				break;
 			}
+		if (g_QueueFamily == (uint32_t)-1)
+		{
+			for (uint32_t i = 0; i < count; i++)
+				if (queues[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+				{
+					g_QueueFamily = i;
+					break;
+				}
+		}
 		free(queues);
 		IM_ASSERT(g_QueueFamily != (uint32_t)-1);
 	}
@@ -217,9 +249,24 @@ static void SetupVulkan(const char** extensions, uint32_t extensions_count)
 	}
 }
 
+static VkPresentModeKHR SelectPresentMode(VkSurfaceKHR surface, Walnut::PresentMode mode)
+{
+	VkPresentModeKHR requested = VK_PRESENT_MODE_FIFO_KHR;
+	switch (mode)
+	{
+		case Walnut::PresentMode::FIFO:      requested = VK_PRESENT_MODE_FIFO_KHR; break;
+		case Walnut::PresentMode::Mailbox:   requested = VK_PRESENT_MODE_MAILBOX_KHR; break;
+		case Walnut::PresentMode::Immediate: requested = VK_PRESENT_MODE_IMMEDIATE_KHR; break;
+	}
+
+	// FIFO support is guaranteed
+	VkPresentModeKHR present_modes[] = { requested, VK_PRESENT_MODE_FIFO_KHR };
+	return ImGui_ImplVulkanH_SelectPresentMode(g_PhysicalDevice, surface, &present_modes[0], IM_ARRAYSIZE(present_modes));
+}
+
 // All the ImGui_ImplVulkanH_XXX structures/functions are optional helpers used by the demo.
 // Your real engine/app may not use them.
-static void SetupVulkanWindow(ImGui_ImplVulkanH_Window* wd, VkSurfaceKHR surface, int width, int height)
+static void SetupVulkanWindow(ImGui_ImplVulkanH_Window* wd, VkSurfaceKHR surface, int width, int height, Walnut::PresentMode presentMode)
 {
 	wd->Surface = surface;
 
@@ -238,12 +285,7 @@ static void SetupVulkanWindow(ImGui_ImplVulkanH_Window* wd, VkSurfaceKHR surface
 	wd->SurfaceFormat = ImGui_ImplVulkanH_SelectSurfaceFormat(g_PhysicalDevice, wd->Surface, requestSurfaceImageFormat, (size_t)IM_ARRAYSIZE(requestSurfaceImageFormat), requestSurfaceColorSpace);
 
 	// Select Present Mode
-#ifdef IMGUI_UNLIMITED_FRAME_RATE
-	VkPresentModeKHR present_modes[] = { VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_FIFO_KHR };
-#else
-	VkPresentModeKHR present_modes[] = { VK_PRESENT_MODE_FIFO_KHR };
-#endif
-	wd->PresentMode = ImGui_ImplVulkanH_SelectPresentMode(g_PhysicalDevice, wd->Surface, &present_modes[0], IM_ARRAYSIZE(present_modes));
+	wd->PresentMode = SelectPresentMode(wd->Surface, presentMode);
 	//printf("[vulkan] Selected PresentMode = %d\n", wd->PresentMode);
 
 	// Create SwapChain, RenderPass, Framebuffer, etc.
@@ -270,8 +312,26 @@ static void CleanupVulkanWindow()
 	ImGui_ImplVulkanH_DestroyWindow(g_Instance, g_Device, &g_MainWindowData, g_Allocator);
 }
 
+// Runs queued frame commands on a one-off command buffer and waits for them,
+// for frames that never reach FrameRender (minimized window, swapchain rebuild)
+static void FlushFrameCommandQueue()
+{
+	if (s_FrameCommandQueue.empty())
+		return;
+
+	VkCommandBuffer command_buffer = Walnut::Application::GetCommandBuffer(true);
+	for (auto& func : s_FrameCommandQueue)
+		func(command_buffer);
+	s_FrameCommandQueue.clear();
+
+	Walnut::Application::FlushCommandBuffer(command_buffer);
+	s_CompletedFrameSerial = s_SubmittedFrameSerial;
+}
+
 static void FrameRender(ImGui_ImplVulkanH_Window* wd, ImDrawData* draw_data)
 {
+	WL_PROFILE_ZONE("ImGui Render");
+
 	VkResult err;
 
 	VkSemaphore image_acquired_semaphore = wd->FrameSemaphores[wd->SemaphoreIndex].ImageAcquiredSemaphore;
@@ -280,6 +340,7 @@ static void FrameRender(ImGui_ImplVulkanH_Window* wd, ImDrawData* draw_data)
 	if (err == VK_ERROR_OUT_OF_DATE_KHR || err == VK_SUBOPTIMAL_KHR)
 	{
 		g_SwapChainRebuild = true;
+		FlushFrameCommandQueue();
 		return;
 	}
 	check_vk_result(err);
@@ -288,11 +349,15 @@ static void FrameRender(ImGui_ImplVulkanH_Window* wd, ImDrawData* draw_data)
 
 	ImGui_ImplVulkanH_Frame* fd = &wd->Frames[wd->FrameIndex];
 	{
+		WL_PROFILE_ZONE("Fence Wait");
 		err = vkWaitForFences(g_Device, 1, &fd->Fence, VK_TRUE, UINT64_MAX);    // wait indefinitely instead of periodically checking
 		check_vk_result(err);
 
 		err = vkResetFences(g_Device, 1, &fd->Fence);
 		check_vk_result(err);
+
+		// Queue submissions complete in order, so everything up to this frame's serial is done
+		s_CompletedFrameSerial = std::max(s_CompletedFrameSerial, s_FrameSerials[wd->FrameIndex]);
 	}
 	
 	{
@@ -319,6 +384,12 @@ static void FrameRender(ImGui_ImplVulkanH_Window* wd, ImDrawData* draw_data)
 		err = vkBeginCommandBuffer(fd->CommandBuffer, &info);
 		check_vk_result(err);
 	}
+	{
+		// Uploads and other work queued through Application::SubmitFrameCommand
+		for (auto& func : s_FrameCommandQueue)
+			func(fd->CommandBuffer);
+		s_FrameCommandQueue.clear();
+	}
 	{
 		VkRenderPassBeginInfo info = {};
 		info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -352,6 +423,8 @@ static void FrameRender(ImGui_ImplVulkanH_Window* wd, ImDrawData* draw_data)
 		check_vk_result(err);
 		err = vkQueueSubmit(g_Queue, 1, &info, fd->Fence);
 		check_vk_result(err);
+
+		s_FrameSerials[wd->FrameIndex] = ++s_SubmittedFrameSerial;
 	}
 }
 
@@ -359,6 +432,9 @@ static void FramePresent(ImGui_ImplVulkanH_Window* wd)
 {
 	if (g_SwapChainRebuild)
 		return;
+
+	// Blocks for a free swapchain image with FIFO presentation
+	WL_PROFILE_ZONE("Present");
 	VkSemaphore render_complete_semaphore = wd->FrameSemaphores[wd->SemaphoreIndex].RenderCompleteSemaphore;
 	VkPresentInfoKHR info = {};
 	info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -385,7 +461,8 @@ static void glfw_error_callback(int error, const char* description)
 namespace Walnut {
 
 	Application::Application(const ApplicationSpecification& specification)
-		: m_Specification(specification)
+		: m_Specification(specification), m_PresentMode(specification.SwapchainPresentMode),
+		m_TargetFrameRate(specification.TargetFrameRate), m_WaitForEvents(specification.WaitForEvents)
 	{
 		s_Instance = this;
 
@@ -436,10 +513,11 @@ namespace Walnut {
 		int w, h;
 		glfwGetFramebufferSize(m_WindowHandle, &w, &h);
 		ImGui_ImplVulkanH_Window* wd = &g_MainWindowData;
-		SetupVulkanWindow(wd, surface, w, h);
+		SetupVulkanWindow(wd, surface, w, h, m_PresentMode);
 
 		s_AllocatedCommandBuffers.resize(wd->ImageCount);
 		s_ResourceFreeQueue.resize(wd->ImageCount);
+		s_FrameSerials.resize(wd->ImageCount, 0);
 
 		// Setup Dear ImGui context
 		IMGUI_CHECKVERSION();
@@ -537,6 +615,7 @@ namespace Walnut {
 				func();
 		}
 		s_ResourceFreeQueue.clear();
+		s_FrameCommandQueue.clear();
 
 		ImGui_ImplVulkan_Shutdown();
 		ImGui_ImplGlfw_Shutdown();
@@ -559,6 +638,8 @@ namespace Walnut {
 		ImVec4 clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
 		ImGuiIO& io = ImGui::GetIO();
 
+		Profiler::SetThreadName("Main");
+
 		// Main loop
 		while (!glfwWindowShouldClose(m_WindowHandle) && m_Running)
 		{
@@ -567,10 +648,15 @@ namespace Walnut {
 			// - When io.WantCaptureMouse is true, do not dispatch mouse input data to your main application.
 			// - When io.WantCaptureKeyboard is true, do not dispatch keyboard input data to your main application.
 			// Generally you may always pass all inputs to dear imgui, and hide them from your application based on those two flags.
-			glfwPollEvents();
+			WaitForNextFrame();
+			if (glfwWindowShouldClose(m_WindowHandle) || !m_Running)
+				break;
 
-			for (auto& layer : m_LayerStack)
-				layer->OnUpdate(m_TimeStep);
+			{
+				WL_PROFILE_ZONE("Layer Update");
+				for (auto& layer : m_LayerStack)
+					layer->OnUpdate(m_TimeStep);
+			}
 
 			// Resize swap chain?
 			if (g_SwapChainRebuild)
@@ -579,6 +665,8 @@ namespace Walnut {
 				glfwGetFramebufferSize(m_WindowHandle, &width, &height);
 				if (width > 0 && height > 0)
 				{
+					g_MainWindowData.PresentMode = SelectPresentMode(g_MainWindowData.Surface, m_PresentMode);
+
 					ImGui_ImplVulkan_SetMinImageCount(g_MinImageCount);
 					ImGui_ImplVulkanH_CreateOrResizeWindow(g_Instance, g_PhysicalDevice, g_Device, &g_MainWindowData, g_QueueFamily, g_Allocator, width, height, g_MinImageCount);
 					g_MainWindowData.FrameIndex = 0;
@@ -587,6 +675,21 @@ namespace Walnut {
 					s_AllocatedCommandBuffers.clear();
 					s_AllocatedCommandBuffers.resize(g_MainWindowData.ImageCount);
 
+					// A different present mode can come with a different image count. The device is idle, so
+					// queued frees can run now rather than be indexed by frames that no longer exist.
+					for (auto& queue : s_ResourceFreeQueue)
+					{
+						for (auto& func : queue)
+							func();
+					}
+					s_ResourceFreeQueue.clear();
+					s_ResourceFreeQueue.resize(g_MainWindowData.ImageCount);
+					s_CurrentFrameIndex = 0;
+
+					// Recreating the window waits for the device to go idle
+					s_FrameSerials.assign(g_MainWindowData.ImageCount, 0);
+					s_CompletedFrameSerial = s_SubmittedFrameSerial;
+
 					g_SwapChainRebuild = false;
 				}
 			}
@@ -647,6 +750,7 @@ namespace Walnut {
 					}
 				}
 
+				WL_PROFILE_ZONE("Layer UI");
 				for (auto& layer : m_LayerStack)
 					layer->OnUIRender();
 
@@ -663,6 +767,8 @@ namespace Walnut {
 			wd->ClearValue.color.float32[3] = clear_color.w;
 			if (!main_is_minimized)
 				FrameRender(wd, main_draw_data);
+			else
+				FlushFrameCommandQueue();
 
 			// Update and Render additional Platform Windows
 			if (io.ConfigFlags & ImGuiConfigFlags_ViewportsEnable)
@@ -679,8 +785,65 @@ namespace Walnut {
 			m_FrameTime = time - m_LastFrameTime;
 			m_TimeStep = glm::min<float>(m_FrameTime, 0.0333f);
 			m_LastFrameTime = time;
+
+			Profiler::EndFrame();
+		}
+
+	}
+
+	void Application::WaitForNextFrame()
+	{
+		WL_PROFILE_ZONE("Frame Wait");
+
+		if (m_TargetFrameRate > 0.0f)
+		{
+			// Sleep granularity is the OS scheduler's, so the cap is approximate
+			double nextFrameStart = m_FrameStartTime + 1.0 / m_TargetFrameRate;
+			double now = glfwGetTime();
+			if (now < nextFrameStart)
+				std::this_thread::sleep_for(std::chrono::duration<double>(nextFrameStart - now));
+		}
+
+		// A rebuild only happens at the top of a frame
+		bool frameRequested = s_FrameRequested.exchange(false) || g_SwapChainRebuild;
+		if (m_PendingFrames > 0)
+		{
+			m_PendingFrames--;
+			frameRequested = true;
 		}
 
+		// Nothing gets presented while minimized, so there is no point in running the layers either
+		bool minimized = glfwGetWindowAttrib(m_WindowHandle, GLFW_ICONIFIED);
+		if (minimized || (m_WaitForEvents && !frameRequested))
+		{
+			glfwWaitEvents();
+			while (glfwGetWindowAttrib(m_WindowHandle, GLFW_ICONIFIED) && !glfwWindowShouldClose(m_WindowHandle) && m_Running)
+				glfwWaitEvents();
+
+			m_PendingFrames = s_FramesAfterWakeUp;
+		}
+		else
+		{
+			glfwPollEvents();
+		}
+
+		m_FrameStartTime = glfwGetTime();
+	}
+
+	void Application::SetPresentMode(PresentMode mode)
+	{
+		if (mode == m_PresentMode)
+			return;
+
+		m_PresentMode = mode;
+		g_SwapChainRebuild = true;
+	}
+
+	void Application::RequestFrame()
+	{
+		s_FrameRequested = true;
+		// Wakes glfwWaitEvents, thread safe
+		glfwPostEmptyEvent();
 	}
 
 	void Application::Close()
@@ -708,6 +871,16 @@ namespace Walnut {
 		return g_Device;
 	}
 
+	VkQueue Application::GetQueue()
+	{
+		return g_Queue;
+	}
+
+	uint32_t Application::GetQueueFamilyIndex()
+	{
+		return g_QueueFamily;
+	}
+
 	VkCommandBuffer Application::GetCommandBuffer(bool begin)
 	{
 		ImGui_ImplVulkanH_Window* wd = &g_MainWindowData;
@@ -755,8 +928,11 @@ namespace Walnut {
 		err = vkQueueSubmit(g_Queue, 1, &end_info, fence);
 		check_vk_result(err);
 
-		err = vkWaitForFences(g_Device, 1, &fence, VK_TRUE, DEFAULT_FENCE_TIMEOUT);
-		check_vk_result(err);
+		{
+			WL_PROFILE_ZONE("Fence Wait");
+			err = vkWaitForFences(g_Device, 1, &fence, VK_TRUE, DEFAULT_FENCE_TIMEOUT);
+			check_vk_result(err);
+		}
 
 		vkDestroyFence(g_Device, fence, nullptr);
 	}
@@ -767,4 +943,50 @@ namespace Walnut {
 		s_ResourceFreeQueue[s_CurrentFrameIndex].emplace_back(func);
 	}
 
+	void Application::SubmitFrameCommand(std::function<void(VkCommandBuffer)>&& func)
+	{
+		s_FrameCommandQueue.emplace_back(func);
+	}
+
+	uint32_t Application::GetFramesInFlight()
+	{
+		return g_MainWindowData.ImageCount;
+	}
+
+	uint64_t Application::GetNextFrameSerial()
+	{
+		return s_SubmittedFrameSerial + 1;
+	}
+
+	uint64_t Application::GetCompletedFrameSerial()
+	{
+		return s_CompletedFrameSerial;
+	}
+
+	void Application::WaitForFrame(uint64_t frameSerial)
+	{
+		if (frameSerial <= s_CompletedFrameSerial)
+			return;
+
+		// Not submitted yet, so the GPU can't be using anything of it
+		if (frameSerial > s_SubmittedFrameSerial)
+			return;
+
+		// Submissions complete in order, so the oldest frame in flight at or after the serial covers it
+		uint32_t frameIndex = 0;
+		for (uint32_t i = 0; i < (uint32_t)s_FrameSerials.size(); i++)
+		{
+			if (s_FrameSerials[i] >= frameSerial && (s_FrameSerials[frameIndex] < frameSerial || s_FrameSerials[i] < s_FrameSerials[frameIndex]))
+				frameIndex = i;
+		}
+
+		WL_PROFILE_ZONE("Fence Wait");
+
+		// Only waited on, FrameRender resets the fence when its swapchain image comes around again
+		VkResult err = vkWaitForFences(g_Device, 1, &g_MainWindowData.Frames[frameIndex].Fence, VK_TRUE, UINT64_MAX);
+		check_vk_result(err);
+
+		s_CompletedFrameSerial = std::max(s_CompletedFrameSerial, s_FrameSerials[frameIndex]);
+	}
+
 }
@@ -16,11 +16,26 @@ struct GLFWwindow;
 
 namespace Walnut {
 
+	enum class PresentMode
+	{
+		// Waits for vertical blank, the only mode every device supports and the fallback for the others
+		FIFO = 0,
+		// Never blocks, a newer frame replaces the queued one
+		Mailbox,
+		// Never blocks and may tear
+		Immediate
+	};
+
 	struct ApplicationSpecification
 	{
 		std::string Name = "Walnut App";
 		uint32_t Width = 1600;
 		uint32_t Height = 900;
+
+		// Initial frame scheduling, see the setters on Application
+		PresentMode SwapchainPresentMode = PresentMode::FIFO;
+		float TargetFrameRate = 0.0f;
+		bool WaitForEvents = false;
 	};
 
 	class Application
@@ -48,17 +63,48 @@ namespace Walnut {
 		float GetTime();
 		GLFWwindow* GetWindowHandle() const { return m_WindowHandle; }
 
+		// Takes effect with a swapchain rebuild at the start of the next frame. Unsupported modes fall back to FIFO.
+		void SetPresentMode(PresentMode mode);
+		PresentMode GetPresentMode() const { return m_PresentMode; }
+
+		// Frames start no more often than this, 0 for no cap. On top of whatever the present mode blocks for.
+		void SetTargetFrameRate(float framesPerSecond) { m_TargetFrameRate = framesPerSecond; }
+		float GetTargetFrameRate() const { return m_TargetFrameRate; }
+
+		// When set, Run sleeps until input arrives or RequestFrame is called, instead of looping continuously.
+		// Layers that animate on their own then have to call RequestFrame for every frame they still need.
+		void SetWaitForEvents(bool waitForEvents) { m_WaitForEvents = waitForEvents; }
+		bool IsWaitingForEvents() const { return m_WaitForEvents; }
+
+		// Makes sure another frame follows, even without input. Safe to call from any thread.
+		static void RequestFrame();
+
 		static VkInstance GetInstance();
 		static VkPhysicalDevice GetPhysicalDevice();
 		static VkDevice GetDevice();
+		static VkQueue GetQueue();
+		static uint32_t GetQueueFamilyIndex();
 
 		static VkCommandBuffer GetCommandBuffer(bool begin);
 		static void FlushCommandBuffer(VkCommandBuffer commandBuffer);
 
 		static void SubmitResourceFree(std::function<void()>&& func);
+
+		// Records func into the next frame's command buffer ahead of the ImGui pass, no host wait involved
+		static void SubmitFrameCommand(std::function<void(VkCommandBuffer)>&& func);
+
+		static uint32_t GetFramesInFlight();
+		// Serial the next submitted frame will carry, compare against GetCompletedFrameSerial
+		static uint64_t GetNextFrameSerial();
+		static uint64_t GetCompletedFrameSerial();
+		// Blocks on that frame's fence only, frames submitted after it keep running
+		static void WaitForFrame(uint64_t frameSerial);
 	private:
 		void Init();
 		void Shutdown();
+
+		// Frame pacing and event polling at the top of every frame, returns once the next frame should start
+		void WaitForNextFrame();
 	private:
 		ApplicationSpecification m_Specification;
 		GLFWwindow* m_WindowHandle = nullptr;
@@ -68,6 +114,14 @@ namespace Walnut {
 		float m_FrameTime = 0.0f;
 		float m_LastFrameTime = 0.0f;
 
+		PresentMode m_PresentMode = PresentMode::FIFO;
+		float m_TargetFrameRate = 0.0f;
+		bool m_WaitForEvents = false;
+		// Frames still to render after waking up before Run may sleep again
+		uint32_t m_PendingFrames = 0;
+		// For the frame rate cap, frame starts are what get spaced out
+		double m_FrameStartTime = 0.0;
+
 		std::vector<std::shared_ptr<Layer>> m_LayerStack;
 		std::function<void()> m_MenubarCallback;
 	};
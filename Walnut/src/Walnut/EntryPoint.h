@@ -3,7 +3,9 @@
 #ifdef WL_PLATFORM_WINDOWS
 
 extern Walnut::Application* Walnut::CreateApplication(int argc, char** argv);
-bool g_ApplicationRunning = true;
+extern bool g_ApplicationRunning;
+// Returned from main when CreateApplication hands back nullptr
+extern int g_ApplicationExitCode;
 
 namespace Walnut {
 
@@ -12,6 +14,10 @@ namespace Walnut {
 		while (g_ApplicationRunning)
 		{
 			Walnut::Application* app = Walnut::CreateApplication(argc, argv);
+			// Nothing to show, eg. a command line run that already did its work
+			if (!app)
+				return g_ApplicationExitCode;
+
 			app->Run();
 			delete app;
 		}
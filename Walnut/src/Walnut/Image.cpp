@@ -4,10 +4,13 @@
 #include "backends/imgui_impl_vulkan.h"
 
 #include "Application.h"
+#include "Profiler.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#include <algorithm>
+
 namespace Walnut {
 
 	namespace Utils {
@@ -30,6 +33,7 @@ namespace Walnut {
 			switch (format)
 			{
 				case ImageFormat::RGBA:    return 4;
+				case ImageFormat::RGBA16F: return 8;
 				case ImageFormat::RGBA32F: return 16;
 			}
 			return 0;
@@ -40,11 +44,50 @@ namespace Walnut {
 			switch (format)
 			{
 				case ImageFormat::RGBA:    return VK_FORMAT_R8G8B8A8_UNORM;
+				case ImageFormat::RGBA16F: return VK_FORMAT_R16G16B16A16_SFLOAT;
 				case ImageFormat::RGBA32F: return VK_FORMAT_R32G32B32A32_SFLOAT;
 			}
 			return (VkFormat)0;
 		}
 
+		static void RecordCopyToImage(VkCommandBuffer command_buffer, VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
+		{
+			VkImageMemoryBarrier copy_barrier = {};
+			copy_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			copy_barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			copy_barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			copy_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			copy_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			copy_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			copy_barrier.image = image;
+			copy_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			copy_barrier.subresourceRange.levelCount = 1;
+			copy_barrier.subresourceRange.layerCount = 1;
+			vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_HOST_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &copy_barrier);
+
+			VkBufferImageCopy region = {};
+			region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			region.imageSubresource.layerCount = 1;
+			region.imageExtent.width = width;
+			region.imageExtent.height = height;
+			region.imageExtent.depth = 1;
+			vkCmdCopyBufferToImage(command_buffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+			VkImageMemoryBarrier use_barrier = {};
+			use_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			use_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			use_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			use_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			use_barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			use_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			use_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			use_barrier.image = image;
+			use_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			use_barrier.subresourceRange.levelCount = 1;
+			use_barrier.subresourceRange.layerCount = 1;
+			vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &use_barrier);
+		}
+
 	}
 
 	Image::Image(std::string_view path)
@@ -66,16 +109,18 @@ namespace Walnut {
 
 		m_Width = width;
 		m_Height = height;
+		m_AllocatedWidth = m_Width;
+		m_AllocatedHeight = m_Height;
 		
-		AllocateMemory(m_Width * m_Height * Utils::BytesPerPixel(m_Format));
+		AllocateMemory(m_AllocatedWidth * m_AllocatedHeight * Utils::BytesPerPixel(m_Format));
 		SetData(data);
 		stbi_image_free(data);
 	}
 
-	Image::Image(uint32_t width, uint32_t height, ImageFormat format, const void* data)
-		: m_Width(width), m_Height(height), m_Format(format)
+	Image::Image(uint32_t width, uint32_t height, ImageFormat format, const void* data, ImageUsage usage)
+		: m_Width(width), m_Height(height), m_AllocatedWidth(width), m_AllocatedHeight(height), m_Format(format), m_Usage(usage)
 	{
-		AllocateMemory(m_Width * m_Height * Utils::BytesPerPixel(m_Format));
+		AllocateMemory(m_AllocatedWidth * m_AllocatedHeight * Utils::BytesPerPixel(m_Format));
 		if (data)
 			SetData(data);
 	}
@@ -87,6 +132,8 @@ namespace Walnut {
 
 	void Image::AllocateMemory(uint64_t size)
 	{
+		WL_PROFILE_COUNT("Image Allocations", 1);
+
 		VkDevice device = Application::GetDevice();
 
 		VkResult err;
@@ -99,14 +146,16 @@ namespace Walnut {
 			info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
 			info.imageType = VK_IMAGE_TYPE_2D;
 			info.format = vulkanFormat;
-			info.extent.width = m_Width;
-			info.extent.height = m_Height;
+			info.extent.width = m_AllocatedWidth;
+			info.extent.height = m_AllocatedHeight;
 			info.extent.depth = 1;
 			info.mipLevels = 1;
 			info.arrayLayers = 1;
 			info.samples = VK_SAMPLE_COUNT_1_BIT;
 			info.tiling = VK_IMAGE_TILING_OPTIMAL;
 			info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+			if (m_Usage == ImageUsage::Storage)
+				info.usage |= VK_IMAGE_USAGE_STORAGE_BIT;
 			info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 			info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 			err = vkCreateImage(device, &info, nullptr, &m_Image);
@@ -144,9 +193,9 @@ namespace Walnut {
 			info.magFilter = VK_FILTER_LINEAR;
 			info.minFilter = VK_FILTER_LINEAR;
 			info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-			info.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-			info.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-			info.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+			info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+			info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+			info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
 			info.minLod = -1000;
 			info.maxLod = 1000;
 			info.maxAnisotropy = 1.0f;
@@ -161,7 +210,8 @@ namespace Walnut {
 	void Image::Release()
 	{
 		Application::SubmitResourceFree([sampler = m_Sampler, imageView = m_ImageView, image = m_Image,
-			memory = m_Memory, stagingBuffer = m_StagingBuffer, stagingBufferMemory = m_StagingBufferMemory]()
+			memory = m_Memory, stagingBuffer = m_StagingBuffer, stagingBufferMemory = m_StagingBufferMemory,
+			stagingSlots = m_StagingSlots]()
 		{
 			VkDevice device = Application::GetDevice();
 
@@ -171,8 +221,17 @@ namespace Walnut {
 			vkFreeMemory(device, memory, nullptr);
 			vkDestroyBuffer(device, stagingBuffer, nullptr);
 			vkFreeMemory(device, stagingBufferMemory, nullptr);
+
+			for (const StagingSlot& slot : stagingSlots)
+			{
+				vkDestroyBuffer(device, slot.Buffer, nullptr);
+				vkFreeMemory(device, slot.Memory, nullptr);
+			}
 		});
 
+		m_StagingSlots.clear();
+		m_StagingSlotIndex = 0;
+
 		m_Sampler = nullptr;
 		m_ImageView = nullptr;
 		m_Image = nullptr;
@@ -183,6 +242,8 @@ namespace Walnut {
 
 	void Image::SetData(const void* data)
 	{
+		WL_PROFILE_ZONE("Image::SetData");
+
 		VkDevice device = Application::GetDevice();
 
 		size_t upload_size = m_Width * m_Height * Utils::BytesPerPixel(m_Format);
@@ -191,11 +252,11 @@ namespace Walnut {
 
 		if (!m_StagingBuffer)
 		{
-			// Create the Upload Buffer
+			// Create the Upload Buffer, large enough for every size that fits the allocation
 			{
 				VkBufferCreateInfo buffer_info = {};
 				buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-				buffer_info.size = upload_size;
+				buffer_info.size = m_AllocatedWidth * m_AllocatedHeight * Utils::BytesPerPixel(m_Format);
 				buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
 				buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 				err = vkCreateBuffer(device, &buffer_info, nullptr, &m_StagingBuffer);
@@ -234,43 +295,92 @@ namespace Walnut {
 		// Copy to Image
 		{
 			VkCommandBuffer command_buffer = Application::GetCommandBuffer(true);
+			Utils::RecordCopyToImage(command_buffer, m_StagingBuffer, m_Image, m_Width, m_Height);
+			Application::FlushCommandBuffer(command_buffer);
+		}
+	}
 
-			VkImageMemoryBarrier copy_barrier = {};
-			copy_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-			copy_barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-			copy_barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-			copy_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-			copy_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-			copy_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-			copy_barrier.image = m_Image;
-			copy_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			copy_barrier.subresourceRange.levelCount = 1;
-			copy_barrier.subresourceRange.layerCount = 1;
-			vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_HOST_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &copy_barrier);
+	void* Image::BeginStreamingWrite()
+	{
+		if (m_StagingSlots.empty())
+			AllocateStagingSlots();
 
-			VkBufferImageCopy region = {};
-			region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			region.imageSubresource.layerCount = 1;
-			region.imageExtent.width = m_Width;
-			region.imageExtent.height = m_Height;
-			region.imageExtent.depth = 1;
-			vkCmdCopyBufferToImage(command_buffer, m_StagingBuffer, m_Image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+		m_StagingSlotIndex = (m_StagingSlotIndex + 1) % (uint32_t)m_StagingSlots.size();
+		StagingSlot& slot = m_StagingSlots[m_StagingSlotIndex];
 
-			VkImageMemoryBarrier use_barrier = {};
-			use_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-			use_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-			use_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-			use_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-			use_barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-			use_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-			use_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-			use_barrier.image = m_Image;
-			use_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			use_barrier.subresourceRange.levelCount = 1;
-			use_barrier.subresourceRange.layerCount = 1;
-			vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &use_barrier);
+		// A slot whose copy has not been recorded yet can simply be overwritten,
+		// the copy will pick up the newer pixels
+		if (slot.FrameSerial < Application::GetNextFrameSerial())
+			Application::WaitForFrame(slot.FrameSerial);
 
-			Application::FlushCommandBuffer(command_buffer);
+		return slot.MappedData;
+	}
+
+	void Image::EndStreamingWrite()
+	{
+		StagingSlot& slot = m_StagingSlots[m_StagingSlotIndex];
+
+		if (!m_StagingCoherent)
+		{
+			VkMappedMemoryRange range = {};
+			range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+			range.memory = slot.Memory;
+			range.size = VK_WHOLE_SIZE;
+			VkResult err = vkFlushMappedMemoryRanges(Application::GetDevice(), 1, &range);
+			check_vk_result(err);
+		}
+
+		slot.FrameSerial = Application::GetNextFrameSerial();
+
+		// Handles are captured by value, a Resize before the next frame defers their release past it
+		Application::SubmitFrameCommand([buffer = slot.Buffer, image = m_Image, width = m_Width, height = m_Height](VkCommandBuffer command_buffer)
+		{
+			Utils::RecordCopyToImage(command_buffer, buffer, image, width, height);
+		});
+	}
+
+	void Image::AllocateStagingSlots()
+	{
+		VkDevice device = Application::GetDevice();
+
+		// Sized for the allocation, slots survive resizes within it
+		size_t upload_size = m_AllocatedWidth * m_AllocatedHeight * Utils::BytesPerPixel(m_Format);
+
+		VkResult err;
+
+		m_StagingSlots.resize(Application::GetFramesInFlight() + 1);
+		m_StagingSlotIndex = 0;
+
+		for (StagingSlot& slot : m_StagingSlots)
+		{
+			VkBufferCreateInfo buffer_info = {};
+			buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+			buffer_info.size = upload_size;
+			buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+			buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			err = vkCreateBuffer(device, &buffer_info, nullptr, &slot.Buffer);
+			check_vk_result(err);
+
+			VkMemoryRequirements req;
+			vkGetBufferMemoryRequirements(device, slot.Buffer, &req);
+
+			// Prefer coherent memory so EndStreamingWrite does not have to flush
+			uint32_t memoryType = Utils::GetVulkanMemoryType(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, req.memoryTypeBits);
+			m_StagingCoherent = memoryType != 0xffffffff;
+			if (!m_StagingCoherent)
+				memoryType = Utils::GetVulkanMemoryType(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, req.memoryTypeBits);
+
+			VkMemoryAllocateInfo alloc_info = {};
+			alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+			alloc_info.allocationSize = req.size;
+			alloc_info.memoryTypeIndex = memoryType;
+			err = vkAllocateMemory(device, &alloc_info, nullptr, &slot.Memory);
+			check_vk_result(err);
+			err = vkBindBufferMemory(device, slot.Buffer, slot.Memory, 0);
+			check_vk_result(err);
+
+			err = vkMapMemory(device, slot.Memory, 0, VK_WHOLE_SIZE, 0, &slot.MappedData);
+			check_vk_result(err);
 		}
 	}
 
@@ -279,13 +389,33 @@ namespace Walnut {
 		if (m_Image && m_Width == width && m_Height == height)
 			return;
 
-		// TODO: max size?
-
 		m_Width = width;
 		m_Height = height;
 
+		if (!m_ReuseAllocation)
+		{
+			m_AllocatedWidth = m_Width;
+			m_AllocatedHeight = m_Height;
+		}
+		else
+		{
+			// Copies already recorded carry their own size, they never reach past the allocation either
+			if (m_Image && m_Width <= m_AllocatedWidth && m_Height <= m_AllocatedHeight)
+				return;
+
+			VkPhysicalDeviceProperties properties;
+			vkGetPhysicalDeviceProperties(Application::GetPhysicalDevice(), &properties);
+			uint32_t maxDimension = properties.limits.maxImageDimension2D;
+
+			// Headroom only, never below the size asked for
+			if (m_Width > m_AllocatedWidth)
+				m_AllocatedWidth = std::max(m_Width, std::min(m_AllocatedWidth + m_AllocatedWidth / 2, maxDimension));
+			if (m_Height > m_AllocatedHeight)
+				m_AllocatedHeight = std::max(m_Height, std::min(m_AllocatedHeight + m_AllocatedHeight / 2, maxDimension));
+		}
+
 		Release();
-		AllocateMemory(m_Width * m_Height * Utils::BytesPerPixel(m_Format));
+		AllocateMemory(m_AllocatedWidth * m_AllocatedHeight * Utils::BytesPerPixel(m_Format));
 	}
 
 }
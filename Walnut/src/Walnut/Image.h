@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include "vulkan/vulkan.h"
 
@@ -10,29 +11,75 @@ namespace Walnut {
 	{
 		None = 0,
 		RGBA,
+		// Half floats, 8 bytes per pixel: HDR at half the upload size of RGBA32F
+		RGBA16F,
 		RGBA32F
 	};
 
+	enum class ImageUsage
+	{
+		Sampled = 0,
+		// Also bound as a storage image, for compute shaders writing into it
+		Storage
+	};
+
 	class Image
 	{
 	public:
 		Image(std::string_view path);
-		Image(uint32_t width, uint32_t height, ImageFormat format, const void* data = nullptr);
+		Image(uint32_t width, uint32_t height, ImageFormat format, const void* data = nullptr, ImageUsage usage = ImageUsage::Sampled);
 		~Image();
 
 		void SetData(const void* data);
 
+		// Streaming uploads for images that change every frame. Write width * height pixels to the pointer
+		// returned by BeginStreamingWrite, then call EndStreamingWrite. The staging memory is persistently
+		// mapped and ring buffered (one slot per frame in flight) and the copy is recorded into the next
+		// frame's command buffer, so nothing waits on the GPU.
+		void* BeginStreamingWrite();
+		void EndStreamingWrite();
+
 		VkDescriptorSet GetDescriptorSet() const { return m_DescriptorSet; }
 
+		// For writing into ImageUsage::Storage images from compute shaders, which must leave them in
+		// VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL for ImGui to sample
+		VkImage GetVulkanImage() const { return m_Image; }
+		VkImageView GetImageView() const { return m_ImageView; }
+		// Linear filtering clamped to the edge, the sampler ImGui draws the image with
+		VkSampler GetSampler() const { return m_Sampler; }
+		ImageFormat GetFormat() const { return m_Format; }
+		ImageUsage GetUsage() const { return m_Usage; }
+
+		// Reallocates to exactly the new size, unless the image reuses its allocation
 		void Resize(uint32_t width, uint32_t height);
+		// Off by default. When on, Resize only reallocates once the image outgrows its allocation, which then
+		// grows by half again, so a window being resized stops reallocating after a few steps.
+		// Draw such an image with the UV scale below.
+		void SetReuseAllocation(bool reuse) { m_ReuseAllocation = reuse; }
 
 		uint32_t GetWidth() const { return m_Width; }
 		uint32_t GetHeight() const { return m_Height; }
+
+		// The image fills the corner of its allocation, draw it with texture coordinates up to these
+		float GetUVScaleX() const { return (float)m_Width / (float)m_AllocatedWidth; }
+		float GetUVScaleY() const { return (float)m_Height / (float)m_AllocatedHeight; }
 	private:
+		struct StagingSlot
+		{
+			VkBuffer Buffer = nullptr;
+			VkDeviceMemory Memory = nullptr;
+			void* MappedData = nullptr;
+			uint64_t FrameSerial = 0;
+		};
+
 		void AllocateMemory(uint64_t size);
+		void AllocateStagingSlots();
 		void Release();
 	private:
 		uint32_t m_Width = 0, m_Height = 0;
+		// Size of the Vulkan image and the staging buffers, at least the size above
+		uint32_t m_AllocatedWidth = 0, m_AllocatedHeight = 0;
+		bool m_ReuseAllocation = false;
 
 		VkImage m_Image = nullptr;
 		VkImageView m_ImageView = nullptr;
@@ -40,12 +87,17 @@ namespace Walnut {
 		VkSampler m_Sampler = nullptr;
 
 		ImageFormat m_Format = ImageFormat::None;
+		ImageUsage m_Usage = ImageUsage::Sampled;
 
 		VkBuffer m_StagingBuffer = nullptr;
 		VkDeviceMemory m_StagingBufferMemory = nullptr;
 
 		size_t m_AlignedSize = 0;
 
+		std::vector<StagingSlot> m_StagingSlots;
+		uint32_t m_StagingSlotIndex = 0;
+		bool m_StagingCoherent = true;
+
 		VkDescriptorSet m_DescriptorSet = nullptr;
 
 		std::string m_Filepath;
@@ -0,0 +1,316 @@
+#include "Profiler.h"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+namespace Walnut {
+
+	namespace Utils {
+
+		struct CapturedEvent
+		{
+			uint32_t Zone;
+			int64_t Start, End;
+		};
+
+		struct ThreadData
+		{
+			uint32_t Index = 0;
+			std::string Name;
+
+			std::atomic<uint64_t> Counters[Profiler::MaxCounters] = {};
+
+			// Guards everything below, only contended while EndFrame or EndCapture collects
+			std::mutex Mutex;
+			int64_t ZoneTime[Profiler::MaxZones] = {};
+			uint32_t ZoneCalls[Profiler::MaxZones] = {};
+			std::vector<CapturedEvent> Events;
+			size_t DroppedEvents = 0;
+		};
+
+		struct CounterSample
+		{
+			int64_t Time;
+			uint64_t Values[Profiler::MaxCounters];
+		};
+
+		struct ProfilerState
+		{
+			std::mutex Mutex;
+			std::vector<const char*> ZoneNames;
+			std::vector<const char*> CounterNames;
+			// Never freed, a thread that exited may still have zones and events to report
+			std::vector<std::unique_ptr<ThreadData>> Threads;
+
+			uint64_t LastCounterTotals[Profiler::MaxCounters] = {};
+			std::vector<Profiler::ZoneStats> FrameZones;
+			std::vector<Profiler::CounterStats> FrameCounters;
+
+			std::atomic<bool> Capturing{ false };
+			// Counter values of every frame of the capture
+			std::vector<CounterSample> CapturedCounters;
+		};
+
+		static ProfilerState& GetState()
+		{
+			static ProfilerState s_State;
+			return s_State;
+		}
+
+		static ThreadData& GetThreadData()
+		{
+			thread_local ThreadData* t_Data = nullptr;
+			if (!t_Data)
+			{
+				ProfilerState& state = GetState();
+				std::lock_guard<std::mutex> lock(state.Mutex);
+
+				t_Data = state.Threads.emplace_back(std::make_unique<ThreadData>()).get();
+				t_Data->Index = (uint32_t)state.Threads.size() - 1;
+			}
+			return *t_Data;
+		}
+
+		// A full table shares its last slot, the name shown is whichever registered it
+		static uint32_t Register(std::vector<const char*>& names, uint32_t maxCount, const char* name)
+		{
+			std::lock_guard<std::mutex> lock(GetState().Mutex);
+
+			for (uint32_t i = 0; i < (uint32_t)names.size(); i++)
+			{
+				if (strcmp(names[i], name) == 0)
+					return i;
+			}
+
+			if (names.size() == maxCount)
+			{
+				std::cerr << "[Profiler] Too many zones or counters, " << name << " shares a slot\n";
+				return maxCount - 1;
+			}
+
+			names.push_back(name);
+			return (uint32_t)names.size() - 1;
+		}
+
+		static void WriteEscaped(std::ofstream& stream, const char* text)
+		{
+			for (const char* c = text; *c; c++)
+			{
+				if (*c == '"' || *c == '\\')
+					stream << '\\';
+				stream << *c;
+			}
+		}
+
+		// Chrome traces count in microseconds
+		static double ToMicroseconds(int64_t nanoseconds)
+		{
+			return (double)nanoseconds * 0.001;
+		}
+
+	}
+
+	uint32_t Profiler::RegisterZone(const char* name)
+	{
+		return Utils::Register(Utils::GetState().ZoneNames, MaxZones, name);
+	}
+
+	uint32_t Profiler::RegisterCounter(const char* name)
+	{
+		return Utils::Register(Utils::GetState().CounterNames, MaxCounters, name);
+	}
+
+	void Profiler::SetThreadName(const std::string& name)
+	{
+		Utils::ThreadData& data = Utils::GetThreadData();
+		std::lock_guard<std::mutex> lock(data.Mutex);
+		data.Name = name;
+	}
+
+	std::atomic<uint64_t>* Profiler::RegisterThreadCounters()
+	{
+		s_ThreadCounters = Utils::GetThreadData().Counters;
+		return s_ThreadCounters;
+	}
+
+	void Profiler::RecordZone(uint32_t zoneIndex, int64_t start, int64_t end)
+	{
+		Utils::ThreadData& data = Utils::GetThreadData();
+		std::lock_guard<std::mutex> lock(data.Mutex);
+
+		data.ZoneTime[zoneIndex] += end - start;
+		data.ZoneCalls[zoneIndex]++;
+
+		if (!Utils::GetState().Capturing.load(std::memory_order_relaxed))
+			return;
+
+		if (data.Events.size() < MaxCapturedEvents)
+			data.Events.push_back({ zoneIndex, start, end });
+		else
+			data.DroppedEvents++;
+	}
+
+	int64_t Profiler::GetTime()
+	{
+		static const auto s_Epoch = std::chrono::steady_clock::now();
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - s_Epoch).count();
+	}
+
+	void Profiler::EndFrame()
+	{
+		Utils::ProfilerState& state = Utils::GetState();
+		std::lock_guard<std::mutex> lock(state.Mutex);
+
+		int64_t zoneTime[MaxZones] = {};
+		uint32_t zoneCalls[MaxZones] = {};
+		uint64_t counterTotals[MaxCounters] = {};
+
+		for (auto& thread : state.Threads)
+		{
+			for (uint32_t i = 0; i < MaxCounters; i++)
+				counterTotals[i] += thread->Counters[i].load(std::memory_order_relaxed);
+
+			std::lock_guard<std::mutex> threadLock(thread->Mutex);
+			for (uint32_t i = 0; i < MaxZones; i++)
+			{
+				zoneTime[i] += thread->ZoneTime[i];
+				zoneCalls[i] += thread->ZoneCalls[i];
+				thread->ZoneTime[i] = 0;
+				thread->ZoneCalls[i] = 0;
+			}
+		}
+
+		state.FrameZones.clear();
+		for (uint32_t i = 0; i < (uint32_t)state.ZoneNames.size(); i++)
+		{
+			if (zoneCalls[i] > 0)
+				state.FrameZones.push_back({ state.ZoneNames[i], (float)((double)zoneTime[i] * 1e-6), zoneCalls[i] });
+		}
+
+		Utils::CounterSample sample{ GetTime(), {} };
+		state.FrameCounters.clear();
+		for (uint32_t i = 0; i < (uint32_t)state.CounterNames.size(); i++)
+		{
+			sample.Values[i] = counterTotals[i] - state.LastCounterTotals[i];
+			state.FrameCounters.push_back({ state.CounterNames[i], sample.Values[i] });
+			state.LastCounterTotals[i] = counterTotals[i];
+		}
+
+		if (state.Capturing.load(std::memory_order_relaxed))
+			state.CapturedCounters.push_back(sample);
+	}
+
+	const std::vector<Profiler::ZoneStats>& Profiler::GetFrameZones()
+	{
+		return Utils::GetState().FrameZones;
+	}
+
+	const std::vector<Profiler::CounterStats>& Profiler::GetFrameCounters()
+	{
+		return Utils::GetState().FrameCounters;
+	}
+
+	void Profiler::BeginCapture()
+	{
+		Utils::ProfilerState& state = Utils::GetState();
+		std::lock_guard<std::mutex> lock(state.Mutex);
+
+		for (auto& thread : state.Threads)
+		{
+			std::lock_guard<std::mutex> threadLock(thread->Mutex);
+			thread->Events.clear();
+			thread->DroppedEvents = 0;
+		}
+		state.CapturedCounters.clear();
+		state.Capturing = true;
+	}
+
+	bool Profiler::EndCapture(const std::string& filepath)
+	{
+		Utils::ProfilerState& state = Utils::GetState();
+		std::lock_guard<std::mutex> lock(state.Mutex);
+		state.Capturing = false;
+
+		std::ofstream stream(filepath);
+		if (!stream)
+		{
+			std::cerr << "[Profiler] Could not open " << filepath << " for writing\n";
+			return false;
+		}
+
+		// Nanosecond resolution, the default precision would print late timestamps in exponent form
+		stream << std::fixed << std::setprecision(3);
+		stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+		bool first = true;
+		auto separator = [&stream, &first]()
+		{
+			if (!first)
+				stream << ",\n";
+			first = false;
+		};
+
+		size_t droppedEvents = 0;
+		for (auto& thread : state.Threads)
+		{
+			std::lock_guard<std::mutex> threadLock(thread->Mutex);
+
+			separator();
+			stream << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread->Index << ",\"args\":{\"name\":\"";
+			if (thread->Name.empty())
+				stream << "Thread " << thread->Index;
+			else
+				Utils::WriteEscaped(stream, thread->Name.c_str());
+			stream << "\"}}";
+
+			for (const Utils::CapturedEvent& event : thread->Events)
+			{
+				separator();
+				stream << "{\"name\":\"";
+				Utils::WriteEscaped(stream, state.ZoneNames[event.Zone]);
+				stream << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->Index
+					<< ",\"ts\":" << Utils::ToMicroseconds(event.Start) << ",\"dur\":" << Utils::ToMicroseconds(event.End - event.Start) << "}";
+			}
+
+			droppedEvents += thread->DroppedEvents;
+			thread->Events.clear();
+			thread->Events.shrink_to_fit();
+		}
+
+		// One sample per frame and counter, drawn as a graph above the threads
+		for (const Utils::CounterSample& sample : state.CapturedCounters)
+		{
+			for (uint32_t i = 0; i < (uint32_t)state.CounterNames.size(); i++)
+			{
+				separator();
+				stream << "{\"name\":\"";
+				Utils::WriteEscaped(stream, state.CounterNames[i]);
+				stream << "\",\"ph\":\"C\",\"pid\":1,\"ts\":" << Utils::ToMicroseconds(sample.Time) << ",\"args\":{\"value\":" << sample.Values[i] << "}}";
+			}
+		}
+		state.CapturedCounters.clear();
+
+		stream << "\n]}\n";
+
+		if (droppedEvents > 0)
+			std::cerr << "[Profiler] " << droppedEvents << " zones did not fit the capture\n";
+
+		if (!stream.good())
+		{
+			std::cerr << "[Profiler] Could not write " << filepath << "\n";
+			return false;
+		}
+
+		return true;
+	}
+
+	bool Profiler::IsCapturing()
+	{
+		return Utils::GetState().Capturing.load(std::memory_order_relaxed);
+	}
+
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Walnut {
+
+	// Scoped timing zones and counters, collected per thread and summed once per frame.
+	// Zones cost two clock reads and an uncontended lock, counters one relaxed add, so they can sit
+	// on per tile and per ray paths. Both compile out in Dist through the macros at the bottom.
+	//
+	// A capture additionally records every zone with its thread and timestamps and writes it as a
+	// Chrome trace (chrome://tracing, ui.perfetto.dev, or Tracy through its import-chrome tool).
+	class Profiler
+	{
+	public:
+		static constexpr uint32_t MaxZones = 64;
+		static constexpr uint32_t MaxCounters = 16;
+		// Per thread, a capture stops recording a thread beyond this and counts what it dropped
+		static constexpr size_t MaxCapturedEvents = 1 << 20;
+
+		struct ZoneStats
+		{
+			const char* Name;
+			// Summed over every call on every thread, nested zones are included in their parent
+			float Milliseconds;
+			uint32_t Calls;
+		};
+
+		struct CounterStats
+		{
+			const char* Name;
+			uint64_t Value;
+		};
+	public:
+		// Same name, same index. Called once per call site through the macros.
+		static uint32_t RegisterZone(const char* name);
+		static uint32_t RegisterCounter(const char* name);
+
+		// Shown in the trace instead of the thread's index
+		static void SetThreadName(const std::string& name);
+
+		static void AddToCounter(uint32_t counterIndex, uint64_t value)
+		{
+			std::atomic<uint64_t>* counters = s_ThreadCounters;
+			if (!counters)
+				counters = RegisterThreadCounters();
+
+			std::atomic<uint64_t>& counter = counters[counterIndex];
+			// Only this thread writes it, others only read
+			counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+		}
+
+		static void RecordZone(uint32_t zoneIndex, int64_t start, int64_t end);
+
+		// Nanoseconds since the first call, the clock of every zone
+		static int64_t GetTime();
+
+		// Closes the frame: what every thread recorded since the last call becomes the last frame's stats
+		static void EndFrame();
+		// Zones and counters that were hit during the last frame, in registration order
+		static const std::vector<ZoneStats>& GetFrameZones();
+		static const std::vector<CounterStats>& GetFrameCounters();
+
+		static void BeginCapture();
+		// Stops the capture and writes it, false if the file could not be written
+		static bool EndCapture(const std::string& filepath);
+		static bool IsCapturing();
+	private:
+		static std::atomic<uint64_t>* RegisterThreadCounters();
+	private:
+		// This thread's counters, cached here because the lookup through the thread's data is not inlined
+		static inline thread_local std::atomic<uint64_t>* s_ThreadCounters = nullptr;
+	};
+
+	class ProfileZone
+	{
+	public:
+		ProfileZone(uint32_t zoneIndex)
+			: m_ZoneIndex(zoneIndex), m_Start(Profiler::GetTime()) {}
+		~ProfileZone() { Profiler::RecordZone(m_ZoneIndex, m_Start, Profiler::GetTime()); }
+
+		ProfileZone(const ProfileZone&) = delete;
+		ProfileZone& operator=(const ProfileZone&) = delete;
+	private:
+		uint32_t m_ZoneIndex;
+		int64_t m_Start;
+	};
+
+}
+
+#define WL_PROFILE_CONCAT_IMPL(a, b) a##b
+#define WL_PROFILE_CONCAT(a, b) WL_PROFILE_CONCAT_IMPL(a, b)
+
+#if !defined(WL_DIST)
+	// Times the rest of the enclosing scope, name must be a string literal
+	#define WL_PROFILE_ZONE(name) \
+		static const uint32_t WL_PROFILE_CONCAT(s_ProfileZone, __LINE__) = ::Walnut::Profiler::RegisterZone(name); \
+		::Walnut::ProfileZone WL_PROFILE_CONCAT(profileZone, __LINE__)(WL_PROFILE_CONCAT(s_ProfileZone, __LINE__))
+	// Adds value to this thread's counter, name must be a string literal
+	#define WL_PROFILE_COUNT(name, value) \
+		do { \
+			static const uint32_t s_ProfileCounter = ::Walnut::Profiler::RegisterCounter(name); \
+			::Walnut::Profiler::AddToCounter(s_ProfileCounter, (uint64_t)(value)); \
+		} while (0)
+#else
+	#define WL_PROFILE_ZONE(name)
+	// Still evaluates value so counting code around it does not warn, the compiler drops it anyway
+	#define WL_PROFILE_COUNT(name, value) ((void)(value))
+#endif
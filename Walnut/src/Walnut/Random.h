@@ -43,6 +43,42 @@ namespace Walnut {
 		{
 			return glm::normalize(Vec3(-1.0f, 1.0f));
 		}
+
+		// Stateless PCG hash generator. The caller owns the seed, usually derived from pixel, frame and bounce,
+		// so these are safe to call from any thread and give the same samples regardless of thread count.
+		static uint32_t PCGHash(uint32_t input)
+		{
+			uint32_t state = input * 747796405u + 2891336453u;
+			uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+			return (word >> 22u) ^ word;
+		}
+
+		static uint32_t Seed(uint32_t a, uint32_t b, uint32_t c = 0)
+		{
+			return PCGHash(a ^ PCGHash(b ^ PCGHash(c)));
+		}
+
+		static uint32_t UInt(uint32_t& seed)
+		{
+			seed = PCGHash(seed);
+			return seed;
+		}
+
+		// [0, 1), the top 24 bits map exactly onto the float mantissa
+		static float Float(uint32_t& seed)
+		{
+			return (float)(UInt(seed) >> 8) * (1.0f / 16777216.0f);
+		}
+
+		static glm::vec3 Vec3(uint32_t& seed, float min, float max)
+		{
+			return glm::vec3(Float(seed) * (max - min) + min, Float(seed) * (max - min) + min, Float(seed) * (max - min) + min);
+		}
+
+		static glm::vec3 InUnitSphere(uint32_t& seed)
+		{
+			return glm::normalize(Vec3(seed, -1.0f, 1.0f));
+		}
 	private:
 		static std::mt19937 s_RandomEngine;
 		static std::uniform_int_distribution<std::mt19937::result_type> s_Distribution;
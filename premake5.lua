@@ -7,4 +7,5 @@ workspace "RayTracer"
 outputdir = "%{cfg.buildcfg}-%{cfg.system}-%{cfg.architecture}"
 
 include "WalnutExternal.lua"
-include "RayTracer"
\ No newline at end of file
+include "RayTracer"
+include "RayTracer-bench"
\ No newline at end of file